@@ -0,0 +1,103 @@
+// Measures job system scheduling overhead and parallelFor scaling.
+//
+// usage: jobs_bench [--max-threads N] [--jobs N] [--items N]
+
+#include "jobs.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsedMs(Clock::time_point start){
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// empty jobs spawned as children of one root, in batches that fit the job ring
+static double emptyJobNs(JobSystem& jobs, uint32_t jobCount){
+    constexpr uint32_t Batch = 1024;
+    auto start = Clock::now();
+    for(uint32_t done=0;done<jobCount;done+=Batch){
+        Job* root = jobs.create([](uint32_t){});
+        uint32_t batch = std::min(Batch, jobCount - done);
+        for(uint32_t i=0;i<batch;++i)
+            jobs.run(jobs.createChild(root, [](uint32_t){}));
+        jobs.run(root);
+        jobs.wait(root);
+    }
+    return elapsedMs(start) * 1e6 / jobCount;
+}
+
+// fine grained parallelFor, mostly scheduling cost
+static double tinyChunksNs(JobSystem& jobs, uint32_t chunkCount){
+    std::vector<uint32_t> out(chunkCount);
+    auto start = Clock::now();
+    jobs.parallelFor(chunkCount, 1, [&](uint32_t begin, uint32_t end, uint32_t){
+        for(uint32_t i=begin;i<end;++i)
+            out[i] = i;
+    });
+    return elapsedMs(start) * 1e6 / chunkCount;
+}
+
+// compute bound parallelFor, shows scaling
+static double computeMs(JobSystem& jobs, const std::vector<float>& input, std::vector<float>& output){
+    auto start = Clock::now();
+    jobs.parallelFor(uint32_t(input.size()), 4096, [&](uint32_t begin, uint32_t end, uint32_t){
+        for(uint32_t i=begin;i<end;++i){
+            float x = input[i];
+            for(int k=0;k<16;++k)
+                x = std::sin(x) * 1.0001f + 0.1f;
+            output[i] = x;
+        }
+    });
+    return elapsedMs(start);
+}
+
+int main(int argc, char* argv[]){
+    uint32_t maxThreads = std::thread::hardware_concurrency();
+    uint32_t jobCount = 200000;
+    uint32_t itemCount = 1 << 22;
+    for(int i=1;i<argc;++i){
+        if(std::strcmp(argv[i],"--max-threads")==0 && i+1<argc)
+            maxThreads = std::atoi(argv[++i]);
+        else if(std::strcmp(argv[i],"--jobs")==0 && i+1<argc)
+            jobCount = std::atoi(argv[++i]);
+        else if(std::strcmp(argv[i],"--items")==0 && i+1<argc)
+            itemCount = std::atoi(argv[++i]);
+    }
+    maxThreads = std::max(maxThreads, 1u);
+
+    std::vector<float> input(itemCount), output(itemCount);
+    for(uint32_t i=0;i<itemCount;++i)
+        input[i] = float(i % 1000) * 0.001f;
+
+    std::vector<uint32_t> threadCounts;
+    for(uint32_t t=1;t<maxThreads;t*=2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    printf("%8s %14s %14s %12s %9s\n", "workers", "empty job ns", "tiny chunk ns", "compute ms", "speedup");
+    double baseline = 0;
+    for(uint32_t threads : threadCounts){
+        JobSystem jobs;
+        jobs.init(threads - 1);
+        // warm up the threads and the job rings
+        emptyJobNs(jobs, 4096);
+        computeMs(jobs, input, output);
+
+        double empty = emptyJobNs(jobs, jobCount);
+        double tiny = tinyChunksNs(jobs, 4096);
+        double compute = 1e30;
+        for(int run=0;run<3;++run)
+            compute = std::min(compute, computeMs(jobs, input, output));
+        if(threads == 1)
+            baseline = compute;
+        printf("%8u %14.1f %14.1f %12.2f %8.2fx\n", threads, empty, tiny, compute, baseline / compute);
+        jobs.destroy();
+    }
+    return 0;
+}
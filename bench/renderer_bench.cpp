@@ -0,0 +1,391 @@
+// Renders scripted scenes headless for a fixed number of frames and reports
+// startup time, CPU and GPU frame time percentiles, heap allocations per
+// frame and GPU memory as JSON. With a baseline written by an earlier run it
+// fails when a metric got worse by more than the threshold.
+//
+// usage: renderer_bench [--frames N] [--warmup N] [--scene name]... [--gpu]
+//                       [--out file.json] [--baseline file.json] [--threshold percent]
+//
+// Runs headless, without SDL video or a window, on a CPU implementation such
+// as lavapipe unless --gpu is given, so numbers from machines without a GPU
+// compare with each other. A baseline is the --out file of a run on the
+// reference machine. Without --out the JSON goes to stdout and everything
+// else to stderr, so the output can be redirected into a baseline. Exit code
+// 1 on regressions, 2 on errors
+
+#include "json.hpp"
+#include "renderer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+// every heap allocation of the process, the renderer included
+static std::atomic<uint64_t> heapAllocations{0};
+
+void* operator new(size_t size){
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if(void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+static double elapsedMs(Clock::time_point start){
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct BenchScene {
+    const char* name;
+    void (*configure)(RendererConfig& config);
+};
+
+static const BenchScene Scenes[] = {
+    // frame overhead: acquire, one draw, submit
+    {"triangle", [](RendererConfig& config){
+        config.testDrawCount = 1;
+    }},
+    // CPU side draw submission, everything sorts and batches into one draw
+    {"triangles_100k", [](RendererConfig& config){
+        config.testDrawCount = 100000;
+    }},
+    // 2048 batches, enough for the main pass to record in parallel secondaries
+    {"materials_2k", [](RendererConfig& config){
+        config.testDrawCount = 100000;
+        config.testMaterialCount = 2048;
+    }},
+    // scene update, compute culling and indirect draws
+    {"culling_10k", [](RendererConfig& config){
+        config.gpuCulling = true;
+        config.testDrawCount = 10000;
+    }},
+    {"culling_100k", [](RendererConfig& config){
+        config.gpuCulling = true;
+        config.testDrawCount = 100000;
+    }},
+    // HDR main pass, bloom, auto exposure and tonemap on the compute queue
+    {"post", [](RendererConfig& config){
+        config.testDrawCount = 1;
+        config.postProcessing = true;
+    }},
+};
+
+struct SceneResult {
+    std::string name;
+    uint32_t frames{0};
+    double startupMs{0};
+    double firstFrameMs{0};
+    ProfilerStats stats;
+    double heapAllocationsPerFrame{0};
+    uint32_t gpuBlocks{0};
+    uint32_t gpuAllocations{0};
+    uint64_t gpuAllocationBytes{0};
+};
+
+static SceneResult runScene(const BenchScene& scene, bool gpu, uint32_t warmup, uint32_t frames, std::string& device){
+    RendererConfig config{};
+    config.headless = true;
+    config.preferCpuDevice = !gpu;
+    config.enableValidationLayers = false;
+    // cold pipeline creation every run, a cache file would make startup depend on earlier runs
+    config.pipelineCachePath.clear();
+    scene.configure(config);
+
+    SceneResult result;
+    result.name = scene.name;
+    result.frames = frames;
+
+    auto start = Clock::now();
+    Renderer engine(config);
+    result.startupMs = elapsedMs(start);
+    device = engine._physicalDevice.getProperties().deviceName.data();
+
+    start = Clock::now();
+    engine.draw();
+    result.firstFrameMs = elapsedMs(start);
+    for(uint32_t i=1;i<warmup;++i)
+        engine.draw();
+
+    uint64_t allocations = heapAllocations.load(std::memory_order_relaxed);
+    for(uint32_t i=0;i<frames;++i)
+        engine.draw();
+    result.heapAllocationsPerFrame = double(heapAllocations.load(std::memory_order_relaxed) - allocations) / frames;
+
+    // samples are published once their frame retired, the newest frames
+    // in flight are not in yet
+    uint32_t samples = frames > config.framesInFlight ? frames - config.framesInFlight : 1;
+    result.stats = engine._profiler.getStats(std::min(samples, Profiler::HistorySize));
+
+    VmaTotalStatistics memory = engine._allocator.getStatistics();
+    result.gpuBlocks = memory.total.statistics.blockCount;
+    result.gpuAllocations = memory.total.statistics.allocationCount;
+    result.gpuAllocationBytes = memory.total.statistics.allocationBytes;
+    return result;
+}
+
+static void writePercentiles(std::ostream& out, const char* name, const TimingPercentiles& p){
+    out << "      \"" << name << "\": {\"avg\": " << p.avg << ", \"p50\": " << p.p50
+        << ", \"p95\": " << p.p95 << ", \"p99\": " << p.p99 << ", \"max\": " << p.max << "},\n";
+}
+
+static std::string toJson(const std::string& device, bool gpuTimestamps, const std::vector<SceneResult>& results){
+    std::ostringstream out;
+    out.precision(4);
+    out << std::fixed;
+    out << "{\n";
+    out << "  \"device\": \"" << jsonEscape(device) << "\",\n";
+    out << "  \"gpu_timestamps\": " << (gpuTimestamps ? "true" : "false") << ",\n";
+    out << "  \"scenes\": {";
+    for(size_t i=0;i<results.size();++i){
+        const SceneResult& r = results[i];
+        out << (i==0 ? "\n" : ",\n");
+        out << "    \"" << jsonEscape(r.name) << "\": {\n";
+        out << "      \"frames\": " << r.frames << ",\n";
+        out << "      \"startup_ms\": " << r.startupMs << ",\n";
+        out << "      \"first_frame_ms\": " << r.firstFrameMs << ",\n";
+        writePercentiles(out, "cpu_ms", r.stats.cpu);
+        writePercentiles(out, "gpu_ms", r.stats.gpu);
+        out << "      \"heap_allocations_per_frame\": " << r.heapAllocationsPerFrame << ",\n";
+        out << "      \"gpu_memory_blocks\": " << r.gpuBlocks << ",\n";
+        out << "      \"gpu_allocations\": " << r.gpuAllocations << ",\n";
+        out << "      \"gpu_allocation_bytes\": " << r.gpuAllocationBytes << "\n";
+        out << "    }";
+    }
+    out << (results.empty() ? "}\n" : "\n  }\n");
+    out << "}\n";
+    return out.str();
+}
+
+// Reads the numbers of a JSON document into dotted paths such as
+// "scenes.triangle.cpu_ms.p50". Enough for files written by toJson()
+class JsonNumbers {
+public:
+    explicit JsonNumbers(const std::string& text) : _text(text){}
+
+    bool parse(std::map<std::string, double>& numbers){
+        _numbers = &numbers;
+        return value("") && (skipSpace(), _pos == _text.size());
+    }
+
+private:
+    void skipSpace(){
+        while(_pos < _text.size() && std::strchr(" \t\r\n", _text[_pos]))
+            ++_pos;
+    }
+
+    // escapes are kept as written, the keys toJson() writes have none
+    bool string(std::string& out){
+        if(_text[_pos] != '"')
+            return false;
+        size_t end = _pos + 1;
+        while(end < _text.size() && _text[end] != '"')
+            end += _text[end] == '\\' ? 2 : 1;
+        if(end >= _text.size())
+            return false;
+        out = _text.substr(_pos + 1, end - _pos - 1);
+        _pos = end + 1;
+        return true;
+    }
+
+    bool value(const std::string& path){
+        skipSpace();
+        if(_pos >= _text.size())
+            return false;
+        char c = _text[_pos];
+        if(c == '{'){
+            ++_pos;
+            skipSpace();
+            if(_pos < _text.size() && _text[_pos] == '}'){
+                ++_pos;
+                return true;
+            }
+            for(;;){
+                skipSpace();
+                std::string key;
+                if(_pos >= _text.size() || !string(key))
+                    return false;
+                skipSpace();
+                if(_pos >= _text.size() || _text[_pos++] != ':')
+                    return false;
+                if(!value(path.empty() ? key : path + "." + key))
+                    return false;
+                skipSpace();
+                if(_pos >= _text.size())
+                    return false;
+                if(_text[_pos] == '}'){
+                    ++_pos;
+                    return true;
+                }
+                if(_text[_pos++] != ',')
+                    return false;
+            }
+        }
+        if(c == '"'){
+            std::string ignored;
+            return string(ignored);
+        }
+        for(const char* word : {"true", "false", "null"}){
+            if(_text.compare(_pos, std::strlen(word), word) == 0){
+                _pos += std::strlen(word);
+                return true;
+            }
+        }
+        const char* begin = _text.c_str() + _pos;
+        char* end = nullptr;
+        double number = std::strtod(begin, &end);
+        if(end == begin)
+            return false;
+        _pos += end - begin;
+        (*_numbers)[path] = number;
+        return true;
+    }
+
+    const std::string& _text;
+    size_t _pos{0};
+    std::map<std::string, double>* _numbers{nullptr};
+};
+
+// Lower is better for every compared metric. The absolute slack keeps tiny
+// values, e.g. sub millisecond frames, from failing on noise
+struct ComparedMetric {
+    const char* key;
+    double slack;
+};
+
+static const ComparedMetric ComparedMetrics[] = {
+    {"startup_ms", 5.0},
+    {"cpu_ms.p50", 0.05},
+    {"cpu_ms.p95", 0.1},
+    {"gpu_ms.p50", 0.05},
+    {"gpu_ms.p95", 0.1},
+    {"heap_allocations_per_frame", 0.5},
+    {"gpu_memory_blocks", 0.0},
+    {"gpu_allocation_bytes", 0.0},
+};
+
+static uint32_t compareBaseline(const std::map<std::string, double>& baseline, const std::map<std::string, double>& current, double threshold){
+    uint32_t regressions = 0;
+    for(const auto& [path, value] : current){
+        auto base = baseline.find(path);
+        if(base == baseline.end())
+            continue;
+        for(const ComparedMetric& metric : ComparedMetrics){
+            size_t keyLength = std::strlen(metric.key);
+            bool matches = path.size() > keyLength && path.compare(path.size() - keyLength, keyLength, metric.key) == 0 &&
+                path[path.size() - keyLength - 1] == '.';
+            if(!matches)
+                continue;
+            double limit = base->second * (1.0 + threshold) + metric.slack;
+            if(value > limit){
+                std::fprintf(stderr, "regression %s: %.4f, baseline %.4f, limit %.4f\n", path.c_str(), value, base->second, limit);
+                ++regressions;
+            }
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char* argv[]){
+    uint32_t frames = 300;
+    uint32_t warmup = 30;
+    bool gpu = false;
+    const char* outPath = nullptr;
+    const char* baselinePath = nullptr;
+    double threshold = 0.15;
+    std::vector<std::string> sceneNames;
+    for(int i=1;i<argc;++i){
+        if(std::strcmp(argv[i],"--frames")==0 && i+1<argc)
+            frames = std::max(std::atoi(argv[++i]), 1);
+        else if(std::strcmp(argv[i],"--warmup")==0 && i+1<argc)
+            warmup = std::max(std::atoi(argv[++i]), 1);
+        else if(std::strcmp(argv[i],"--scene")==0 && i+1<argc)
+            sceneNames.push_back(argv[++i]);
+        else if(std::strcmp(argv[i],"--gpu")==0)
+            gpu = true;
+        else if(std::strcmp(argv[i],"--out")==0 && i+1<argc)
+            outPath = argv[++i];
+        else if(std::strcmp(argv[i],"--baseline")==0 && i+1<argc)
+            baselinePath = argv[++i];
+        else if(std::strcmp(argv[i],"--threshold")==0 && i+1<argc)
+            threshold = std::atof(argv[++i]) / 100.0;
+    }
+
+    std::vector<const BenchScene*> scenes;
+    for(const BenchScene& scene : Scenes){
+        if(sceneNames.empty() || std::find(sceneNames.begin(), sceneNames.end(), scene.name) != sceneNames.end())
+            scenes.push_back(&scene);
+    }
+    if(scenes.empty()){
+        std::fprintf(stderr, "no matching scenes, known ones are:");
+        for(const BenchScene& scene : Scenes)
+            std::fprintf(stderr, " %s", scene.name);
+        std::fprintf(stderr, "\n");
+        return 2;
+    }
+
+    std::vector<SceneResult> results;
+    std::string device;
+    bool gpuTimestamps = false;
+    try{
+        for(const BenchScene* scene : scenes){
+            results.push_back(runScene(*scene, gpu, warmup, frames, device));
+            const SceneResult& r = results.back();
+            gpuTimestamps = gpuTimestamps || r.stats.gpu.max > 0;
+            std::fprintf(stderr, "%-16s startup %8.2f ms  cpu p50 %7.3f p95 %7.3f ms  gpu p50 %7.3f ms  %6.1f allocs/frame\n",
+                r.name.c_str(), r.startupMs, r.stats.cpu.p50, r.stats.cpu.p95, r.stats.gpu.p50, r.heapAllocationsPerFrame);
+        }
+    }
+    catch(const std::exception& e){
+        std::fprintf(stderr, "benchmark failed: %s\n", e.what());
+        return 2;
+    }
+
+    std::string json = toJson(device, gpuTimestamps, results);
+    if(outPath){
+        std::ofstream out(outPath);
+        if(!(out << json)){
+            std::fprintf(stderr, "failed to write %s\n", outPath);
+            return 2;
+        }
+    }
+    else
+        printf("%s", json.c_str());
+
+    if(baselinePath){
+        std::ifstream in(baselinePath);
+        std::stringstream text;
+        if(in)
+            text << in.rdbuf();
+        std::map<std::string, double> baseline, current;
+        if(!in || !JsonNumbers(text.str()).parse(baseline)){
+            std::fprintf(stderr, "can't read baseline %s\n", baselinePath);
+            return 2;
+        }
+        JsonNumbers(json).parse(current);
+        uint32_t regressions = compareBaseline(baseline, current, threshold);
+        if(regressions > 0){
+            std::fprintf(stderr, "%u regressions against %s\n", regressions, baselinePath);
+            return 1;
+        }
+        std::fprintf(stderr, "no regressions against %s\n", baselinePath);
+    }
+    return 0;
+}
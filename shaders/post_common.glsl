@@ -0,0 +1,31 @@
+// Shared by the post processing shaders. Bloom levels live one after the
+// other in a storage buffer, RGBA16F packed into two words per texel, and are
+// filtered by hand since the bindless set has no storage images
+
+layout(set = 0, binding = 1) buffer BloomTexels {
+    uvec2 texels[];
+} bloomBuffers[];
+
+// offset in texels of the level, reads past the edge clamp
+vec4 loadBloom(uint bloomBuffer, uint offset, uvec2 extent, ivec2 p){
+    p = clamp(p, ivec2(0), ivec2(extent) - 1);
+    uvec2 t = bloomBuffers[bloomBuffer].texels[offset + uint(p.y) * extent.x + uint(p.x)];
+    return vec4(unpackHalf2x16(t.x), unpackHalf2x16(t.y));
+}
+
+void storeBloom(uint bloomBuffer, uint offset, uvec2 extent, ivec2 p, vec4 value){
+    bloomBuffers[bloomBuffer].texels[offset + uint(p.y) * extent.x + uint(p.x)] =
+        uvec2(packHalf2x16(value.xy), packHalf2x16(value.zw));
+}
+
+// bilinear with clamp to edge, uv normalized over the level
+vec4 sampleBloom(uint bloomBuffer, uint offset, uvec2 extent, vec2 uv){
+    vec2 p = uv * vec2(extent) - 0.5;
+    ivec2 i = ivec2(floor(p));
+    vec2 f = p - vec2(i);
+    vec4 a = loadBloom(bloomBuffer, offset, extent, i);
+    vec4 b = loadBloom(bloomBuffer, offset, extent, i + ivec2(1, 0));
+    vec4 c = loadBloom(bloomBuffer, offset, extent, i + ivec2(0, 1));
+    vec4 d = loadBloom(bloomBuffer, offset, extent, i + ivec2(1, 1));
+    return mix(mix(a, b, f.x), mix(c, d, f.x), f.y);
+}
@@ -0,0 +1,46 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Scene objects with their streamed texture. The meshes carry no texture
+// coordinates, the texture is box projected from the object space position
+
+layout(set = 0, binding = 0) uniform texture2D images[];
+
+// bindless image index of every scene texture, rewritten per frame since it
+// changes with the residency
+layout(set = 0, binding = 1) readonly buffer TextureTable {
+    uint images[];
+} textureTables[];
+
+layout(set = 0, binding = 2) uniform sampler samplers[];
+
+layout(push_constant) uniform Push {
+    mat4 viewProj;
+    uint instanceBuffer;
+    uint textureTable;
+    uint textureSampler;
+} push;
+
+layout(location = 0) in vec4 inColor;
+layout(location = 1) in vec3 inLocal;
+layout(location = 2) flat in uint inTexture;
+
+layout(location = 0) out vec4 outColor;
+
+const uint NoTexture = 0xffffffffu;
+
+void main(){
+    outColor = inColor;
+    if(inTexture == NoTexture)
+        return;
+    uint image = textureTables[push.textureTable].images[inTexture];
+    // nothing resident yet
+    if(image == NoTexture)
+        return;
+
+    // project along the axis the face is most aligned with
+    vec3 n = abs(cross(dFdx(inLocal), dFdy(inLocal)));
+    vec2 uv = n.x > n.y && n.x > n.z ? inLocal.yz : (n.y > n.z ? inLocal.xz : inLocal.xy);
+    vec4 texel = texture(sampler2D(images[nonuniformEXT(image)], samplers[push.textureSampler]), uv + 0.5);
+    outColor = vec4(inColor.rgb * texel.rgb, inColor.a * texel.a);
+}
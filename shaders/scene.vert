@@ -0,0 +1,40 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+struct SceneInstance {
+    // rows of the affine world matrix
+    vec4 transform[3];
+    // world space bounding sphere, read by the culling pass
+    vec4 sphere;
+    vec4 color;
+    // x index into the scene texture table, ~0u untextured
+    uvec4 material;
+};
+
+layout(set = 0, binding = 1) readonly buffer Instances {
+    SceneInstance instances[];
+} instanceBuffers[];
+
+layout(push_constant) uniform Push {
+    mat4 viewProj;
+    uint instanceBuffer;
+    uint textureTable;
+    uint textureSampler;
+} push;
+
+layout(location = 0) in vec3 inPosition;
+
+layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec3 outLocal;
+layout(location = 2) flat out uint outTexture;
+
+void main(){
+    // the culling pass stores the object index in firstInstance
+    SceneInstance instance = instanceBuffers[push.instanceBuffer].instances[gl_InstanceIndex];
+    mat3x4 transform = mat3x4(instance.transform[0], instance.transform[1], instance.transform[2]);
+    vec3 world = vec4(inPosition, 1.0) * transform;
+    gl_Position = push.viewProj * vec4(world, 1.0);
+    outColor = instance.color;
+    outLocal = inPosition;
+    outTexture = instance.material.x;
+}
@@ -0,0 +1,27 @@
+#version 450
+
+// per instance, one instance per queued triangle
+layout(location = 8) in vec4 inColor;
+layout(location = 9) in float inAngle;
+
+layout(push_constant) uniform Material {
+    uint material;
+} push;
+
+layout(location = 0) out vec4 outColor;
+
+void main(){
+    // positions come from the vertex index, no vertex buffer needed
+    const vec2 positions[3] = vec2[](
+        vec2( 0.0, -0.5),
+        vec2( 0.5,  0.5),
+        vec2(-0.5,  0.5)
+    );
+    float s = sin(inAngle);
+    float c = cos(inAngle);
+    vec2 p = positions[gl_VertexIndex];
+    gl_Position = vec4(c*p.x - s*p.y, s*p.x + c*p.y, 0.0, 1.0);
+    // test materials only differ in a tint, enough to keep them apart as batches
+    float tint = float(push.material % 16u) / 15.0;
+    outColor = vec4(inColor.rgb * (0.75 + 0.25 * tint), inColor.a);
+}
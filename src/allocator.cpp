@@ -0,0 +1,262 @@
+#include "allocator.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+void GpuAllocator::init(vk::Instance instance, vk::PhysicalDevice physicalDevice, vk::Device device, uint32_t apiVersion){
+    VmaAllocatorCreateInfo createInfo{};
+    createInfo.instance = instance;
+    createInfo.physicalDevice = physicalDevice;
+    createInfo.device = device;
+    createInfo.vulkanApiVersion = apiVersion;
+    // nothing links the loader, VMA loads its functions like vulkan.hpp does
+    VmaVulkanFunctions functions{};
+    functions.vkGetInstanceProcAddr = VULKAN_HPP_DEFAULT_DISPATCHER.vkGetInstanceProcAddr;
+    functions.vkGetDeviceProcAddr = VULKAN_HPP_DEFAULT_DISPATCHER.vkGetDeviceProcAddr;
+    createInfo.pVulkanFunctions = &functions;
+    vk::resultCheck(
+        vk::Result(vmaCreateAllocator(&createInfo, &_allocator)),
+        "failed to create allocator"
+    );
+
+    // Representative resources of each class, used to pick the memory type of its pool.
+    // The buffer usages are the union of what the callers of each class pass
+    VkBufferCreateInfo geometryInfo = vk::BufferCreateInfo{
+        {},
+        65536,
+        vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer |
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer |
+        vk::BufferUsageFlagBits::eTransferDst
+    };
+    // staging buffers double as per frame uniform, storage, vertex, index and indirect data
+    VkBufferCreateInfo stagingInfo = vk::BufferCreateInfo{
+        {},
+        65536,
+        vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer |
+        vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer |
+        vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferSrc
+    };
+    // readback buffers are written by copies or by compute shaders
+    VkBufferCreateInfo readbackInfo = vk::BufferCreateInfo{
+        {},
+        65536,
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst
+    };
+    vk::ImageCreateInfo textureInfo{};
+    textureInfo.imageType = vk::ImageType::e2D;
+    textureInfo.format = vk::Format::eR8G8B8A8Unorm;
+    textureInfo.extent = vk::Extent3D{256, 256, 1};
+    textureInfo.mipLevels = 1;
+    textureInfo.arrayLayers = 1;
+    textureInfo.samples = vk::SampleCountFlagBits::e1;
+    textureInfo.tiling = vk::ImageTiling::eOptimal;
+    textureInfo.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    VkImageCreateInfo cTextureInfo = textureInfo;
+
+    for(uint32_t i=0;i<PooledMemoryClassCount;++i){
+        MemoryClass memClass = MemoryClass(i);
+        VmaAllocationCreateInfo allocInfo = getAllocationInfo(memClass);
+        VmaPoolCreateInfo poolInfo{};
+        VkResult result;
+        if(memClass==MemoryClass::Texture)
+            result = vmaFindMemoryTypeIndexForImageInfo(_allocator, &cTextureInfo, &allocInfo, &poolInfo.memoryTypeIndex);
+        else{
+            const VkBufferCreateInfo* bufferInfo =
+                memClass==MemoryClass::StaticGeometry ? &geometryInfo :
+                memClass==MemoryClass::Staging        ? &stagingInfo  :
+                                                        &readbackInfo;
+            result = vmaFindMemoryTypeIndexForBufferInfo(_allocator, bufferInfo, &allocInfo, &poolInfo.memoryTypeIndex);
+        }
+        vk::resultCheck(vk::Result(result), "no memory type for pool");
+        vk::resultCheck(
+            vk::Result(vmaCreatePool(_allocator, &poolInfo, &_pools[i])),
+            "failed to create memory pool"
+        );
+    }
+}
+
+void GpuAllocator::destroy(){
+    for(VmaPool& pool : _pools){
+        vmaDestroyPool(_allocator, pool);
+        pool = nullptr;
+    }
+    vmaDestroyAllocator(_allocator);
+    _allocator = nullptr;
+}
+
+VmaAllocationCreateInfo GpuAllocator::getAllocationInfo(MemoryClass memClass){
+    VmaAllocationCreateInfo info{};
+    switch(memClass){
+        case MemoryClass::StaticGeometry:
+        case MemoryClass::Texture:
+            info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+            break;
+        case MemoryClass::Staging:
+            info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+            info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+            break;
+        case MemoryClass::Readback:
+            // random access lets VMA prefer HOST_CACHED memory, reads from uncached memory are very slow
+            info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+            info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+            break;
+        case MemoryClass::RenderTarget:
+            info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+            info.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+            info.priority = 1.0f;
+            break;
+    }
+    if(uint32_t(memClass) < PooledMemoryClassCount)
+        info.pool = _pools[uint32_t(memClass)];
+    return info;
+}
+
+AllocatedBuffer GpuAllocator::createBuffer(MemoryClass memClass, vk::DeviceSize size, vk::BufferUsageFlags usage,
+    const std::vector<uint32_t>& concurrentFamilies){
+    std::vector<uint32_t> families = concurrentFamilies;
+    std::sort(families.begin(), families.end());
+    families.erase(std::unique(families.begin(), families.end()), families.end());
+    vk::BufferCreateInfo createInfo{{}, size, usage};
+    if(families.size() > 1){
+        createInfo.sharingMode = vk::SharingMode::eConcurrent;
+        createInfo.setQueueFamilyIndices(families);
+    }
+    VkBufferCreateInfo bufferInfo = createInfo;
+    VmaAllocationCreateInfo allocInfo = getAllocationInfo(memClass);
+
+    AllocatedBuffer result{};
+    result.size = size;
+    VkBuffer buffer;
+    VmaAllocationInfo info;
+    VkResult vkResult = vmaCreateBuffer(_allocator, &bufferInfo, &allocInfo, &buffer, &result.allocation, &info);
+    if(vkResult!=VK_SUCCESS && allocInfo.pool!=nullptr){
+        // the pool's memory type was picked for the usages the engine passes,
+        // buffers with other usages may need a different one
+        allocInfo.pool = nullptr;
+        vkResult = vmaCreateBuffer(_allocator, &bufferInfo, &allocInfo, &buffer, &result.allocation, &info);
+    }
+    vk::resultCheck(vk::Result(vkResult), "failed to create buffer");
+    result.buffer = buffer;
+    result.mapped = info.pMappedData;
+    return result;
+}
+
+void GpuAllocator::destroyBuffer(AllocatedBuffer& buffer){
+    vmaDestroyBuffer(_allocator, buffer.buffer, buffer.allocation);
+    buffer = {};
+}
+
+AllocatedImage GpuAllocator::createImage(MemoryClass memClass, const vk::ImageCreateInfo& imageInfo){
+    VkImageCreateInfo cImageInfo = imageInfo;
+    VmaAllocationCreateInfo allocInfo = getAllocationInfo(memClass);
+
+    AllocatedImage result{};
+    VkImage image;
+    VkResult vkResult = vmaCreateImage(_allocator, &cImageInfo, &allocInfo, &image, &result.allocation, nullptr);
+    if(vkResult!=VK_SUCCESS && allocInfo.pool!=nullptr){
+        // the texture pool's memory type was picked for a plain RGBA8 image,
+        // images with unusual formats or tiling may need a different one
+        allocInfo.pool = nullptr;
+        vkResult = vmaCreateImage(_allocator, &cImageInfo, &allocInfo, &image, &result.allocation, nullptr);
+    }
+    vk::resultCheck(vk::Result(vkResult), "failed to create image");
+    result.image = image;
+    return result;
+}
+
+void GpuAllocator::destroyImage(AllocatedImage& image){
+    vmaDestroyImage(_allocator, image.image, image.allocation);
+    image = {};
+}
+
+VmaAllocation GpuAllocator::allocateMemory(MemoryClass memClass, const vk::MemoryRequirements& requirements){
+    VkMemoryRequirements cRequirements = requirements;
+    VmaAllocationCreateInfo allocInfo = getAllocationInfo(memClass);
+    // VMA derives the memory type of the AUTO usages from a buffer or image
+    // usage, which raw requirements don't have, and fails them. Pools have
+    // their memory type already
+    if(!allocInfo.pool && allocInfo.usage == VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE){
+        allocInfo.usage = VMA_MEMORY_USAGE_UNKNOWN;
+        allocInfo.preferredFlags |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    }
+    else if(!allocInfo.pool && allocInfo.usage == VMA_MEMORY_USAGE_AUTO_PREFER_HOST){
+        allocInfo.usage = VMA_MEMORY_USAGE_UNKNOWN;
+        allocInfo.requiredFlags |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    }
+    VmaAllocation allocation;
+    vk::resultCheck(
+        vk::Result(vmaAllocateMemory(_allocator, &cRequirements, &allocInfo, &allocation, nullptr)),
+        "failed to allocate memory"
+    );
+    return allocation;
+}
+
+void GpuAllocator::bindImageMemory(VmaAllocation allocation, vk::DeviceSize offset, vk::Image image){
+    vk::resultCheck(
+        vk::Result(vmaBindImageMemory2(_allocator, allocation, offset, image, nullptr)),
+        "failed to bind image memory"
+    );
+}
+
+void GpuAllocator::freeMemory(VmaAllocation allocation){
+    vmaFreeMemory(_allocator, allocation);
+}
+
+void GpuAllocator::flush(const AllocatedBuffer& buffer, vk::DeviceSize offset, vk::DeviceSize size){
+    // no-op for coherent memory
+    vk::resultCheck(
+        vk::Result(vmaFlushAllocation(_allocator, buffer.allocation, offset, size)),
+        "failed to flush allocation"
+    );
+}
+
+void GpuAllocator::invalidate(const AllocatedBuffer& buffer, vk::DeviceSize offset, vk::DeviceSize size){
+    vk::resultCheck(
+        vk::Result(vmaInvalidateAllocation(_allocator, buffer.allocation, offset, size)),
+        "failed to invalidate allocation"
+    );
+}
+
+VmaTotalStatistics GpuAllocator::getStatistics(){
+    VmaTotalStatistics stats;
+    vmaCalculateStatistics(_allocator, &stats);
+    return stats;
+}
+
+void FrameArena::init(GpuAllocator& allocator, vk::DeviceSize capacity, vk::DeviceSize minAlignment){
+    // one long lived staging allocation per frame in flight, sub-allocated by bumping _offset
+    _buffer = allocator.createBuffer(
+        MemoryClass::Staging,
+        capacity,
+        vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer |
+        vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer |
+        vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferSrc
+    );
+    _minAlignment = minAlignment==0 ? 1 : minAlignment;
+    _offset = 0;
+}
+
+void FrameArena::destroy(GpuAllocator& allocator){
+    allocator.destroyBuffer(_buffer);
+    _offset = 0;
+}
+
+TransientAllocation FrameArena::allocate(vk::DeviceSize size, vk::DeviceSize alignment){
+    // alignments reported by the device are powers of two
+    vk::DeviceSize align = std::max(alignment, _minAlignment);
+    vk::DeviceSize offset = (_offset + align - 1) & ~(align - 1);
+    if(offset + size > _buffer.size)
+        throw std::runtime_error("frame arena exhausted");
+    _offset = offset + size;
+
+    TransientAllocation result;
+    result.buffer = _buffer.buffer;
+    result.offset = offset;
+    result.mapped = static_cast<char*>(_buffer.mapped) + offset;
+    return result;
+}
+
+void FrameArena::flush(GpuAllocator& allocator){
+    if(_offset>0)
+        allocator.flush(_buffer, 0, _offset);
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include <vk_mem_alloc.h>
+
+// Usage classes, every class except RenderTarget is served from its own VMA pool
+enum class MemoryClass : uint32_t {
+    StaticGeometry, // device local vertex, index and storage buffers
+    Texture,        // device local sampled images
+    Staging,        // host visible upload source, written sequentially
+    Readback,       // host visible and cached, copy destination for the GPU
+    RenderTarget,   // attachments, always get a dedicated allocation
+};
+
+inline constexpr uint32_t PooledMemoryClassCount = 4;
+
+struct AllocatedBuffer {
+    vk::Buffer buffer;
+    VmaAllocation allocation{nullptr};
+    vk::DeviceSize size{0};
+    // persistently mapped pointer, null when the memory is not host visible
+    void* mapped{nullptr};
+};
+
+struct AllocatedImage {
+    vk::Image image;
+    VmaAllocation allocation{nullptr};
+};
+
+// Slice of a FrameArena, only valid until the frame that allocated it retires
+struct TransientAllocation {
+    vk::Buffer buffer;
+    vk::DeviceSize offset{0};
+    void* mapped{nullptr};
+};
+
+class GpuAllocator;
+
+// Linear allocator over one persistently mapped buffer for transient per frame
+// uniform and vertex data. Allocation is a pointer bump, reset() is called
+// once the frame that owns the arena has retired
+class FrameArena {
+public:
+    void init(GpuAllocator& allocator, vk::DeviceSize capacity, vk::DeviceSize minAlignment);
+
+    void destroy(GpuAllocator& allocator);
+
+    TransientAllocation allocate(vk::DeviceSize size, vk::DeviceSize alignment=0);
+
+    // make the host writes of this frame visible to the device
+    void flush(GpuAllocator& allocator);
+
+    void reset(){
+        _offset = 0;
+    }
+
+    vk::DeviceSize used() const {
+        return _offset;
+    }
+
+private:
+    AllocatedBuffer _buffer;
+    vk::DeviceSize _offset{0};
+    vk::DeviceSize _minAlignment{1};
+};
+
+// Owns the VmaAllocator and one pool per MemoryClass so resources are
+// sub-allocated from a few large blocks instead of one vkAllocateMemory each
+class GpuAllocator {
+public:
+    void init(vk::Instance instance, vk::PhysicalDevice physicalDevice, vk::Device device, uint32_t apiVersion);
+
+    void destroy();
+
+    // Buffers are exclusive to one queue family at a time unless
+    // concurrentFamilies names more than one distinct family
+    AllocatedBuffer createBuffer(MemoryClass memClass, vk::DeviceSize size, vk::BufferUsageFlags usage,
+        const std::vector<uint32_t>& concurrentFamilies = {});
+
+    void destroyBuffer(AllocatedBuffer& buffer);
+
+    AllocatedImage createImage(MemoryClass memClass, const vk::ImageCreateInfo& imageInfo);
+
+    void destroyImage(AllocatedImage& image);
+
+    // Memory for resources the caller places and binds itself, e.g. transient
+    // images aliasing each other
+    VmaAllocation allocateMemory(MemoryClass memClass, const vk::MemoryRequirements& requirements);
+
+    void bindImageMemory(VmaAllocation allocation, vk::DeviceSize offset, vk::Image image);
+
+    void freeMemory(VmaAllocation allocation);
+
+    void flush(const AllocatedBuffer& buffer, vk::DeviceSize offset, vk::DeviceSize size);
+
+    void invalidate(const AllocatedBuffer& buffer, vk::DeviceSize offset, vk::DeviceSize size);
+
+    // number of live vkAllocateMemory blocks and of sub-allocations in them
+    VmaTotalStatistics getStatistics();
+
+    VmaAllocator handle() const {
+        return _allocator;
+    }
+
+private:
+    VmaAllocationCreateInfo getAllocationInfo(MemoryClass memClass);
+
+    VmaAllocator _allocator{nullptr};
+    std::array<VmaPool, PooledMemoryClassCount> _pools{};
+};
@@ -0,0 +1,187 @@
+#include "bindless.hpp"
+
+#include "pipelines.hpp"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+void BindlessDescriptors::init(
+    vk::Device device,
+    vk::PhysicalDevice physicalDevice,
+    uint32_t framesInFlight,
+    uint32_t imageCapacity,
+    uint32_t bufferCapacity,
+    uint32_t samplerCapacity
+){
+    _device = device;
+    _framesInFlight = framesInFlight;
+
+    auto properties = physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceVulkan12Properties>();
+    const auto& limits12 = properties.get<vk::PhysicalDeviceVulkan12Properties>();
+    _slots[SampledImages].capacity = std::min({
+        imageCapacity,
+        limits12.maxPerStageDescriptorUpdateAfterBindSampledImages,
+        limits12.maxDescriptorSetUpdateAfterBindSampledImages
+    });
+    _slots[StorageBuffers].capacity = std::min({
+        bufferCapacity,
+        limits12.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+        limits12.maxDescriptorSetUpdateAfterBindStorageBuffers
+    });
+    _slots[Samplers].capacity = std::min({
+        samplerCapacity,
+        limits12.maxPerStageDescriptorUpdateAfterBindSamplers,
+        limits12.maxDescriptorSetUpdateAfterBindSamplers
+    });
+    // the three arrays also share one per stage budget, images give way first
+    uint32_t otherResources = _slots[StorageBuffers].capacity + _slots[Samplers].capacity;
+    if(_slots[SampledImages].capacity + otherResources > limits12.maxPerStageUpdateAfterBindResources)
+        _slots[SampledImages].capacity = limits12.maxPerStageUpdateAfterBindResources - std::min(otherResources, limits12.maxPerStageUpdateAfterBindResources);
+
+    std::array<vk::DescriptorSetLayoutBinding, BindingCount> bindings = {
+        vk::DescriptorSetLayoutBinding{SampledImages, vk::DescriptorType::eSampledImage, _slots[SampledImages].capacity, vk::ShaderStageFlagBits::eAll},
+        vk::DescriptorSetLayoutBinding{StorageBuffers, vk::DescriptorType::eStorageBuffer, _slots[StorageBuffers].capacity, vk::ShaderStageFlagBits::eAll},
+        vk::DescriptorSetLayoutBinding{Samplers, vk::DescriptorType::eSampler, _slots[Samplers].capacity, vk::ShaderStageFlagBits::eAll},
+    };
+    // Slots may be written while the set is bound by frames in flight as long
+    // as those frames don't use them, unwritten slots are never accessed
+    vk::DescriptorBindingFlags bindingFlag =
+        vk::DescriptorBindingFlagBits::eUpdateAfterBind |
+        vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending |
+        vk::DescriptorBindingFlagBits::ePartiallyBound;
+    std::array<vk::DescriptorBindingFlags, BindingCount> bindingFlags = {bindingFlag, bindingFlag, bindingFlag};
+
+    vk::DescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{};
+    flagsInfo.setBindingFlags(bindingFlags);
+    vk::DescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.flags = vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool;
+    layoutInfo.setBindings(bindings);
+    layoutInfo.pNext = &flagsInfo;
+    _setLayout = _device.createDescriptorSetLayout(layoutInfo);
+
+    std::array<vk::DescriptorPoolSize, BindingCount> poolSizes = {
+        vk::DescriptorPoolSize{vk::DescriptorType::eSampledImage, _slots[SampledImages].capacity},
+        vk::DescriptorPoolSize{vk::DescriptorType::eStorageBuffer, _slots[StorageBuffers].capacity},
+        vk::DescriptorPoolSize{vk::DescriptorType::eSampler, _slots[Samplers].capacity},
+    };
+    vk::DescriptorPoolCreateInfo poolInfo{};
+    poolInfo.flags = vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind;
+    poolInfo.maxSets = 1;
+    poolInfo.setPoolSizes(poolSizes);
+    _pool = _device.createDescriptorPool(poolInfo);
+
+    vk::DescriptorSetAllocateInfo allocInfo{};
+    allocInfo.descriptorPool = _pool;
+    allocInfo.setSetLayouts(_setLayout);
+    _set = _device.allocateDescriptorSets(allocInfo)[0];
+
+    vk::PushConstantRange pushRange{vk::ShaderStageFlagBits::eAll, 0, PushConstantSize};
+    vk::PipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.setSetLayouts(_setLayout);
+    pipelineLayoutInfo.setPushConstantRanges(pushRange);
+    _pipelineLayout = _device.createPipelineLayout(pipelineLayoutInfo);
+    uint32_t keyWords[BindingCount + 2] = {
+        _slots[SampledImages].capacity, _slots[StorageBuffers].capacity, _slots[Samplers].capacity,
+        uint32_t(VkDescriptorBindingFlags(bindingFlag)), PushConstantSize
+    };
+    _layoutKey = contentHash(keyWords, sizeof(keyWords));
+}
+
+void BindlessDescriptors::destroy(){
+    _device.destroyPipelineLayout(_pipelineLayout);
+    // frees _set with it
+    _device.destroyDescriptorPool(_pool);
+    _device.destroyDescriptorSetLayout(_setLayout);
+    for(auto& slots : _slots)
+        slots = {};
+}
+
+BindlessIndex BindlessDescriptors::allocateLocked(Binding binding){
+    SlotAllocator& slots = _slots[binding];
+    if(!slots.free.empty()){
+        BindlessIndex index = slots.free.back();
+        slots.free.pop_back();
+        return index;
+    }
+    if(slots.next == slots.capacity)
+        throw std::runtime_error("bindless descriptor array full");
+    return slots.next++;
+}
+
+void BindlessDescriptors::writeLocked(
+    Binding binding,
+    BindlessIndex index,
+    const vk::DescriptorImageInfo* image,
+    const vk::DescriptorBufferInfo* buffer
+){
+    static constexpr vk::DescriptorType types[BindingCount] = {
+        vk::DescriptorType::eSampledImage,
+        vk::DescriptorType::eStorageBuffer,
+        vk::DescriptorType::eSampler,
+    };
+    vk::WriteDescriptorSet write{};
+    write.dstSet = _set;
+    write.dstBinding = binding;
+    write.dstArrayElement = index;
+    write.descriptorCount = 1;
+    write.descriptorType = types[binding];
+    write.pImageInfo = image;
+    write.pBufferInfo = buffer;
+    _device.updateDescriptorSets(write, {});
+}
+
+BindlessIndex BindlessDescriptors::registerImage(vk::ImageView view, vk::ImageLayout layout){
+    std::lock_guard<std::mutex> lock(_mutex);
+    BindlessIndex index = allocateLocked(SampledImages);
+    vk::DescriptorImageInfo info{{}, view, layout};
+    writeLocked(SampledImages, index, &info, nullptr);
+    return index;
+}
+
+BindlessIndex BindlessDescriptors::registerBuffer(vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range){
+    std::lock_guard<std::mutex> lock(_mutex);
+    BindlessIndex index = allocateLocked(StorageBuffers);
+    vk::DescriptorBufferInfo info{buffer, offset, range};
+    writeLocked(StorageBuffers, index, nullptr, &info);
+    return index;
+}
+
+BindlessIndex BindlessDescriptors::registerSampler(vk::Sampler sampler){
+    std::lock_guard<std::mutex> lock(_mutex);
+    BindlessIndex index = allocateLocked(Samplers);
+    vk::DescriptorImageInfo info{sampler, {}, {}};
+    writeLocked(Samplers, index, &info, nullptr);
+    return index;
+}
+
+void BindlessDescriptors::releaseImage(BindlessIndex index, uint64_t frameNumber){
+    std::lock_guard<std::mutex> lock(_mutex);
+    _slots[SampledImages].pending.push_back({index, frameNumber});
+}
+
+void BindlessDescriptors::releaseBuffer(BindlessIndex index, uint64_t frameNumber){
+    std::lock_guard<std::mutex> lock(_mutex);
+    _slots[StorageBuffers].pending.push_back({index, frameNumber});
+}
+
+void BindlessDescriptors::releaseSampler(BindlessIndex index, uint64_t frameNumber){
+    std::lock_guard<std::mutex> lock(_mutex);
+    _slots[Samplers].pending.push_back({index, frameNumber});
+}
+
+void BindlessDescriptors::retire(uint64_t frameNumber){
+    std::lock_guard<std::mutex> lock(_mutex);
+    for(auto& slots : _slots){
+        // releases are queued in frame order, the fence wait before this call
+        // retired every frame up to frameNumber - framesInFlight
+        while(!slots.pending.empty() && slots.pending.front().frameNumber + _framesInFlight <= frameNumber){
+            slots.free.push_back(slots.pending.front().index);
+            slots.pending.pop_front();
+        }
+    }
+}
+
+void BindlessDescriptors::bind(vk::CommandBuffer cmd, vk::PipelineBindPoint bindPoint) const {
+    cmd.bindDescriptorSets(bindPoint, _pipelineLayout, 0, _set, {});
+}
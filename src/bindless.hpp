@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+// Index into one of the bindless arrays, stays valid until released
+using BindlessIndex = uint32_t;
+inline constexpr BindlessIndex InvalidBindlessIndex = ~0u;
+
+// One update-after-bind descriptor set holding every sampled image, storage
+// buffer and sampler, bound once per command buffer. Shaders index the arrays
+// with the integers handed out here, usually passed through push constants
+// or storage buffers:
+//
+//   layout(set = 0, binding = 0) uniform texture2D images[];
+//   layout(set = 0, binding = 1) buffer Buffers { uint data[]; } buffers[];
+//   layout(set = 0, binding = 2) uniform sampler samplers[];
+//
+// Released indices are recycled only once every frame that could still
+// reference them has retired. All methods are thread safe
+class BindlessDescriptors {
+public:
+    enum Binding : uint32_t {
+        SampledImages = 0,
+        StorageBuffers = 1,
+        Samplers = 2,
+        BindingCount = 3,
+    };
+
+    static constexpr uint32_t PushConstantSize = 128;
+
+    // capacities are clamped to the device's update-after-bind limits
+    void init(
+        vk::Device device,
+        vk::PhysicalDevice physicalDevice,
+        uint32_t framesInFlight,
+        uint32_t imageCapacity,
+        uint32_t bufferCapacity,
+        uint32_t samplerCapacity
+    );
+
+    void destroy();
+
+    BindlessIndex registerImage(vk::ImageView view, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal);
+
+    BindlessIndex registerBuffer(vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = VK_WHOLE_SIZE);
+
+    BindlessIndex registerSampler(vk::Sampler sampler);
+
+    // the resource itself may only be destroyed once frameNumber retired
+    void releaseImage(BindlessIndex index, uint64_t frameNumber);
+
+    void releaseBuffer(BindlessIndex index, uint64_t frameNumber);
+
+    void releaseSampler(BindlessIndex index, uint64_t frameNumber);
+
+    // Call after the fence wait of frameNumber, recycles indices released
+    // by frames that can no longer be executing
+    void retire(uint64_t frameNumber);
+
+    void bind(vk::CommandBuffer cmd, vk::PipelineBindPoint bindPoint) const;
+
+    vk::DescriptorSetLayout setLayout() const {
+        return _setLayout;
+    }
+
+    // set 0 plus PushConstantSize bytes of push constants for all stages
+    vk::PipelineLayout pipelineLayout() const {
+        return _pipelineLayout;
+    }
+
+    // content key of the pipeline layout, see ShaderProgram::layoutKey
+    uint64_t layoutKey() const {
+        return _layoutKey;
+    }
+
+    uint32_t capacity(Binding binding) const {
+        return _slots[binding].capacity;
+    }
+
+private:
+    struct PendingRelease {
+        BindlessIndex index;
+        uint64_t frameNumber;
+    };
+
+    struct SlotAllocator {
+        uint32_t capacity{0};
+        uint32_t next{0};
+        std::vector<BindlessIndex> free;
+        std::deque<PendingRelease> pending;
+    };
+
+    BindlessIndex allocateLocked(Binding binding);
+
+    void writeLocked(Binding binding, BindlessIndex index, const vk::DescriptorImageInfo* image, const vk::DescriptorBufferInfo* buffer);
+
+    std::mutex _mutex;
+    vk::Device _device;
+    uint32_t _framesInFlight{1};
+
+    vk::DescriptorPool _pool;
+    vk::DescriptorSetLayout _setLayout;
+    vk::PipelineLayout _pipelineLayout;
+    uint64_t _layoutKey{0};
+    vk::DescriptorSet _set;
+
+    SlotAllocator _slots[BindingCount];
+};
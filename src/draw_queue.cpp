@@ -0,0 +1,200 @@
+#include "draw_queue.hpp"
+
+#include <cstring>
+
+#include "shader_program.hpp"
+
+void DrawQueue::clear(){
+    _packets.clear();
+    _instanceData.clear();
+    _batches.clear();
+    _instances = {};
+    _stats = {};
+}
+
+uint32_t DrawQueue::append(uint32_t count){
+    uint32_t first = uint32_t(_packets.size());
+    _packets.resize(size_t(first) + count);
+    _instanceData.resize((size_t(first) + count) * _instanceStride);
+    return first;
+}
+
+uint32_t DrawQueue::push(const DrawPacket& packet, const void* instanceData){
+    uint32_t index = append(1);
+    _packets[index] = packet;
+    if(_instanceStride > 0)
+        std::memcpy(this->instanceData(index), instanceData, _instanceStride);
+    return index;
+}
+
+void DrawQueue::sortKeys(){
+    // LSD radix sort of (key, index) with 8 bit digits. Every pass is stable,
+    // so equal keys keep their submission order. Passes where all keys have
+    // the same digit are skipped, most of the key is usually constant
+    uint32_t count = size();
+    _order.resize(count);
+    _scratch.resize(count);
+    _keys.resize(count);
+    _keyScratch.resize(count);
+    for(uint32_t i=0;i<count;++i){
+        _order[i] = i;
+        _keys[i] = _packets[i].key;
+    }
+
+    for(uint32_t shift=0;shift<64;shift+=8){
+        uint32_t histogram[256] = {};
+        for(uint32_t i=0;i<count;++i)
+            ++histogram[(_keys[i] >> shift) & 0xff];
+        if(histogram[(_keys[0] >> shift) & 0xff] == count)
+            continue;
+
+        uint32_t offset = 0;
+        for(uint32_t& bucket : histogram){
+            uint32_t n = bucket;
+            bucket = offset;
+            offset += n;
+        }
+        for(uint32_t i=0;i<count;++i){
+            uint32_t dst = histogram[(_keys[i] >> shift) & 0xff]++;
+            _keyScratch[dst] = _keys[i];
+            _scratch[dst] = _order[i];
+        }
+        _keys.swap(_keyScratch);
+        _order.swap(_scratch);
+    }
+}
+
+bool DrawQueue::batchable(const DrawPacket& a, const DrawPacket& b) const {
+    // the key is only for ordering, equal state is what allows merging
+    return a.pipeline == b.pipeline &&
+        a.layout == b.layout &&
+        a.descriptorSet == b.descriptorSet &&
+        a.vertexBuffer == b.vertexBuffer &&
+        a.indexBuffer == b.indexBuffer &&
+        (!a.indexBuffer || a.indexType == b.indexType) &&
+        a.count == b.count &&
+        a.first == b.first &&
+        a.vertexOffset == b.vertexOffset &&
+        a.material == b.material &&
+        a.materialStages == b.materialStages;
+}
+
+void DrawQueue::build(FrameArena& arena){
+    _batches.clear();
+    _stats = {};
+    _stats.packets = size();
+    if(_packets.empty())
+        return;
+
+    sortKeys();
+
+    // instance data in sorted order, so every batch reads a contiguous range
+    if(_instanceStride > 0){
+        _instances = arena.allocate(vk::DeviceSize(size()) * _instanceStride);
+        uint8_t* dst = static_cast<uint8_t*>(_instances.mapped);
+        for(uint32_t i=0;i<size();++i)
+            std::memcpy(dst + size_t(i) * _instanceStride, instanceData(_order[i]), _instanceStride);
+    }
+
+    // what record() would bind for the whole queue in one call, tracked
+    // with the same rules
+    vk::Pipeline boundPipeline;
+    vk::PipelineLayout boundLayout;
+    vk::DescriptorSet boundSet;
+    vk::Buffer boundVertices;
+    vk::Buffer boundIndices;
+    vk::IndexType boundIndexType{vk::IndexType::eUint32};
+    bool materialPushed = false;
+    uint32_t boundMaterial = 0;
+    const DrawPacket* previous = nullptr;
+    for(uint32_t i=0;i<size();++i){
+        const DrawPacket& packet = _packets[_order[i]];
+        if(!_batches.empty() && batchable(*previous, packet)){
+            ++_batches.back().instanceCount;
+            continue;
+        }
+        _batches.push_back({i, 1});
+        previous = &packet;
+
+        if(packet.pipeline != boundPipeline){
+            ++_stats.pipelineBinds;
+            boundPipeline = packet.pipeline;
+        }
+        if(packet.layout != boundLayout){
+            boundLayout = packet.layout;
+            boundSet = nullptr;
+            materialPushed = false;
+        }
+        if(packet.descriptorSet && packet.descriptorSet != boundSet){
+            ++_stats.descriptorBinds;
+            boundSet = packet.descriptorSet;
+        }
+        if(packet.vertexBuffer && packet.vertexBuffer != boundVertices){
+            ++_stats.vertexBufferBinds;
+            boundVertices = packet.vertexBuffer;
+        }
+        if(packet.indexBuffer && (packet.indexBuffer != boundIndices || packet.indexType != boundIndexType)){
+            ++_stats.indexBufferBinds;
+            boundIndices = packet.indexBuffer;
+            boundIndexType = packet.indexType;
+        }
+        if(packet.materialStages && (!materialPushed || packet.material != boundMaterial)){
+            ++_stats.materialPushes;
+            materialPushed = true;
+            boundMaterial = packet.material;
+        }
+    }
+    _stats.batches = batchCount();
+}
+
+void DrawQueue::record(vk::CommandBuffer cmd, uint32_t begin, uint32_t end) const {
+    if(_instanceStride > 0 && begin < end)
+        cmd.bindVertexBuffers(InstanceBinding, _instances.buffer, _instances.offset);
+
+    vk::Pipeline boundPipeline;
+    vk::PipelineLayout boundLayout;
+    vk::DescriptorSet boundSet;
+    vk::Buffer boundVertices;
+    vk::Buffer boundIndices;
+    vk::IndexType boundIndexType{vk::IndexType::eUint32};
+    bool materialPushed = false;
+    uint32_t boundMaterial = 0;
+    for(uint32_t i=begin;i<end;++i){
+        const DrawBatch& batch = _batches[i];
+        const DrawPacket& packet = _packets[_order[batch.first]];
+        if(packet.pipeline != boundPipeline){
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, packet.pipeline);
+            boundPipeline = packet.pipeline;
+        }
+        // sets and push constants stay valid across layouts compatible for
+        // them, rebinding on a layout change keeps that simple
+        if(packet.layout != boundLayout){
+            boundLayout = packet.layout;
+            boundSet = nullptr;
+            materialPushed = false;
+        }
+        if(packet.descriptorSet && packet.descriptorSet != boundSet){
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, packet.layout, 0, packet.descriptorSet, {});
+            boundSet = packet.descriptorSet;
+        }
+        if(packet.vertexBuffer && packet.vertexBuffer != boundVertices){
+            cmd.bindVertexBuffers(0, packet.vertexBuffer, vk::DeviceSize{0});
+            boundVertices = packet.vertexBuffer;
+        }
+        if(packet.indexBuffer && (packet.indexBuffer != boundIndices || packet.indexType != boundIndexType)){
+            cmd.bindIndexBuffer(packet.indexBuffer, 0, packet.indexType);
+            boundIndices = packet.indexBuffer;
+            boundIndexType = packet.indexType;
+        }
+        if(packet.materialStages && (!materialPushed || packet.material != boundMaterial)){
+            cmd.pushConstants(packet.layout, packet.materialStages, 0, sizeof(uint32_t), &packet.material);
+            materialPushed = true;
+            boundMaterial = packet.material;
+        }
+
+        if(packet.indexBuffer)
+            cmd.drawIndexed(packet.count, batch.instanceCount, packet.first, packet.vertexOffset, batch.first);
+        else
+            cmd.draw(packet.count, batch.instanceCount, packet.first, batch.first);
+    }
+}
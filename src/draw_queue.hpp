@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.hpp"
+
+// 64 bit sort key, most significant first:
+//   pass      4 bits   e.g. opaque before transparent
+//   pipeline 16 bits
+//   material 20 bits
+//   depth    24 bits   front to back, invert for back to front
+// so sorting groups draws by pass, then state, then depth. Fields are masked
+inline uint64_t makeDrawKey(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t depth){
+    return uint64_t(pass & 0xf) << 60 |
+        uint64_t(pipeline & 0xffff) << 44 |
+        uint64_t(material & 0xfffff) << 24 |
+        uint64_t(depth & 0xffffff);
+}
+
+// view depth in [0, far] to the key's depth field
+inline uint32_t quantizeDrawDepth(float depth, float far){
+    float t = far > 0.0f ? depth / far : 0.0f;
+    t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+    return uint32_t(t * float(0xffffff));
+}
+
+// Everything a draw binds and draws. Draws with equal state and geometry
+// become instances of one draw
+struct DrawPacket {
+    uint64_t key{0};
+    vk::Pipeline pipeline;
+    vk::PipelineLayout layout;
+    // bound at set 0, e.g. the bindless set. Null binds nothing
+    vk::DescriptorSet descriptorSet;
+    // binding 0, null draws without vertex buffer
+    vk::Buffer vertexBuffer;
+    // null draws non indexed
+    vk::Buffer indexBuffer;
+    vk::IndexType indexType{vk::IndexType::eUint32};
+    // vertex or index count and first vertex or index
+    uint32_t count{0};
+    uint32_t first{0};
+    int32_t vertexOffset{0};
+    // pushed as 4 bytes at offset 0 when it changes, nothing when no stages
+    uint32_t material{0};
+    vk::ShaderStageFlags materialStages;
+};
+
+// one instanced draw recorded by the queue
+struct DrawBatch {
+    // sorted position of the first packet, which has the batch's state
+    uint32_t first;
+    uint32_t instanceCount;
+};
+
+struct DrawQueueStats {
+    uint32_t packets{0};
+    uint32_t batches{0};
+    // binds left after elision, over the whole sorted queue
+    uint32_t pipelineBinds{0};
+    uint32_t descriptorBinds{0};
+    uint32_t vertexBufferBinds{0};
+    uint32_t indexBufferBinds{0};
+    uint32_t materialPushes{0};
+};
+
+// Per frame draw submission. Callers append packets, each with instanceStride
+// bytes of per instance data, in any order and possibly from several job
+// workers at once through append() and packet()/instanceData(). build() radix
+// sorts them by key, merges adjacent packets with equal state and geometry
+// into instanced draws and copies the instance data in sorted order into the
+// frame arena, where the batch's instances are read from InstanceBinding.
+// record() then binds only what changed between batches.
+//
+// Equal keys keep their submission order
+class DrawQueue {
+public:
+    void init(uint32_t instanceStride){
+        _instanceStride = instanceStride;
+    }
+
+    void clear();
+
+    // appends count empty packets, returns the index of the first
+    uint32_t append(uint32_t count);
+
+    uint32_t push(const DrawPacket& packet, const void* instanceData);
+
+    DrawPacket& packet(uint32_t index){
+        return _packets[index];
+    }
+
+    // instanceStride bytes
+    void* instanceData(uint32_t index){
+        return _instanceData.data() + size_t(index) * _instanceStride;
+    }
+
+    uint32_t size() const {
+        return uint32_t(_packets.size());
+    }
+
+    // sorts, batches and writes the instance data, once per frame before record()
+    void build(FrameArena& arena);
+
+    uint32_t batchCount() const {
+        return uint32_t(_batches.size());
+    }
+
+    // Records batches [begin, end). Each call starts without bound state, so
+    // ranges may go to different secondary command buffers. Viewport and
+    // scissor are left to the caller
+    void record(vk::CommandBuffer cmd, uint32_t begin, uint32_t end) const;
+
+    const DrawQueueStats& stats() const {
+        return _stats;
+    }
+
+private:
+    void sortKeys();
+
+    bool batchable(const DrawPacket& a, const DrawPacket& b) const;
+
+    uint32_t _instanceStride{0};
+    std::vector<DrawPacket> _packets;
+    std::vector<uint8_t> _instanceData;
+
+    // packet indices in key order and the radix sort scratch
+    std::vector<uint32_t> _order;
+    std::vector<uint32_t> _scratch;
+    std::vector<uint64_t> _keys;
+    std::vector<uint64_t> _keyScratch;
+
+    std::vector<DrawBatch> _batches;
+    TransientAllocation _instances;
+    DrawQueueStats _stats;
+};
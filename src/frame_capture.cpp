@@ -0,0 +1,242 @@
+#include "frame_capture.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vulkan/vulkan_format_traits.hpp>
+
+#include <shaders/capture_nv12_comp.hpp>
+
+namespace {
+    // each thread converts a block of 4x2 pixels
+    constexpr uint32_t BlockWidth = 4;
+    constexpr uint32_t BlockHeight = 2;
+    constexpr uint32_t GroupSize = 8;
+
+    // matches the push block of capture_nv12.comp
+    struct Nv12Push {
+        uint32_t extent[2];
+        uint32_t rowPitch;
+        uint32_t chromaOffset;
+        uint32_t image;
+        uint32_t imageSampler;
+        uint32_t outputBuffer;
+        uint32_t srgb;
+    };
+    static_assert(sizeof(Nv12Push) <= BindlessDescriptors::PushConstantSize);
+
+    uint32_t alignUp(uint32_t value, uint32_t alignment){
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+void FrameCapture::init(
+    vk::Device device,
+    GpuAllocator& allocator,
+    BindlessDescriptors& bindless,
+    PipelineManager& pipelines,
+    uint32_t slotCount,
+    CaptureFormat format,
+    uint32_t framesInFlight
+){
+    _device = device;
+    _allocator = &allocator;
+    _bindless = &bindless;
+    _format = format;
+    _framesInFlight = framesInFlight;
+    if(slotCount == 0)
+        return;
+    _slots.resize(std::min(slotCount, MaxSlots));
+
+    if(_format == CaptureFormat::Nv12){
+        _program = createShaderProgram(_device, {&shaders::capture_nv12_comp}, bindless);
+        ComputePipelineDesc pipelineDesc{};
+        pipelineDesc.stage = _program.stages[0];
+        pipelineDesc.layout = _program.layout;
+        pipelineDesc.layoutKey = _program.layoutKey;
+        _nv12Pipeline = pipelines.getComputePipeline(pipelineDesc);
+
+        // texelFetch ignores filtering, the sampler only completes the combined image
+        _sampler = _device.createSampler(vk::SamplerCreateInfo{});
+        _samplerIndex = _bindless->registerSampler(_sampler);
+    }
+}
+
+void FrameCapture::destroy(){
+    for(auto& slot : _slots){
+        if(slot.buffer.buffer)
+            _allocator->destroyBuffer(slot.buffer);
+    }
+    _slots.clear();
+    _inFlight.clear();
+    _targetViews.clear();
+    if(_sampler)
+        _device.destroySampler(_sampler);
+    _sampler = nullptr;
+    // the pipeline is owned by the pipeline manager
+    destroyShaderProgram(_device, _program);
+}
+
+vk::ImageUsageFlags FrameCapture::requiredUsage() const {
+    if(!enabled())
+        return {};
+    return _format == CaptureFormat::Nv12 ? vk::ImageUsageFlagBits::eSampled : vk::ImageUsageFlagBits::eTransferSrc;
+}
+
+void FrameCapture::setTarget(vk::Format format, vk::Extent2D extent, const std::vector<vk::ImageView>& views, uint64_t frameNumber){
+    if(!enabled())
+        return;
+    _targetFormat = format;
+    _targetExtent = extent;
+    if(_format == CaptureFormat::Nv12){
+        releaseTargetViews(frameNumber);
+        for(vk::ImageView view : views)
+            _targetViews.push_back({view, _bindless->registerImage(view)});
+    }
+    // resize the buffers now rather than in the middle of a frame, the ones
+    // still in flight or held follow when they are reused
+    for(auto& slot : _slots){
+        if(slot.state == SlotState::Free)
+            prepareSlot(slot, frameNumber);
+    }
+}
+
+void FrameCapture::releaseTargetViews(uint64_t frameNumber){
+    for(const TargetView& target : _targetViews)
+        _bindless->releaseImage(target.index, frameNumber);
+    _targetViews.clear();
+}
+
+void FrameCapture::declareAccess(RenderGraphPassBuilder& pass, RenderGraphResource backbuffer) const {
+    if(_format == CaptureFormat::Nv12)
+        pass.sampled(backbuffer, vk::PipelineStageFlagBits::eComputeShader);
+    else
+        pass.transferSrc(backbuffer);
+    // the readback buffers are outside of the graph
+    pass.sideEffects();
+}
+
+void FrameCapture::prepareSlot(Slot& slot, uint64_t frameNumber){
+    CapturedFrame& frame = slot.frame;
+    frame.extent = _targetExtent;
+    frame.format = _format;
+    frame.imageFormat = _targetFormat;
+    uint32_t planeHeight = _targetExtent.height;
+    if(_format == CaptureFormat::Nv12){
+        // whole blocks, so every thread writes aligned words
+        frame.rowPitch = alignUp(_targetExtent.width, BlockWidth);
+        planeHeight = alignUp(_targetExtent.height, BlockHeight);
+        frame.size = vk::DeviceSize(frame.rowPitch) * planeHeight * 3 / 2;
+    }
+    else{
+        frame.rowPitch = _targetExtent.width * vk::blockSize(_targetFormat);
+        frame.size = vk::DeviceSize(frame.rowPitch) * planeHeight;
+    }
+
+    if(slot.buffer.size < frame.size){
+        if(slot.buffer.buffer){
+            if(slot.bufferIndex != InvalidBindlessIndex)
+                _bindless->releaseBuffer(slot.bufferIndex, frameNumber);
+            slot.bufferIndex = InvalidBindlessIndex;
+            _allocator->destroyBuffer(slot.buffer);
+        }
+        vk::BufferUsageFlags usage = _format == CaptureFormat::Nv12 ?
+            vk::BufferUsageFlags(vk::BufferUsageFlagBits::eStorageBuffer) :
+            vk::BufferUsageFlags(vk::BufferUsageFlagBits::eTransferDst);
+        slot.buffer = _allocator->createBuffer(MemoryClass::Readback, frame.size, usage);
+        if(!slot.buffer.mapped)
+            throw std::runtime_error("capture buffer is not host visible");
+        if(_format == CaptureFormat::Nv12)
+            slot.bufferIndex = _bindless->registerBuffer(slot.buffer.buffer);
+    }
+
+    frame.data = static_cast<const uint8_t*>(slot.buffer.mapped);
+    frame.chroma = _format == CaptureFormat::Nv12 ? frame.data + vk::DeviceSize(frame.rowPitch) * planeHeight : nullptr;
+}
+
+void FrameCapture::record(vk::CommandBuffer cmd, vk::Image image, vk::ImageView view, uint64_t frameNumber, vk::Fence fence){
+    auto it = std::find_if(_slots.begin(), _slots.end(), [](const Slot& slot){
+        return slot.state == SlotState::Free;
+    });
+    if(it == _slots.end()){
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Slot& slot = *it;
+    uint32_t slotIndex = uint32_t(it - _slots.begin());
+    prepareSlot(slot, frameNumber);
+    slot.frame.frameNumber = frameNumber;
+    slot.frame.slot = slotIndex;
+
+    vk::PipelineStageFlags srcStage;
+    vk::AccessFlags srcAccess;
+    if(_format == CaptureFormat::Nv12){
+        auto target = std::find_if(_targetViews.begin(), _targetViews.end(), [&](const TargetView& target){
+            return target.view == view;
+        });
+        if(target == _targetViews.end())
+            throw std::runtime_error("captured image was not passed to setTarget");
+
+        Nv12Push push{};
+        push.extent[0] = _targetExtent.width;
+        push.extent[1] = _targetExtent.height;
+        push.rowPitch = slot.frame.rowPitch;
+        push.chromaOffset = uint32_t(slot.frame.chroma - slot.frame.data);
+        push.image = target->index;
+        push.imageSampler = _samplerIndex;
+        push.outputBuffer = slot.bufferIndex;
+        push.srgb = std::strcmp(vk::componentNumericFormat(_targetFormat, 0), "SRGB") == 0;
+
+        uint32_t blocksX = alignUp(_targetExtent.width, BlockWidth) / BlockWidth;
+        uint32_t blocksY = alignUp(_targetExtent.height, BlockHeight) / BlockHeight;
+        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, _nv12Pipeline);
+        _bindless->bind(cmd, vk::PipelineBindPoint::eCompute);
+        cmd.pushConstants(_program.layout, _program.pushConstants.stageFlags, 0, sizeof(Nv12Push), &push);
+        cmd.dispatch((blocksX + GroupSize - 1) / GroupSize, (blocksY + GroupSize - 1) / GroupSize, 1);
+        srcStage = vk::PipelineStageFlagBits::eComputeShader;
+        srcAccess = vk::AccessFlagBits::eShaderWrite;
+    }
+    else{
+        vk::BufferImageCopy region{};
+        region.imageSubresource = vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, 0, 0, 1};
+        region.imageExtent = vk::Extent3D{_targetExtent.width, _targetExtent.height, 1};
+        cmd.copyImageToBuffer(image, vk::ImageLayout::eTransferSrcOptimal, slot.buffer.buffer, region);
+        srcStage = vk::PipelineStageFlagBits::eTransfer;
+        srcAccess = vk::AccessFlagBits::eTransferWrite;
+    }
+
+    // makes the writes available to the host once the fence signaled
+    vk::BufferMemoryBarrier barrier{
+        srcAccess, vk::AccessFlagBits::eHostRead,
+        VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+        slot.buffer.buffer, 0, VK_WHOLE_SIZE
+    };
+    cmd.pipelineBarrier(srcStage, vk::PipelineStageFlagBits::eHost, {}, {}, barrier, {});
+
+    slot.state = SlotState::InFlight;
+    slot.fence = fence;
+    _inFlight.push_back(slotIndex);
+    _captured.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FrameCapture::poll(uint64_t frameNumber){
+    uint32_t released;
+    while(_released.pop(released))
+        _slots[released].state = SlotState::Free;
+
+    while(!_inFlight.empty()){
+        Slot& slot = _slots[_inFlight.front()];
+        // The fence wait of this frame retired everything up to
+        // frameNumber - framesInFlight. Newer frames may be done already,
+        // their fences aren't reset before their slot comes around again
+        bool done = slot.frame.frameNumber + _framesInFlight <= frameNumber ||
+            _device.getFenceStatus(slot.fence) == vk::Result::eSuccess;
+        if(!done)
+            break;
+        // host cached memory may not be coherent
+        _allocator->invalidate(slot.buffer, 0, slot.frame.size);
+        slot.state = SlotState::Handed;
+        _completed.push(slot.frame);
+        _inFlight.pop_front();
+    }
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.hpp"
+#include "bindless.hpp"
+#include "pipelines.hpp"
+#include "render_graph.hpp"
+#include "shader_program.hpp"
+#include "spsc_queue.hpp"
+
+enum class CaptureFormat {
+    // the bytes of the backbuffer format, rows tightly packed
+    Native,
+    // converted on the GPU, BT.709 limited range. The Y plane is followed by
+    // interleaved CbCr at half resolution, both with the same row pitch
+    Nv12,
+};
+
+// A captured frame, viewed in place in its persistently mapped readback
+// buffer. The memory belongs to the capture until release()
+struct CapturedFrame {
+    uint64_t frameNumber{0};
+    vk::Extent2D extent;
+    CaptureFormat format{CaptureFormat::Native};
+    // backbuffer format, the pixel layout of Native captures
+    vk::Format imageFormat{vk::Format::eUndefined};
+    const uint8_t* data{nullptr};
+    vk::DeviceSize size{0};
+    // bytes between rows, of both planes for Nv12
+    uint32_t rowPitch{0};
+    // CbCr plane, Nv12 only. Its rows cover two Y rows each
+    const uint8_t* chroma{nullptr};
+    uint32_t slot{0};
+};
+
+struct FrameCaptureStats {
+    uint64_t captured{0};
+    // frames not captured because every buffer was in flight or held
+    uint64_t dropped{0};
+};
+
+// Copies the final image of every frame into a ring of persistently mapped,
+// host cached readback buffers, for video encoding and similar consumers.
+//
+// record() runs in a render graph pass after everything that writes the
+// backbuffer and either copies the image or, for Nv12, converts it with a
+// compute dispatch writing straight into the readback buffer. poll() runs
+// after the frame fence wait and never blocks: captures whose frame fence
+// signaled move to a completed queue in frame order. A consumer on any one
+// thread takes them with acquire(), reads the mapped memory in place and
+// hands the buffer back with release(). When the consumer falls behind and
+// no buffer is free the frame is dropped instead of stalling draw()
+class FrameCapture {
+public:
+    static constexpr uint32_t MaxSlots = 16;
+
+    // slotCount 0 leaves capture disabled
+    void init(
+        vk::Device device,
+        GpuAllocator& allocator,
+        BindlessDescriptors& bindless,
+        PipelineManager& pipelines,
+        uint32_t slotCount,
+        CaptureFormat format,
+        uint32_t framesInFlight
+    );
+
+    // the frames that captured must have retired, views handed out become invalid
+    void destroy();
+
+    bool enabled() const {
+        return !_slots.empty();
+    }
+
+    // usage the captured images need besides being rendered to
+    vk::ImageUsageFlags requiredUsage() const;
+
+    // Format, size and views of the images captured from now on, on every
+    // swapchain creation. frameNumber is the first frame using them
+    void setTarget(vk::Format format, vk::Extent2D extent, const std::vector<vk::ImageView>& views, uint64_t frameNumber);
+
+    // render graph access of the capture pass
+    void declareAccess(RenderGraphPassBuilder& pass, RenderGraphResource backbuffer) const;
+
+    // Records the capture of the frame from inside its graph pass. fence is
+    // the one its submit signals
+    void record(vk::CommandBuffer cmd, vk::Image image, vk::ImageView view, uint64_t frameNumber, vk::Fence fence);
+
+    // After the frame fence wait of frameNumber, before the fence is reset.
+    // Queues the finished captures and recycles released buffers
+    void poll(uint64_t frameNumber);
+
+    // consumer thread, false when no capture finished
+    bool acquire(CapturedFrame& frame){
+        return _completed.pop(frame);
+    }
+
+    // consumer thread, the frame's memory may be reused afterwards
+    void release(const CapturedFrame& frame){
+        // a queue as large as the ring never fills
+        _released.push(frame.slot);
+    }
+
+    FrameCaptureStats stats() const {
+        return {_captured.load(std::memory_order_relaxed), _dropped.load(std::memory_order_relaxed)};
+    }
+
+private:
+    enum class SlotState {
+        Free,
+        // recorded, waiting for the frame's fence
+        InFlight,
+        // queued for or held by the consumer
+        Handed,
+    };
+
+    struct Slot {
+        SlotState state{SlotState::Free};
+        AllocatedBuffer buffer;
+        BindlessIndex bufferIndex{InvalidBindlessIndex};
+        CapturedFrame frame;
+        vk::Fence fence;
+    };
+
+    struct TargetView {
+        vk::ImageView view;
+        BindlessIndex index;
+    };
+
+    // makes the slot's buffer hold the current target, reallocates after a resize
+    void prepareSlot(Slot& slot, uint64_t frameNumber);
+
+    void releaseTargetViews(uint64_t frameNumber);
+
+    vk::Device _device;
+    GpuAllocator* _allocator{nullptr};
+    BindlessDescriptors* _bindless{nullptr};
+    CaptureFormat _format{CaptureFormat::Native};
+    uint32_t _framesInFlight{1};
+
+    ShaderProgram _program;
+    vk::Pipeline _nv12Pipeline;
+    vk::Sampler _sampler;
+    BindlessIndex _samplerIndex{InvalidBindlessIndex};
+
+    vk::Format _targetFormat{vk::Format::eUndefined};
+    vk::Extent2D _targetExtent;
+    std::vector<TargetView> _targetViews;
+
+    std::vector<Slot> _slots;
+    // in submission order, so frames complete in order
+    std::deque<uint32_t> _inFlight;
+
+    // render thread to consumer and back
+    SpscQueue<CapturedFrame, MaxSlots> _completed;
+    SpscQueue<uint32_t, MaxSlots> _released;
+
+    std::atomic<uint64_t> _captured{0};
+    std::atomic<uint64_t> _dropped{0};
+};
@@ -0,0 +1,245 @@
+#include "gpu_culling.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <glm/geometric.hpp>
+
+#include <shaders/cull_comp.hpp>
+
+namespace {
+    constexpr uint32_t CullGroupSize = 64;
+
+    // matches the push block of cull.comp
+    struct CullPush {
+        glm::vec4 frustum[6];
+        uint32_t objectCount;
+        uint32_t objectBuffer;
+        uint32_t drawBuffer;
+        uint32_t countBuffer;
+        uint32_t instanceBuffer;
+    };
+    static_assert(sizeof(CullPush) <= BindlessDescriptors::PushConstantSize);
+
+    // Planes with inward normals from a zero to one depth projection,
+    // row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+    void extractFrustum(const glm::mat4& m, glm::vec4 planes[6]){
+        auto row = [&](int i){
+            return glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+        };
+        planes[0] = row(3) + row(0);
+        planes[1] = row(3) - row(0);
+        planes[2] = row(3) + row(1);
+        planes[3] = row(3) - row(1);
+        planes[4] = row(2);
+        planes[5] = row(3) - row(2);
+        for(int i=0;i<6;++i)
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+}
+
+void GpuCulling::init(
+    vk::Device device,
+    GpuAllocator& allocator,
+    UploadManager& uploads,
+    BindlessDescriptors& bindless,
+    PipelineManager& pipelines,
+    vk::Queue computeQueue,
+    uint32_t computeFamily,
+    uint32_t graphicsFamily,
+    uint32_t framesInFlight,
+    uint32_t maxObjects
+){
+    _device = device;
+    _allocator = &allocator;
+    _uploads = &uploads;
+    _bindless = &bindless;
+    _computeQueue = computeQueue;
+    _computeFamily = computeFamily;
+    _graphicsFamily = graphicsFamily;
+    _maxObjects = std::max(maxObjects, 1u);
+
+    _program = createShaderProgram(_device, {&shaders::cull_comp}, bindless);
+    ComputePipelineDesc pipelineDesc{};
+    pipelineDesc.stage = _program.stages[0];
+    pipelineDesc.layout = _program.layout;
+    pipelineDesc.layoutKey = _program.layoutKey;
+    _pipeline = pipelines.getComputePipeline(pipelineDesc);
+
+    _objects = _allocator->createBuffer(
+        MemoryClass::StaticGeometry,
+        _maxObjects * sizeof(CullObject),
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst
+    );
+    _objectsIndex = _bindless->registerBuffer(_objects.buffer);
+
+    vk::CommandPoolCreateInfo poolInfo{
+        vk::CommandPoolCreateFlagBits::eTransient,
+        _computeFamily
+    };
+    _frames.resize(framesInFlight);
+    for(auto& frame : _frames){
+        frame.commandPool = _device.createCommandPool(poolInfo);
+        vk::CommandBufferAllocateInfo allocInfo{
+            frame.commandPool,
+            vk::CommandBufferLevel::ePrimary,
+            1
+        };
+        frame.commandBuffer = _device.allocateCommandBuffers(allocInfo)[0];
+        frame.finished = _device.createSemaphore({});
+
+        frame.draws = _allocator->createBuffer(
+            MemoryClass::StaticGeometry,
+            _maxObjects * sizeof(vk::DrawIndexedIndirectCommand),
+            vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer
+        );
+        frame.count = _allocator->createBuffer(
+            MemoryClass::StaticGeometry,
+            sizeof(uint32_t),
+            vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst
+        );
+        frame.drawsIndex = _bindless->registerBuffer(frame.draws.buffer);
+        frame.countIndex = _bindless->registerBuffer(frame.count.buffer);
+    }
+}
+
+void GpuCulling::destroy(){
+    for(auto& frame : _frames){
+        _device.destroyCommandPool(frame.commandPool);
+        _device.destroySemaphore(frame.finished);
+        _allocator->destroyBuffer(frame.draws);
+        _allocator->destroyBuffer(frame.count);
+    }
+    _frames.clear();
+    _allocator->destroyBuffer(_objects);
+    // the pipeline is owned by the pipeline manager
+    destroyShaderProgram(_device, _program);
+    _objectCount = 0;
+}
+
+UploadTicket GpuCulling::setObjects(const CullObject* objects, uint32_t count){
+    if(count > _maxObjects)
+        throw std::runtime_error("more cull objects than reserved");
+    _objectCount = count;
+    _objectsReady = false;
+    if(count == 0)
+        return 0;
+    _objectsTicket = _uploads->uploadBuffer(
+        _objects,
+        0,
+        objects,
+        count * sizeof(CullObject),
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::AccessFlagBits::eShaderRead,
+        _computeFamily
+    );
+    return _objectsTicket;
+}
+
+vk::Semaphore GpuCulling::cull(uint32_t slot, const glm::mat4& viewProj, BindlessIndex instances){
+    FrameResources& frame = _frames[slot];
+    // the slot's previous cull finished before the graphics submit waiting on it
+    _device.resetCommandPool(frame.commandPool);
+    vk::CommandBuffer cmd = frame.commandBuffer;
+    cmd.begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+
+    uint64_t uploadWaitValue = _uploads->recordAcquires(cmd, _computeFamily);
+    // ready once the acquire is recorded, at the latest into this command
+    // buffer just above. Until then the count stays 0 and nothing is drawn
+    if(!_objectsReady && _objectCount > 0)
+        _objectsReady = _uploads->isReady(_objectsTicket);
+
+    // The indirect buffers are rewritten from scratch, so taking them back
+    // from the graphics queue needs no ownership transfer
+    cmd.fillBuffer(frame.count.buffer, 0, sizeof(uint32_t), 0);
+    vk::MemoryBarrier clearBarrier{
+        vk::AccessFlagBits::eTransferWrite,
+        vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite
+    };
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader,
+        {}, clearBarrier, {}, {}
+    );
+
+    if(_objectsReady){
+        CullPush push{};
+        extractFrustum(viewProj, push.frustum);
+        push.objectCount = _objectCount;
+        push.objectBuffer = _objectsIndex;
+        push.drawBuffer = frame.drawsIndex;
+        push.countBuffer = frame.countIndex;
+        push.instanceBuffer = instances;
+
+        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, _pipeline);
+        _bindless->bind(cmd, vk::PipelineBindPoint::eCompute);
+        cmd.pushConstants(_program.layout, _program.pushConstants.stageFlags, 0, sizeof(CullPush), &push);
+        cmd.dispatch((_objectCount + CullGroupSize - 1) / CullGroupSize, 1, 1);
+    }
+
+    if(needsOwnershipTransfer()){
+        // release, the matching acquire is recorded by recordAcquire()
+        vk::BufferMemoryBarrier releases[2];
+        for(int i=0;i<2;++i){
+            releases[i].srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+            releases[i].srcQueueFamilyIndex = _computeFamily;
+            releases[i].dstQueueFamilyIndex = _graphicsFamily;
+            releases[i].offset = 0;
+            releases[i].size = VK_WHOLE_SIZE;
+        }
+        releases[0].buffer = frame.draws.buffer;
+        releases[1].buffer = frame.count.buffer;
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eBottomOfPipe,
+            {}, {}, releases, {}
+        );
+    }
+    cmd.end();
+
+    vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eAllCommands;
+    vk::Semaphore uploadTimeline = _uploads->timeline();
+    vk::TimelineSemaphoreSubmitInfo timelineInfo{};
+    vk::SubmitInfo submit{};
+    if(uploadWaitValue != 0){
+        timelineInfo.setWaitSemaphoreValues(uploadWaitValue);
+        submit.pNext = &timelineInfo;
+        submit.setWaitSemaphores(uploadTimeline);
+        submit.setWaitDstStageMask(waitStage);
+    }
+    submit.setCommandBuffers(cmd);
+    submit.setSignalSemaphores(frame.finished);
+    {
+        std::lock_guard<std::mutex> queueLock(_uploads->queueMutex());
+        _computeQueue.submit(submit, nullptr);
+    }
+    return frame.finished;
+}
+
+void GpuCulling::recordAcquire(vk::CommandBuffer cmd, uint32_t slot){
+    if(!needsOwnershipTransfer())
+        return;
+    FrameResources& frame = _frames[slot];
+    vk::BufferMemoryBarrier acquires[2];
+    for(int i=0;i<2;++i){
+        acquires[i].dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead;
+        acquires[i].srcQueueFamilyIndex = _computeFamily;
+        acquires[i].dstQueueFamilyIndex = _graphicsFamily;
+        acquires[i].offset = 0;
+        acquires[i].size = VK_WHOLE_SIZE;
+    }
+    acquires[0].buffer = frame.draws.buffer;
+    acquires[1].buffer = frame.count.buffer;
+    // chains with the wait on the cull semaphore at DrawIndirect
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eDrawIndirect, vk::PipelineStageFlagBits::eDrawIndirect,
+        {}, {}, acquires, {}
+    );
+}
+
+void GpuCulling::recordDraw(vk::CommandBuffer cmd, uint32_t slot){
+    FrameResources& frame = _frames[slot];
+    cmd.drawIndexedIndirectCount(
+        frame.draws.buffer, 0,
+        frame.count.buffer, 0,
+        _objectCount,
+        sizeof(vk::DrawIndexedIndirectCommand)
+    );
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.hpp"
+#include "bindless.hpp"
+#include "pipelines.hpp"
+#include "shader_program.hpp"
+#include "upload.hpp"
+
+// matches CullObject in cull.comp, the draw of an object. Its bounds are
+// dynamic and come from the SceneInstance of the same index
+struct CullObject {
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t pad;
+};
+
+// Frustum culling on the compute queue. Draw records of every object live in
+// one device local buffer, their world bounds in the frame's SceneInstance
+// buffer. Each frame a dispatch appends the draws of the visible objects to
+// per frame indirect buffers that a single drawIndexedIndirectCount consumes,
+// so the CPU cost of a frame doesn't grow with the object count. Draws carry
+// the object index in firstInstance.
+//
+// When the compute family differs from the graphics family the indirect
+// buffers are released by the compute queue and acquired in recordAcquire()
+class GpuCulling {
+public:
+    void init(
+        vk::Device device,
+        GpuAllocator& allocator,
+        UploadManager& uploads,
+        BindlessDescriptors& bindless,
+        PipelineManager& pipelines,
+        vk::Queue computeQueue,
+        uint32_t computeFamily,
+        uint32_t graphicsFamily,
+        uint32_t framesInFlight,
+        uint32_t maxObjects
+    );
+
+    // the frames that culled must have retired
+    void destroy();
+
+    // Only while no frame culling the previous objects is in flight. Frames
+    // cull nothing until the upload finished and the compute queue acquired it
+    UploadTicket setObjects(const CullObject* objects, uint32_t count);
+
+    // Records and submits the cull of a frame slot once its previous frame
+    // retired. instances is the bindless index of the frame's SceneInstance
+    // buffer, already written and flushed. The returned semaphore is signaled
+    // when the draws are written, the graphics submit of the same frame must
+    // wait on it at DrawIndirect
+    vk::Semaphore cull(uint32_t slot, const glm::mat4& viewProj, BindlessIndex instances);
+
+    // graphics side of the ownership transfer, outside of the render pass
+    void recordAcquire(vk::CommandBuffer cmd, uint32_t slot);
+
+    // draws with the bound pipeline and vertex and index buffers
+    void recordDraw(vk::CommandBuffer cmd, uint32_t slot);
+
+    uint32_t objectCount() const {
+        return _objectCount;
+    }
+
+private:
+    struct FrameResources {
+        vk::CommandPool commandPool;
+        vk::CommandBuffer commandBuffer;
+        vk::Semaphore finished;
+        AllocatedBuffer draws;
+        AllocatedBuffer count;
+        BindlessIndex drawsIndex{InvalidBindlessIndex};
+        BindlessIndex countIndex{InvalidBindlessIndex};
+    };
+
+    bool needsOwnershipTransfer() const {
+        return _computeFamily != _graphicsFamily;
+    }
+
+    vk::Device _device;
+    GpuAllocator* _allocator{nullptr};
+    UploadManager* _uploads{nullptr};
+    BindlessDescriptors* _bindless{nullptr};
+    vk::Queue _computeQueue;
+    uint32_t _computeFamily{0};
+    uint32_t _graphicsFamily{0};
+
+    ShaderProgram _program;
+    vk::Pipeline _pipeline;
+
+    uint32_t _maxObjects{0};
+    uint32_t _objectCount{0};
+    UploadTicket _objectsTicket{0};
+    bool _objectsReady{false};
+    AllocatedBuffer _objects;
+    BindlessIndex _objectsIndex{InvalidBindlessIndex};
+
+    std::vector<FrameResources> _frames;
+};
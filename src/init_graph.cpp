@@ -0,0 +1,105 @@
+#include "init_graph.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "json.hpp"
+
+void StartupTrace::add(const char* name, uint32_t thread, Clock::time_point begin, Clock::time_point end){
+    std::lock_guard<std::mutex> lock(_mutex);
+    _spans.push_back({name, thread, begin, end});
+}
+
+double StartupTrace::elapsedMs() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    Clock::time_point end = _origin;
+    for(const Span& span : _spans)
+        end = std::max(end, span.end);
+    return std::chrono::duration<double, std::milli>(end - _origin).count();
+}
+
+bool StartupTrace::writeChromeTrace(const char* path) const {
+    FILE* file = std::fopen(path, "w");
+    if(!file)
+        return false;
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto micros = [&](Clock::time_point time){
+        return std::chrono::duration<double, std::micro>(time - _origin).count();
+    };
+
+    std::fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    std::vector<uint32_t> threads;
+    for(size_t i=0;i<_spans.size();++i){
+        const Span& span = _spans[i];
+        // complete events, begin and duration in microseconds
+        std::fprintf(file, "%s\n  {\"name\": \"%s\", \"cat\": \"startup\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+            i==0 ? "" : ",", jsonEscape(span.name).c_str(), span.thread, micros(span.begin), micros(span.end) - micros(span.begin));
+        if(std::find(threads.begin(), threads.end(), span.thread) == threads.end())
+            threads.push_back(span.thread);
+    }
+    for(uint32_t thread : threads){
+        std::fprintf(file, "%s\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"worker %u\"}}",
+            _spans.empty() ? "" : ",", thread, thread);
+    }
+    std::fprintf(file, "\n]}\n");
+    return std::fclose(file) == 0;
+}
+
+void InitGraph::add(const char* name, std::initializer_list<const char*> dependencies, std::function<void()> function,
+    InitThread thread){
+    uint32_t wave = 0;
+    for(const char* dependency : dependencies){
+        auto it = std::find_if(_steps.begin(), _steps.end(), [&](const Step& step){
+            return std::strcmp(step.name, dependency) == 0;
+        });
+        // added in order, so the graph can't have cycles
+        if(it == _steps.end())
+            throw std::logic_error(std::string("init step ") + name + " depends on unknown step " + dependency);
+        wave = std::max(wave, it->wave + 1);
+    }
+    _steps.push_back({name, std::move(function), thread, wave});
+    _waveCount = std::max(_waveCount, wave + 1);
+}
+
+void InitGraph::execute(){
+    for(uint32_t wave=0;wave<_waveCount;++wave){
+        Job* root = _jobs.create([](uint32_t){});
+        for(uint32_t i=0;i<_steps.size();++i){
+            if(_steps[i].wave != wave || _steps[i].thread != InitThread::Any)
+                continue;
+            InitGraph* graph = this;
+            _jobs.run(_jobs.createChild(root, [graph, i](uint32_t worker){
+                graph->runStep(i, worker);
+            }));
+        }
+        // the workers start on the others meanwhile
+        for(uint32_t i=0;i<_steps.size();++i){
+            if(_steps[i].wave == wave && _steps[i].thread == InitThread::Caller)
+                runStep(i, _jobs.currentWorker());
+        }
+        _jobs.run(root);
+        _jobs.wait(root);
+
+        if(_error)
+            std::rethrow_exception(_error);
+    }
+}
+
+void InitGraph::runStep(uint32_t index, uint32_t worker){
+    Step& step = _steps[index];
+    StartupTrace::Clock::time_point begin = StartupTrace::Clock::now();
+    // jobs must not throw
+    try{
+        step.function();
+    }
+    catch(...){
+        std::lock_guard<std::mutex> lock(_errorMutex);
+        if(!_error)
+            _error = std::current_exception();
+    }
+    if(_trace)
+        _trace->add(step.name, worker, begin, StartupTrace::Clock::now());
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <vector>
+
+#include "jobs.hpp"
+
+// Timed spans of startup, written as a Chrome trace (chrome://tracing,
+// Perfetto). Times are relative to the construction of the trace. Thread safe
+class StartupTrace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // records until destroyed, for work outside of an InitGraph
+    class Scope {
+    public:
+        Scope(StartupTrace& trace, const char* name, uint32_t thread = 0)
+            : _trace(trace), _name(name), _thread(thread), _begin(Clock::now()) {}
+
+        ~Scope(){
+            _trace.add(_name, _thread, _begin, Clock::now());
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        StartupTrace& _trace;
+        const char* _name;
+        uint32_t _thread;
+        Clock::time_point _begin;
+    };
+
+    StartupTrace() : _origin(Clock::now()) {}
+
+    // name must outlive the trace, thread is the job worker index
+    void add(const char* name, uint32_t thread, Clock::time_point begin, Clock::time_point end);
+
+    // end of the latest span
+    double elapsedMs() const;
+
+    bool writeChromeTrace(const char* path) const;
+
+private:
+    struct Span {
+        const char* name;
+        uint32_t thread;
+        Clock::time_point begin;
+        Clock::time_point end;
+    };
+
+    Clock::time_point _origin;
+    mutable std::mutex _mutex;
+    std::vector<Span> _spans;
+};
+
+enum class InitThread {
+    // any job worker
+    Any,
+    // the thread calling execute(), for window system calls
+    Caller,
+};
+
+// Startup steps with dependencies, run on the job system. Steps are grouped
+// into waves by the longest dependency chain in front of them, the steps of
+// a wave run concurrently and a wave starts once the previous one finished.
+// Startup graphs are shallow, so this costs little over starting each step
+// the moment its own dependencies are done, and keeps steps that must stay on
+// the calling thread simple to schedule.
+//
+// Steps only overlap with steps they have no dependency path to or from, so
+// steps writing disjoint state need no locks. The first exception a step
+// throws is rethrown by execute() once its wave finished, later waves don't
+// run
+class InitGraph {
+public:
+    InitGraph(JobSystem& jobs, StartupTrace* trace = nullptr) : _jobs(jobs), _trace(trace) {}
+
+    // Dependencies are named and must have been added before. name must
+    // outlive the graph and its trace
+    void add(const char* name, std::initializer_list<const char*> dependencies, std::function<void()> function,
+        InitThread thread = InitThread::Any);
+
+    // from a job worker, normally the thread that initialized the job system
+    void execute();
+
+private:
+    struct Step {
+        const char* name;
+        std::function<void()> function;
+        InitThread thread;
+        uint32_t wave;
+    };
+
+    void runStep(uint32_t index, uint32_t worker);
+
+    JobSystem& _jobs;
+    StartupTrace* _trace;
+    std::vector<Step> _steps;
+    uint32_t _waveCount{0};
+
+    std::mutex _errorMutex;
+    std::exception_ptr _error;
+};
@@ -0,0 +1,196 @@
+#include "jobs.hpp"
+
+#include <stdexcept>
+
+namespace {
+    thread_local const JobSystem* t_jobSystem = nullptr;
+    thread_local uint32_t t_worker = 0;
+}
+
+bool JobDeque::push(Job* job){
+    int64_t bottom = _bottom.load(std::memory_order_relaxed);
+    int64_t top = _top.load(std::memory_order_acquire);
+    if(bottom - top >= Capacity)
+        return false;
+    _jobs[bottom & (Capacity - 1)].store(job, std::memory_order_relaxed);
+    // publishes the job's contents to stealers that acquire _bottom
+    _bottom.store(bottom + 1, std::memory_order_release);
+    return true;
+}
+
+Job* JobDeque::pop(){
+    int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+    _bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = _top.load(std::memory_order_relaxed);
+    if(top > bottom){
+        // empty
+        _bottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    Job* job = _jobs[bottom & (Capacity - 1)].load(std::memory_order_relaxed);
+    if(top == bottom){
+        // last job, race the stealers for it
+        if(!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            job = nullptr;
+        _bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+Job* JobDeque::steal(){
+    int64_t top = _top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = _bottom.load(std::memory_order_acquire);
+    if(top >= bottom)
+        return nullptr;
+    Job* job = _jobs[top & (Capacity - 1)].load(std::memory_order_relaxed);
+    if(!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+    return job;
+}
+
+void JobSystem::init(uint32_t threadCount){
+    _workerCount = threadCount + 1;
+    _workers = std::make_unique<Worker[]>(_workerCount);
+    _quit.store(false);
+    for(uint32_t i=0;i<_workerCount;++i){
+        _workers[i].jobs = std::make_unique<Job[]>(MaxJobsPerWorker);
+        _workers[i].random = 0x9e3779b9u * (i + 1);
+    }
+    t_jobSystem = this;
+    t_worker = 0;
+    for(uint32_t i=1;i<_workerCount;++i)
+        _workers[i].thread = std::thread(&JobSystem::workerLoop, this, i);
+}
+
+void JobSystem::destroy(){
+    _quit.store(true);
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+    }
+    _wake.notify_all();
+    for(uint32_t i=1;i<_workerCount;++i)
+        _workers[i].thread.join();
+    _workers.reset();
+    _workerCount = 0;
+    if(t_jobSystem == this)
+        t_jobSystem = nullptr;
+}
+
+void JobSystem::rebindMainThread(){
+    t_jobSystem = this;
+    t_worker = 0;
+}
+
+uint32_t JobSystem::currentWorker() const {
+    if(t_jobSystem != this)
+        throw std::runtime_error("job system used from a thread that is not one of its workers");
+    return t_worker;
+}
+
+Job* JobSystem::allocate(){
+    Worker& worker = _workers[currentWorker()];
+    Job* job = &worker.jobs[worker.allocated & (MaxJobsPerWorker - 1)];
+    ++worker.allocated;
+    return job;
+}
+
+void JobSystem::run(Job* job){
+    uint32_t worker = currentWorker();
+    // a full deque means plenty of queued work, running inline is fine
+    if(!_workers[worker].deque.push(job)){
+        execute(job, worker);
+        return;
+    }
+    // pairs with the fence of a worker going to sleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(_sleeping.load(std::memory_order_relaxed) > 0){
+        {
+            std::lock_guard<std::mutex> lock(_sleepMutex);
+            ++_wakeups;
+        }
+        _wake.notify_one();
+    }
+}
+
+void JobSystem::wait(const Job* job){
+    uint32_t worker = currentWorker();
+    while(!isFinished(job)){
+        Job* next = getJob(worker);
+        if(next)
+            execute(next, worker);
+        else
+            std::this_thread::yield();
+    }
+}
+
+Job* JobSystem::getJob(uint32_t worker){
+    Worker& self = _workers[worker];
+    if(Job* job = self.deque.pop())
+        return job;
+    if(_workerCount == 1)
+        return nullptr;
+
+    // xorshift, start stealing at a random victim so thieves spread out
+    uint32_t x = self.random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    self.random = x;
+    for(uint32_t i=0;i<_workerCount;++i){
+        uint32_t victim = (x + i) % _workerCount;
+        if(victim == worker)
+            continue;
+        if(Job* job = _workers[victim].deque.steal())
+            return job;
+    }
+    return nullptr;
+}
+
+void JobSystem::execute(Job* job, uint32_t worker){
+    job->function(*job, worker);
+    finish(job);
+}
+
+void JobSystem::finish(Job* job){
+    // once the counter hits zero a waiter may move on and recycle the job
+    Job* parent = job->parent;
+    if(job->unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1 && parent)
+        finish(parent);
+}
+
+void JobSystem::workerLoop(uint32_t worker){
+    t_jobSystem = this;
+    t_worker = worker;
+    uint32_t idleSpins = 0;
+    while(!_quit.load(std::memory_order_relaxed)){
+        if(Job* job = getJob(worker)){
+            execute(job, worker);
+            idleSpins = 0;
+            continue;
+        }
+        if(++idleSpins < 64){
+            std::this_thread::yield();
+            continue;
+        }
+        idleSpins = 0;
+
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _sleeping.fetch_add(1, std::memory_order_relaxed);
+        // Pairs with the fence in run(). Either run() sees this worker as
+        // sleeping and notifies under the mutex, or the check below sees its job
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        Job* job = getJob(worker);
+        if(!job){
+            uint64_t wakeups = _wakeups;
+            _wake.wait(lock, [&]{
+                return _wakeups != wakeups || _quit.load(std::memory_order_relaxed);
+            });
+        }
+        _sleeping.fetch_sub(1, std::memory_order_relaxed);
+        lock.unlock();
+        if(job)
+            execute(job, worker);
+    }
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A unit of work with its callable stored inline. A job is finished once it
+// ran and all of its children finished
+struct alignas(64) Job {
+    static constexpr size_t DataSize = 40;
+    using Function = void(*)(Job& job, uint32_t worker);
+
+    Function function;
+    Job* parent;
+    std::atomic<int32_t> unfinished;
+    alignas(8) unsigned char data[DataSize];
+};
+
+// Chase-Lev deque of a single worker. The owner pushes and pops at the
+// bottom, other workers steal from the top
+class JobDeque {
+public:
+    static constexpr int64_t Capacity = 4096;
+
+    // false when full
+    bool push(Job* job);
+
+    Job* pop();
+
+    Job* steal();
+
+private:
+    std::atomic<int64_t> _top{0};
+    std::atomic<int64_t> _bottom{0};
+    std::atomic<Job*> _jobs[Capacity];
+};
+
+// Fixed pool of workers with per worker deques and work stealing. The thread
+// that calls init() is worker 0 and runs jobs while it waits.
+//
+// Jobs are allocated from a per worker ring and recycled without checks, at
+// most MaxJobsPerWorker may be alive per worker. Only workers and the init
+// thread may create, run or wait on jobs. Jobs must not throw
+class JobSystem {
+public:
+    static constexpr uint32_t MaxJobsPerWorker = 4096;
+
+    // workers still running join here, e.g. when startup threw before destroy()
+    ~JobSystem(){
+        if(_workers)
+            destroy();
+    }
+
+    // threadCount extra threads, 0 runs every job on the init thread
+    void init(uint32_t threadCount);
+
+    void destroy();
+
+    // Makes the calling thread worker 0 in place of the thread that called
+    // init(), which must not use the job system afterwards. No jobs may be alive
+    void rebindMainThread();
+
+    uint32_t workerCount() const {
+        return _workerCount;
+    }
+
+    // fn(uint32_t worker), captures must be trivially copyable and fit in Job::DataSize
+    template<typename F>
+    Job* create(F fn){
+        return createChild(nullptr, std::move(fn));
+    }
+
+    // parent doesn't finish before the child did, create children before running the parent
+    template<typename F>
+    Job* createChild(Job* parent, F fn){
+        static_assert(sizeof(F) <= Job::DataSize, "job captures too large");
+        static_assert(alignof(F) <= 8, "job captures over aligned");
+        static_assert(std::is_trivially_copyable<F>::value, "job captures must be trivially copyable");
+        Job* job = allocate();
+        job->function = [](Job& job, uint32_t worker){
+            (*std::launder(reinterpret_cast<F*>(job.data)))(worker);
+        };
+        job->parent = parent;
+        job->unfinished.store(1, std::memory_order_relaxed);
+        if(parent)
+            parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+        new(job->data) F(std::move(fn));
+        return job;
+    }
+
+    void run(Job* job);
+
+    // runs other jobs until job finished
+    void wait(const Job* job);
+
+    bool isFinished(const Job* job) const {
+        return job->unfinished.load(std::memory_order_acquire) == 0;
+    }
+
+    // Splits [0, count) into chunks of at least grain items and calls
+    // fn(begin, end, worker) for each of them in parallel, returns when all finished
+    template<typename F>
+    void parallelFor(uint32_t count, uint32_t grain, const F& fn){
+        if(count == 0)
+            return;
+        // keep the number of live jobs well below the per worker ring
+        grain = std::max({grain, 1u, (count + MaxJobsPerWorker/4 - 1) / (MaxJobsPerWorker/4)});
+        if(count <= grain || _workerCount == 1){
+            fn(0u, count, currentWorker());
+            return;
+        }
+        Job* root = create([](uint32_t){});
+        const F* function = &fn;
+        for(uint32_t begin=0;begin<count;begin+=grain){
+            uint32_t end = std::min(count, begin + grain);
+            run(createChild(root, [function, begin, end](uint32_t worker){
+                (*function)(begin, end, worker);
+            }));
+        }
+        run(root);
+        wait(root);
+    }
+
+    // index of the calling worker, throws on foreign threads
+    uint32_t currentWorker() const;
+
+private:
+    struct Worker {
+        JobDeque deque;
+        std::unique_ptr<Job[]> jobs;
+        uint32_t allocated{0};
+        uint32_t random{0};
+        std::thread thread;
+    };
+
+    Job* allocate();
+
+    Job* getJob(uint32_t worker);
+
+    void execute(Job* job, uint32_t worker);
+
+    void finish(Job* job);
+
+    void workerLoop(uint32_t worker);
+
+    std::unique_ptr<Worker[]> _workers;
+    uint32_t _workerCount{0};
+
+    std::atomic<bool> _quit{false};
+    std::atomic<uint32_t> _sleeping{0};
+    std::mutex _sleepMutex;
+    // bumped by run() under _sleepMutex for every wakeup it sends
+    uint64_t _wakeups{0};
+    std::condition_variable _wake;
+};
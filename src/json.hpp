@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+// Escapes a string for use between the quotes of a JSON string: quotes,
+// backslashes and control characters. Other bytes pass through, so UTF-8
+// stays UTF-8
+inline std::string jsonEscape(const std::string& text){
+    std::string out;
+    out.reserve(text.size());
+    for(char c : text){
+        switch(c){
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if(static_cast<unsigned char>(c) < 0x20){
+                    char code[8];
+                    std::snprintf(code, sizeof(code), "\\u%04x", unsigned(static_cast<unsigned char>(c)));
+                    out += code;
+                }
+                else
+                    out += c;
+        }
+    }
+    return out;
+}
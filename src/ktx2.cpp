@@ -0,0 +1,90 @@
+#include "ktx2.hpp"
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vulkan/vulkan_format_traits.hpp>
+
+#ifdef TEXTURE_ZSTD
+#include <zstd.h>
+#endif
+
+Ktx2File::Ktx2File(const std::string& path) : _path(path){
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if(!file)
+        throw std::runtime_error("can't open texture " + path);
+    uint64_t fileSize = uint64_t(file.tellg());
+    file.seekg(0);
+
+    bool valid = fileSize >= sizeof(Ktx2Header) &&
+        file.read(reinterpret_cast<char*>(&_header), sizeof(Ktx2Header)) &&
+        std::memcmp(_header.identifier, Ktx2Identifier, sizeof(Ktx2Identifier)) == 0;
+    if(!valid)
+        throw std::runtime_error("not a KTX2 file " + path);
+
+    const Ktx2Header& h = _header;
+    if(h.vkFormat == VK_FORMAT_UNDEFINED)
+        throw std::runtime_error("texture needs a Basis transcoder " + path);
+    if(h.pixelWidth == 0 || h.pixelHeight == 0 || h.pixelDepth > 1 || h.layerCount > 1 || h.faceCount != 1)
+        throw std::runtime_error("only single 2D textures are supported " + path);
+
+    auto scheme = Ktx2Supercompression(h.supercompressionScheme);
+#ifdef TEXTURE_ZSTD
+    bool decodable = scheme == Ktx2Supercompression::None || scheme == Ktx2Supercompression::Zstandard;
+#else
+    bool decodable = scheme == Ktx2Supercompression::None;
+#endif
+    if(!decodable)
+        throw std::runtime_error("unsupported supercompression " + std::to_string(h.supercompressionScheme) + " in " + path);
+
+    // 0 asks the loader to generate mips, we only stream what is stored
+    uint32_t levelCount = std::max(h.levelCount, 1u);
+    if(levelCount > 32 || ((h.pixelWidth | h.pixelHeight) >> (levelCount - 1)) == 0)
+        throw std::runtime_error("too many mip levels in " + path);
+    _levels.resize(levelCount);
+    if(!file.read(reinterpret_cast<char*>(_levels.data()), levelCount * sizeof(Ktx2Level)))
+        throw std::runtime_error("truncated KTX2 file " + path);
+
+    // levels are uploaded as is, their size must match what a copy reads
+    uint32_t blockSize = vk::blockSize(format());
+    std::array<uint8_t, 3> block = vk::blockExtent(format());
+    if(blockSize == 0)
+        throw std::runtime_error("unknown format in " + path);
+    for(uint32_t i=0;i<levelCount;++i){
+        const Ktx2Level& level = _levels[i];
+        vk::Extent3D extent = levelExtent(i);
+        uint64_t expected = uint64_t((extent.width + block[0] - 1) / block[0]) * ((extent.height + block[1] - 1) / block[1]) * blockSize;
+        bool fits = level.byteOffset <= fileSize && level.byteLength <= fileSize - level.byteOffset;
+        if(scheme == Ktx2Supercompression::None)
+            fits = fits && level.byteLength == level.uncompressedByteLength;
+        if(!fits || level.uncompressedByteLength != expected)
+            throw std::runtime_error("invalid level index in " + path);
+    }
+}
+
+void Ktx2File::readLevel(uint32_t level, std::vector<uint8_t>& data) const {
+    const Ktx2Level& index = _levels[level];
+    std::ifstream file(_path, std::ios::binary);
+    if(!file)
+        throw std::runtime_error("can't open texture " + _path);
+    file.seekg(std::streamoff(index.byteOffset));
+
+    if(Ktx2Supercompression(_header.supercompressionScheme) == Ktx2Supercompression::None){
+        data.resize(index.byteLength);
+        if(!file.read(reinterpret_cast<char*>(data.data()), std::streamsize(index.byteLength)))
+            throw std::runtime_error("can't read level " + std::to_string(level) + " of " + _path);
+        return;
+    }
+
+#ifdef TEXTURE_ZSTD
+    // one zstd frame per level
+    std::vector<uint8_t> compressed(index.byteLength);
+    if(!file.read(reinterpret_cast<char*>(compressed.data()), std::streamsize(index.byteLength)))
+        throw std::runtime_error("can't read level " + std::to_string(level) + " of " + _path);
+    data.resize(index.uncompressedByteLength);
+    size_t size = ZSTD_decompress(data.data(), data.size(), compressed.data(), compressed.size());
+    if(ZSTD_isError(size) || size != data.size())
+        throw std::runtime_error("can't decode level " + std::to_string(level) + " of " + _path);
+#endif
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+// KTX2 container, see the Khronos KTX File Format Specification 2.0.
+// Little endian, fields in file order
+inline constexpr uint8_t Ktx2Identifier[12] = {
+    0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A
+};
+
+enum class Ktx2Supercompression : uint32_t {
+    None = 0,
+    BasisLZ = 1,
+    Zstandard = 2,
+    Zlib = 3,
+};
+
+struct Ktx2Header {
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+
+static_assert(sizeof(Ktx2Header) == 80, "KTX2 header layout");
+
+// follows the header, one per mip level, level 0 is the largest
+struct Ktx2Level {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+static_assert(sizeof(Ktx2Level) == 24, "KTX2 level index layout");
+
+// Header and level index of a .ktx2 file. Mip data is read on demand with
+// readLevel(), each call opens the file on its own so several threads can
+// stream levels of the same file at once.
+//
+// Only 2D textures with one layer and face and a Vulkan format are accepted.
+// Zstandard supercompression is decoded when the build found libzstd,
+// BasisLZ and UASTC need a Basis transcoder and are rejected
+class Ktx2File {
+public:
+    Ktx2File() = default;
+
+    // throws when the file can't be read, is not KTX2 or is not supported
+    explicit Ktx2File(const std::string& path);
+
+    vk::Format format() const {
+        return vk::Format(_header.vkFormat);
+    }
+
+    uint32_t levelCount() const {
+        return uint32_t(_levels.size());
+    }
+
+    vk::Extent3D levelExtent(uint32_t level) const {
+        return {
+            std::max(_header.pixelWidth >> level, 1u),
+            std::max(_header.pixelHeight >> level, 1u),
+            1
+        };
+    }
+
+    // bytes of the level once decoded
+    uint64_t levelSize(uint32_t level) const {
+        return _levels[level].uncompressedByteLength;
+    }
+
+    // Reads and decodes one level into data, resized to levelSize(level).
+    // Throws on read or decode errors
+    void readLevel(uint32_t level, std::vector<uint8_t>& data) const;
+
+    const std::string& path() const {
+        return _path;
+    }
+
+private:
+    std::string _path;
+    Ktx2Header _header{};
+    std::vector<Ktx2Level> _levels;
+};
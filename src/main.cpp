@@ -1,26 +1,208 @@
 #include "SDL_events.h"
 #include "SDL_keycode.h"
 #include <SDL.h>
+#include <SDL_vulkan.h>
 
+#include "render_thread.hpp"
 #include "renderer.hpp"
 
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
 
 
+
+static bool parsePresentPolicy(const char* name, PresentPolicy& policy){
+    if(std::strcmp(name,"fifo")==0)
+        policy = PresentPolicy::Fifo;
+    else if(std::strcmp(name,"relaxed")==0)
+        policy = PresentPolicy::FifoRelaxed;
+    else if(std::strcmp(name,"mailbox")==0)
+        policy = PresentPolicy::Mailbox;
+    else if(std::strcmp(name,"immediate")==0)
+        policy = PresentPolicy::Immediate;
+    else
+        return false;
+    return true;
+}
+
 int main(int argc, char* argv[]){
-    
-    Renderer engine;
+    // usage: test [--frames-in-flight N] [--headless] [--frames N] [--no-validation]
+    //             [--present fifo|relaxed|mailbox|immediate] [--swapchain-images N]
+    //             [--no-profile] [--profile-out file.csv|file.json]
+    //             [--job-threads N] [--draws N] [--materials N] [--gpu-culling]
+    //             [--mesh file.mesh]
+    //             [--texture file.ktx2]... [--texture-budget MB]
+    //             [--capture native|nv12] [--capture-buffers N] [--post]
+    //             [--startup-trace file.json]
+    RendererConfig config{};
+    std::vector<const char*> texturePaths;
+    uint64_t maxFrames=0;
+    const char* profileOut=nullptr;
+    for(int i=1;i<argc;++i){
+        if(std::strcmp(argv[i],"--frames-in-flight")==0 && i+1<argc)
+            config.framesInFlight = std::atoi(argv[++i]);
+        else if(std::strcmp(argv[i],"--frames")==0 && i+1<argc)
+            maxFrames = std::strtoull(argv[++i],nullptr,10);
+        else if(std::strcmp(argv[i],"--headless")==0)
+            config.headless = true;
+        else if(std::strcmp(argv[i],"--no-validation")==0)
+            config.enableValidationLayers = false;
+        else if(std::strcmp(argv[i],"--present")==0 && i+1<argc){
+            if(!parsePresentPolicy(argv[++i],config.presentPolicy))
+                printf("unknown present policy %s, using fifo\n",argv[i]);
+        }
+        else if(std::strcmp(argv[i],"--swapchain-images")==0 && i+1<argc)
+            config.swapchainImageCount = std::atoi(argv[++i]);
+        else if(std::strcmp(argv[i],"--no-profile")==0)
+            config.profiling = false;
+        else if(std::strcmp(argv[i],"--profile-out")==0 && i+1<argc)
+            profileOut = argv[++i];
+        else if(std::strcmp(argv[i],"--job-threads")==0 && i+1<argc)
+            config.jobThreads = std::atoi(argv[++i]);
+        else if(std::strcmp(argv[i],"--draws")==0 && i+1<argc)
+            config.testDrawCount = std::atoi(argv[++i]);
+        else if(std::strcmp(argv[i],"--materials")==0 && i+1<argc)
+            config.testMaterialCount = std::atoi(argv[++i]);
+        else if(std::strcmp(argv[i],"--gpu-culling")==0)
+            config.gpuCulling = true;
+        else if(std::strcmp(argv[i],"--mesh")==0 && i+1<argc)
+            config.scenePath = argv[++i];
+        else if(std::strcmp(argv[i],"--texture")==0 && i+1<argc)
+            texturePaths.push_back(argv[++i]);
+        else if(std::strcmp(argv[i],"--texture-budget")==0 && i+1<argc)
+            config.textureBudget = std::strtoull(argv[++i],nullptr,10)*1024*1024;
+        else if(std::strcmp(argv[i],"--capture")==0 && i+1<argc){
+            ++i;
+            config.captureFormat = std::strcmp(argv[i],"nv12")==0 ? CaptureFormat::Nv12 : CaptureFormat::Native;
+            if(config.captureBuffers==0)
+                config.captureBuffers = 4;
+        }
+        else if(std::strcmp(argv[i],"--capture-buffers")==0 && i+1<argc)
+            config.captureBuffers = std::atoi(argv[++i]);
+        else if(std::strcmp(argv[i],"--post")==0)
+            config.postProcessing = true;
+        else if(std::strcmp(argv[i],"--startup-trace")==0 && i+1<argc)
+            config.startupTracePath = argv[++i];
+    }
+
+    // a device or file that can't be used ends here instead of in terminate
+    std::unique_ptr<Renderer> renderer;
+    try{
+        renderer = std::make_unique<Renderer>(config);
+    }
+    catch(const std::exception& e){
+        printf("startup failed: %s\n", e.what());
+        return 1;
+    }
+    Renderer& engine = *renderer;
+    if(texturePaths.size() > Renderer::MaxSceneTextures){
+        printf("at most %u textures\n", Renderer::MaxSceneTextures);
+        return 1;
+    }
+    std::vector<TextureHandle> textures;
+    for(const char* path : texturePaths)
+        textures.push_back(engine._textures.load(path));
+    // sampled by the scene objects, only drawn with --gpu-culling
+    engine.setSceneTextures(textures);
+    // the main thread only handles events from here on, frames are drawn on the render thread
+    RenderInput input{};
+    input.drawableSize = engine._swapchainExtent;
+    input.presentPolicy = config.presentPolicy;
+    RenderThread renderThread;
+    auto start = std::chrono::steady_clock::now();
+    renderThread.start(engine, maxFrames);
+
+    uint64_t capturedFrames=0, capturedBytes=0;
     bool running=true;
     SDL_Event event;
-    while(running){
-        while(SDL_PollEvent(&event)!=0){
-            if(event.type==SDL_QUIT)
-                running = false;    
-            if(event.type==SDL_KEYDOWN){
-                if(event.key.keysym.sym==SDLK_ESCAPE)
-                    running=false;
-            }
+    while(running && !renderThread.finished()){
+        // headless has no window and no events, it just waits for the frames
+        if(config.headless)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        else if(SDL_WaitEventTimeout(&event, 10)){
+            do{
+                if(event.type==SDL_QUIT)
+                    running = false;
+                if(event.type==SDL_WINDOWEVENT && event.window.event==SDL_WINDOWEVENT_SIZE_CHANGED)
+                    input.resized = true;
+                if(event.type==SDL_KEYDOWN){
+                    if(event.key.keysym.sym==SDLK_ESCAPE)
+                        running=false;
+                    // cycle fifo -> relaxed -> mailbox -> immediate
+                    if(event.key.keysym.sym==SDLK_p)
+                        input.presentPolicy = PresentPolicy((uint32_t(input.presentPolicy)+1)%4);
+                }
+            } while(SDL_PollEvent(&event)!=0);
         }
-        engine.draw();
+        if(!config.headless){
+            int width, height;
+            SDL_Vulkan_GetDrawableSize(engine._window, &width, &height);
+            input.drawableSize = vk::Extent2D{uint32_t(width), uint32_t(height)};
+        }
+        // stands in for an encoder, which would read the frames in place before releasing them
+        CapturedFrame captured;
+        while(engine._capture.acquire(captured)){
+            ++capturedFrames;
+            capturedBytes += captured.size;
+            engine._capture.release(captured);
+        }
+        input.polledAt = std::chrono::steady_clock::now();
+        // a full queue keeps the resize for the next snapshot
+        if(renderThread.push(input))
+            input.resized = false;
+    }
+    try{
+        renderThread.stop();
+    }
+    catch(const std::exception& e){
+        printf("render thread failed: %s\n", e.what());
+        return 1;
+    }
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now()-start;
+    uint64_t frames = renderThread.frames();
+    if(frames>0)
+        printf("frames in flight: %u, avg frame time: %.3f ms over %lu frames, input latency %.3f ms\n",
+            config.framesInFlight, seconds.count()*1000.0/frames, frames, renderThread.inputLatencyMs());
+    if(config.profiling){
+        ProfilerStats stats = engine._profiler.getStats();
+        printf("cpu ms p50 %.3f p95 %.3f p99 %.3f\n", stats.cpu.p50, stats.cpu.p95, stats.cpu.p99);
+        if(engine._profiler.hasGpuTimestamps())
+            printf("gpu ms p50 %.3f p95 %.3f p99 %.3f\n", stats.gpu.p50, stats.gpu.p95, stats.gpu.p99);
+        if(profileOut){
+            size_t len = std::strlen(profileOut);
+            bool csv = len>=4 && std::strcmp(profileOut+len-4,".csv")==0;
+            bool written = csv ? engine._profiler.writeCsv(profileOut) : engine._profiler.writeJson(profileOut);
+            if(!written)
+                printf("failed to write %s\n", profileOut);
+        }
+    }
+    {
+        // of the graph compiled last, on the latest swapchain creation
+        RenderGraphStats stats = engine._graph.stats();
+        printf("render graph: %u of %u passes, %u image barriers, %u transient images, %.1f MB, %.1f MB without aliasing\n",
+            stats.passes - stats.culledPasses, stats.passes, stats.imageBarriers, stats.transientImages,
+            stats.transientBytes/1048576.0, stats.unaliasedBytes/1048576.0);
+    }
+    {
+        PipelineManager::Stats stats = engine._pipelines.getStats();
+        printf("pipelines: %u created in %.1f ms, %u deduplicated, %zu bytes of cache loaded\n",
+            stats.created, stats.compileMs, stats.deduplicated, stats.loadedCacheBytes);
+    }
+    if(!textures.empty()){
+        TextureStreamerStats stats = engine._textures.stats();
+        printf("textures: %u failed %u, resident %.1f MB of %.1f MB budget, %lu evictions\n",
+            stats.textures, stats.failed, stats.committedBytes/1048576.0, stats.budget/1048576.0,
+            (unsigned long)stats.evictions);
+    }
+    if(config.captureBuffers>0){
+        FrameCaptureStats stats = engine._capture.stats();
+        printf("capture: %lu frames read, %.1f MB, %lu captured, %lu dropped\n",
+            (unsigned long)capturedFrames, capturedBytes/1048576.0,
+            (unsigned long)stats.captured, (unsigned long)stats.dropped);
     }
     printf("finish\n");
 
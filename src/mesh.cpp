@@ -0,0 +1,202 @@
+#include "mesh.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MeshFile::MeshFile(const std::string& path){
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("can't open mesh " + path);
+    _file = file;
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size) || size.QuadPart == 0){
+        unmap();
+        throw std::runtime_error("can't map mesh " + path);
+    }
+    _size = size_t(size.QuadPart);
+    _mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(_mapping)
+        _data = static_cast<const uint8_t*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+    if(!_data){
+        unmap();
+        throw std::runtime_error("can't map mesh " + path);
+    }
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw std::runtime_error("can't open mesh " + path);
+    struct stat info;
+    void* data = MAP_FAILED;
+    if(fstat(fd, &info) == 0 && info.st_size > 0){
+        _size = size_t(info.st_size);
+        data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    // the mapping keeps its own reference to the file
+    close(fd);
+    if(data == MAP_FAILED)
+        throw std::runtime_error("can't map mesh " + path);
+    _data = static_cast<const uint8_t*>(data);
+    // the streams are read front to back exactly once, start reading ahead now
+    madvise(data, _size, MADV_SEQUENTIAL);
+    madvise(data, _size, MADV_WILLNEED);
+#endif
+
+    auto fits = [&](uint64_t offset, uint64_t size){
+        return offset <= _size && size <= _size - offset;
+    };
+    bool valid = _size >= sizeof(MeshFileHeader);
+    if(valid){
+        const MeshFileHeader& h = header();
+        valid = h.magic == MeshFileMagic && h.version == MeshFileVersion &&
+            h.attributeCount <= MeshFileMaxAttributes &&
+            (h.indexType == VK_INDEX_TYPE_UINT16 || h.indexType == VK_INDEX_TYPE_UINT32) &&
+            fits(sizeof(MeshFileHeader), uint64_t(h.subMeshCount) * sizeof(MeshFileSubMesh)) &&
+            fits(h.vertexOffset, h.vertexSize) &&
+            fits(h.indexOffset, h.indexSize) &&
+            h.vertexOffset % MeshFileAlignment == 0 &&
+            h.indexOffset % MeshFileAlignment == 0;
+    }
+    if(valid){
+        // attributes must stay inside a vertex
+        const MeshFileHeader& h = header();
+        for(uint32_t i=0;i<h.attributeCount && valid;++i){
+            uint32_t size = meshAttributeSize(h.attributes[i].format);
+            valid = size != 0 && uint64_t(h.attributes[i].offset) + size <= h.vertexStride;
+        }
+    }
+    if(valid){
+        // Sub-meshes must stay inside the streams and their indices inside the
+        // sub-mesh's vertices, whatever the GPU reads comes from them. Reading
+        // the indices here also pages them in for the upload
+        const MeshFileHeader& h = header();
+        uint64_t indexCount = h.indexSize / meshIndexSize(h.indexType);
+        uint64_t vertexCount = h.vertexStride ? h.vertexSize / h.vertexStride : 0;
+        for(uint32_t i=0;i<h.subMeshCount && valid;++i){
+            const MeshFileSubMesh& sub = subMeshes()[i];
+            valid = uint64_t(sub.firstIndex) + sub.indexCount <= indexCount &&
+                sub.vertexOffset >= 0 &&
+                uint64_t(sub.vertexOffset) + sub.vertexCount <= vertexCount;
+            if(valid && h.indexType == VK_INDEX_TYPE_UINT16){
+                const uint16_t* indices = static_cast<const uint16_t*>(indexData()) + sub.firstIndex;
+                valid = std::all_of(indices, indices + sub.indexCount, [&](uint16_t index){ return index < sub.vertexCount; });
+            }else if(valid){
+                const uint32_t* indices = static_cast<const uint32_t*>(indexData()) + sub.firstIndex;
+                valid = std::all_of(indices, indices + sub.indexCount, [&](uint32_t index){ return index < sub.vertexCount; });
+            }
+        }
+    }
+    if(!valid){
+        unmap();
+        throw std::runtime_error("not a valid mesh file " + path);
+    }
+}
+
+MeshFile::~MeshFile(){
+    unmap();
+}
+
+MeshFile::MeshFile(MeshFile&& other) noexcept {
+    *this = std::move(other);
+}
+
+MeshFile& MeshFile::operator=(MeshFile&& other) noexcept {
+    if(this != &other){
+        unmap();
+        std::swap(_data, other._data);
+        std::swap(_size, other._size);
+#ifdef _WIN32
+        std::swap(_file, other._file);
+        std::swap(_mapping, other._mapping);
+#endif
+    }
+    return *this;
+}
+
+void MeshFile::unmap(){
+#ifdef _WIN32
+    if(_data)
+        UnmapViewOfFile(_data);
+    if(_mapping)
+        CloseHandle(_mapping);
+    if(_file)
+        CloseHandle(_file);
+    _file = nullptr;
+    _mapping = nullptr;
+#else
+    if(_data)
+        munmap(const_cast<uint8_t*>(_data), _size);
+#endif
+    _data = nullptr;
+    _size = 0;
+}
+
+void MeshFile::matchVertexInput(ShaderProgram& program) const {
+    const MeshFileHeader& h = header();
+    for(auto& attribute : program.attributes){
+        // per instance data doesn't come from the mesh
+        if(attribute.binding != 0)
+            continue;
+        const MeshFileAttribute* match = std::find_if(h.attributes, h.attributes + h.attributeCount, [&](const MeshFileAttribute& a){
+            return a.location == attribute.location;
+        });
+        if(match == h.attributes + h.attributeCount)
+            throw std::runtime_error("mesh has no vertex attribute " + std::to_string(attribute.location));
+        if(vk::Format(match->format) != attribute.format)
+            throw std::runtime_error("mesh stores vertex attribute " + std::to_string(attribute.location) + " in another format");
+        attribute.offset = match->offset;
+    }
+    program.vertexStride = h.vertexStride;
+}
+
+UploadTicket uploadMesh(const MeshFile& file, GpuAllocator& allocator, UploadManager& uploads, GpuMesh& mesh){
+    const MeshFileHeader& h = file.header();
+    mesh.indexType = file.indexType();
+    mesh.vertices = allocator.createBuffer(
+        MemoryClass::StaticGeometry,
+        std::max<vk::DeviceSize>(h.vertexSize, 1),
+        vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst
+    );
+    mesh.indices = allocator.createBuffer(
+        MemoryClass::StaticGeometry,
+        std::max<vk::DeviceSize>(h.indexSize, 1),
+        vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst
+    );
+
+    // half the ring per chunk, the next chunk is staged while the previous copies
+    vk::DeviceSize chunkSize = std::max<vk::DeviceSize>(uploads.stagingSize() / 2, 4) & ~vk::DeviceSize(3);
+    UploadTicket ticket = 0;
+    auto upload = [&](const AllocatedBuffer& dst, const void* data, vk::DeviceSize size, vk::AccessFlags access){
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for(vk::DeviceSize offset=0;offset<size;offset+=chunkSize){
+            ticket = uploads.uploadBuffer(
+                dst,
+                offset,
+                bytes + offset,
+                std::min(chunkSize, size - offset),
+                vk::PipelineStageFlagBits::eVertexInput,
+                access
+            );
+        }
+    };
+    upload(mesh.vertices, file.vertexData(), h.vertexSize, vk::AccessFlagBits::eVertexAttributeRead);
+    upload(mesh.indices, file.indexData(), h.indexSize, vk::AccessFlagBits::eIndexRead);
+    return ticket;
+}
+
+void destroyMesh(GpuAllocator& allocator, GpuMesh& mesh){
+    allocator.destroyBuffer(mesh.vertices);
+    allocator.destroyBuffer(mesh.indices);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.hpp"
+#include "mesh_format.hpp"
+#include "shader_program.hpp"
+#include "upload.hpp"
+
+// Read only memory mapping of a .mesh file. Opening validates the header,
+// the attribute table, the sub-mesh table and every index against its
+// sub-mesh's vertices. The accessors point straight into the mapping, which
+// stays alive as long as the MeshFile
+class MeshFile {
+public:
+    MeshFile() = default;
+
+    // throws when the file can't be mapped or is not a valid mesh file
+    explicit MeshFile(const std::string& path);
+
+    ~MeshFile();
+
+    MeshFile(MeshFile&& other) noexcept;
+
+    MeshFile& operator=(MeshFile&& other) noexcept;
+
+    MeshFile(const MeshFile&) = delete;
+
+    MeshFile& operator=(const MeshFile&) = delete;
+
+    const MeshFileHeader& header() const {
+        return *reinterpret_cast<const MeshFileHeader*>(_data);
+    }
+
+    const MeshFileSubMesh* subMeshes() const {
+        return reinterpret_cast<const MeshFileSubMesh*>(_data + sizeof(MeshFileHeader));
+    }
+
+    uint32_t subMeshCount() const {
+        return header().subMeshCount;
+    }
+
+    const void* vertexData() const {
+        return _data + header().vertexOffset;
+    }
+
+    const void* indexData() const {
+        return _data + header().indexOffset;
+    }
+
+    vk::IndexType indexType() const {
+        return vk::IndexType(header().indexType);
+    }
+
+    // Points the program's per vertex attributes at the file's interleaved layout.
+    // Throws when the file lacks a location the program reads or stores it
+    // in another format
+    void matchVertexInput(ShaderProgram& program) const;
+
+private:
+    void unmap();
+
+    const uint8_t* _data{nullptr};
+    size_t _size{0};
+#ifdef _WIN32
+    void* _file{nullptr};
+    void* _mapping{nullptr};
+#endif
+};
+
+// device local buffers holding the streams of a mesh file
+struct GpuMesh {
+    AllocatedBuffer vertices;
+    AllocatedBuffer indices;
+    vk::IndexType indexType{vk::IndexType::eUint32};
+};
+
+// Copies the streams from the mapping into the staging ring without an
+// intermediate copy. Large streams go through in chunks, so a mesh may be
+// bigger than the ring. Returns the ticket of the last copy
+UploadTicket uploadMesh(const MeshFile& file, GpuAllocator& allocator, UploadManager& uploads, GpuMesh& mesh);
+
+void destroyMesh(GpuAllocator& allocator, GpuMesh& mesh);
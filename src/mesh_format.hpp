@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+#include <vulkan/vulkan_core.h>
+
+// On disk layout of the .mesh files written by tools/mesh_convert and read
+// in place from a memory mapping by MeshFile:
+//
+//   MeshFileHeader
+//   MeshFileSubMesh[subMeshCount]
+//   vertex stream, interleaved as described by the header's attributes
+//   index stream
+//
+// The streams start at multiples of MeshFileAlignment and are byte for byte
+// what the vertex and index buffers hold. Little endian only
+
+inline constexpr uint32_t MeshFileMagic = 0x4853454d; // "MESH"
+inline constexpr uint32_t MeshFileVersion = 1;
+inline constexpr uint32_t MeshFileAlignment = 256;
+inline constexpr uint32_t MeshFileMaxAttributes = 8;
+
+struct MeshFileAttribute {
+    uint32_t location;
+    // VkFormat
+    uint32_t format;
+    // from the start of a vertex
+    uint32_t offset;
+};
+
+struct MeshFileBounds {
+    float min[3];
+    float max[3];
+};
+
+struct MeshFileSubMesh {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    // added to every index, indices are local to the sub-mesh
+    int32_t vertexOffset;
+    uint32_t vertexCount;
+    MeshFileBounds bounds;
+    float sphereCenter[3];
+    float sphereRadius;
+};
+
+struct MeshFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertexStride;
+    uint32_t attributeCount;
+    MeshFileAttribute attributes[MeshFileMaxAttributes];
+    // VkIndexType, 16 or 32 bit
+    uint32_t indexType;
+    uint32_t subMeshCount;
+    // byte ranges in the file
+    uint64_t vertexOffset;
+    uint64_t vertexSize;
+    uint64_t indexOffset;
+    uint64_t indexSize;
+    MeshFileBounds bounds;
+};
+
+static_assert(std::is_trivially_copyable<MeshFileHeader>::value && sizeof(MeshFileHeader) == 176);
+static_assert(std::is_trivially_copyable<MeshFileSubMesh>::value && sizeof(MeshFileSubMesh) == 56);
+
+inline uint32_t meshIndexSize(uint32_t indexType){
+    return indexType == VK_INDEX_TYPE_UINT16 ? 2 : 4;
+}
+
+// bytes of a vertex attribute, 0 for formats meshes can't store. Shader inputs
+// are matched as 32 bit scalars and vectors
+inline uint32_t meshAttributeSize(uint32_t format){
+    switch(format){
+        case VK_FORMAT_R32_SFLOAT: case VK_FORMAT_R32_SINT: case VK_FORMAT_R32_UINT:
+            return 4;
+        case VK_FORMAT_R32G32_SFLOAT: case VK_FORMAT_R32G32_SINT: case VK_FORMAT_R32G32_UINT:
+            return 8;
+        case VK_FORMAT_R32G32B32_SFLOAT: case VK_FORMAT_R32G32B32_SINT: case VK_FORMAT_R32G32B32_UINT:
+            return 12;
+        case VK_FORMAT_R32G32B32A32_SFLOAT: case VK_FORMAT_R32G32B32A32_SINT: case VK_FORMAT_R32G32B32A32_UINT:
+            return 16;
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,427 @@
+#include "pipelines.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <vulkan/vulkan_hash.hpp>
+
+template<typename T>
+static void hashCombine(size_t& seed, const T& value){
+    seed ^= std::hash<T>{}(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+static void hashStage(size_t& seed, const ShaderStageDesc& stage){
+    hashCombine(seed, uint32_t(stage.stage));
+    if(stage.codeHash)
+        hashCombine(seed, stage.codeHash);
+    else
+        hashCombine(seed, stage.module);
+    hashCombine(seed, stage.entry);
+}
+
+bool GraphicsPipelineDesc::operator==(const GraphicsPipelineDesc& other) const {
+    return stages == other.stages &&
+        bindings == other.bindings &&
+        attributes == other.attributes &&
+        topology == other.topology &&
+        polygonMode == other.polygonMode &&
+        cullMode == other.cullMode &&
+        frontFace == other.frontFace &&
+        depthTest == other.depthTest &&
+        depthWrite == other.depthWrite &&
+        depthCompare == other.depthCompare &&
+        blend == other.blend &&
+        colorAttachmentCount == other.colorAttachmentCount &&
+        samples == other.samples &&
+        layoutKey == other.layoutKey &&
+        (layoutKey != 0 || layout == other.layout) &&
+        renderPassKey == other.renderPassKey &&
+        (renderPassKey != 0 || renderPass == other.renderPass) &&
+        subpass == other.subpass;
+}
+
+size_t GraphicsPipelineDescHash::operator()(const GraphicsPipelineDesc& desc) const {
+    size_t seed = 0;
+    for(const auto& stage : desc.stages)
+        hashStage(seed, stage);
+    for(const auto& binding : desc.bindings){
+        hashCombine(seed, binding.binding);
+        hashCombine(seed, binding.stride);
+        hashCombine(seed, uint32_t(binding.inputRate));
+    }
+    for(const auto& attribute : desc.attributes){
+        hashCombine(seed, attribute.location);
+        hashCombine(seed, attribute.binding);
+        hashCombine(seed, uint32_t(attribute.format));
+        hashCombine(seed, attribute.offset);
+    }
+    hashCombine(seed, uint32_t(desc.topology));
+    hashCombine(seed, uint32_t(desc.polygonMode));
+    hashCombine(seed, uint32_t(VkCullModeFlags(desc.cullMode)));
+    hashCombine(seed, uint32_t(desc.frontFace));
+    hashCombine(seed, desc.depthTest);
+    hashCombine(seed, desc.depthWrite);
+    hashCombine(seed, uint32_t(desc.depthCompare));
+    hashCombine(seed, desc.blend);
+    hashCombine(seed, desc.colorAttachmentCount);
+    hashCombine(seed, uint32_t(desc.samples));
+    if(desc.layoutKey)
+        hashCombine(seed, desc.layoutKey);
+    else
+        hashCombine(seed, desc.layout);
+    if(desc.renderPassKey)
+        hashCombine(seed, desc.renderPassKey);
+    else
+        hashCombine(seed, desc.renderPass);
+    hashCombine(seed, desc.subpass);
+    return seed;
+}
+
+size_t ComputePipelineDescHash::operator()(const ComputePipelineDesc& desc) const {
+    size_t seed = 0;
+    hashStage(seed, desc.stage);
+    if(desc.layoutKey)
+        hashCombine(seed, desc.layoutKey);
+    else
+        hashCombine(seed, desc.layout);
+    return seed;
+}
+
+PipelineBuilder& PipelineBuilder::shader(vk::ShaderStageFlagBits stage, vk::ShaderModule module, const char* entry, uint64_t codeHash){
+    _desc.stages.push_back({stage, module, entry, codeHash});
+    return *this;
+}
+
+PipelineBuilder& PipelineBuilder::vertexBinding(uint32_t binding, uint32_t stride, vk::VertexInputRate rate){
+    _desc.bindings.push_back({binding, stride, rate});
+    return *this;
+}
+
+PipelineBuilder& PipelineBuilder::vertexAttribute(uint32_t location, uint32_t binding, vk::Format format, uint32_t offset){
+    _desc.attributes.push_back({location, binding, format, offset});
+    return *this;
+}
+
+PipelineBuilder& PipelineBuilder::topology(vk::PrimitiveTopology topology){
+    _desc.topology = topology;
+    return *this;
+}
+
+PipelineBuilder& PipelineBuilder::polygonMode(vk::PolygonMode mode){
+    _desc.polygonMode = mode;
+    return *this;
+}
+
+PipelineBuilder& PipelineBuilder::cull(vk::CullModeFlags mode, vk::FrontFace frontFace){
+    _desc.cullMode = mode;
+    _desc.frontFace = frontFace;
+    return *this;
+}
+
+PipelineBuilder& PipelineBuilder::depth(bool test, bool write, vk::CompareOp compare){
+    _desc.depthTest = test;
+    _desc.depthWrite = write;
+    _desc.depthCompare = compare;
+    return *this;
+}
+
+PipelineBuilder& PipelineBuilder::blend(bool enable){
+    _desc.blend = enable;
+    return *this;
+}
+
+PipelineBuilder& PipelineBuilder::colorAttachments(uint32_t count){
+    _desc.colorAttachmentCount = count;
+    return *this;
+}
+
+PipelineBuilder& PipelineBuilder::samples(vk::SampleCountFlagBits samples){
+    _desc.samples = samples;
+    return *this;
+}
+
+PipelineBuilder& PipelineBuilder::layout(vk::PipelineLayout layout, uint64_t key){
+    _desc.layout = layout;
+    _desc.layoutKey = key;
+    return *this;
+}
+
+PipelineBuilder& PipelineBuilder::renderPass(vk::RenderPass renderPass, uint32_t subpass, uint64_t key){
+    _desc.renderPass = renderPass;
+    _desc.renderPassKey = key;
+    _desc.subpass = subpass;
+    return *this;
+}
+
+void PipelineManager::init(vk::Device device, vk::PhysicalDevice physicalDevice, std::string cachePath){
+    _device = device;
+    _deviceProperties = physicalDevice.getProperties();
+    _cachePath = std::move(cachePath);
+
+    std::vector<uint8_t> data = loadCacheData();
+    vk::PipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.initialDataSize = data.size();
+    cacheInfo.pInitialData = data.data();
+    _cache = _device.createPipelineCache(cacheInfo);
+    _stats.loadedCacheBytes = data.size();
+}
+
+void PipelineManager::destroy(){
+    // background compiles hold no lock while compiling, wait for them first
+    std::vector<std::future<void>> compiles;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        compiles = std::move(_backgroundCompiles);
+    }
+    for(auto& compile : compiles)
+        compile.wait();
+
+    saveCache();
+
+    auto destroyAll = [&](auto& pipelines){
+        // failed compiles were erased, every future left holds a pipeline
+        for(auto& [desc, future] : pipelines)
+            _device.destroyPipeline(future.get());
+        pipelines.clear();
+    };
+    destroyAll(_graphicsPipelines);
+    destroyAll(_computePipelines);
+    _device.destroyPipelineCache(_cache);
+    _cache = nullptr;
+}
+
+std::vector<uint8_t> PipelineManager::loadCacheData(){
+    if(_cachePath.empty())
+        return {};
+    FILE* file = std::fopen(_cachePath.c_str(), "rb");
+    if(!file)
+        return {};
+    std::vector<uint8_t> data;
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    if(size > 0){
+        data.resize(size);
+        if(std::fread(data.data(), 1, data.size(), file) != data.size())
+            data.clear();
+    }
+    std::fclose(file);
+
+    // Header layout is VkPipelineCacheHeaderVersionOne. Drivers are supposed
+    // to reject foreign data themselves, some crash instead
+    constexpr size_t headerSize = 16 + VK_UUID_SIZE;
+    if(data.size() < headerSize)
+        return {};
+    uint32_t header[4];
+    std::memcpy(header, data.data(), sizeof(header));
+    bool valid = header[0] >= headerSize && header[0] <= data.size() &&
+        header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+        header[2] == _deviceProperties.vendorID &&
+        header[3] == _deviceProperties.deviceID &&
+        std::memcmp(data.data() + 16, _deviceProperties.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0;
+    if(!valid){
+        fprintf(stderr, "pipeline cache: %s belongs to another device or driver, ignoring it\n", _cachePath.c_str());
+        return {};
+    }
+    return data;
+}
+
+bool PipelineManager::saveCache(){
+    if(_cachePath.empty() || !_cache)
+        return false;
+    std::vector<uint8_t> data = _device.getPipelineCacheData(_cache);
+
+    // write next to the old file and swap, a crash mid write can't leave a truncated cache
+    std::string tmpPath = _cachePath + ".tmp";
+    FILE* file = std::fopen(tmpPath.c_str(), "wb");
+    if(!file)
+        return false;
+    bool written = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+    written = std::fclose(file) == 0 && written;
+    std::error_code error;
+    if(written)
+        std::filesystem::rename(tmpPath, _cachePath, error);
+    if(!written || error){
+        std::filesystem::remove(tmpPath, error);
+        fprintf(stderr, "pipeline cache: failed to write %s\n", _cachePath.c_str());
+        return false;
+    }
+    return true;
+}
+
+PipelineManager::Stats PipelineManager::getStats(){
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+template<typename Desc, typename Hash>
+std::shared_future<vk::Pipeline> PipelineManager::request(
+    std::unordered_map<Desc, std::shared_future<vk::Pipeline>, Hash>& pipelines,
+    const Desc& desc,
+    CompileMode mode
+){
+    std::promise<vk::Pipeline> promise;
+    std::shared_future<vk::Pipeline> future;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = pipelines.find(desc);
+        if(it != pipelines.end()){
+            ++_stats.deduplicated;
+            return it->second;
+        }
+        // published before compiling so concurrent requests wait on this compile
+        future = promise.get_future().share();
+        pipelines.emplace(desc, future);
+
+        if(mode == CompileMode::Async){
+            // drop the handles of finished compiles
+            auto finished = [](std::future<void>& f){
+                return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+            };
+            _backgroundCompiles.erase(
+                std::remove_if(_backgroundCompiles.begin(), _backgroundCompiles.end(), finished),
+                _backgroundCompiles.end()
+            );
+            _backgroundCompiles.push_back(std::async(std::launch::async, [this, &pipelines, desc, promise = std::move(promise)]() mutable {
+                try{
+                    promise.set_value(compile(desc));
+                }
+                catch(...){
+                    forget(pipelines, desc);
+                    promise.set_exception(std::current_exception());
+                }
+            }));
+            return future;
+        }
+    }
+
+    try{
+        promise.set_value(compile(desc));
+    }
+    catch(...){
+        forget(pipelines, desc);
+        promise.set_exception(std::current_exception());
+    }
+    return future;
+}
+
+template<typename Desc, typename Hash>
+void PipelineManager::forget(std::unordered_map<Desc, std::shared_future<vk::Pipeline>, Hash>& pipelines, const Desc& desc){
+    // Requests already waiting on the compile get its exception, later ones
+    // compile again. Only this compile publishes desc until it is erased
+    std::lock_guard<std::mutex> lock(_mutex);
+    pipelines.erase(desc);
+}
+
+vk::Pipeline PipelineManager::getGraphicsPipeline(const GraphicsPipelineDesc& desc){
+    return request(_graphicsPipelines, desc, CompileMode::Sync).get();
+}
+
+vk::Pipeline PipelineManager::getComputePipeline(const ComputePipelineDesc& desc){
+    return request(_computePipelines, desc, CompileMode::Sync).get();
+}
+
+std::shared_future<vk::Pipeline> PipelineManager::compileGraphicsPipelineAsync(const GraphicsPipelineDesc& desc){
+    return request(_graphicsPipelines, desc, CompileMode::Async);
+}
+
+std::shared_future<vk::Pipeline> PipelineManager::compileComputePipelineAsync(const ComputePipelineDesc& desc){
+    return request(_computePipelines, desc, CompileMode::Async);
+}
+
+vk::Pipeline PipelineManager::compile(const GraphicsPipelineDesc& desc){
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<vk::PipelineShaderStageCreateInfo> stages;
+    stages.reserve(desc.stages.size());
+    for(const auto& stage : desc.stages)
+        stages.push_back(vk::PipelineShaderStageCreateInfo({}, stage.stage, stage.module, stage.entry.c_str()));
+
+    vk::PipelineVertexInputStateCreateInfo vertexInput{};
+    vertexInput.setVertexBindingDescriptions(desc.bindings);
+    vertexInput.setVertexAttributeDescriptions(desc.attributes);
+
+    vk::PipelineInputAssemblyStateCreateInfo inputAssembly({}, desc.topology, false);
+
+    // viewport and scissor are dynamic
+    vk::PipelineViewportStateCreateInfo viewport{};
+    viewport.viewportCount = 1;
+    viewport.scissorCount = 1;
+
+    vk::PipelineRasterizationStateCreateInfo rasterization{};
+    rasterization.polygonMode = desc.polygonMode;
+    rasterization.cullMode = desc.cullMode;
+    rasterization.frontFace = desc.frontFace;
+    rasterization.lineWidth = 1.0f;
+
+    vk::PipelineMultisampleStateCreateInfo multisample{};
+    multisample.rasterizationSamples = desc.samples;
+
+    vk::PipelineDepthStencilStateCreateInfo depthStencil{};
+    depthStencil.depthTestEnable = desc.depthTest;
+    depthStencil.depthWriteEnable = desc.depthWrite;
+    depthStencil.depthCompareOp = desc.depthCompare;
+
+    vk::PipelineColorBlendAttachmentState blendAttachment{};
+    blendAttachment.colorWriteMask =
+        vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+        vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+    if(desc.blend){
+        blendAttachment.blendEnable = true;
+        blendAttachment.srcColorBlendFactor = vk::BlendFactor::eOne;
+        blendAttachment.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+        blendAttachment.colorBlendOp = vk::BlendOp::eAdd;
+        blendAttachment.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+        blendAttachment.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+        blendAttachment.alphaBlendOp = vk::BlendOp::eAdd;
+    }
+    std::vector<vk::PipelineColorBlendAttachmentState> blendAttachments(desc.colorAttachmentCount, blendAttachment);
+    vk::PipelineColorBlendStateCreateInfo colorBlend{};
+    colorBlend.setAttachments(blendAttachments);
+
+    std::array<vk::DynamicState, 2> dynamicStates = {vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+    vk::PipelineDynamicStateCreateInfo dynamicState{};
+    dynamicState.setDynamicStates(dynamicStates);
+
+    vk::GraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.setStages(stages);
+    pipelineInfo.pVertexInputState = &vertexInput;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewport;
+    pipelineInfo.pRasterizationState = &rasterization;
+    pipelineInfo.pMultisampleState = &multisample;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlend;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = desc.layout;
+    pipelineInfo.renderPass = desc.renderPass;
+    pipelineInfo.subpass = desc.subpass;
+
+    // the pipeline cache is internally synchronized
+    vk::Pipeline pipeline = _device.createGraphicsPipeline(_cache, pipelineInfo).value;
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::lock_guard<std::mutex> lock(_mutex);
+    ++_stats.created;
+    _stats.compileMs += elapsed.count();
+    return pipeline;
+}
+
+vk::Pipeline PipelineManager::compile(const ComputePipelineDesc& desc){
+    auto start = std::chrono::steady_clock::now();
+
+    vk::ComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.stage = vk::PipelineShaderStageCreateInfo({}, desc.stage.stage, desc.stage.module, desc.stage.entry.c_str());
+    pipelineInfo.layout = desc.layout;
+    vk::Pipeline pipeline = _device.createComputePipeline(_cache, pipelineInfo).value;
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::lock_guard<std::mutex> lock(_mutex);
+    ++_stats.created;
+    _stats.compileMs += elapsed.count();
+    return pipeline;
+}
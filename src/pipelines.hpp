@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+// FNV-1a, chain calls through seed. Content keys of pipeline descriptions
+// are built with it
+inline constexpr uint64_t ContentHashSeed = 0xcbf29ce484222325ull;
+
+inline uint64_t contentHash(const void* data, size_t size, uint64_t seed = ContentHashSeed){
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for(size_t i=0;i<size;++i)
+        seed = (seed ^ bytes[i]) * 0x100000001b3ull;
+    return seed;
+}
+
+// Pipelines are deduplicated by what their objects contain, not by handle.
+// Modules, layouts and render passes may be destroyed once the pipeline
+// exists and a later object can reuse the handle value. A key of 0 falls
+// back to the handle, which must then stay alive as long as the manager
+struct ShaderStageDesc {
+    vk::ShaderStageFlagBits stage;
+    vk::ShaderModule module;
+    std::string entry{"main"};
+    // contentHash of the SPIR-V
+    uint64_t codeHash{0};
+
+    bool operator==(const ShaderStageDesc& other) const {
+        return stage == other.stage && codeHash == other.codeHash &&
+            (codeHash != 0 || module == other.module) && entry == other.entry;
+    }
+};
+
+// Full fixed function state of a graphics pipeline. Viewport and scissor are
+// always dynamic so pipelines survive swapchain resizes
+struct GraphicsPipelineDesc {
+    std::vector<ShaderStageDesc> stages;
+    std::vector<vk::VertexInputBindingDescription> bindings;
+    std::vector<vk::VertexInputAttributeDescription> attributes;
+    vk::PrimitiveTopology topology{vk::PrimitiveTopology::eTriangleList};
+    vk::PolygonMode polygonMode{vk::PolygonMode::eFill};
+    vk::CullModeFlags cullMode{vk::CullModeFlagBits::eNone};
+    vk::FrontFace frontFace{vk::FrontFace::eCounterClockwise};
+    bool depthTest{false};
+    bool depthWrite{false};
+    vk::CompareOp depthCompare{vk::CompareOp::eLessOrEqual};
+    // premultiplied alpha blending on every color attachment
+    bool blend{false};
+    uint32_t colorAttachmentCount{1};
+    vk::SampleCountFlagBits samples{vk::SampleCountFlagBits::e1};
+    vk::PipelineLayout layout;
+    // contentHash of the set layouts and push constant ranges
+    uint64_t layoutKey{0};
+    vk::RenderPass renderPass;
+    // contentHash of what makes render passes compatible, the attachment
+    // formats and sample counts
+    uint64_t renderPassKey{0};
+    uint32_t subpass{0};
+
+    bool operator==(const GraphicsPipelineDesc& other) const;
+};
+
+struct ComputePipelineDesc {
+    ShaderStageDesc stage{vk::ShaderStageFlagBits::eCompute};
+    vk::PipelineLayout layout;
+    uint64_t layoutKey{0};
+
+    bool operator==(const ComputePipelineDesc& other) const {
+        return stage == other.stage && layoutKey == other.layoutKey &&
+            (layoutKey != 0 || layout == other.layout);
+    }
+};
+
+struct GraphicsPipelineDescHash {
+    size_t operator()(const GraphicsPipelineDesc& desc) const;
+};
+
+struct ComputePipelineDescHash {
+    size_t operator()(const ComputePipelineDesc& desc) const;
+};
+
+// Fluent helper filling a GraphicsPipelineDesc
+class PipelineBuilder {
+public:
+    PipelineBuilder& shader(vk::ShaderStageFlagBits stage, vk::ShaderModule module, const char* entry = "main", uint64_t codeHash = 0);
+    PipelineBuilder& vertexBinding(uint32_t binding, uint32_t stride, vk::VertexInputRate rate = vk::VertexInputRate::eVertex);
+    PipelineBuilder& vertexAttribute(uint32_t location, uint32_t binding, vk::Format format, uint32_t offset);
+    PipelineBuilder& topology(vk::PrimitiveTopology topology);
+    PipelineBuilder& polygonMode(vk::PolygonMode mode);
+    PipelineBuilder& cull(vk::CullModeFlags mode, vk::FrontFace frontFace = vk::FrontFace::eCounterClockwise);
+    PipelineBuilder& depth(bool test, bool write, vk::CompareOp compare = vk::CompareOp::eLessOrEqual);
+    PipelineBuilder& blend(bool enable);
+    PipelineBuilder& colorAttachments(uint32_t count);
+    PipelineBuilder& samples(vk::SampleCountFlagBits samples);
+    PipelineBuilder& layout(vk::PipelineLayout layout, uint64_t key = 0);
+    PipelineBuilder& renderPass(vk::RenderPass renderPass, uint32_t subpass = 0, uint64_t key = 0);
+
+    const GraphicsPipelineDesc& desc() const {
+        return _desc;
+    }
+
+private:
+    GraphicsPipelineDesc _desc;
+};
+
+// Creates pipelines through one vk::PipelineCache that is loaded from and
+// saved to disk, so a warm start skips most of the driver's shader compilation.
+// Identical descriptions return the same pipeline, which stays owned by the
+// manager until destroy(). A failed compile is not kept, requesting the
+// description again retries it. All methods are thread safe
+class PipelineManager {
+public:
+    struct Stats {
+        uint32_t created{0};
+        // requests answered with an existing pipeline
+        uint32_t deduplicated{0};
+        double compileMs{0};
+        // read from the cache file by init(), 0 on a cold start
+        size_t loadedCacheBytes{0};
+    };
+
+    // A cache file written by another driver or device is ignored
+    void init(vk::Device device, vk::PhysicalDevice physicalDevice, std::string cachePath);
+
+    // waits for background compiles, writes the cache file and destroys every pipeline
+    void destroy();
+
+    vk::Pipeline getGraphicsPipeline(const GraphicsPipelineDesc& desc);
+
+    vk::Pipeline getComputePipeline(const ComputePipelineDesc& desc);
+
+    // Compiles on a background thread, requesting the same description
+    // again, synchronously or not, waits for the same compile
+    std::shared_future<vk::Pipeline> compileGraphicsPipelineAsync(const GraphicsPipelineDesc& desc);
+
+    std::shared_future<vk::Pipeline> compileComputePipelineAsync(const ComputePipelineDesc& desc);
+
+    // writes the current cache contents, also done by destroy()
+    bool saveCache();
+
+    Stats getStats();
+
+private:
+    enum class CompileMode {
+        Sync,
+        Async,
+    };
+
+    template<typename Desc, typename Hash>
+    std::shared_future<vk::Pipeline> request(
+        std::unordered_map<Desc, std::shared_future<vk::Pipeline>, Hash>& pipelines,
+        const Desc& desc,
+        CompileMode mode
+    );
+
+    // drops the entry of a failed compile
+    template<typename Desc, typename Hash>
+    void forget(std::unordered_map<Desc, std::shared_future<vk::Pipeline>, Hash>& pipelines, const Desc& desc);
+
+    vk::Pipeline compile(const GraphicsPipelineDesc& desc);
+
+    vk::Pipeline compile(const ComputePipelineDesc& desc);
+
+    std::vector<uint8_t> loadCacheData();
+
+    std::mutex _mutex;
+    vk::Device _device;
+    vk::PhysicalDeviceProperties _deviceProperties;
+    vk::PipelineCache _cache;
+    std::string _cachePath;
+
+    std::unordered_map<GraphicsPipelineDesc, std::shared_future<vk::Pipeline>, GraphicsPipelineDescHash> _graphicsPipelines;
+    std::unordered_map<ComputePipelineDesc, std::shared_future<vk::Pipeline>, ComputePipelineDescHash> _computePipelines;
+    std::vector<std::future<void>> _backgroundCompiles;
+    Stats _stats;
+};
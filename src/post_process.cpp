@@ -0,0 +1,499 @@
+#include "post_process.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <vulkan/vulkan_format_traits.hpp>
+
+#include <shaders/post_bloom_down_comp.hpp>
+#include <shaders/post_bloom_up_comp.hpp>
+#include <shaders/post_exposure_comp.hpp>
+#include <shaders/post_histogram_comp.hpp>
+#include <shaders/post_tonemap_comp.hpp>
+
+namespace {
+    constexpr uint32_t HistogramBins = 256;
+    constexpr uint32_t HistogramGroupSize = 16;
+    constexpr uint32_t GroupSize = 8;
+
+    // match the push blocks of the post_*.comp shaders
+    struct HistogramPush {
+        uint32_t extent[2];
+        float minLogLuminance;
+        float inverseLogLuminanceRange;
+        uint32_t image;
+        uint32_t imageSampler;
+        uint32_t histogram;
+    };
+
+    struct ExposurePush {
+        uint32_t pixelCount;
+        float minLogLuminance;
+        float logLuminanceRange;
+        float adaptation;
+        float keyValue;
+        uint32_t histogram;
+        uint32_t exposureBuffer;
+        uint32_t reset;
+    };
+
+    struct BloomDownPush {
+        uint32_t srcExtent[2];
+        uint32_t dstExtent[2];
+        uint32_t srcOffset;
+        uint32_t dstOffset;
+        uint32_t bloomBuffer;
+        uint32_t image;
+        uint32_t imageSampler;
+        float threshold;
+        float knee;
+    };
+
+    struct BloomUpPush {
+        uint32_t srcExtent[2];
+        uint32_t dstExtent[2];
+        uint32_t srcOffset;
+        uint32_t dstOffset;
+        uint32_t bloomBuffer;
+    };
+
+    struct TonemapPush {
+        uint32_t extent[2];
+        uint32_t bloomExtent[2];
+        uint32_t bloomOffset;
+        uint32_t bloomBuffer;
+        uint32_t image;
+        uint32_t imageSampler;
+        uint32_t exposureBuffer;
+        uint32_t outputBuffer;
+        float bloomStrength;
+        uint32_t flags;
+    };
+    static_assert(sizeof(TonemapPush) <= BindlessDescriptors::PushConstantSize);
+
+    // flags of post_tonemap.comp
+    constexpr uint32_t FlagSrgb = 1;
+    constexpr uint32_t FlagSwapRedBlue = 2;
+
+    // RGBA16F packed into two words
+    constexpr vk::DeviceSize BloomTexelSize = 8;
+
+    uint32_t groups(uint32_t size, uint32_t groupSize){
+        return (size + groupSize - 1) / groupSize;
+    }
+
+    // writes of the previous dispatch or copy visible to the next dispatch
+    void computeBarrier(vk::CommandBuffer cmd, vk::PipelineStageFlags srcStage, vk::AccessFlags srcAccess){
+        vk::MemoryBarrier barrier{srcAccess, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite};
+        cmd.pipelineBarrier(srcStage, vk::PipelineStageFlagBits::eComputeShader, {}, barrier, {}, {});
+    }
+
+    ShaderProgram createProgram(vk::Device device, const ShaderBlob& blob, BindlessDescriptors& bindless,
+        PipelineManager& pipelines, vk::Pipeline& pipeline){
+        ShaderProgram program = createShaderProgram(device, {&blob}, bindless);
+        ComputePipelineDesc pipelineDesc{};
+        pipelineDesc.stage = program.stages[0];
+        pipelineDesc.layout = program.layout;
+        pipelineDesc.layoutKey = program.layoutKey;
+        pipeline = pipelines.getComputePipeline(pipelineDesc);
+        return program;
+    }
+}
+
+void PostProcess::init(
+    vk::Device device,
+    GpuAllocator& allocator,
+    ResourceRegistry& registry,
+    BindlessDescriptors& bindless,
+    PipelineManager& pipelines,
+    vk::Queue computeQueue,
+    std::mutex& queueMutex,
+    uint32_t computeFamily,
+    uint32_t graphicsFamily,
+    uint32_t framesInFlight
+){
+    _device = device;
+    _allocator = &allocator;
+    _registry = &registry;
+    _bindless = &bindless;
+    _computeQueue = computeQueue;
+    _queueMutex = &queueMutex;
+    _families = {graphicsFamily, computeFamily};
+
+    _histogramProgram = createProgram(_device, shaders::post_histogram_comp, bindless, pipelines, _histogramPipeline);
+    _exposureProgram = createProgram(_device, shaders::post_exposure_comp, bindless, pipelines, _exposurePipeline);
+    _downProgram = createProgram(_device, shaders::post_bloom_down_comp, bindless, pipelines, _downPipeline);
+    _upProgram = createProgram(_device, shaders::post_bloom_up_comp, bindless, pipelines, _upPipeline);
+    _tonemapProgram = createProgram(_device, shaders::post_tonemap_comp, bindless, pipelines, _tonemapPipeline);
+
+    // the first bloom level is filtered by the sampler, the rest by hand
+    vk::SamplerCreateInfo samplerInfo{};
+    samplerInfo.magFilter = vk::Filter::eLinear;
+    samplerInfo.minFilter = vk::Filter::eLinear;
+    samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    _sampler = _device.createSampler(samplerInfo);
+    _samplerIndex = _bindless->registerSampler(_sampler);
+
+    _histogram = _allocator->createBuffer(
+        MemoryClass::StaticGeometry,
+        HistogramBins * sizeof(uint32_t),
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst
+    );
+    _histogramIndex = _bindless->registerBuffer(_histogram.buffer);
+    _exposure = _allocator->createBuffer(MemoryClass::StaticGeometry, 2 * sizeof(float), vk::BufferUsageFlagBits::eStorageBuffer);
+    _exposureIndex = _bindless->registerBuffer(_exposure.buffer);
+
+    vk::SemaphoreTypeCreateInfo timelineType{vk::SemaphoreType::eTimeline, 0};
+    _timeline = _device.createSemaphore(vk::SemaphoreCreateInfo{{}, &timelineType});
+
+    vk::CommandPoolCreateInfo poolInfo{
+        vk::CommandPoolCreateFlagBits::eTransient,
+        computeFamily
+    };
+    _sets.resize(framesInFlight + 1);
+    for(auto& set : _sets){
+        set.commandPool = _device.createCommandPool(poolInfo);
+        vk::CommandBufferAllocateInfo allocInfo{
+            set.commandPool,
+            vk::CommandBufferLevel::ePrimary,
+            1
+        };
+        set.commandBuffer = _device.allocateCommandBuffers(allocInfo)[0];
+        set.hdrReady = _device.createSemaphore({});
+    }
+}
+
+void PostProcess::destroy(){
+    // never initialized, post processing is off
+    if(!_device)
+        return;
+    for(auto& set : _sets){
+        _device.destroyCommandPool(set.commandPool);
+        _device.destroySemaphore(set.hdrReady);
+    }
+    // the device is idle, the registry frees them when it is destroyed
+    releaseTargets(0);
+    _sets.clear();
+    if(_histogram.buffer)
+        _allocator->destroyBuffer(_histogram);
+    if(_exposure.buffer)
+        _allocator->destroyBuffer(_exposure);
+    _histogram = {};
+    _exposure = {};
+    _device.destroySemaphore(_timeline);
+    _timeline = nullptr;
+    if(_sampler)
+        _device.destroySampler(_sampler);
+    _sampler = nullptr;
+    // the pipelines are owned by the pipeline manager
+    for(ShaderProgram* program : {&_histogramProgram, &_exposureProgram, &_downProgram, &_upProgram, &_tonemapProgram})
+        destroyShaderProgram(_device, *program);
+}
+
+vk::ImageUsageFlags PostProcess::requiredUsage() const {
+    return enabled() ? vk::ImageUsageFlagBits::eTransferDst : vk::ImageUsageFlags{};
+}
+
+void PostProcess::setTarget(vk::Format format, vk::Extent2D extent, uint64_t frameNumber){
+    if(!enabled())
+        return;
+    if(vk::blockSize(format) != 4 || vk::componentCount(format) != 4 || vk::componentBits(format, 0) != 8)
+        throw std::runtime_error("post processing needs an 8 bit RGBA or BGRA backbuffer");
+    _targetFormat = format;
+    _outputFlags = 0;
+    if(std::strcmp(vk::componentNumericFormat(format, 0), "SRGB") == 0)
+        _outputFlags |= FlagSrgb;
+    if(std::strcmp(vk::componentName(format, 0), "B") == 0)
+        _outputFlags |= FlagSwapRedBlue;
+
+    if(extent == _targetExtent && _sets[0].hdr.valid())
+        return;
+    releaseTargets(frameNumber);
+    _targetExtent = extent;
+    createTargets();
+}
+
+void PostProcess::releaseTargets(uint64_t frameNumber){
+    // Chains already submitted may still read them. The graphics submits
+    // wait on the latest chain, so the frame rule covers the bindless indices
+    RetirePoint lastUse{frameNumber, _timeline, _submittedValue};
+    for(auto& set : _sets){
+        if(set.hdrIndex != InvalidBindlessIndex)
+            _bindless->releaseImage(set.hdrIndex, frameNumber);
+        if(set.outputIndex != InvalidBindlessIndex)
+            _bindless->releaseBuffer(set.outputIndex, frameNumber);
+        _registry->release(set.hdrView, lastUse);
+        _registry->release(set.hdr, lastUse);
+        _registry->release(set.output, lastUse);
+        set.hdrIndex = InvalidBindlessIndex;
+        set.outputIndex = InvalidBindlessIndex;
+        set.hdrView = {};
+        set.hdr = {};
+        set.output = {};
+    }
+    if(_bloomIndex != InvalidBindlessIndex)
+        _bindless->releaseBuffer(_bloomIndex, frameNumber);
+    _registry->release(_bloom, lastUse);
+    _bloomIndex = InvalidBindlessIndex;
+    _bloom = {};
+    _bloomLevels.clear();
+    // the last output has the old size
+    _outputSet = ~0u;
+}
+
+void PostProcess::createTargets(){
+    // one family leaves the resources exclusive
+    std::vector<uint32_t> families = _families[0] != _families[1] ? _families : std::vector<uint32_t>{};
+
+    for(auto& set : _sets){
+        vk::ImageCreateInfo imageInfo{};
+        imageInfo.imageType = vk::ImageType::e2D;
+        imageInfo.format = HdrFormat;
+        imageInfo.extent = vk::Extent3D{_targetExtent.width, _targetExtent.height, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = vk::SampleCountFlagBits::e1;
+        imageInfo.tiling = vk::ImageTiling::eOptimal;
+        imageInfo.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled;
+        imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+        if(!families.empty()){
+            imageInfo.sharingMode = vk::SharingMode::eConcurrent;
+            imageInfo.setQueueFamilyIndices(families);
+        }
+        set.hdr = _registry->createImage(MemoryClass::RenderTarget, imageInfo);
+
+        vk::ImageViewCreateInfo viewInfo{};
+        viewInfo.image = _registry->image(set.hdr);
+        viewInfo.viewType = vk::ImageViewType::e2D;
+        viewInfo.format = HdrFormat;
+        viewInfo.subresourceRange = vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+        set.hdrView = _registry->createImageView(viewInfo);
+        set.hdrIndex = _bindless->registerImage(_registry->imageView(set.hdrView));
+
+        set.output = _registry->createBuffer(
+            MemoryClass::StaticGeometry,
+            vk::DeviceSize(_targetExtent.width) * _targetExtent.height * 4,
+            vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc,
+            families
+        );
+        set.outputIndex = _bindless->registerBuffer(_registry->buffer(set.output).buffer);
+    }
+
+    // halving down to a single texel at most
+    vk::Extent2D levelExtent = _targetExtent;
+    uint32_t texels = 0;
+    uint32_t levelCount = std::max(settings.bloomLevels, 1u);
+    for(uint32_t i=0;i<levelCount;++i){
+        if(i > 0 && levelExtent.width == 1 && levelExtent.height == 1)
+            break;
+        levelExtent = vk::Extent2D{std::max(levelExtent.width / 2, 1u), std::max(levelExtent.height / 2, 1u)};
+        _bloomLevels.push_back({levelExtent, texels});
+        texels += levelExtent.width * levelExtent.height;
+    }
+    _bloom = _registry->createBuffer(MemoryClass::StaticGeometry, texels * BloomTexelSize, vk::BufferUsageFlagBits::eStorageBuffer);
+    _bloomIndex = _bindless->registerBuffer(_registry->buffer(_bloom).buffer);
+}
+
+void PostProcess::beginFrame(uint64_t frameNumber){
+    _current = uint32_t(frameNumber % _sets.size());
+    FrameSet& set = _sets[_current];
+    if(set.value != 0){
+        vk::SemaphoreWaitInfo waitInfo{{}, _timeline, set.value};
+        vk::resultCheck(_device.waitSemaphores(waitInfo, 1000000000), "wait for post processing");
+    }
+    _device.resetCommandPool(set.commandPool);
+}
+
+RenderGraphImportDesc PostProcess::hdrImportDesc() const {
+    RenderGraphImportDesc desc{};
+    desc.format = HdrFormat;
+    desc.extent = _targetExtent;
+    // the previous contents were consumed by the chain that used the set
+    desc.initialLayout = vk::ImageLayout::eUndefined;
+    desc.finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    return desc;
+}
+
+vk::Image PostProcess::hdrImage() const {
+    return _registry->image(_sets[_current].hdr);
+}
+
+vk::ImageView PostProcess::hdrView() const {
+    return _registry->imageView(_sets[_current].hdrView);
+}
+
+void PostProcess::declareOutput(RenderGraphPassBuilder& pass, RenderGraphResource backbuffer) const {
+    pass.transferDst(backbuffer);
+}
+
+void PostProcess::recordOutput(vk::CommandBuffer cmd, vk::Image backbuffer){
+    if(_outputSet == ~0u){
+        vk::ClearColorValue black{std::array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f}};
+        vk::ImageSubresourceRange range{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+        cmd.clearColorImage(backbuffer, vk::ImageLayout::eTransferDstOptimal, black, range);
+        return;
+    }
+    vk::BufferImageCopy region{};
+    region.imageSubresource = vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, 0, 0, 1};
+    region.imageExtent = vk::Extent3D{_targetExtent.width, _targetExtent.height, 1};
+    cmd.copyBufferToImage(_registry->buffer(_sets[_outputSet].output).buffer, backbuffer, vk::ImageLayout::eTransferDstOptimal, region);
+}
+
+uint64_t PostProcess::outputWaitValue() const {
+    // The latest chain even when its output isn't copied, e.g. after a
+    // resize, so a retired frame implies that every chain before it finished
+    return _submittedValue;
+}
+
+vk::Semaphore PostProcess::hdrReady() const {
+    return _sets[_current].hdrReady;
+}
+
+void PostProcess::submit(){
+    FrameSet& set = _sets[_current];
+    auto now = std::chrono::steady_clock::now();
+    float adaptation = 1.0f;
+    if(_submittedValue != 0){
+        float dt = std::chrono::duration<float>(now - _lastSubmit).count();
+        adaptation = 1.0f - std::exp(-dt * settings.adaptationRate);
+    }
+    _lastSubmit = now;
+
+    vk::CommandBuffer cmd = set.commandBuffer;
+    cmd.begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    recordChain(cmd, set, adaptation);
+    cmd.end();
+
+    set.value = ++_submittedValue;
+    vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eComputeShader;
+    // values for binary semaphores are ignored
+    uint64_t waitValue = 0;
+    vk::TimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.setWaitSemaphoreValues(waitValue);
+    timelineInfo.setSignalSemaphoreValues(set.value);
+
+    vk::SubmitInfo submitInfo{};
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.setWaitSemaphores(set.hdrReady);
+    submitInfo.setWaitDstStageMask(waitStage);
+    submitInfo.setCommandBuffers(cmd);
+    submitInfo.setSignalSemaphores(_timeline);
+    {
+        std::lock_guard<std::mutex> queueLock(*_queueMutex);
+        _computeQueue.submit(submitInfo);
+    }
+    _outputSet = _current;
+}
+
+void PostProcess::recordChain(vk::CommandBuffer cmd, const FrameSet& set, float adaptation){
+    // The previous chain on this queue used the histogram, bloom and exposure.
+    // The histogram is cleared at the transfer stage, after the previous
+    // exposure pass read it
+    vk::MemoryBarrier previous{
+        vk::AccessFlagBits::eShaderWrite,
+        vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite
+    };
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+        {}, previous, {}, {}
+    );
+    cmd.fillBuffer(_histogram.buffer, 0, VK_WHOLE_SIZE, 0);
+    computeBarrier(cmd, vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite);
+    _bindless->bind(cmd, vk::PipelineBindPoint::eCompute);
+
+    float logRange = std::max(settings.maxLogLuminance - settings.minLogLuminance, 1e-3f);
+
+    // histogram and first bloom level both only read the HDR image
+    HistogramPush histogram{};
+    histogram.extent[0] = _targetExtent.width;
+    histogram.extent[1] = _targetExtent.height;
+    histogram.minLogLuminance = settings.minLogLuminance;
+    histogram.inverseLogLuminanceRange = 1.0f / logRange;
+    histogram.image = set.hdrIndex;
+    histogram.imageSampler = _samplerIndex;
+    histogram.histogram = _histogramIndex;
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, _histogramPipeline);
+    cmd.pushConstants(_histogramProgram.layout, _histogramProgram.pushConstants.stageFlags, 0, sizeof(histogram), &histogram);
+    cmd.dispatch(groups(_targetExtent.width, HistogramGroupSize), groups(_targetExtent.height, HistogramGroupSize), 1);
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, _downPipeline);
+    for(uint32_t i=0;i<_bloomLevels.size();++i){
+        const BloomLevel& dst = _bloomLevels[i];
+        BloomDownPush down{};
+        vk::Extent2D src = i == 0 ? _targetExtent : _bloomLevels[i-1].extent;
+        down.srcExtent[0] = src.width;
+        down.srcExtent[1] = src.height;
+        down.dstExtent[0] = dst.extent.width;
+        down.dstExtent[1] = dst.extent.height;
+        down.srcOffset = i == 0 ? 0 : _bloomLevels[i-1].offset;
+        down.dstOffset = dst.offset;
+        down.bloomBuffer = _bloomIndex;
+        down.image = i == 0 ? set.hdrIndex : InvalidBindlessIndex;
+        down.imageSampler = _samplerIndex;
+        down.threshold = settings.bloomThreshold;
+        down.knee = std::max(settings.bloomKnee, 1e-4f);
+        // the exposure barrier below covers the second level
+        if(i > 1)
+            computeBarrier(cmd, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite);
+        cmd.pushConstants(_downProgram.layout, _downProgram.pushConstants.stageFlags, 0, sizeof(down), &down);
+        cmd.dispatch(groups(dst.extent.width, GroupSize), groups(dst.extent.height, GroupSize), 1);
+        // the histogram is done by the time the second level starts
+        if(i == 0){
+            computeBarrier(cmd, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite);
+            ExposurePush exposure{};
+            exposure.pixelCount = _targetExtent.width * _targetExtent.height;
+            exposure.minLogLuminance = settings.minLogLuminance;
+            exposure.logLuminanceRange = logRange;
+            exposure.adaptation = adaptation;
+            exposure.keyValue = settings.keyValue;
+            exposure.histogram = _histogramIndex;
+            exposure.exposureBuffer = _exposureIndex;
+            exposure.reset = _submittedValue == 0;
+            cmd.bindPipeline(vk::PipelineBindPoint::eCompute, _exposurePipeline);
+            cmd.pushConstants(_exposureProgram.layout, _exposureProgram.pushConstants.stageFlags, 0, sizeof(exposure), &exposure);
+            cmd.dispatch(1, 1, 1);
+            cmd.bindPipeline(vk::PipelineBindPoint::eCompute, _downPipeline);
+        }
+    }
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, _upPipeline);
+    for(uint32_t i=uint32_t(_bloomLevels.size())-1;i>0;--i){
+        const BloomLevel& src = _bloomLevels[i];
+        const BloomLevel& dst = _bloomLevels[i-1];
+        BloomUpPush up{};
+        up.srcExtent[0] = src.extent.width;
+        up.srcExtent[1] = src.extent.height;
+        up.dstExtent[0] = dst.extent.width;
+        up.dstExtent[1] = dst.extent.height;
+        up.srcOffset = src.offset;
+        up.dstOffset = dst.offset;
+        up.bloomBuffer = _bloomIndex;
+        computeBarrier(cmd, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite);
+        cmd.pushConstants(_upProgram.layout, _upProgram.pushConstants.stageFlags, 0, sizeof(up), &up);
+        cmd.dispatch(groups(dst.extent.width, GroupSize), groups(dst.extent.height, GroupSize), 1);
+    }
+    computeBarrier(cmd, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite);
+
+    TonemapPush tonemap{};
+    tonemap.extent[0] = _targetExtent.width;
+    tonemap.extent[1] = _targetExtent.height;
+    tonemap.bloomExtent[0] = _bloomLevels[0].extent.width;
+    tonemap.bloomExtent[1] = _bloomLevels[0].extent.height;
+    tonemap.bloomOffset = _bloomLevels[0].offset;
+    tonemap.bloomBuffer = _bloomIndex;
+    tonemap.image = set.hdrIndex;
+    tonemap.imageSampler = _samplerIndex;
+    tonemap.exposureBuffer = _exposureIndex;
+    tonemap.outputBuffer = set.outputIndex;
+    tonemap.bloomStrength = settings.bloomStrength;
+    tonemap.flags = _outputFlags;
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, _tonemapPipeline);
+    cmd.pushConstants(_tonemapProgram.layout, _tonemapProgram.pushConstants.stageFlags, 0, sizeof(tonemap), &tonemap);
+    cmd.dispatch(groups(_targetExtent.width, GroupSize), groups(_targetExtent.height, GroupSize), 1);
+    // the graphics queue reads the output after the timeline wait, a
+    // semaphore signal makes all prior writes available
+}
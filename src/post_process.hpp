@@ -0,0 +1,187 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.hpp"
+#include "bindless.hpp"
+#include "pipelines.hpp"
+#include "render_graph.hpp"
+#include "resource_registry.hpp"
+#include "shader_program.hpp"
+
+struct PostProcessSettings {
+    // scene luminance bloom starts at, faded in over the knee below it
+    float bloomThreshold{1.0f};
+    float bloomKnee{0.5f};
+    float bloomStrength{0.05f};
+    // levels of the chain, the first one at half resolution
+    uint32_t bloomLevels{6};
+    // histogram range in log2 luminance
+    float minLogLuminance{-10.0f};
+    float maxLogLuminance{6.0f};
+    // per second, how fast the exposure follows the scene
+    float adaptationRate{1.5f};
+    // the average luminance is exposed to this
+    float keyValue{0.18f};
+};
+
+// Post processing on the compute queue: a luminance histogram drives auto
+// exposure, a dual filter bloom chain is downsampled and upsampled, and the
+// tonemap writes the result as display ready pixels into a buffer.
+//
+// The main pass renders into one of a small ring of HDR images. Once the
+// graphics submit signals it, the post chain of that frame is submitted to the
+// compute queue and runs while the graphics queue goes on with the next frame.
+// The output pass of that next frame copies the finished pixels into the
+// backbuffer, after waiting on the post timeline, so presentation lags the
+// main pass by one frame. Without a separate compute family the chain runs
+// on the graphics queue after the frame, with the same synchronization.
+//
+// The HDR images and output buffers are shared concurrently by the two
+// families instead of being transferred. The bloom chain, histogram and
+// exposure are only touched by compute work, which runs in submission order,
+// so there is one of each
+class PostProcess {
+public:
+    static constexpr vk::Format HdrFormat = vk::Format::eR16G16B16A16Sfloat;
+
+    PostProcessSettings settings;
+
+    void init(
+        vk::Device device,
+        GpuAllocator& allocator,
+        ResourceRegistry& registry,
+        BindlessDescriptors& bindless,
+        PipelineManager& pipelines,
+        vk::Queue computeQueue,
+        std::mutex& queueMutex,
+        uint32_t computeFamily,
+        uint32_t graphicsFamily,
+        uint32_t framesInFlight
+    );
+
+    // after the device went idle
+    void destroy();
+
+    bool enabled() const {
+        return !_sets.empty();
+    }
+
+    // usage the backbuffer needs besides being rendered to
+    vk::ImageUsageFlags requiredUsage() const;
+
+    // Backbuffer format and size, on every swapchain creation. frameNumber is
+    // the first frame using them, resources of the previous size are released
+    // as of it. Only 8 bit RGBA and BGRA formats can be written
+    void setTarget(vk::Format format, vk::Extent2D extent, uint64_t frameNumber);
+
+    // Before recording the frame, waits until the compute work that last used
+    // the frame's HDR image and output buffer finished. Rarely blocks, the ring
+    // is one longer than the frames in flight
+    void beginFrame(uint64_t frameNumber);
+
+    // this frame's render target of the main pass, import desc and image
+    RenderGraphImportDesc hdrImportDesc() const;
+
+    vk::Image hdrImage() const;
+
+    vk::ImageView hdrView() const;
+
+    // render graph access of the output pass
+    void declareOutput(RenderGraphPassBuilder& pass, RenderGraphResource backbuffer) const;
+
+    // Copies the previous frame's result into the backbuffer from inside the
+    // output pass, clears it when there is none of the current size
+    void recordOutput(vk::CommandBuffer cmd, vk::Image backbuffer);
+
+    // Timeline value the graphics submit has to wait for at the transfer
+    // stage before the output copy, 0 for none
+    uint64_t outputWaitValue() const;
+
+    vk::Semaphore timeline() const {
+        return _timeline;
+    }
+
+    // the graphics submit of this frame signals it after the main pass
+    vk::Semaphore hdrReady() const;
+
+    // Records and submits the chain of this frame, after its graphics submit
+    void submit();
+
+private:
+    // one per frame that may be between main pass and presentation
+    struct FrameSet {
+        vk::CommandPool commandPool;
+        vk::CommandBuffer commandBuffer;
+        vk::Semaphore hdrReady;
+        // timeline value of the last chain that used the set
+        uint64_t value{0};
+
+        // in the registry, they are released on every resize
+        ImageHandle hdr;
+        ImageViewHandle hdrView;
+        BindlessIndex hdrIndex{InvalidBindlessIndex};
+        BufferHandle output;
+        BindlessIndex outputIndex{InvalidBindlessIndex};
+    };
+
+    struct BloomLevel {
+        vk::Extent2D extent;
+        // in texels
+        uint32_t offset;
+    };
+
+    void createTargets();
+
+    void releaseTargets(uint64_t frameNumber);
+
+    void recordChain(vk::CommandBuffer cmd, const FrameSet& set, float adaptation);
+
+    vk::Device _device;
+    GpuAllocator* _allocator{nullptr};
+    ResourceRegistry* _registry{nullptr};
+    BindlessDescriptors* _bindless{nullptr};
+    vk::Queue _computeQueue;
+    // UploadManager::queueMutex()
+    std::mutex* _queueMutex{nullptr};
+    std::vector<uint32_t> _families;
+
+    ShaderProgram _histogramProgram;
+    ShaderProgram _exposureProgram;
+    ShaderProgram _downProgram;
+    ShaderProgram _upProgram;
+    ShaderProgram _tonemapProgram;
+    vk::Pipeline _histogramPipeline;
+    vk::Pipeline _exposurePipeline;
+    vk::Pipeline _downPipeline;
+    vk::Pipeline _upPipeline;
+    vk::Pipeline _tonemapPipeline;
+    vk::Sampler _sampler;
+    BindlessIndex _samplerIndex{InvalidBindlessIndex};
+
+    AllocatedBuffer _histogram;
+    BindlessIndex _histogramIndex{InvalidBindlessIndex};
+    AllocatedBuffer _exposure;
+    BindlessIndex _exposureIndex{InvalidBindlessIndex};
+    // in the registry, sized by the target
+    BufferHandle _bloom;
+    BindlessIndex _bloomIndex{InvalidBindlessIndex};
+    std::vector<BloomLevel> _bloomLevels;
+
+    vk::Format _targetFormat{vk::Format::eUndefined};
+    vk::Extent2D _targetExtent;
+    uint32_t _outputFlags{0};
+
+    std::vector<FrameSet> _sets;
+    uint32_t _current{0};
+    // set holding the newest finished output, ~0u when it doesn't match the target
+    uint32_t _outputSet{~0u};
+
+    vk::Semaphore _timeline;
+    uint64_t _submittedValue{0};
+    std::chrono::steady_clock::time_point _lastSubmit;
+};
@@ -0,0 +1,304 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+void Profiler::init(
+    vk::Device device,
+    vk::PhysicalDevice physicalDevice,
+    uint32_t queueFamily,
+    uint32_t framesInFlight,
+    bool enabled
+){
+    _enabled = enabled;
+    _device = device;
+    _history = std::make_unique<HistoryEntry[]>(HistorySize);
+    _slots.resize(framesInFlight);
+    if(!_enabled)
+        return;
+
+    // queues without valid timestamp bits can't be timed, CPU scopes still work
+    uint32_t validBits = physicalDevice.getQueueFamilyProperties()[queueFamily].timestampValidBits;
+    _gpuEnabled = validBits != 0;
+    if(!_gpuEnabled){
+        fprintf(stderr, "profiler: queue family %u has no timestamp support\n", queueFamily);
+        return;
+    }
+    _timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    _timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+
+    vk::QueryPoolCreateInfo poolInfo{};
+    poolInfo.queryType = vk::QueryType::eTimestamp;
+    poolInfo.queryCount = MaxQueriesPerFrame;
+    for(auto& slot : _slots)
+        slot.queryPool = _device.createQueryPool(poolInfo);
+}
+
+void Profiler::destroy(){
+    for(auto& slot : _slots){
+        if(slot.queryPool)
+            _device.destroyQueryPool(slot.queryPool);
+    }
+    _slots.clear();
+    _recordingSlot = nullptr;
+}
+
+void Profiler::beginFrame(uint64_t frameNumber){
+    if(!_enabled)
+        return;
+    // a frame abandoned before endFrame() is simply overwritten
+    _current = FrameSample{};
+    _current.frameNumber = frameNumber;
+    _recordingSlot = nullptr;
+    _frameStart = std::chrono::steady_clock::now();
+}
+
+void Profiler::collect(uint32_t slotIndex){
+    if(!_enabled)
+        return;
+    Slot& slot = _slots[slotIndex];
+    if(!slot.hasPending)
+        return;
+    slot.hasPending = false;
+
+    if(_gpuEnabled && slot.queryCount > 0){
+        auto [result, ticks] = _device.getQueryPoolResults<uint64_t>(
+            slot.queryPool,
+            0,
+            slot.queryCount,
+            slot.queryCount * sizeof(uint64_t),
+            sizeof(uint64_t),
+            vk::QueryResultFlagBits::e64
+        );
+        // the fence was waited on, eNotReady means the frame never reached the GPU
+        if(result == vk::Result::eSuccess){
+            auto toMs = [&](uint32_t begin, uint32_t end){
+                uint64_t delta = (ticks[end] - ticks[begin]) & _timestampMask;
+                return float(double(delta) * _timestampPeriod * 1e-6);
+            };
+            // queries 0 and 1 are the frame begin and end
+            slot.pending.gpuMs = toMs(0, 1);
+            for(const auto& scope : slot.scopes){
+                if(scope.endQuery != 0)
+                    slot.pending.gpuScopeMs[scope.scope] += toMs(scope.beginQuery, scope.endQuery);
+            }
+        }
+    }
+    publish(slot.pending);
+}
+
+void Profiler::beginGpuFrame(vk::CommandBuffer cmd, uint32_t slotIndex){
+    if(!_enabled)
+        return;
+    Slot& slot = _slots[slotIndex];
+    _recordingSlot = &slot;
+    slot.scopes.clear();
+    slot.queryCount = 0;
+    _gpuScopeStack.clear();
+    if(!_gpuEnabled)
+        return;
+
+    cmd.resetQueryPool(slot.queryPool, 0, MaxQueriesPerFrame);
+    // query 1 is reserved for the frame end
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, slot.queryPool, 0);
+    slot.queryCount = 2;
+}
+
+void Profiler::endGpuFrame(vk::CommandBuffer cmd){
+    if(!_gpuEnabled || !_recordingSlot)
+        return;
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, _recordingSlot->queryPool, 1);
+}
+
+void Profiler::beginGpuScope(vk::CommandBuffer cmd, const char* name){
+    if(!_gpuEnabled || !_recordingSlot)
+        return;
+    Slot& slot = *_recordingSlot;
+    uint32_t recordIndex = uint32_t(slot.scopes.size());
+    _gpuScopeStack.push_back(recordIndex);
+    // out of queries, the scope is kept on the stack but not timed
+    if(slot.queryCount + 2 > MaxQueriesPerFrame){
+        slot.scopes.push_back({scopeId(name), 0, 0});
+        return;
+    }
+    uint32_t query = slot.queryCount++;
+    slot.scopes.push_back({scopeId(name), query, 0});
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, slot.queryPool, query);
+}
+
+void Profiler::endGpuScope(vk::CommandBuffer cmd){
+    if(!_gpuEnabled || !_recordingSlot || _gpuScopeStack.empty())
+        return;
+    Slot& slot = *_recordingSlot;
+    GpuScopeRecord& record = slot.scopes[_gpuScopeStack.back()];
+    _gpuScopeStack.pop_back();
+    if(record.beginQuery == 0)
+        return;
+    record.endQuery = slot.queryCount++;
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, slot.queryPool, record.endQuery);
+}
+
+void Profiler::endFrame(){
+    if(!_enabled || !_recordingSlot)
+        return;
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - _frameStart;
+    _current.cpuMs = float(elapsed.count());
+    _recordingSlot->pending = _current;
+    _recordingSlot->hasPending = true;
+    _recordingSlot = nullptr;
+}
+
+uint32_t Profiler::scopeId(const char* name){
+    uint32_t count = _scopeCount.load(std::memory_order_relaxed);
+    for(uint32_t i=0;i<count;++i){
+        if(_scopeNames[i] == name || std::strcmp(_scopeNames[i], name) == 0)
+            return i;
+    }
+    if(count == FrameSample::MaxScopes)
+        throw std::runtime_error("too many profiler scopes");
+    _scopeNames[count] = name;
+    _scopeCount.store(count + 1, std::memory_order_release);
+    return count;
+}
+
+void Profiler::addCpuTime(uint32_t scope, std::chrono::steady_clock::duration duration){
+    if(!_enabled)
+        return;
+    std::chrono::duration<double, std::milli> ms = duration;
+    _current.cpuScopeMs[scope] += float(ms.count());
+}
+
+const char* Profiler::scopeName(uint32_t scope) const {
+    return scope < scopeCount() ? _scopeNames[scope] : "";
+}
+
+void Profiler::publish(const FrameSample& sample){
+    // single writer, readers detect a torn copy through the sequence number
+    uint64_t n = _written.load(std::memory_order_relaxed);
+    HistoryEntry& entry = _history[n % HistorySize];
+    entry.sequence.store(2*n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.sample = sample;
+    entry.sequence.store(2*n + 2, std::memory_order_release);
+    _written.store(n + 1, std::memory_order_release);
+}
+
+void Profiler::copyHistory(std::vector<FrameSample>& out, uint32_t maxCount) const {
+    out.clear();
+    if(!_history)
+        return;
+    uint64_t end = _written.load(std::memory_order_acquire);
+    uint64_t count = std::min<uint64_t>({end, maxCount, HistorySize});
+    out.reserve(count);
+    for(uint64_t n = end - count; n < end; ++n){
+        const HistoryEntry& entry = _history[n % HistorySize];
+        uint64_t before = entry.sequence.load(std::memory_order_acquire);
+        // overwritten by a newer frame or being written right now
+        if(before != 2*n + 2)
+            continue;
+        FrameSample sample = entry.sample;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(entry.sequence.load(std::memory_order_relaxed) != before)
+            continue;
+        out.push_back(sample);
+    }
+}
+
+static TimingPercentiles computePercentiles(std::vector<double>& values){
+    TimingPercentiles result;
+    result.count = uint32_t(values.size());
+    if(values.empty())
+        return result;
+    std::sort(values.begin(), values.end());
+    double sum = 0;
+    for(double v : values)
+        sum += v;
+    // nearest rank
+    auto rank = [&](double p){
+        size_t index = size_t(std::ceil(p * values.size()));
+        return values[std::clamp<size_t>(index, 1, values.size()) - 1];
+    };
+    result.avg = sum / values.size();
+    result.p50 = rank(0.50);
+    result.p95 = rank(0.95);
+    result.p99 = rank(0.99);
+    result.max = values.back();
+    return result;
+}
+
+ProfilerStats Profiler::getStats(uint32_t maxCount) const {
+    std::vector<FrameSample> samples;
+    copyHistory(samples, maxCount);
+
+    ProfilerStats stats;
+    std::vector<double> cpu, gpu;
+    cpu.reserve(samples.size());
+    gpu.reserve(samples.size());
+    for(const auto& sample : samples){
+        cpu.push_back(sample.cpuMs);
+        gpu.push_back(sample.gpuMs);
+        for(uint32_t i=0;i<FrameSample::MaxScopes;++i){
+            stats.cpuScopeAvgMs[i] += sample.cpuScopeMs[i];
+            stats.gpuScopeAvgMs[i] += sample.gpuScopeMs[i];
+        }
+    }
+    if(!samples.empty()){
+        for(uint32_t i=0;i<FrameSample::MaxScopes;++i){
+            stats.cpuScopeAvgMs[i] /= samples.size();
+            stats.gpuScopeAvgMs[i] /= samples.size();
+        }
+    }
+    stats.cpu = computePercentiles(cpu);
+    stats.gpu = computePercentiles(gpu);
+    return stats;
+}
+
+bool Profiler::writeCsv(const char* path) const {
+    FILE* file = std::fopen(path, "w");
+    if(!file)
+        return false;
+    std::vector<FrameSample> samples;
+    copyHistory(samples);
+    uint32_t scopes = scopeCount();
+
+    std::fprintf(file, "frame,cpu_ms,gpu_ms");
+    for(uint32_t i=0;i<scopes;++i)
+        std::fprintf(file, ",cpu:%s,gpu:%s", _scopeNames[i], _scopeNames[i]);
+    std::fprintf(file, "\n");
+    for(const auto& sample : samples){
+        std::fprintf(file, "%lu,%.4f,%.4f", (unsigned long)sample.frameNumber, sample.cpuMs, sample.gpuMs);
+        for(uint32_t i=0;i<scopes;++i)
+            std::fprintf(file, ",%.4f,%.4f", sample.cpuScopeMs[i], sample.gpuScopeMs[i]);
+        std::fprintf(file, "\n");
+    }
+    return std::fclose(file) == 0;
+}
+
+static void writeJsonPercentiles(FILE* file, const char* name, const TimingPercentiles& p){
+    std::fprintf(file,
+        "  \"%s\": {\"count\": %u, \"avg_ms\": %.4f, \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f},\n",
+        name, p.count, p.avg, p.p50, p.p95, p.p99, p.max);
+}
+
+bool Profiler::writeJson(const char* path) const {
+    FILE* file = std::fopen(path, "w");
+    if(!file)
+        return false;
+    ProfilerStats stats = getStats();
+    uint32_t scopes = scopeCount();
+
+    std::fprintf(file, "{\n");
+    std::fprintf(file, "  \"gpu_timestamps\": %s,\n", _gpuEnabled ? "true" : "false");
+    writeJsonPercentiles(file, "cpu", stats.cpu);
+    writeJsonPercentiles(file, "gpu", stats.gpu);
+    std::fprintf(file, "  \"scopes\": {");
+    for(uint32_t i=0;i<scopes;++i){
+        std::fprintf(file, "%s\n    \"%s\": {\"cpu_avg_ms\": %.4f, \"gpu_avg_ms\": %.4f}",
+            i==0 ? "" : ",", _scopeNames[i], stats.cpuScopeAvgMs[i], stats.gpuScopeAvgMs[i]);
+    }
+    std::fprintf(file, "%s}\n}\n", scopes>0 ? "\n  " : "");
+    return std::fclose(file) == 0;
+}
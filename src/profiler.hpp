@@ -0,0 +1,184 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+// Timings of one retired frame, scope arrays are indexed by scope id
+struct FrameSample {
+    static constexpr uint32_t MaxScopes = 32;
+
+    uint64_t frameNumber{0};
+    // CPU time from beginFrame() to endFrame()
+    float cpuMs{0};
+    // GPU time between the first and last timestamp of the frame, 0 without timestamp support
+    float gpuMs{0};
+    std::array<float, MaxScopes> cpuScopeMs{};
+    std::array<float, MaxScopes> gpuScopeMs{};
+};
+
+struct TimingPercentiles {
+    uint32_t count{0};
+    double avg{0};
+    double p50{0};
+    double p95{0};
+    double p99{0};
+    double max{0};
+};
+
+struct ProfilerStats {
+    TimingPercentiles cpu;
+    TimingPercentiles gpu;
+    // per scope averages over the same frames
+    std::array<double, FrameSample::MaxScopes> cpuScopeAvgMs{};
+    std::array<double, FrameSample::MaxScopes> gpuScopeAvgMs{};
+};
+
+// Per frame CPU scope timers and GPU timestamp queries, one query pool per
+// frame in flight. Results of a frame are read back after its fence has been
+// waited on, so reading never stalls, and pushed into a lock-free history
+// ring that other threads can read while the render thread keeps writing.
+//
+// Recording (beginFrame/endFrame/scopes) happens on the render thread only.
+// Scope names must outlive the profiler, string literals are expected
+class Profiler {
+public:
+    static constexpr uint32_t HistorySize = 1024;
+    // frame begin/end plus a begin/end pair per GPU scope
+    static constexpr uint32_t MaxQueriesPerFrame = 2 + 2*64;
+
+    class CpuScope {
+    public:
+        CpuScope(Profiler& profiler, const char* name)
+            : _profiler(profiler), _scope(profiler.scopeId(name)), _start(std::chrono::steady_clock::now()){}
+        ~CpuScope(){
+            _profiler.addCpuTime(_scope, std::chrono::steady_clock::now() - _start);
+        }
+        CpuScope(const CpuScope&) = delete;
+        CpuScope& operator=(const CpuScope&) = delete;
+    private:
+        Profiler& _profiler;
+        uint32_t _scope;
+        std::chrono::steady_clock::time_point _start;
+    };
+
+    class GpuScope {
+    public:
+        GpuScope(Profiler& profiler, vk::CommandBuffer cmd, const char* name)
+            : _profiler(profiler), _cmd(cmd){
+            _profiler.beginGpuScope(_cmd, name);
+        }
+        ~GpuScope(){
+            _profiler.endGpuScope(_cmd);
+        }
+        GpuScope(const GpuScope&) = delete;
+        GpuScope& operator=(const GpuScope&) = delete;
+    private:
+        Profiler& _profiler;
+        vk::CommandBuffer _cmd;
+    };
+
+    void init(
+        vk::Device device,
+        vk::PhysicalDevice physicalDevice,
+        uint32_t queueFamily,
+        uint32_t framesInFlight,
+        bool enabled
+    );
+
+    void destroy();
+
+    // starts CPU timing of a frame, call before waiting on the frame fence
+    void beginFrame(uint64_t frameNumber);
+
+    // Reads back the GPU timestamps the previous use of this slot wrote and
+    // publishes its sample. The slot's fence must have been waited on
+    void collect(uint32_t slot);
+
+    // resets the slot's queries and writes the frame begin timestamp, call
+    // right after vkBeginCommandBuffer and outside of any render pass
+    void beginGpuFrame(vk::CommandBuffer cmd, uint32_t slot);
+
+    void endGpuFrame(vk::CommandBuffer cmd);
+
+    void beginGpuScope(vk::CommandBuffer cmd, const char* name);
+
+    void endGpuScope(vk::CommandBuffer cmd);
+
+    // marks the frame as submitted, its sample is published by collect() once the GPU is done
+    void endFrame();
+
+    uint32_t scopeId(const char* name);
+
+    void addCpuTime(uint32_t scope, std::chrono::steady_clock::duration duration);
+
+    // Copies up to maxCount of the newest published samples, oldest first.
+    // Safe to call from any thread
+    void copyHistory(std::vector<FrameSample>& out, uint32_t maxCount = HistorySize) const;
+
+    ProfilerStats getStats(uint32_t maxCount = HistorySize) const;
+
+    const char* scopeName(uint32_t scope) const;
+
+    uint32_t scopeCount() const {
+        return _scopeCount.load(std::memory_order_acquire);
+    }
+
+    bool hasGpuTimestamps() const {
+        return _gpuEnabled;
+    }
+
+    // per frame rows, one column per scope
+    bool writeCsv(const char* path) const;
+
+    // percentile summary plus per scope averages
+    bool writeJson(const char* path) const;
+
+private:
+    struct GpuScopeRecord {
+        uint32_t scope;
+        uint32_t beginQuery;
+        uint32_t endQuery;
+    };
+
+    struct Slot {
+        vk::QueryPool queryPool;
+        uint32_t queryCount{0};
+        std::vector<GpuScopeRecord> scopes;
+        // sample waiting for its GPU results
+        FrameSample pending;
+        bool hasPending{false};
+    };
+
+    // seqlock entry, sequence is odd while the sample is being written
+    struct HistoryEntry {
+        std::atomic<uint64_t> sequence{0};
+        FrameSample sample;
+    };
+
+    void publish(const FrameSample& sample);
+
+    bool _enabled{false};
+    bool _gpuEnabled{false};
+    vk::Device _device;
+    // nanoseconds per timestamp tick
+    double _timestampPeriod{1.0};
+    uint64_t _timestampMask{~0ull};
+
+    std::vector<Slot> _slots;
+    Slot* _recordingSlot{nullptr};
+    std::vector<uint32_t> _gpuScopeStack;
+
+    FrameSample _current;
+    std::chrono::steady_clock::time_point _frameStart;
+
+    std::array<const char*, FrameSample::MaxScopes> _scopeNames{};
+    std::atomic<uint32_t> _scopeCount{0};
+
+    std::unique_ptr<HistoryEntry[]> _history;
+    std::atomic<uint64_t> _written{0};
+};
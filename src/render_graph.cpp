@@ -0,0 +1,649 @@
+#include "render_graph.hpp"
+
+#include "pipelines.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+    constexpr vk::AccessFlags WriteAccess =
+        vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentWrite |
+        vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite;
+
+    bool hasDepth(vk::Format format){
+        switch(format){
+            case vk::Format::eD16Unorm:
+            case vk::Format::eX8D24UnormPack32:
+            case vk::Format::eD32Sfloat:
+            case vk::Format::eD16UnormS8Uint:
+            case vk::Format::eD24UnormS8Uint:
+            case vk::Format::eD32SfloatS8Uint:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    bool hasStencil(vk::Format format){
+        return format == vk::Format::eD16UnormS8Uint || format == vk::Format::eD24UnormS8Uint ||
+            format == vk::Format::eD32SfloatS8Uint || format == vk::Format::eS8Uint;
+    }
+
+    vk::ImageAspectFlags aspectOf(vk::Format format){
+        vk::ImageAspectFlags aspect;
+        if(hasDepth(format))
+            aspect |= vk::ImageAspectFlagBits::eDepth;
+        if(hasStencil(format))
+            aspect |= vk::ImageAspectFlagBits::eStencil;
+        return aspect ? aspect : vk::ImageAspectFlags(vk::ImageAspectFlagBits::eColor);
+    }
+
+    bool isAttachment(vk::ImageLayout layout){
+        return layout == vk::ImageLayout::eColorAttachmentOptimal || layout == vk::ImageLayout::eDepthStencilAttachmentOptimal;
+    }
+}
+
+vk::ImageView RenderGraphContext::view(RenderGraphResource resource) const {
+    return graph->view(resource);
+}
+
+vk::Image RenderGraphContext::image(RenderGraphResource resource) const {
+    return graph->image(resource);
+}
+
+RenderGraphPassBuilder& RenderGraphPassBuilder::colorAttachment(RenderGraphResource resource, std::optional<vk::ClearColorValue> clear){
+    vk::AccessFlags access = vk::AccessFlagBits::eColorAttachmentWrite;
+    // loading the previous contents reads them
+    if(!clear)
+        access |= vk::AccessFlagBits::eColorAttachmentRead;
+    std::optional<vk::ClearValue> clearValue;
+    if(clear)
+        clearValue = vk::ClearValue{*clear};
+    _graph.addAccess(_pass, {
+        resource, RenderGraph::AccessType::ColorAttachment,
+        vk::PipelineStageFlagBits::eColorAttachmentOutput, access,
+        vk::ImageLayout::eColorAttachmentOptimal, true, clearValue
+    });
+    return *this;
+}
+
+RenderGraphPassBuilder& RenderGraphPassBuilder::depthAttachment(RenderGraphResource resource, std::optional<vk::ClearDepthStencilValue> clear){
+    std::optional<vk::ClearValue> clearValue;
+    if(clear)
+        clearValue = vk::ClearValue{*clear};
+    _graph.addAccess(_pass, {
+        resource, RenderGraph::AccessType::DepthAttachment,
+        vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests,
+        vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+        vk::ImageLayout::eDepthStencilAttachmentOptimal, true, clearValue
+    });
+    return *this;
+}
+
+RenderGraphPassBuilder& RenderGraphPassBuilder::sampled(RenderGraphResource resource, vk::PipelineStageFlags stages){
+    _graph.addAccess(_pass, {
+        resource, RenderGraph::AccessType::Sampled, stages, vk::AccessFlagBits::eShaderRead,
+        vk::ImageLayout::eShaderReadOnlyOptimal, false, {}
+    });
+    return *this;
+}
+
+RenderGraphPassBuilder& RenderGraphPassBuilder::storageRead(RenderGraphResource resource, vk::PipelineStageFlags stages){
+    _graph.addAccess(_pass, {
+        resource, RenderGraph::AccessType::StorageRead, stages, vk::AccessFlagBits::eShaderRead,
+        vk::ImageLayout::eGeneral, false, {}
+    });
+    return *this;
+}
+
+RenderGraphPassBuilder& RenderGraphPassBuilder::storageWrite(RenderGraphResource resource, vk::PipelineStageFlags stages){
+    _graph.addAccess(_pass, {
+        resource, RenderGraph::AccessType::StorageWrite, stages,
+        vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+        vk::ImageLayout::eGeneral, true, {}
+    });
+    return *this;
+}
+
+RenderGraphPassBuilder& RenderGraphPassBuilder::transferSrc(RenderGraphResource resource){
+    _graph.addAccess(_pass, {
+        resource, RenderGraph::AccessType::TransferSrc, vk::PipelineStageFlagBits::eTransfer,
+        vk::AccessFlagBits::eTransferRead, vk::ImageLayout::eTransferSrcOptimal, false, {}
+    });
+    return *this;
+}
+
+RenderGraphPassBuilder& RenderGraphPassBuilder::transferDst(RenderGraphResource resource){
+    _graph.addAccess(_pass, {
+        resource, RenderGraph::AccessType::TransferDst, vk::PipelineStageFlagBits::eTransfer,
+        vk::AccessFlagBits::eTransferWrite, vk::ImageLayout::eTransferDstOptimal, true, {}
+    });
+    return *this;
+}
+
+RenderGraphPassBuilder& RenderGraphPassBuilder::sideEffects(){
+    _graph._passes[_pass].sideEffects = true;
+    return *this;
+}
+
+void RenderGraph::init(vk::Device device, GpuAllocator& allocator, uint32_t framesInFlight){
+    _device = device;
+    _allocator = &allocator;
+    _framesInFlight = framesInFlight;
+}
+
+void RenderGraph::destroy(){
+    reset(0);
+    for(auto& compiled : _retired)
+        destroyCompiled(compiled);
+    _retired.clear();
+}
+
+void RenderGraph::reset(uint64_t frameNumber){
+    _compiled.retireFrame = frameNumber;
+    _retired.push_back(std::move(_compiled));
+    _compiled = {};
+    _resources.clear();
+    _passes.clear();
+    _finalBarriers.clear();
+    _finalResources.clear();
+    _finalSrcStages = {};
+    _compiledOnce = false;
+    _stats = {};
+}
+
+void RenderGraph::retire(uint64_t frameNumber){
+    auto it = _retired.begin();
+    while(it != _retired.end()){
+        if(it->retireFrame + _framesInFlight <= frameNumber){
+            destroyCompiled(*it);
+            it = _retired.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+void RenderGraph::destroyCompiled(Compiled& compiled){
+    for(auto framebuffer : compiled.framebuffers)
+        _device.destroyFramebuffer(framebuffer);
+    for(auto renderPass : compiled.renderPasses)
+        _device.destroyRenderPass(renderPass);
+    for(auto view : compiled.views)
+        _device.destroyImageView(view);
+    for(auto image : compiled.images)
+        _device.destroyImage(image);
+    for(auto memory : compiled.memory)
+        _allocator->freeMemory(memory);
+    compiled = {};
+}
+
+RenderGraphResource RenderGraph::createImage(const std::string& name, const RenderGraphImageDesc& desc){
+    Resource resource;
+    resource.name = name;
+    resource.desc = desc;
+    _resources.push_back(std::move(resource));
+    return RenderGraphResource(_resources.size() - 1);
+}
+
+RenderGraphResource RenderGraph::importImage(const std::string& name, const RenderGraphImportDesc& desc){
+    Resource resource;
+    resource.name = name;
+    resource.imported = true;
+    resource.import = desc;
+    resource.desc.format = desc.format;
+    resource.desc.extent = desc.extent;
+    _resources.push_back(std::move(resource));
+    return RenderGraphResource(_resources.size() - 1);
+}
+
+RenderGraphPassBuilder RenderGraph::addPass(const std::string& name, RenderGraphExecute execute){
+    Pass pass;
+    pass.name = name;
+    pass.execute = std::move(execute);
+    _passes.push_back(std::move(pass));
+    return RenderGraphPassBuilder(*this, uint32_t(_passes.size() - 1));
+}
+
+void RenderGraph::addAccess(uint32_t pass, const Access& access){
+    if(access.resource >= _resources.size())
+        throw std::runtime_error("render graph pass " + _passes[pass].name + " uses an unknown resource");
+    for(const auto& other : _passes[pass].accesses){
+        if(other.resource == access.resource)
+            throw std::runtime_error("render graph pass " + _passes[pass].name + " uses " + _resources[access.resource].name + " twice");
+    }
+    _passes[pass].accesses.push_back(access);
+}
+
+void RenderGraph::setImportedImage(RenderGraphResource resource, vk::Image image, vk::ImageView view){
+    _resources[resource].image = image;
+    _resources[resource].view = view;
+}
+
+vk::RenderPass RenderGraph::renderPass(uint32_t pass) const {
+    return _passes[pass].renderPass;
+}
+
+uint64_t RenderGraph::renderPassKey(uint32_t pass) const {
+    return _passes[pass].renderPassKey;
+}
+
+void RenderGraph::compile(){
+    if(_compiledOnce)
+        throw std::runtime_error("render graph compiled twice without reset");
+    _compiledOnce = true;
+
+    cullPasses();
+    allocateTransients();
+    computeBarriers();
+    chooseAttachmentOps();
+    createRenderPasses();
+
+    _stats.passes = uint32_t(_passes.size());
+    _stats.imageBarriers = uint32_t(_finalBarriers.size());
+    for(const auto& pass : _passes){
+        _stats.culledPasses += pass.culled ? 1 : 0;
+        _stats.imageBarriers += uint32_t(pass.barriers.size());
+    }
+    _stats.transientImages = uint32_t(_compiled.images.size());
+}
+
+void RenderGraph::cullPasses(){
+    // walk back from the imported images and passes with side effects,
+    // a pass survives when a survivor or an import needs what it writes
+    std::vector<bool> needed(_resources.size());
+    for(size_t i=0;i<_resources.size();++i)
+        needed[i] = _resources[i].imported;
+    for(size_t p=_passes.size();p-- > 0;){
+        Pass& pass = _passes[p];
+        bool keep = pass.sideEffects;
+        for(const auto& access : pass.accesses)
+            keep = keep || (access.write && needed[access.resource]);
+        pass.culled = !keep;
+        if(!keep)
+            continue;
+        for(const auto& access : pass.accesses){
+            // attachments that are loaded read the previous contents
+            bool loads = isAttachment(access.layout) && !access.clear;
+            if(!access.write || loads)
+                needed[access.resource] = true;
+        }
+    }
+}
+
+void RenderGraph::allocateTransients(){
+    struct Placement {
+        RenderGraphResource resource;
+        vk::DeviceSize offset;
+        vk::DeviceSize size;
+    };
+    struct Heap {
+        uint32_t memoryTypeBits;
+        vk::DeviceSize alignment{1};
+        vk::DeviceSize size{0};
+        std::vector<Placement> placements;
+    };
+
+    // lifetimes, usage and every stage and write that touches each image
+    std::vector<vk::ImageUsageFlags> usages(_resources.size());
+    std::vector<vk::PipelineStageFlags> stages(_resources.size());
+    std::vector<vk::AccessFlags> writes(_resources.size());
+    for(uint32_t p=0;p<_passes.size();++p){
+        if(_passes[p].culled)
+            continue;
+        for(const auto& access : _passes[p].accesses){
+            Resource& resource = _resources[access.resource];
+            resource.firstPass = std::min(resource.firstPass, p);
+            resource.lastPass = std::max(resource.lastPass, p);
+            stages[access.resource] |= access.stages;
+            writes[access.resource] |= access.access & WriteAccess;
+            switch(access.type){
+                case AccessType::ColorAttachment: usages[access.resource] |= vk::ImageUsageFlagBits::eColorAttachment; break;
+                case AccessType::DepthAttachment: usages[access.resource] |= vk::ImageUsageFlagBits::eDepthStencilAttachment; break;
+                case AccessType::Sampled:         usages[access.resource] |= vk::ImageUsageFlagBits::eSampled; break;
+                case AccessType::StorageRead:
+                case AccessType::StorageWrite:    usages[access.resource] |= vk::ImageUsageFlagBits::eStorage; break;
+                case AccessType::TransferSrc:     usages[access.resource] |= vk::ImageUsageFlagBits::eTransferSrc; break;
+                case AccessType::TransferDst:     usages[access.resource] |= vk::ImageUsageFlagBits::eTransferDst; break;
+            }
+        }
+    }
+
+    std::vector<std::pair<RenderGraphResource, vk::MemoryRequirements>> transients;
+    for(uint32_t r=0;r<_resources.size();++r){
+        Resource& resource = _resources[r];
+        if(resource.imported || resource.firstPass == ~0u)
+            continue;
+        vk::ImageCreateInfo imageInfo{};
+        imageInfo.imageType = vk::ImageType::e2D;
+        imageInfo.format = resource.desc.format;
+        imageInfo.extent = vk::Extent3D{resource.desc.extent.width, resource.desc.extent.height, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = vk::SampleCountFlagBits::e1;
+        imageInfo.tiling = vk::ImageTiling::eOptimal;
+        imageInfo.usage = resource.desc.usage | usages[r];
+        imageInfo.sharingMode = vk::SharingMode::eExclusive;
+        imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+        resource.image = _device.createImage(imageInfo);
+        _compiled.images.push_back(resource.image);
+        transients.push_back({r, _device.getImageMemoryRequirements(resource.image)});
+    }
+
+    // Largest first, each image goes to the lowest offset that no image with
+    // an overlapping lifetime occupies. Optimal tiling images only, so there
+    // is no buffer image granularity to respect
+    std::sort(transients.begin(), transients.end(), [](const auto& a, const auto& b){
+        return a.second.size > b.second.size;
+    });
+    std::vector<Heap> heaps;
+    vk::DeviceSize unaliasedSize = 0;
+    for(const auto& [r, requirements] : transients){
+        const Resource& resource = _resources[r];
+        unaliasedSize += requirements.size;
+        auto overlaps = [&](const Placement& other){
+            const Resource& o = _resources[other.resource];
+            return o.firstPass <= resource.lastPass && resource.firstPass <= o.lastPass;
+        };
+        Heap* heap = nullptr;
+        for(auto& candidate : heaps){
+            if(candidate.memoryTypeBits & requirements.memoryTypeBits){
+                heap = &candidate;
+                break;
+            }
+        }
+        if(!heap){
+            heaps.push_back(Heap{requirements.memoryTypeBits});
+            heap = &heaps.back();
+        }
+
+        std::vector<vk::DeviceSize> offsets{0};
+        for(const auto& other : heap->placements){
+            if(overlaps(other))
+                offsets.push_back((other.offset + other.size + requirements.alignment - 1) / requirements.alignment * requirements.alignment);
+        }
+        std::sort(offsets.begin(), offsets.end());
+        vk::DeviceSize offset = offsets.back();
+        for(vk::DeviceSize candidate : offsets){
+            bool free = std::none_of(heap->placements.begin(), heap->placements.end(), [&](const Placement& other){
+                return overlaps(other) && candidate < other.offset + other.size && other.offset < candidate + requirements.size;
+            });
+            if(free){
+                offset = candidate;
+                break;
+            }
+        }
+        heap->placements.push_back({r, offset, requirements.size});
+        heap->memoryTypeBits &= requirements.memoryTypeBits;
+        heap->alignment = std::max(heap->alignment, requirements.alignment);
+        heap->size = std::max(heap->size, offset + requirements.size);
+    }
+
+    vk::DeviceSize aliasedSize = 0;
+    for(const auto& heap : heaps){
+        VmaAllocation memory = _allocator->allocateMemory(
+            MemoryClass::RenderTarget,
+            vk::MemoryRequirements{heap.size, heap.alignment, heap.memoryTypeBits}
+        );
+        _compiled.memory.push_back(memory);
+        aliasedSize += heap.size;
+        for(const auto& placement : heap.placements){
+            Resource& resource = _resources[placement.resource];
+            _allocator->bindImageMemory(memory, placement.offset, resource.image);
+
+            // the first access of a frame waits for the last accesses of the
+            // previous frame to the same memory, whichever image made them
+            for(const auto& other : heap.placements){
+                if(placement.offset < other.offset + other.size && other.offset < placement.offset + placement.size){
+                    resource.frameStartStages |= stages[other.resource];
+                    resource.frameStartAccess |= writes[other.resource];
+                }
+            }
+
+            vk::ImageViewCreateInfo viewInfo{
+                {},
+                resource.image,
+                vk::ImageViewType::e2D,
+                resource.desc.format,
+                {},
+                {aspectOf(resource.desc.format), 0, 1, 0, 1}
+            };
+            resource.view = _device.createImageView(viewInfo);
+            _compiled.views.push_back(resource.view);
+        }
+    }
+    _stats.transientBytes = aliasedSize;
+    _stats.unaliasedBytes = unaliasedSize;
+}
+
+void RenderGraph::computeBarriers(){
+    // Known state of every image while walking the passes. Writes and layout
+    // transitions are made visible to the stages of the barrier that ordered
+    // them, later reads from other stages need one more execution dependency
+    struct State {
+        vk::ImageLayout layout;
+        vk::PipelineStageFlags writeStages;
+        vk::AccessFlags writeAccess;
+        vk::PipelineStageFlags visibleStages;
+        vk::PipelineStageFlags readStages;
+    };
+    std::vector<State> states(_resources.size());
+    for(size_t r=0;r<_resources.size();++r){
+        const Resource& resource = _resources[r];
+        if(resource.imported)
+            states[r] = {resource.import.initialLayout, resource.import.waitStages, {}, {}, {}};
+        else
+            states[r] = {vk::ImageLayout::eUndefined, resource.frameStartStages, resource.frameStartAccess, {}, {}};
+    }
+
+    auto barrier = [&](RenderGraphResource r, const State& state, vk::ImageLayout newLayout, vk::AccessFlags dstAccess){
+        vk::ImageMemoryBarrier imageBarrier{};
+        imageBarrier.srcAccessMask = state.writeAccess;
+        imageBarrier.dstAccessMask = dstAccess;
+        imageBarrier.oldLayout = state.layout;
+        imageBarrier.newLayout = newLayout;
+        imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.subresourceRange = vk::ImageSubresourceRange{aspectOf(_resources[r].desc.format), 0, 1, 0, 1};
+        return imageBarrier;
+    };
+    auto srcStages = [](vk::PipelineStageFlags stages){
+        return stages ? stages : vk::PipelineStageFlags(vk::PipelineStageFlagBits::eTopOfPipe);
+    };
+
+    for(auto& pass : _passes){
+        if(pass.culled)
+            continue;
+        for(const auto& access : pass.accesses){
+            State& state = states[access.resource];
+            if(access.layout != state.layout || access.write){
+                // writes wait for earlier writes and reads, transitions are writes
+                pass.barriers.push_back(barrier(access.resource, state, access.layout, access.access));
+                pass.barrierResources.push_back(access.resource);
+                pass.srcStages |= srcStages(state.writeStages | state.readStages);
+                pass.dstStages |= access.stages;
+                state.layout = access.layout;
+                state.writeStages = access.stages;
+                state.writeAccess = access.access & WriteAccess;
+                state.visibleStages = access.stages;
+                state.readStages = access.write ? vk::PipelineStageFlags{} : access.stages;
+            }
+            else{
+                if(access.stages & ~state.visibleStages){
+                    pass.barriers.push_back(barrier(access.resource, state, access.layout, access.access));
+                    pass.barrierResources.push_back(access.resource);
+                    pass.srcStages |= srcStages(state.writeStages);
+                    pass.dstStages |= access.stages;
+                    state.visibleStages |= access.stages;
+                }
+                state.readStages |= access.stages;
+            }
+        }
+    }
+
+    for(RenderGraphResource r=0;r<_resources.size();++r){
+        const Resource& resource = _resources[r];
+        const State& state = states[r];
+        if(!resource.imported || resource.import.finalLayout == vk::ImageLayout::eUndefined || resource.import.finalLayout == state.layout)
+            continue;
+        _finalBarriers.push_back(barrier(r, state, resource.import.finalLayout, {}));
+        _finalResources.push_back(r);
+        _finalSrcStages |= srcStages(state.writeStages | state.readStages);
+    }
+}
+
+void RenderGraph::chooseAttachmentOps(){
+    // backwards, an attachment is stored when a later access or the import needs it
+    std::vector<bool> contentsNeeded(_resources.size());
+    for(size_t r=0;r<_resources.size();++r)
+        contentsNeeded[r] = _resources[r].imported;
+    for(size_t p=_passes.size();p-- > 0;){
+        Pass& pass = _passes[p];
+        if(pass.culled)
+            continue;
+        for(auto& access : pass.accesses){
+            bool attachment = access.type == AccessType::ColorAttachment || access.type == AccessType::DepthAttachment;
+            if(attachment)
+                access.storeOp = contentsNeeded[access.resource] ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
+            contentsNeeded[access.resource] = !(attachment && access.clear);
+        }
+    }
+
+    // forwards, an attachment without clear value loads only existing contents
+    std::vector<bool> hasContents(_resources.size());
+    for(size_t r=0;r<_resources.size();++r)
+        hasContents[r] = _resources[r].imported && _resources[r].import.initialLayout != vk::ImageLayout::eUndefined;
+    for(auto& pass : _passes){
+        if(pass.culled)
+            continue;
+        for(auto& access : pass.accesses){
+            if(access.clear)
+                access.loadOp = vk::AttachmentLoadOp::eClear;
+            else if(hasContents[access.resource])
+                access.loadOp = vk::AttachmentLoadOp::eLoad;
+            if(access.write)
+                hasContents[access.resource] = true;
+        }
+    }
+}
+
+void RenderGraph::createRenderPasses(){
+    for(auto& pass : _passes){
+        if(pass.culled)
+            continue;
+        std::vector<const Access*> attachments;
+        for(const auto& access : pass.accesses){
+            if(access.type == AccessType::ColorAttachment)
+                attachments.push_back(&access);
+        }
+        uint32_t colorCount = uint32_t(attachments.size());
+        for(const auto& access : pass.accesses){
+            if(access.type == AccessType::DepthAttachment){
+                if(attachments.size() > colorCount)
+                    throw std::runtime_error("render graph pass " + pass.name + " has more than one depth attachment");
+                attachments.push_back(&access);
+            }
+        }
+        if(attachments.empty())
+            continue;
+
+        std::vector<vk::AttachmentDescription> descriptions;
+        std::vector<vk::AttachmentReference> references;
+        pass.extent = _resources[attachments[0]->resource].desc.extent;
+        for(const Access* access : attachments){
+            const Resource& resource = _resources[access->resource];
+            if(resource.desc.extent != pass.extent)
+                throw std::runtime_error("render graph pass " + pass.name + " has attachments of different sizes");
+            // barriers do the layout transitions, the render pass keeps the layout
+            vk::AttachmentDescription description{};
+            description.format = resource.desc.format;
+            description.samples = vk::SampleCountFlagBits::e1;
+            description.loadOp = access->loadOp;
+            description.storeOp = access->storeOp;
+            bool stencil = hasStencil(resource.desc.format);
+            description.stencilLoadOp = stencil ? access->loadOp : vk::AttachmentLoadOp::eDontCare;
+            description.stencilStoreOp = stencil ? access->storeOp : vk::AttachmentStoreOp::eDontCare;
+            description.initialLayout = access->layout;
+            description.finalLayout = access->layout;
+            descriptions.push_back(description);
+            references.push_back(vk::AttachmentReference{uint32_t(references.size()), access->layout});
+            pass.attachments.push_back(access->resource);
+            pass.clearValues.push_back(access->clear.value_or(vk::ClearValue{}));
+        }
+
+        vk::SubpassDescription subpass{};
+        subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+        subpass.colorAttachmentCount = colorCount;
+        subpass.pColorAttachments = references.data();
+        if(references.size() > colorCount)
+            subpass.pDepthStencilAttachment = &references[colorCount];
+
+        vk::RenderPassCreateInfo renderPassInfo{};
+        renderPassInfo.setAttachments(descriptions);
+        renderPassInfo.setSubpasses(subpass);
+        pass.renderPass = _device.createRenderPass(renderPassInfo);
+        _compiled.renderPasses.push_back(pass.renderPass);
+
+        // single subpass passes are compatible when their attachments have
+        // the same formats and sample counts in the same order
+        uint64_t key = contentHash(&colorCount, sizeof(colorCount));
+        for(const auto& description : descriptions){
+            uint32_t words[2] = {uint32_t(description.format), uint32_t(description.samples)};
+            key = contentHash(words, sizeof(words), key);
+        }
+        pass.renderPassKey = key;
+    }
+}
+
+vk::Framebuffer RenderGraph::getFramebuffer(Pass& pass){
+    std::vector<VkImageView> views;
+    for(RenderGraphResource r : pass.attachments)
+        views.push_back(_resources[r].view);
+    auto it = pass.framebuffers.find(views);
+    if(it != pass.framebuffers.end())
+        return it->second;
+
+    vk::FramebufferCreateInfo framebufferInfo{};
+    framebufferInfo.renderPass = pass.renderPass;
+    framebufferInfo.attachmentCount = uint32_t(views.size());
+    framebufferInfo.pAttachments = reinterpret_cast<const vk::ImageView*>(views.data());
+    framebufferInfo.width = pass.extent.width;
+    framebufferInfo.height = pass.extent.height;
+    framebufferInfo.layers = 1;
+    vk::Framebuffer framebuffer = _device.createFramebuffer(framebufferInfo);
+    pass.framebuffers.emplace(std::move(views), framebuffer);
+    _compiled.framebuffers.push_back(framebuffer);
+    return framebuffer;
+}
+
+void RenderGraph::execute(vk::CommandBuffer cmd){
+    for(auto& pass : _passes){
+        if(pass.culled)
+            continue;
+        if(!pass.barriers.empty()){
+            for(size_t i=0;i<pass.barriers.size();++i)
+                pass.barriers[i].image = _resources[pass.barrierResources[i]].image;
+            cmd.pipelineBarrier(pass.srcStages, pass.dstStages, {}, {}, {}, pass.barriers);
+        }
+
+        RenderGraphContext context;
+        context.cmd = cmd;
+        context.graph = this;
+        if(pass.renderPass){
+            context.renderPass = pass.renderPass;
+            context.framebuffer = getFramebuffer(pass);
+            context.extent = pass.extent;
+            context.renderPassBegin.renderPass = context.renderPass;
+            context.renderPassBegin.framebuffer = context.framebuffer;
+            context.renderPassBegin.renderArea = vk::Rect2D{{0, 0}, pass.extent};
+            context.renderPassBegin.setClearValues(pass.clearValues);
+        }
+        pass.execute(context);
+    }
+
+    if(!_finalBarriers.empty()){
+        for(size_t i=0;i<_finalBarriers.size();++i)
+            _finalBarriers[i].image = _resources[_finalResources[i]].image;
+        cmd.pipelineBarrier(_finalSrcStages, vk::PipelineStageFlagBits::eBottomOfPipe, {}, {}, {}, _finalBarriers);
+    }
+}
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.hpp"
+
+using RenderGraphResource = uint32_t;
+
+inline constexpr RenderGraphResource InvalidRenderGraphResource = ~0u;
+
+// Image owned by the graph, only valid during the frame. The usage flags of
+// the declared accesses are added automatically
+struct RenderGraphImageDesc {
+    vk::Format format{vk::Format::eUndefined};
+    vk::Extent2D extent;
+    vk::ImageUsageFlags usage;
+};
+
+// Image owned by someone else, e.g. a swapchain image. The actual image is
+// set before every execute()
+struct RenderGraphImportDesc {
+    vk::Format format{vk::Format::eUndefined};
+    vk::Extent2D extent;
+    // layout at the start of the frame and the one it is left in
+    vk::ImageLayout initialLayout{vk::ImageLayout::eUndefined};
+    vk::ImageLayout finalLayout{vk::ImageLayout::eUndefined};
+    // stages the first access has to wait for, e.g. the stage the swapchain
+    // acquire semaphore is waited on
+    vk::PipelineStageFlags waitStages{vk::PipelineStageFlagBits::eTopOfPipe};
+};
+
+// outcome of the last compile()
+struct RenderGraphStats {
+    uint32_t passes{0};
+    uint32_t culledPasses{0};
+    // including the ones into the final layouts of imported images
+    uint32_t imageBarriers{0};
+    uint32_t transientImages{0};
+    // memory of the transient images, and what it would be without aliasing
+    vk::DeviceSize transientBytes{0};
+    vk::DeviceSize unaliasedBytes{0};
+};
+
+// What a pass gets to record itself. Raster passes begin and end their
+// render pass themselves, so they may pick inline or secondary contents
+struct RenderGraphContext {
+    vk::CommandBuffer cmd;
+    // null for passes without attachments
+    vk::RenderPass renderPass;
+    vk::Framebuffer framebuffer;
+    vk::Extent2D extent;
+    // render pass, framebuffer, area and the declared clear values
+    vk::RenderPassBeginInfo renderPassBegin;
+    const class RenderGraph* graph{nullptr};
+
+    vk::ImageView view(RenderGraphResource resource) const;
+
+    vk::Image image(RenderGraphResource resource) const;
+};
+
+using RenderGraphExecute = std::function<void(RenderGraphContext&)>;
+
+class RenderGraph;
+
+// Declares what a pass reads and writes. Attachments are bound in declaration
+// order, colors first and depth last in the framebuffer
+class RenderGraphPassBuilder {
+public:
+    RenderGraphPassBuilder(RenderGraph& graph, uint32_t pass) : _graph(graph), _pass(pass){}
+
+    // without a clear value the previous contents are loaded, if there are any
+    RenderGraphPassBuilder& colorAttachment(RenderGraphResource resource, std::optional<vk::ClearColorValue> clear = {});
+
+    RenderGraphPassBuilder& depthAttachment(RenderGraphResource resource, std::optional<vk::ClearDepthStencilValue> clear = {});
+
+    RenderGraphPassBuilder& sampled(RenderGraphResource resource, vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eFragmentShader);
+
+    RenderGraphPassBuilder& storageRead(RenderGraphResource resource, vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eComputeShader);
+
+    RenderGraphPassBuilder& storageWrite(RenderGraphResource resource, vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eComputeShader);
+
+    RenderGraphPassBuilder& transferSrc(RenderGraphResource resource);
+
+    RenderGraphPassBuilder& transferDst(RenderGraphResource resource);
+
+    // never culled, for passes with effects outside of the graph
+    RenderGraphPassBuilder& sideEffects();
+
+    uint32_t index() const {
+        return _pass;
+    }
+
+private:
+    RenderGraph& _graph;
+    uint32_t _pass;
+};
+
+// Frame graph of passes over images. Passes declare their accesses, compile()
+// then
+//  - culls passes that contribute nothing to an imported image or a pass
+//    with side effects
+//  - derives one pipeline barrier per pass with the layout transitions and the
+//    minimal stages and accesses, reads after reads need none
+//  - creates a render pass per raster pass, storing only attachments that
+//    are read later
+//  - places transient images whose lifetimes don't overlap in the same memory
+//
+// Declarations and compiled objects stay valid until reset(), the graph is
+// rebuilt only when its inputs change, e.g. on swapchain recreation. Passes
+// run in declaration order on one queue
+class RenderGraph {
+public:
+    void init(vk::Device device, GpuAllocator& allocator, uint32_t framesInFlight);
+
+    // the frames that executed the graph must have retired
+    void destroy();
+
+    // Drops every pass and resource. The compiled objects are destroyed by
+    // retire() once the frames up to frameNumber that may use them retired
+    void reset(uint64_t frameNumber);
+
+    RenderGraphResource createImage(const std::string& name, const RenderGraphImageDesc& desc);
+
+    RenderGraphResource importImage(const std::string& name, const RenderGraphImportDesc& desc);
+
+    RenderGraphPassBuilder addPass(const std::string& name, RenderGraphExecute execute);
+
+    // throws on inconsistent declarations
+    void compile();
+
+    // before execute(), every frame
+    void setImportedImage(RenderGraphResource resource, vk::Image image, vk::ImageView view);
+
+    void execute(vk::CommandBuffer cmd);
+
+    // destroys compiled objects retired before frames that have now retired
+    void retire(uint64_t frameNumber);
+
+    // null when the pass was culled or has no attachments
+    vk::RenderPass renderPass(uint32_t pass) const;
+
+    // Equal for compatible render passes, also across reset(). Pipelines are
+    // keyed on it, see GraphicsPipelineDesc::renderPassKey
+    uint64_t renderPassKey(uint32_t pass) const;
+
+    vk::ImageView view(RenderGraphResource resource) const {
+        return _resources[resource].view;
+    }
+
+    vk::Image image(RenderGraphResource resource) const {
+        return _resources[resource].image;
+    }
+
+    bool isCulled(uint32_t pass) const {
+        return _passes[pass].culled;
+    }
+
+    RenderGraphStats stats() const {
+        return _stats;
+    }
+
+private:
+    friend class RenderGraphPassBuilder;
+
+    enum class AccessType {
+        ColorAttachment,
+        DepthAttachment,
+        Sampled,
+        StorageRead,
+        StorageWrite,
+        TransferSrc,
+        TransferDst,
+    };
+
+    struct Access {
+        RenderGraphResource resource;
+        AccessType type;
+        vk::PipelineStageFlags stages;
+        vk::AccessFlags access;
+        vk::ImageLayout layout;
+        bool write;
+        std::optional<vk::ClearValue> clear;
+
+        // attachments only, decided by compile()
+        vk::AttachmentLoadOp loadOp{vk::AttachmentLoadOp::eDontCare};
+        vk::AttachmentStoreOp storeOp{vk::AttachmentStoreOp::eDontCare};
+    };
+
+    struct Resource {
+        std::string name;
+        bool imported{false};
+        RenderGraphImageDesc desc;
+        RenderGraphImportDesc import;
+        vk::Image image;
+        vk::ImageView view;
+        // first and last kept pass using it, transient only
+        uint32_t firstPass{~0u};
+        uint32_t lastPass{0};
+        // state at the start of a frame, the last accesses of everything
+        // sharing its memory, so the next frame waits for the previous one
+        vk::PipelineStageFlags frameStartStages;
+        vk::AccessFlags frameStartAccess;
+    };
+
+    struct Pass {
+        std::string name;
+        RenderGraphExecute execute;
+        std::vector<Access> accesses;
+        bool sideEffects{false};
+        bool culled{false};
+
+        // compiled
+        vk::PipelineStageFlags srcStages;
+        vk::PipelineStageFlags dstStages;
+        std::vector<vk::ImageMemoryBarrier> barriers;
+        // images are filled in at execute(), imported ones change per frame
+        std::vector<RenderGraphResource> barrierResources;
+        vk::RenderPass renderPass;
+        uint64_t renderPassKey{0};
+        vk::Extent2D extent;
+        std::vector<RenderGraphResource> attachments;
+        std::vector<vk::ClearValue> clearValues;
+        // keyed by the attachment views, imported views change per frame
+        std::map<std::vector<VkImageView>, vk::Framebuffer> framebuffers;
+    };
+
+    // Vulkan objects of one compile, destroyed together
+    struct Compiled {
+        std::vector<vk::RenderPass> renderPasses;
+        std::vector<vk::Framebuffer> framebuffers;
+        std::vector<vk::ImageView> views;
+        std::vector<vk::Image> images;
+        std::vector<VmaAllocation> memory;
+        uint64_t retireFrame{0};
+    };
+
+    void addAccess(uint32_t pass, const Access& access);
+
+    void cullPasses();
+
+    void allocateTransients();
+
+    void computeBarriers();
+
+    void chooseAttachmentOps();
+
+    void createRenderPasses();
+
+    vk::Framebuffer getFramebuffer(Pass& pass);
+
+    void destroyCompiled(Compiled& compiled);
+
+    vk::Device _device;
+    GpuAllocator* _allocator{nullptr};
+    uint32_t _framesInFlight{1};
+
+    std::vector<Resource> _resources;
+    std::vector<Pass> _passes;
+    // barriers into the final layouts of imported images
+    vk::PipelineStageFlags _finalSrcStages;
+    std::vector<vk::ImageMemoryBarrier> _finalBarriers;
+    std::vector<RenderGraphResource> _finalResources;
+    bool _compiledOnce{false};
+    RenderGraphStats _stats;
+
+    Compiled _compiled;
+    std::vector<Compiled> _retired;
+};
@@ -0,0 +1,85 @@
+#include "render_thread.hpp"
+
+#include <utility>
+
+RenderThread::~RenderThread(){
+    // an exception unwinding main must not leave a joinable thread behind
+    if(_thread.joinable()){
+        _stop.store(true, std::memory_order_release);
+        _thread.join();
+    }
+}
+
+void RenderThread::start(Renderer& renderer, uint64_t maxFrames){
+    _renderer = &renderer;
+    _stop.store(false);
+    _finished.store(false);
+    _frames.store(0);
+    _error = nullptr;
+    _latencySumMs = 0;
+    _latencySamples = 0;
+    _thread = std::thread(&RenderThread::loop, this, maxFrames);
+}
+
+void RenderThread::stop(){
+    _stop.store(true, std::memory_order_release);
+    if(_thread.joinable())
+        _thread.join();
+    if(_error)
+        std::rethrow_exception(std::exchange(_error, nullptr));
+}
+
+double RenderThread::inputLatencyMs() const {
+    return _latencySamples > 0 ? _latencySumMs / _latencySamples : 0.0;
+}
+
+void RenderThread::loop(uint64_t maxFrames){
+    try{
+        // per frame jobs are run and waited on from here now
+        _renderer->bindRenderThread();
+
+        uint64_t frames = 0;
+        while(!_stop.load(std::memory_order_acquire)){
+            RenderInput input;
+            RenderInput latest;
+            bool received = false;
+            bool resized = false;
+            while(_inputs.pop(input)){
+                resized = resized || input.resized;
+                latest = input;
+                received = true;
+            }
+            if(received){
+                if(resized)
+                    _renderer->requestSwapchainRecreate(latest.drawableSize);
+                if(latest.presentPolicy != _renderer->config.presentPolicy)
+                    _renderer->setPresentPolicy(latest.presentPolicy);
+                _latencySumMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - latest.polledAt).count();
+                ++_latencySamples;
+            }
+
+            uint64_t frameNumber = _renderer->_frameNumber;
+            _renderer->draw();
+            // minimized or out of date, nothing was rendered
+            if(_renderer->_frameNumber == frameNumber){
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                continue;
+            }
+            _frames.store(++frames, std::memory_order_relaxed);
+            if(maxFrames != 0 && frames >= maxFrames)
+                break;
+        }
+    }
+    catch(...){
+        _error = std::current_exception();
+    }
+
+    try{
+        _renderer->shutdown();
+    }
+    catch(...){
+        if(!_error)
+            _error = std::current_exception();
+    }
+    _finished.store(true, std::memory_order_release);
+}
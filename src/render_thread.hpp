@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <thread>
+#include <vulkan/vulkan.hpp>
+
+#include "renderer.hpp"
+#include "spsc_queue.hpp"
+
+// Window and input state at one event poll of the main thread
+struct RenderInput {
+    // drawable size of the window in pixels, 0 while minimized
+    vk::Extent2D drawableSize;
+    // the window was resized since the last snapshot that went through
+    bool resized{false};
+    PresentPolicy presentPolicy{PresentPolicy::Fifo};
+    std::chrono::steady_clock::time_point polledAt;
+};
+
+// Runs Renderer::draw() in a loop on its own thread so the main thread keeps
+// handling window events while a frame is slow or acquire blocks. The main
+// thread pushes snapshots through a lock-free queue, the render thread applies
+// the newest one before each frame, merging the resize flags of the ones
+// it skipped.
+//
+// Shutdown: stop() asks the loop to end after the current frame, the render
+// thread then waits for the device to go idle with Renderer::shutdown() and
+// exits. Once stop() returned the renderer can be destroyed on the main thread
+class RenderThread {
+public:
+    static constexpr uint32_t QueueSize = 64;
+
+    ~RenderThread();
+
+    // maxFrames 0 renders until stop()
+    void start(Renderer& renderer, uint64_t maxFrames = 0);
+
+    // main thread, false when the render thread is behind and the queue full
+    bool push(const RenderInput& input){
+        return _inputs.push(input);
+    }
+
+    // true once the loop ended, after maxFrames or an error
+    bool finished() const {
+        return _finished.load(std::memory_order_acquire);
+    }
+
+    // Ends the loop and joins the thread, rethrows what ended it early
+    void stop();
+
+    uint64_t frames() const {
+        return _frames.load(std::memory_order_relaxed);
+    }
+
+    // average age of the snapshot a frame started with
+    double inputLatencyMs() const;
+
+private:
+    void loop(uint64_t maxFrames);
+
+    Renderer* _renderer{nullptr};
+    SpscQueue<RenderInput, QueueSize> _inputs;
+    std::thread _thread;
+    std::atomic<bool> _stop{false};
+    std::atomic<bool> _finished{false};
+    std::atomic<uint64_t> _frames{0};
+    std::exception_ptr _error;
+
+    // render thread only until stop() joined
+    double _latencySumMs{0};
+    uint64_t _latencySamples{0};
+};
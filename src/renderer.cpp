@@ -1,95 +1,678 @@
 #include "renderer.hpp"
+#include <volk.h>
 #include <vulkan/vulkan.hpp>
-
-Renderer::Renderer(bool validationLayers) : enableValidationLayers(validationLayers){
-    initSDL();
+#include <glm/vec4.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <exception>
+#include <mutex>
+
+#include <shaders/scene_vert.hpp>
+#include <shaders/scene_frag.hpp>
+#include <shaders/triangle_vert.hpp>
+#include <shaders/triangle_frag.hpp>
+
+// Storage of the dispatcher every vulkan.hpp call goes through. Global, so
+// only one Renderer can be alive at a time
+VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
+
+Renderer::Renderer(RendererConfig config) : config(config){
+    if(config.framesInFlight==0)
+        throw std::runtime_error("need at least one frame in flight");
+    if(config.headless && config.headlessImageCount==0)
+        throw std::runtime_error("need at least one offscreen image");
+    if(!config.headless){
+        StartupTrace::Scope scope(_startupTrace, "sdl");
+        initSDL();
+    }
+    if(config.jobThreads == ~0u){
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        config.jobThreads = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+    }
+    {
+        StartupTrace::Scope scope(_startupTrace, "job system");
+        _jobs.init(config.jobThreads);
+    }
     initVulkan();
+    if(!config.startupTracePath.empty() && !_startupTrace.writeChromeTrace(config.startupTracePath.c_str()))
+        fprintf(stderr, "failed to write %s\n", config.startupTracePath.c_str());
 }
 
 Renderer::~Renderer(){
-    vk::resultCheck(
-        _device.waitForFences(_renderFence, true, 1000000000),
-        "wait for fence"
-    );
-    _device.destroyFence(_renderFence);
-    _device.destroySemaphore(_renderSemaphore);
-    _device.destroySemaphore(_presentSemaphore);
-    for(int i=0;i<_frameBuffers.size();++i){
-        _device.destroyFramebuffer(_frameBuffers[i]);
-    }
-    _device.destroyRenderPass(_renderPass);
-    _device.destroyCommandPool(_commandPool);
+    shutdown();
+    _textures.destroy();
+    _capture.destroy();
+    _post.destroy();
+    _uploads.destroy();
+    _profiler.destroy();
+    _pipelines.destroy();
+    destroyShaderProgram(_device, _triangleProgram);
+    if(config.gpuCulling){
+        _culling.destroy();
+        destroyShaderProgram(_device, _sceneProgram);
+        destroyMesh(_allocator, _sceneMesh);
+        for(auto& frame : _frames){
+            _allocator.destroyBuffer(frame.sceneInstances);
+            _allocator.destroyBuffer(frame.sceneTextureTable);
+        }
+        _device.destroySampler(_sceneSampler);
+    }
+    _bindless.destroy();
+    for(auto& frame : _frames){
+        _device.destroyFence(frame.renderFence);
+        _device.destroySemaphore(frame.presentSemaphore);
+        _device.destroyCommandPool(frame.commandPool);
+        for(auto& worker : frame.workerCommands)
+            _device.destroyCommandPool(worker.commandPool);
+        frame.arena.destroy(_allocator);
+    }
+    destroyRetiredSwapchains(true);
+    _graph.destroy();
     for(auto im : _swapchainImageViews)
         _device.destroyImageView(im);
-    _device.destroySwapchainKHR(_swapchain);
+    for(auto semaphore : _renderSemaphores)
+        _device.destroySemaphore(semaphore);
+    if(config.headless){
+        for(auto& target : _offscreenTargets)
+            _allocator.destroyImage(target);
+    }
+    else
+        _device.destroySwapchainKHR(_swapchain);
+    _registry.destroy();
+    _allocator.destroy();
     _device.destroy();
-    _instance.destroySurfaceKHR(_surface);
+    if(!config.headless)
+        _instance.destroySurfaceKHR(_surface);
     _instance.destroy();
-    SDL_DestroyWindow(_window);
+    if(!config.headless)
+        SDL_DestroyWindow(_window);
+    _jobs.destroy();
+}
+
+void Renderer::shutdown(){
+    if(_shutdown)
+        return;
+    _shutdown = true;
+    // every queue, so culling and uploads in flight are covered as well as
+    // the frames, and no timeout that could expire on a slow last frame
+    std::lock_guard<std::mutex> queueLock(_uploads.queueMutex());
+    _device.waitIdle();
 }
 
 void Renderer::draw(){
-    printf("frame:%ld\n",_frameNumber);
-    // Timeout 1 second
-    vk::resultCheck(
-        _device.waitForFences(_renderFence, true, 1000000000),
-        "wait for fence"
-    );
-    _device.resetFences(_renderFence);
+    FrameData& frame = getCurrentFrame();
+    uint32_t frameSlot = _frameNumber % _frames.size();
+    _profiler.beginFrame(_frameNumber);
 
-    auto [swapImageResult, swapImageInd] = _device.acquireNextImageKHR(_swapchain,1000000000,_presentSemaphore,{});
-    vk::resultCheck(swapImageResult,"swapchain image");
-    _commandBuffer.reset();
+    // start the copies queued since the last frame on the transfer queue
+    _uploads.flush();
 
-    // Prepare cmd
-    vk::CommandBufferBeginInfo cmdBeginInfo{
-        vk::CommandBufferUsageFlagBits::eOneTimeSubmit
-    };
+    // Wait until the GPU is done with this frame slot, only blocks when 
+    // the CPU is config.framesInFlight frames ahead. Timeout 1 second
+    {
+        Profiler::CpuScope scope(_profiler, "fence wait");
+        vk::resultCheck(
+            _device.waitForFences(frame.renderFence, true, 1000000000),
+            "wait for fence"
+        );
+    }
+    // the timestamps the slot's previous frame wrote are available now
+    _profiler.collect(frameSlot);
+    _bindless.retire(_frameNumber);
+    _graph.retire(_frameNumber);
+    _textures.update(_frameNumber);
+    _capture.poll(_frameNumber);
+    _registry.retire(_frameNumber);
+    // everything the retired frame allocated is no longer read by the GPU
+    frame.arena.reset();
+    for(auto& worker : frame.workerCommands){
+        if(worker.used > 0)
+            _device.resetCommandPool(worker.commandPool);
+        worker.used = 0;
+    }
+
+    uint32_t swapImageInd;
+    if(config.headless){
+        // offscreen targets are simply rotated, there is nothing to acquire
+        swapImageInd = _frameNumber % _swapchainImages.size();
+    }
+    else{
+        Profiler::CpuScope scope(_profiler, "acquire");
+        destroyRetiredSwapchains(false);
+        if(_swapchainDirty){
+            recreateSwapchain();
+            // minimized, nothing to draw into
+            if(_swapchainDirty)
+                return;
+        }
+
+        vk::Result swapImageResult;
+        try{
+            auto [result, imageInd] = _device.acquireNextImageKHR(_swapchain,1000000000,frame.presentSemaphore,{});
+            swapImageResult = result;
+            swapImageInd = imageInd;
+        }
+        catch(vk::OutOfDateKHRError&){
+            // the semaphore was not signaled and the fence is untouched, retry next frame
+            _swapchainDirty = true;
+            return;
+        }
+        // a suboptimal image can still be presented, recreate afterwards
+        if(swapImageResult == vk::Result::eSuboptimalKHR)
+            _swapchainDirty = true;
+        else
+            vk::resultCheck(swapImageResult,"swapchain image");
+    }
 
-    _commandBuffer.begin(cmdBeginInfo);
+    // The image may still be in use by an older frame slot when the swapchain
+    // has fewer images than frames in flight or returns them out of order
+    if(_imagesInFlight[swapImageInd] && _imagesInFlight[swapImageInd]!=frame.renderFence){
+        vk::resultCheck(
+            _device.waitForFences(_imagesInFlight[swapImageInd], true, 1000000000),
+            "wait for image fence"
+        );
+    }
+    _imagesInFlight[swapImageInd] = frame.renderFence;
 
-    vk::ClearValue clVal{
+    // Submitted ahead of the graphics work so it overlaps with the previous
+    // frame when the compute queue runs asynchronously
+    vk::Semaphore cullSemaphore;
+    if(config.gpuCulling){
+        _sceneViewProj = sceneViewProj();
         {
-            0.0f,
-            0.0f,
-            std::abs(std::sin(_frameNumber/120.f)),
-            0.0f
+            Profiler::CpuScope scope(_profiler, "scene update");
+            updateScene(frame);
         }
-    };
-    vk::RenderPassBeginInfo rpInfo{};
-    rpInfo.renderPass = _renderPass;
-    rpInfo.renderArea = vk::Rect2D{
-        {0,0},
-        _window_size
-    };
-    rpInfo.framebuffer = _frameBuffers[swapImageInd];
-    rpInfo.clearValueCount = 1;
-    rpInfo.pClearValues = &clVal;
+        Profiler::CpuScope scope(_profiler, "cull");
+        cullSemaphore = _culling.cull(frameSlot, _sceneViewProj, frame.sceneInstanceIndex);
+    }
 
-    _commandBuffer.beginRenderPass(&rpInfo, vk::SubpassContents::eInline);
-    _commandBuffer.endRenderPass();
-    _commandBuffer.end();
+    uint64_t uploadWaitValue;
+    {
+        Profiler::CpuScope scope(_profiler, "record");
+        _device.resetFences(frame.renderFence);
+        frame.commandBuffer.reset();
+
+        // Prepare cmd
+        vk::CommandBufferBeginInfo cmdBeginInfo{
+            vk::CommandBufferUsageFlagBits::eOneTimeSubmit
+        };
+
+        frame.commandBuffer.begin(cmdBeginInfo);
+        _profiler.beginGpuFrame(frame.commandBuffer, frameSlot);
+
+        // take ownership of finished uploads before anything can read them
+        uploadWaitValue = _uploads.recordAcquires(frame.commandBuffer);
+        // the mesh is acquired at the latest just above
+        if(config.gpuCulling && !_sceneMeshReady)
+            _sceneMeshReady = _uploads.isReady(_sceneMeshTicket);
+
+        if(config.gpuCulling)
+            _culling.recordAcquire(frame.commandBuffer, frameSlot);
+        else
+            buildDrawList();
+        _graph.setImportedImage(_backbuffer, _swapchainImages[swapImageInd], _swapchainImageViews[swapImageInd]);
+        if(_post.enabled()){
+            _post.beginFrame(_frameNumber);
+            _graph.setImportedImage(_hdr, _post.hdrImage(), _post.hdrView());
+        }
+        {
+            Profiler::GpuScope gpuScope(_profiler, frame.commandBuffer, "main pass");
+            _graph.execute(frame.commandBuffer);
+        }
+        _profiler.endGpuFrame(frame.commandBuffer);
+        frame.commandBuffer.end();
+    }
+
+    frame.arena.flush(_allocator);
 
     // submit cmd
+    // the swapchain image is only needed once we write color, the uploads
+    // wait covers every stage that may read the acquired resources.
+    // Values for binary semaphores are ignored
+    std::vector<vk::Semaphore> waitSemaphores;
+    std::vector<vk::PipelineStageFlags> waitStages;
+    std::vector<uint64_t> waitValues;
+    if(!config.headless){
+        waitSemaphores.push_back(frame.presentSemaphore);
+        waitStages.push_back(_post.enabled() ? vk::PipelineStageFlagBits::eTransfer : vk::PipelineStageFlagBits::eColorAttachmentOutput);
+        waitValues.push_back(0);
+    }
+    if(uploadWaitValue!=0){
+        waitSemaphores.push_back(_uploads.timeline());
+        waitStages.push_back(vk::PipelineStageFlagBits::eAllCommands);
+        waitValues.push_back(uploadWaitValue);
+    }
+    if(cullSemaphore){
+        waitSemaphores.push_back(cullSemaphore);
+        waitStages.push_back(vk::PipelineStageFlagBits::eDrawIndirect);
+        waitValues.push_back(0);
+    }
+    // only the output copy waits for the post processing of the previous
+    // frame, the main pass overlaps with it
+    std::vector<vk::Semaphore> signalSemaphores;
+    if(!config.headless)
+        signalSemaphores.push_back(_renderSemaphores[swapImageInd]);
+    if(_post.enabled()){
+        if(_post.outputWaitValue()!=0){
+            waitSemaphores.push_back(_post.timeline());
+            waitStages.push_back(vk::PipelineStageFlagBits::eTransfer);
+            waitValues.push_back(_post.outputWaitValue());
+        }
+        signalSemaphores.push_back(_post.hdrReady());
+    }
+
+    vk::TimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.setWaitSemaphoreValues(waitValues);
+
     vk::SubmitInfo submit{};
-    vk::PipelineStageFlags waitStage{vk::PipelineStageFlagBits::eColorAttachmentOutput};
-    submit.pWaitDstStageMask = &waitStage; //??
+    submit.pNext = &timelineInfo;
+    submit.setWaitSemaphores(waitSemaphores);
+    submit.setWaitDstStageMask(waitStages);
+    submit.setSignalSemaphores(signalSemaphores);
+    submit.setCommandBuffers(frame.commandBuffer);
 
-    submit.setWaitSemaphores(_presentSemaphore);
-    submit.setSignalSemaphores(_renderSemaphore);
-    submit.setCommandBuffers(_commandBuffer);
+    {
+        Profiler::CpuScope scope(_profiler, "submit");
+        std::lock_guard<std::mutex> queueLock(_uploads.queueMutex());
+        _graphicsQueue.submit(submit,frame.renderFence);
+    }
+
+    if(_post.enabled()){
+        Profiler::CpuScope scope(_profiler, "post");
+        _post.submit();
+    }
 
-    _graphicsQueue.submit(submit,_renderFence);
+    if(config.headless){
+        _profiler.endFrame();
+        ++_frameNumber;
+        return;
+    }
 
     // present render
     vk::PresentInfoKHR presentInfo{};
     presentInfo.setSwapchains(_swapchain);
-    presentInfo.setWaitSemaphores(_renderSemaphore);
+    presentInfo.setWaitSemaphores(_renderSemaphores[swapImageInd]);
     presentInfo.setImageIndices(swapImageInd);
-    vk::resultCheck(_graphicsQueue.presentKHR(presentInfo),"failed present");
+    vk::Result presentResult;
+    {
+        Profiler::CpuScope scope(_profiler, "present");
+        std::lock_guard<std::mutex> queueLock(_uploads.queueMutex());
+        try{
+            presentResult = _graphicsQueue.presentKHR(presentInfo);
+        }
+        catch(vk::OutOfDateKHRError&){
+            presentResult = vk::Result::eErrorOutOfDateKHR;
+        }
+    }
+    if(presentResult == vk::Result::eSuboptimalKHR || presentResult == vk::Result::eErrorOutOfDateKHR)
+        _swapchainDirty = true;
+    else
+        vk::resultCheck(presentResult,"failed present");
+    _profiler.endFrame();
     ++_frameNumber;
 }
 
+void Renderer::setPresentPolicy(PresentPolicy policy){
+    config.presentPolicy = policy;
+    if(!config.headless)
+        _swapchainDirty = true;
+}
+
+vk::ShaderModule Renderer::createShaderModule(const uint32_t* code, size_t size){
+    vk::ShaderModuleCreateInfo moduleInfo{};
+    moduleInfo.codeSize = size;
+    moduleInfo.pCode = code;
+    return _device.createShaderModule(moduleInfo);
+}
+
+void Renderer::buildDrawList(){
+    // triangles sharing a material sort into one instanced draw
+    _drawQueue.clear();
+    uint32_t first = _drawQueue.append(config.testDrawCount);
+    uint32_t materialCount = std::max(config.testMaterialCount, 1u);
+    // per draw transform update, independent per item
+    _jobs.parallelFor(config.testDrawCount, 1024, [&](uint32_t begin, uint32_t end, uint32_t){
+        for(uint32_t i=begin;i<end;++i){
+            uint32_t material = i % materialCount;
+            DrawPacket& packet = _drawQueue.packet(first + i);
+            packet.key = makeDrawKey(0, 0, material, 0);
+            packet.pipeline = _trianglePipeline;
+            packet.layout = _triangleProgram.layout;
+            packet.count = 3;
+            packet.material = material;
+            packet.materialStages = _triangleProgram.pushConstants.stageFlags;
+            float t = float(i) / float(config.testDrawCount);
+            TriangleInstance instance;
+            instance.color = glm::vec4(1.0f, 0.5f + 0.5f*t, 0.1f, 1.0f);
+            instance.angle = _frameNumber/60.f + t*6.2831853f;
+            std::memcpy(_drawQueue.instanceData(first + i), &instance, sizeof(instance));
+        }
+    });
+    _drawQueue.build(getCurrentFrame().arena);
+}
+
+void Renderer::initScene(const MeshFile& file){
+    // sub-meshes the objects cycle through, in mesh space
+    std::vector<MeshFileSubMesh> meshes;
+    // brings the mesh file to about unit size
+    float meshScale = 1.0f;
+    if(!config.scenePath.empty()){
+        if(file.subMeshCount() == 0)
+            throw std::runtime_error("mesh has no sub-meshes " + config.scenePath);
+        _sceneMeshTicket = uploadMesh(file, _allocator, _uploads, _sceneMesh);
+        meshes.assign(file.subMeshes(), file.subMeshes() + file.subMeshCount());
+        const MeshFileBounds& bounds = file.header().bounds;
+        glm::vec3 halfExtent = (glm::vec3(bounds.max[0], bounds.max[1], bounds.max[2]) - glm::vec3(bounds.min[0], bounds.min[1], bounds.min[2])) * 0.5f;
+        if(glm::length(halfExtent) > 0.0f)
+            meshScale = 0.87f / glm::length(halfExtent);
+
+        _sceneProgram = createShaderProgram(_device, {&shaders::scene_vert, &shaders::scene_frag}, _bindless);
+        file.matchVertexInput(_sceneProgram);
+    }
+    else{
+        // cube and square pyramid around the origin, counter clockwise seen from
+        // outside, both fit a sphere of radius 0.87
+        const float vertices[] = {
+            -0.5f, -0.5f, -0.5f,   0.5f, -0.5f, -0.5f,   0.5f,  0.5f, -0.5f,  -0.5f,  0.5f, -0.5f,
+            -0.5f, -0.5f,  0.5f,   0.5f, -0.5f,  0.5f,   0.5f,  0.5f,  0.5f,  -0.5f,  0.5f,  0.5f,
+            -0.5f,  0.5f, -0.5f,   0.5f,  0.5f, -0.5f,   0.5f,  0.5f,  0.5f,  -0.5f,  0.5f,  0.5f,
+             0.0f, -0.5f,  0.0f,
+        };
+        const uint32_t indices[] = {
+            0, 2, 1,  0, 3, 2,  4, 5, 6,  4, 6, 7,  0, 1, 5,  0, 5, 4,
+            3, 7, 6,  3, 6, 2,  0, 4, 7,  0, 7, 3,  1, 2, 6,  1, 6, 5,
+            0, 2, 1,  0, 3, 2,  0, 1, 4,  1, 2, 4,  2, 3, 4,  3, 0, 4,
+        };
+        MeshFileSubMesh cube{};
+        cube.indexCount = 36;
+        cube.sphereRadius = 0.87f;
+        MeshFileSubMesh pyramid = cube;
+        pyramid.firstIndex = 36;
+        pyramid.indexCount = 18;
+        pyramid.vertexOffset = 8;
+        meshes = {cube, pyramid};
+
+        _sceneMesh.vertices = _allocator.createBuffer(MemoryClass::StaticGeometry, sizeof(vertices),
+            vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst);
+        _sceneMesh.indices = _allocator.createBuffer(MemoryClass::StaticGeometry, sizeof(indices),
+            vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst);
+        _sceneMesh.indexType = vk::IndexType::eUint32;
+        _uploads.uploadBuffer(_sceneMesh.vertices, 0, vertices, sizeof(vertices));
+        // tickets grow, the later one covers both
+        _sceneMeshTicket = _uploads.uploadBuffer(_sceneMesh.indices, 0, indices, sizeof(indices));
+
+        _sceneProgram = createShaderProgram(_device, {&shaders::scene_vert, &shaders::scene_frag}, _bindless);
+    }
+
+    uint32_t objectCount = config.testDrawCount;
+    std::vector<CullObject> objects(objectCount);
+    _scene.clear();
+    _scene.reserve(objectCount);
+    // grid centered on the origin, the camera flies through it
+    uint32_t side = uint32_t(std::ceil(std::cbrt(double(objectCount))));
+    const float spacing = 3.0f;
+    for(uint32_t i=0;i<objectCount;++i){
+        glm::vec3 cell{float(i % side), float(i / side % side), float(i / (side*side))};
+        const MeshFileSubMesh& mesh = meshes[i % meshes.size()];
+        SceneNode node = _scene.create();
+        _scene.setPosition(node, (cell - glm::vec3(float(side - 1) * 0.5f)) * spacing);
+        _scene.setScale(node, (0.75f + 0.5f * float(i % 7) / 6.0f) * meshScale);
+        _scene.setBounds(node, glm::vec4(mesh.sphereCenter[0], mesh.sphereCenter[1], mesh.sphereCenter[2], mesh.sphereRadius));
+        _scene.setColor(node, glm::vec4(cell / float(side), 1.0f));
+
+        objects[i].indexCount = mesh.indexCount;
+        objects[i].firstIndex = mesh.firstIndex;
+        objects[i].vertexOffset = mesh.vertexOffset;
+    }
+
+    // written by the host, read by the compute and graphics queues
+    std::vector<uint32_t> families{_queueIndices.graphicsFamily.value(), _queueIndices.computeFamily.value()};
+    for(auto& frame : _frames){
+        frame.sceneInstances = _allocator.createBuffer(
+            MemoryClass::Staging,
+            std::max<vk::DeviceSize>(objectCount * sizeof(SceneInstance), 1),
+            vk::BufferUsageFlagBits::eStorageBuffer,
+            families
+        );
+        frame.sceneInstanceIndex = _bindless.registerBuffer(frame.sceneInstances.buffer);
+        frame.sceneTextureTable = _allocator.createBuffer(
+            MemoryClass::Staging,
+            MaxSceneTextures * sizeof(BindlessIndex),
+            vk::BufferUsageFlagBits::eStorageBuffer
+        );
+        frame.sceneTextureTableIndex = _bindless.registerBuffer(frame.sceneTextureTable.buffer);
+    }
+
+    // the streamed textures keep their tail mips, sampling picks the rest
+    vk::SamplerCreateInfo samplerInfo{};
+    samplerInfo.magFilter = vk::Filter::eLinear;
+    samplerInfo.minFilter = vk::Filter::eLinear;
+    samplerInfo.mipmapMode = vk::SamplerMipmapMode::eLinear;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    _sceneSampler = _device.createSampler(samplerInfo);
+    _sceneSamplerIndex = _bindless.registerSampler(_sceneSampler);
+
+    _culling.init(
+        _device,
+        _allocator,
+        _uploads,
+        _bindless,
+        _pipelines,
+        _computeQueue,
+        _queueIndices.computeFamily.value(),
+        _queueIndices.graphicsFamily.value(),
+        config.framesInFlight,
+        objectCount
+    );
+    _culling.setObjects(objects.data(), objectCount);
+
+    PipelineBuilder builder = pipelineBuilder();
+    _sceneProgram.configure(builder);
+    builder.cull(vk::CullModeFlagBits::eBack);
+    builder.depth(true, true);
+    _scenePipeline = _pipelines.getGraphicsPipeline(builder.desc());
+}
+
+void Renderer::updateScene(FrameData& frame){
+    // every object spins, objects share one of a few spin rates
+    constexpr uint32_t SpinCount = 8;
+    glm::quat spins[SpinCount];
+    float time = _frameNumber / 60.f;
+    for(uint32_t i=0;i<SpinCount;++i){
+        glm::vec3 axis = glm::normalize(glm::vec3(std::sin(float(i)), 1.0f, std::cos(float(i))));
+        spins[i] = glm::angleAxis(time * (0.5f + 0.25f * float(i)), axis);
+    }
+    _jobs.parallelFor(_scene.size(), 16384, [&](uint32_t begin, uint32_t end, uint32_t){
+        for(uint32_t i=begin;i<end;++i)
+            _scene.setRotation(i, spins[i % SpinCount]);
+    });
+
+    _scene.update(_jobs, static_cast<SceneInstance*>(frame.sceneInstances.mapped));
+    _allocator.flush(frame.sceneInstances, 0, _scene.size() * sizeof(SceneInstance));
+
+    // residency changed in update(), which swaps the images and their indices
+    BindlessIndex* table = static_cast<BindlessIndex*>(frame.sceneTextureTable.mapped);
+    for(size_t t=0;t<_sceneTextures.size();++t)
+        table[t] = _textures.bindlessIndex(_sceneTextures[t]);
+    _allocator.flush(frame.sceneTextureTable, 0, _sceneTextures.size() * sizeof(BindlessIndex));
+    requestSceneTextures();
+}
+
+void Renderer::setSceneTextures(const std::vector<TextureHandle>& textures){
+    if(textures.size() > MaxSceneTextures)
+        throw std::runtime_error("more scene textures than MaxSceneTextures");
+    _sceneTextures = textures;
+    uint32_t textureCount = uint32_t(textures.size());
+    for(SceneNode node=0;node<_scene.size();++node)
+        _scene.setMaterial(node, textureCount > 0 ? node % textureCount : NoSceneMaterial);
+}
+
+void Renderer::requestSceneTextures(){
+    if(_sceneTextures.empty())
+        return;
+    uint32_t textureCount = uint32_t(_sceneTextures.size());
+    // pixels per world unit at distance 1
+    float focal = 0.5f * float(_swapchainExtent.height) / std::tan(glm::radians(SceneFovY * 0.5f));
+    _jobs.parallelFor(_scene.size(), 16384, [&](uint32_t begin, uint32_t end, uint32_t){
+        // largest projected diameter of the range, per texture
+        std::vector<float> pixels(textureCount, 0.0f);
+        for(uint32_t i=begin;i<end;++i){
+            uint32_t material = _scene.material(i);
+            if(material >= textureCount)
+                continue;
+            // The objects have no parents and their spheres sit about at their
+            // origin. Read from the scene, the instances are write combined.
+            // Clip w is the view depth. Objects beside the view still count,
+            // the exact visibility is only known to the culling pass
+            float radius = _scene.scaledRadius(i);
+            float depth = (_sceneViewProj * glm::vec4(_scene.position(i), 1.0f)).w;
+            if(depth <= radius)
+                continue;
+            float& size = pixels[material];
+            size = std::max(size, 2.0f * radius * focal / depth);
+        }
+        for(uint32_t t=0;t<textureCount;++t)
+            if(pixels[t] > 0.0f)
+                _textures.requestSize(_sceneTextures[t], pixels[t]);
+    });
+}
+
+glm::mat4 Renderer::sceneViewProj(){
+    uint32_t side = uint32_t(std::ceil(std::cbrt(double(config.testDrawCount))));
+    float extent = std::max(float(side) * 3.0f, 3.0f);
+    float angle = _frameNumber / 240.f;
+    glm::vec3 eye{std::cos(angle) * extent * 0.6f, extent * 0.2f, std::sin(angle) * extent * 0.6f};
+    glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    float aspect = float(_swapchainExtent.width) / float(std::max(_swapchainExtent.height, 1u));
+    glm::mat4 proj = glm::perspectiveRH_ZO(glm::radians(SceneFovY), aspect, 0.1f, extent * 2.0f);
+    // Vulkan clip space has y pointing down
+    proj[1][1] *= -1.0f;
+    return proj * view;
+}
+
+void Renderer::recordScene(vk::CommandBuffer cmd){
+    if(!_sceneMeshReady)
+        return;
+    vk::Viewport viewport{0.0f, 0.0f, float(_swapchainExtent.width), float(_swapchainExtent.height), 0.0f, 1.0f};
+    cmd.setViewport(0, viewport);
+    cmd.setScissor(0, vk::Rect2D{{0,0}, _swapchainExtent});
+
+    FrameData& frame = getCurrentFrame();
+    ScenePush push{_sceneViewProj, frame.sceneInstanceIndex, frame.sceneTextureTableIndex, _sceneSamplerIndex};
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, _scenePipeline);
+    _bindless.bind(cmd, vk::PipelineBindPoint::eGraphics);
+    cmd.pushConstants(_sceneProgram.layout, _sceneProgram.pushConstants.stageFlags, 0, sizeof(ScenePush), &push);
+    cmd.bindVertexBuffers(0, _sceneMesh.vertices.buffer, vk::DeviceSize{0});
+    cmd.bindIndexBuffer(_sceneMesh.indices.buffer, 0, _sceneMesh.indexType);
+    _culling.recordDraw(cmd, _frameNumber % _frames.size());
+}
+
+void Renderer::recordMainPass(FrameData& frame, const RenderGraphContext& context){
+    // below this a partition costs more in overhead than it saves
+    constexpr uint32_t MinDrawsPerPartition = 256;
+    uint32_t drawCount = _drawQueue.batchCount();
+    uint32_t workers = _jobs.workerCount();
+
+    // the graph has the declared clear values, the color pulses per frame
+    std::vector<vk::ClearValue> clearValues(
+        context.renderPassBegin.pClearValues,
+        context.renderPassBegin.pClearValues + context.renderPassBegin.clearValueCount
+    );
+    clearValues[0].color = vk::ClearColorValue{std::array<float, 4>{
+        0.0f,
+        0.0f,
+        std::abs(std::sin(_frameNumber/120.f)),
+        0.0f
+    }};
+    vk::RenderPassBeginInfo rpInfo = context.renderPassBegin;
+    rpInfo.setClearValues(clearValues);
+
+    // one indirect draw regardless of the object count, nothing to split
+    if(config.gpuCulling){
+        frame.commandBuffer.beginRenderPass(&rpInfo, vk::SubpassContents::eInline);
+        recordScene(frame.commandBuffer);
+        frame.commandBuffer.endRenderPass();
+        return;
+    }
+
+    if(workers == 1 || drawCount < 2*MinDrawsPerPartition){
+        frame.commandBuffer.beginRenderPass(&rpInfo, vk::SubpassContents::eInline);
+        recordDraws(frame.commandBuffer, 0, drawCount);
+        frame.commandBuffer.endRenderPass();
+        return;
+    }
+
+    // more partitions than workers so a slow worker doesn't hold up the frame.
+    // Partitions are contiguous and executed in index order, so the result does
+    // not depend on which worker recorded what
+    uint32_t partitionCount = std::min(workers*4, (drawCount + MinDrawsPerPartition - 1) / MinDrawsPerPartition);
+    uint32_t partitionSize = (drawCount + partitionCount - 1) / partitionCount;
+    std::vector<vk::CommandBuffer> secondaries(partitionCount);
+
+    auto recordPartition = [&](uint32_t partition, uint32_t worker){
+        WorkerCommands& commands = frame.workerCommands[worker];
+        if(commands.used == commands.secondaries.size()){
+            vk::CommandBufferAllocateInfo allocInfo{
+                commands.commandPool,
+                vk::CommandBufferLevel::eSecondary,
+                1
+            };
+            commands.secondaries.push_back(_device.allocateCommandBuffers(allocInfo)[0]);
+        }
+        vk::CommandBuffer cmd = commands.secondaries[commands.used++];
+
+        vk::CommandBufferInheritanceInfo inheritance{};
+        inheritance.renderPass = rpInfo.renderPass;
+        inheritance.subpass = 0;
+        inheritance.framebuffer = rpInfo.framebuffer;
+        vk::CommandBufferBeginInfo beginInfo{
+            vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+            &inheritance
+        };
+        cmd.begin(beginInfo);
+        uint32_t first = partition * partitionSize;
+        uint32_t count = std::min(partitionSize, drawCount - first);
+        recordDraws(cmd, first, count);
+        cmd.end();
+        secondaries[partition] = cmd;
+    };
+    // jobs must not throw, the first error is rethrown here once all are done
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    _jobs.parallelFor(partitionCount, 1, [&](uint32_t begin, uint32_t end, uint32_t worker){
+        for(uint32_t partition=begin;partition<end;++partition){
+            try{
+                recordPartition(partition, worker);
+            }
+            catch(...){
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if(!error)
+                    error = std::current_exception();
+            }
+        }
+    });
+    if(error)
+        std::rethrow_exception(error);
+
+    frame.commandBuffer.beginRenderPass(&rpInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+    frame.commandBuffer.executeCommands(secondaries);
+    frame.commandBuffer.endRenderPass();
+}
+
+void Renderer::recordDraws(vk::CommandBuffer cmd, uint32_t firstBatch, uint32_t batchCount){
+    // dynamic state is not inherited by secondaries, every buffer sets its own
+    vk::Viewport viewport{0.0f, 0.0f, float(_swapchainExtent.width), float(_swapchainExtent.height), 0.0f, 1.0f};
+    cmd.setViewport(0, viewport);
+    cmd.setScissor(0, vk::Rect2D{{0,0}, _swapchainExtent});
+    _drawQueue.record(cmd, firstBatch, firstBatch + batchCount);
+}
+
+PipelineBuilder Renderer::pipelineBuilder(){
+    PipelineBuilder builder;
+    builder.renderPass(_graph.renderPass(_mainPass), 0, _graph.renderPassKey(_mainPass));
+    return builder;
+}
+
 
 bool Renderer::checkValidationLayerSupport() {
     auto availableLayers = vk::enumerateInstanceLayerProperties();
@@ -116,11 +699,6 @@ std::vector<const char*> Renderer::getSDLRequiredExtensions(){
     SDL_Vulkan_GetInstanceExtensions(_window, &pCount, nullptr);
     std::vector<const char*> extensions(pCount);    
     SDL_Vulkan_GetInstanceExtensions(_window, &pCount, extensions.data());
-
-    for(const char *extension : extensions){
-        printf("Extension: %s\n", extension);
-    }
-
     return extensions;
 
 }
@@ -130,7 +708,8 @@ void Renderer::initSDL(){
     err = SDL_Init(SDL_INIT_VIDEO);
     assert(err >= 0);
     err = SDL_Vulkan_LoadLibrary(nullptr);
-    assert(err >= 0);
+    if(err < 0)
+        throw std::runtime_error(std::string("failed to load Vulkan: ") + SDL_GetError());
 
     _window = SDL_CreateWindow(
         "Vulkan Engine",
@@ -138,22 +717,176 @@ void Renderer::initSDL(){
         SDL_WINDOWPOS_CENTERED,
         _window_size.width,
         _window_size.height,
-        SDL_WINDOW_VULKAN | SDL_WINDOW_SHOWN
+        SDL_WINDOW_VULKAN | SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE
     );
     assert(_window!=nullptr);
-    printf("init sdl\n");
+    fprintf(stderr, "init sdl\n");
 }
 
 
 
 void Renderer::initVulkan(){
-    if(enableValidationLayers && !checkValidationLayerSupport())
-        throw std::runtime_error("Validation not suported");
+    // Independent steps run concurrently on the job workers, each writes only
+    // its own members. Timings go to the startup trace
+    InitGraph graph(_jobs, &_startupTrace);
+    // mapped early so its read ahead overlaps with instance and device creation
+    MeshFile sceneFile;
+
+    graph.add("loader", {}, [this]{
+        // the loader is opened at runtime, no Vulkan installation is a normal error
+        if(volkInitialize() != VK_SUCCESS)
+            throw std::runtime_error("failed to load Vulkan, no loader found");
+        VULKAN_HPP_DEFAULT_DISPATCHER.init(vkGetInstanceProcAddr);
+
+        if(config.enableValidationLayers && !checkValidationLayerSupport())
+            throw std::runtime_error("Validation not suported");
+    });
+    graph.add("scene file", {}, [this, &sceneFile]{
+        if(config.gpuCulling && !config.scenePath.empty())
+            sceneFile = MeshFile(config.scenePath);
+    });
+    // the surface is created through SDL, on the thread that owns the window
+    graph.add("instance", {"loader"}, [this]{
+        initInstance();
+    }, InitThread::Caller);
+    graph.add("physical device", {"instance"}, [this]{
+        auto optPhysicalDevice = getSuitablePhysicalDevice();
+        if(!optPhysicalDevice.has_value())
+            throw std::runtime_error(config.gpuCulling ?
+                "no suitable device found, GPU culling also needs multiDrawIndirect, drawIndirectFirstInstance and drawIndirectCount" :
+                "no suitable device found");
+
+        _physicalDevice = optPhysicalDevice.value();
+
+        _queueIndices = findQueueFamilies(_physicalDevice);
+
+        if(!_queueIndices.graphicsFamily.has_value())
+            throw std::runtime_error("found no graphics queue");
+
+        _depthFormat = chooseDepthFormat();
+    });
+    graph.add("device", {"physical device"}, [this]{
+        initDevice();
+    });
+
+    graph.add("allocator", {"device"}, [this]{
+        _allocator.init(_instance, _physicalDevice, _device, ApiVersion);
+        _registry.init(_device, _allocator, config.framesInFlight);
+    });
+    graph.add("profiler", {"device"}, [this]{
+        _profiler.init(
+            _device,
+            _physicalDevice,
+            _queueIndices.graphicsFamily.value(),
+            config.framesInFlight,
+            config.profiling
+        );
+    });
+    graph.add("pipeline cache", {"device"}, [this]{
+        _pipelines.init(_device, _physicalDevice, config.pipelineCachePath);
+    });
+    graph.add("bindless", {"device"}, [this]{
+        _bindless.init(
+            _device,
+            _physicalDevice,
+            config.framesInFlight,
+            config.bindlessImageCount,
+            config.bindlessBufferCount,
+            config.bindlessSamplerCount
+        );
+    });
+    graph.add("commands", {"device"}, [this]{
+        initCommands();
+    });
+
+    graph.add("uploads", {"allocator"}, [this]{
+        _uploads.init(
+            _device,
+            _allocator,
+            _transferQueue,
+            _queueIndices.transferFamily.value(),
+            _queueIndices.graphicsFamily.value(),
+            config.uploadStagingSize,
+            _physicalDevice.getProperties().limits.optimalBufferCopyOffsetAlignment
+        );
+    });
+    graph.add("textures", {"uploads", "bindless"}, [this]{
+        _textures.init(
+            _device,
+            _allocator,
+            _uploads,
+            _bindless,
+            config.framesInFlight,
+            config.textureBudget,
+            config.textureDecodeThreads
+        );
+    });
+    // compute pipelines compile here, next to the other setup
+    graph.add("capture", {"allocator", "bindless", "pipeline cache"}, [this]{
+        _capture.init(
+            _device,
+            _allocator,
+            _bindless,
+            _pipelines,
+            config.captureBuffers,
+            config.captureFormat,
+            config.framesInFlight
+        );
+    });
+    graph.add("post processing", {"allocator", "bindless", "pipeline cache"}, [this]{
+        if(!config.postProcessing)
+            return;
+        _post.init(
+            _device,
+            _allocator,
+            _registry,
+            _bindless,
+            _pipelines,
+            _computeQueue,
+            _uploads.queueMutex(),
+            _queueIndices.computeFamily.value(),
+            _queueIndices.graphicsFamily.value(),
+            config.framesInFlight
+        );
+    });
+    graph.add("frame arenas", {"allocator", "commands"}, [this]{
+        initFrameArenas();
+    });
+
+    // the image usage depends on capture and post processing
+    graph.add("swapchain", {"allocator", "capture", "post processing"}, [this]{
+        if(config.headless)
+            initOffscreenTargets();
+        else
+            initSwapchain();
+    });
+    graph.add("render graph", {"swapchain"}, [this]{
+        _graph.init(_device, _allocator, config.framesInFlight);
+        initRenderGraph();
+    });
+    graph.add("sync", {"commands", "swapchain"}, [this]{
+        initSyncStructures();
+    });
+    // both compile against the main render pass, concurrently
+    graph.add("pipelines", {"render graph"}, [this]{
+        initPipelines();
+    });
+    graph.add("scene", {"render graph", "uploads", "commands", "scene file"}, [this, &sceneFile]{
+        if(config.gpuCulling)
+            initScene(sceneFile);
+    });
+
+    graph.execute();
+}
 
-    std::vector<const char*> extensions = getSDLRequiredExtensions();        
+void Renderer::initInstance(){
+    // headless needs no surface extensions
+    std::vector<const char*> extensions;
+    if(!config.headless)
+        extensions = getSDLRequiredExtensions();        
 
     // initialize the vk::ApplicationInfo structure
-    vk::ApplicationInfo applicationInfo( AppName.c_str(), 1, EngineName.c_str(), 1, VK_API_VERSION_1_1 );
+    vk::ApplicationInfo applicationInfo( AppName.c_str(), 1, EngineName.c_str(), 1, ApiVersion );
 
     // initialize the vk::InstanceCreateInfo
     vk::InstanceCreateInfo instanceCreateInfo = {
@@ -162,143 +895,220 @@ void Renderer::initVulkan(){
         {}, 
         extensions
     };
-    if(enableValidationLayers)
+    if(config.enableValidationLayers)
         instanceCreateInfo.setPEnabledLayerNames(validationLayers);
 
 
     // create an Instance
     _instance = vk::createInstance( instanceCreateInfo );
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(_instance);
 
-    {
+    if(!config.headless){
         VkSurfaceKHR surf;
         if(!SDL_Vulkan_CreateSurface(_window, _instance, &surf))
             throw std::runtime_error("Failed to create Surface");
         _surface = surf;
     }
+}
 
-    auto optPhysicalDevice = getSuitablePhysicalDevice();
-    if(!optPhysicalDevice.has_value())
-        throw std::runtime_error("no suitable device found");
-
-    _physicalDevice = optPhysicalDevice.value();
-
-    _queueIndices = findQueueFamilies(_physicalDevice);
-
-    if(!_queueIndices.graphicsFamily.has_value())
-        throw std::runtime_error("found no graphics queue");
-
-    // Create device
+void Renderer::initDevice(){
+    // Create device, one queue per distinct family
     float queuePriority = 1.0f;
-    vk::DeviceQueueCreateInfo deviceQueueCreateInfo(
-        vk::DeviceQueueCreateFlags(), 
-        _queueIndices.graphicsFamily.value(), 
-        1, 
-        &queuePriority 
-    );
+    std::vector<uint32_t> families = {_queueIndices.graphicsFamily.value()};
+    for(uint32_t family : {_queueIndices.transferFamily.value(), _queueIndices.computeFamily.value()}){
+        if(std::find(families.begin(), families.end(), family) == families.end())
+            families.push_back(family);
+    }
+
+    std::vector<vk::DeviceQueueCreateInfo> deviceQueueCreateInfos;
+    for(uint32_t family : families){
+        deviceQueueCreateInfos.push_back(vk::DeviceQueueCreateInfo(
+            vk::DeviceQueueCreateFlags(), 
+            family, 
+            1, 
+            &queuePriority 
+        ));
+    }
 
+    // GPU culling writes many indirect draws that index objects through
+    // firstInstance, nothing else draws indirectly
+    vk::PhysicalDeviceFeatures features{};
+    features.multiDrawIndirect = config.gpuCulling;
+    features.drawIndirectFirstInstance = config.gpuCulling;
+
+    vk::PhysicalDeviceVulkan12Features features12{};
+    features12.timelineSemaphore = true;
+    features12.drawIndirectCount = config.gpuCulling;
+    // bindless descriptor arrays
+    features12.descriptorIndexing = true;
+    features12.runtimeDescriptorArray = true;
+    features12.descriptorBindingPartiallyBound = true;
+    features12.descriptorBindingUpdateUnusedWhilePending = true;
+    features12.descriptorBindingSampledImageUpdateAfterBind = true;
+    features12.descriptorBindingStorageBufferUpdateAfterBind = true;
+    features12.shaderSampledImageArrayNonUniformIndexing = true;
+    features12.shaderStorageBufferArrayNonUniformIndexing = true;
+
+    std::vector<const char*> enabledExtensions = getDeviceExtensions();
     vk::DeviceCreateInfo deviceCreateInfo(
         vk::DeviceCreateFlags(), 
-        deviceQueueCreateInfo,
+        deviceQueueCreateInfos,
         {},
-        deviceExtensions
+        enabledExtensions
     );
+    deviceCreateInfo.pEnabledFeatures = &features;
+    deviceCreateInfo.pNext = &features12;
 
     _device = _physicalDevice.createDevice(deviceCreateInfo);
+    // device functions straight from the driver, skipping the loader's trampolines
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(_device);
 
     _graphicsQueue = _device.getQueue(_queueIndices.graphicsFamily.value(),0);
-
-    initSwapchain();
-
-    initCommands();
-    
-    initDefaultRenderPass();
-
-    initFrameBuffers();
-
-    initSyncStructures();
+    _transferQueue = _device.getQueue(_queueIndices.transferFamily.value(),0);
+    _computeQueue = _device.getQueue(_queueIndices.computeFamily.value(),0);
 }
 
 void Renderer::initSyncStructures(){
+    // fences start signaled so the first wait on each frame slot returns immediately
     vk::FenceCreateInfo fenceInfo{vk::FenceCreateFlagBits::eSignaled};
-    _renderFence = _device.createFence(fenceInfo);
-
     vk::SemaphoreCreateInfo semInfo{};
-    _presentSemaphore = _device.createSemaphore(semInfo);
-    _renderSemaphore = _device.createSemaphore(semInfo);
-}
-
-void Renderer::initFrameBuffers(){
-    //create the framebuffers for the swapchain images. 
-    //This will connect the render-pass to the images for rendering
-    vk::FramebufferCreateInfo fbInfo{};
-    fbInfo.renderPass = _renderPass;
-    fbInfo.attachmentCount = 1;
-    fbInfo.width = _window_size.width;
-    fbInfo.height = _window_size.height;
-    fbInfo.layers = 1;
-    
-    _frameBuffers = std::vector<vk::Framebuffer>(_swapchainImages.size());
-
-    for(int i=0;i<_swapchainImages.size();++i){
-        fbInfo.pAttachments = &_swapchainImageViews[i];
-        auto fbResult = _device.createFramebuffer(
-            &fbInfo, 
-            nullptr, 
-            &_frameBuffers[i]
-        );
-        vk::resultCheck(fbResult, "bad frame buffer");
+
+    for(auto& frame : _frames){
+        frame.renderFence = _device.createFence(fenceInfo);
+        frame.presentSemaphore = _device.createSemaphore(semInfo);
     }
 
+    _imagesInFlight = std::vector<vk::Fence>(_swapchainImages.size());
 }
 
-void Renderer::initDefaultRenderPass(){
-    // the renderpass will use this color attachment.
-    vk::AttachmentDescription colorAtt{};
-    //the attachment will have the format needed by the swapchain
-    colorAtt.format = _swapchainFormat;
-    //1 sample, we won't be doing MSAA
-    colorAtt.samples = vk::SampleCountFlagBits::e1;
-    // we Clear when this attachment is loaded
-    colorAtt.loadOp = vk::AttachmentLoadOp::eClear;
-    // we keep the attachment stored when the renderpass ends
-    colorAtt.storeOp = vk::AttachmentStoreOp::eStore;
-    //we don't care about stencil
-    colorAtt.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-    colorAtt.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+void Renderer::initRenderGraph(){
+    // frames still in flight keep the previous graph's objects alive
+    _graph.reset(_frameNumber);
+
+    RenderGraphImportDesc backbuffer{};
+    backbuffer.format = _swapchainFormat;
+    backbuffer.extent = _swapchainExtent;
+    // presented, offscreen targets are left ready to be copied out
+    backbuffer.finalLayout = config.headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR;
+    // the acquire semaphore is waited on at this stage, the first write is
+    // the post processing output copy when there is one
+    backbuffer.waitStages = _post.enabled() ? vk::PipelineStageFlagBits::eTransfer : vk::PipelineStageFlagBits::eColorAttachmentOutput;
+    _backbuffer = _graph.importImage("backbuffer", backbuffer);
+
+    RenderGraphPassBuilder mainPass = _graph.addPass("main", [this](RenderGraphContext& context){
+        recordMainPass(getCurrentFrame(), context);
+    });
+    if(_post.enabled()){
+        _post.setTarget(_swapchainFormat, _swapchainExtent, _frameNumber);
+        // the image of the frame's set is passed in every frame
+        _hdr = _graph.importImage("hdr", _post.hdrImportDesc());
+        mainPass.colorAttachment(_hdr, vk::ClearColorValue{});
+    }
+    else
+        mainPass.colorAttachment(_backbuffer, vk::ClearColorValue{});
+    if(config.gpuCulling){
+        // only used inside the pass, never stored
+        RenderGraphImageDesc depth{};
+        depth.format = _depthFormat;
+        depth.extent = _swapchainExtent;
+        mainPass.depthAttachment(_graph.createImage("depth", depth), vk::ClearDepthStencilValue{1.0f, 0});
+    }
+    _mainPass = mainPass.index();
+
+    if(_post.enabled()){
+        // the previous frame's post processing result
+        RenderGraphPassBuilder outputPass = _graph.addPass("post output", [this](RenderGraphContext& context){
+            _post.recordOutput(context.cmd, context.image(_backbuffer));
+        });
+        _post.declareOutput(outputPass, _backbuffer);
+    }
 
-    //we don't know or care about the starting layout of the attachment
-    colorAtt.initialLayout = vk::ImageLayout::eUndefined;
+    if(_capture.enabled()){
+        // after everything that draws into the backbuffer
+        RenderGraphPassBuilder capturePass = _graph.addPass("capture", [this](RenderGraphContext& context){
+            _capture.record(context.cmd, context.image(_backbuffer), context.view(_backbuffer),
+                _frameNumber, getCurrentFrame().renderFence);
+        });
+        _capture.declareAccess(capturePass, _backbuffer);
+        _capture.setTarget(_swapchainFormat, _swapchainExtent, _swapchainImageViews, _frameNumber);
+    }
+    _graph.compile();
+}
 
-    //after the renderpass ends, the image has to be on a layout ready for display
-    colorAtt.finalLayout = vk::ImageLayout::ePresentSrcKHR;
+vk::Format Renderer::chooseDepthFormat(){
+    // D16 is the one depth attachment format every device supports
+    for(vk::Format format : {vk::Format::eD32Sfloat, vk::Format::eX8D24UnormPack32, vk::Format::eD16Unorm}){
+        vk::FormatProperties properties = _physicalDevice.getFormatProperties(format);
+        if(properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eDepthStencilAttachment)
+            return format;
+    }
+    return vk::Format::eD16Unorm;
+}
 
-    vk::AttachmentReference colorAttRef{};
-    //attachment number will index into the pAttachments array in the parent renderpass itself
-    colorAttRef.attachment = 0;
-    colorAttRef.layout = vk::ImageLayout::eColorAttachmentOptimal;
+void Renderer::initPipelines(){
+    // SPIR-V and layouts are embedded at build time, nothing is read from disk
+    _triangleProgram = createShaderProgram(_device, {&shaders::triangle_vert, &shaders::triangle_frag});
+    PipelineBuilder builder = pipelineBuilder();
+    _triangleProgram.configure(builder);
+    if(_triangleProgram.instanceStride != sizeof(TriangleInstance))
+        throw std::runtime_error("TriangleInstance doesn't match the instance inputs of triangle.vert");
+    _drawQueue.init(_triangleProgram.instanceStride);
+    _trianglePipeline = _pipelines.getGraphicsPipeline(builder.desc());
+}
 
-    // 1 subpass
-    vk::SubpassDescription subpass{};
-    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colorAttRef;
+vk::SurfaceFormatKHR Renderer::chooseSurfaceFormat(){
+    // get the supported VkFormats
+    std::vector<vk::SurfaceFormatKHR> formats = _physicalDevice.getSurfaceFormatsKHR( _surface );
+    assert( !formats.empty() );
+    // a single undefined entry means the surface takes any format
+    if(formats.size()==1 && formats[0].format == vk::Format::eUndefined)
+        return {vk::Format::eB8G8R8A8Unorm, vk::ColorSpaceKHR::eSrgbNonlinear};
+
+    // On recreation keep the current format, the render passes and anything
+    // built against them must stay compatible
+    std::vector<vk::Format> preferred = {vk::Format::eB8G8R8A8Unorm, vk::Format::eR8G8B8A8Unorm};
+    if(_swapchain)
+        preferred.insert(preferred.begin(), _swapchainFormat);
+    for(vk::Format format : preferred){
+        for(const auto& f : formats){
+            if(f.format == format && f.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear)
+                return f;
+        }
+    }
+    return formats[0];
+}
 
-    vk::RenderPassCreateInfo rPassInfo{};
-    rPassInfo.attachmentCount = 1;
-    rPassInfo.pAttachments = &colorAtt;
-    rPassInfo.subpassCount = 1;
-    rPassInfo.pSubpasses = &subpass;
-    
-    auto result = _device.createRenderPass(&rPassInfo,nullptr,&_renderPass);
-    vk::resultCheck(result,"failed to create render pass");
+vk::PresentModeKHR Renderer::choosePresentMode(){
+    std::vector<vk::PresentModeKHR> supported = _physicalDevice.getSurfacePresentModesKHR( _surface );
 
+    std::vector<vk::PresentModeKHR> preference;
+    switch(config.presentPolicy){
+        case PresentPolicy::Fifo:
+            preference = {vk::PresentModeKHR::eFifo};
+            break;
+        case PresentPolicy::FifoRelaxed:
+            preference = {vk::PresentModeKHR::eFifoRelaxed, vk::PresentModeKHR::eFifo};
+            break;
+        case PresentPolicy::Mailbox:
+            preference = {vk::PresentModeKHR::eMailbox, vk::PresentModeKHR::eImmediate, vk::PresentModeKHR::eFifo};
+            break;
+        case PresentPolicy::Immediate:
+            preference = {vk::PresentModeKHR::eImmediate, vk::PresentModeKHR::eMailbox, vk::PresentModeKHR::eFifo};
+            break;
+    }
+    for(vk::PresentModeKHR mode : preference){
+        if(std::find(supported.begin(), supported.end(), mode) != supported.end())
+            return mode;
+    }
+    // FIFO support is required by the spec
+    return vk::PresentModeKHR::eFifo;
 }
 
 void Renderer::initSwapchain(){
-    // get the supported VkFormats
-    std::vector<vk::SurfaceFormatKHR> formats = _physicalDevice.getSurfaceFormatsKHR( _surface );
-    assert( !formats.empty() );
-    _swapchainFormat = ( formats[0].format == vk::Format::eUndefined ) ? vk::Format::eB8G8R8A8Unorm : formats[0].format;
+    vk::SurfaceFormatKHR surfaceFormat = chooseSurfaceFormat();
+    _swapchainFormat = surfaceFormat.format;
+    _swapchainColorSpace = surfaceFormat.colorSpace;
+    _presentMode = choosePresentMode();
 
     vk::SurfaceCapabilitiesKHR surfaceCapabilities = _physicalDevice.getSurfaceCapabilitiesKHR( _surface );
     if ( surfaceCapabilities.currentExtent.width == std::numeric_limits<uint32_t>::max() ){
@@ -319,6 +1129,11 @@ void Renderer::initSwapchain(){
         _swapchainExtent = surfaceCapabilities.currentExtent;
     }
 
+    // presentable images are only guaranteed to be color attachments
+    vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eColorAttachment | _capture.requiredUsage() | _post.requiredUsage();
+    if((surfaceCapabilities.supportedUsageFlags & usage) != usage)
+        throw std::runtime_error("swapchain images can't be captured or post processed on this surface");
+
     vk::SurfaceTransformFlagBitsKHR preTransform = ( surfaceCapabilities.supportedTransforms & vk::SurfaceTransformFlagBitsKHR::eIdentity )
                                                 ? vk::SurfaceTransformFlagBitsKHR::eIdentity
                                                 : surfaceCapabilities.currentTransform;
@@ -329,28 +1144,40 @@ void Renderer::initSwapchain(){
     : ( surfaceCapabilities.supportedCompositeAlpha & vk::CompositeAlphaFlagBitsKHR::eInherit )        ? vk::CompositeAlphaFlagBitsKHR::eInherit
                                                                                                         : vk::CompositeAlphaFlagBitsKHR::eOpaque;
 
+    uint32_t imageCount = config.swapchainImageCount;
+    if(imageCount == 0){
+        // mailbox needs a spare image to replace the queued one without blocking
+        imageCount = surfaceCapabilities.minImageCount + (_presentMode == vk::PresentModeKHR::eMailbox ? 1 : 0);
+    }
+    imageCount = std::max(imageCount, surfaceCapabilities.minImageCount);
+    // max of 0 means no limit
+    if(surfaceCapabilities.maxImageCount != 0)
+        imageCount = std::min(imageCount, surfaceCapabilities.maxImageCount);
+
+    // the current swapchain, if any, is retired by this call and its resources 
+    // can be reused by the driver
     vk::SwapchainCreateInfoKHR swapChainCreateInfo(
         vk::SwapchainCreateFlagsKHR(),
         _surface,
-        surfaceCapabilities.minImageCount,
+        imageCount,
         _swapchainFormat,
-        vk::ColorSpaceKHR::eSrgbNonlinear,
+        _swapchainColorSpace,
         _swapchainExtent,
         1,
-        vk::ImageUsageFlagBits::eColorAttachment,
+        usage,
         vk::SharingMode::eExclusive,
         {},
         preTransform,
         compositeAlpha,
-        vk::PresentModeKHR::eFifo,
+        _presentMode,
         true,
-        nullptr
+        _swapchain
     );
+    uint32_t queueFamilyIndices[2] = {_queueIndices.graphicsFamily.value(), _queueIndices.presentFamily.value()};
     if (!_queueIndices.isGraphicsAndPresentEqual()){
         // If the graphics and present queues are from different queue families, we either have to explicitly transfer
         // ownership of images between the queues, or we have to create the swapchain with imageSharingMode as
         // VK_SHARING_MODE_CONCURRENT
-        uint32_t queueFamilyIndices[2] = {_queueIndices.graphicsFamily.value(), _queueIndices.transferFamily.value()};
         swapChainCreateInfo.imageSharingMode      = vk::SharingMode::eConcurrent;
         swapChainCreateInfo.queueFamilyIndexCount = 2;
         swapChainCreateInfo.pQueueFamilyIndices   = queueFamilyIndices;
@@ -360,6 +1187,92 @@ void Renderer::initSwapchain(){
 
     _swapchainImages = _device.getSwapchainImagesKHR( _swapchain );
 
+    _renderSemaphores.clear();
+    for(size_t i=0;i<_swapchainImages.size();++i)
+        _renderSemaphores.push_back(_device.createSemaphore(vk::SemaphoreCreateInfo{}));
+
+    initImageViews();
+}
+
+void Renderer::recreateSwapchain(){
+    // minimized, keep the dirty flag until there is something to draw into
+    if(_window_size.width == 0 || _window_size.height == 0)
+        return;
+
+    // No device wait: the old swapchain is passed as oldSwapchain and is
+    // destroyed once the frames recorded against it have retired
+    RetiredSwapchain retired{};
+    retired.swapchain = _swapchain;
+    retired.imageViews = std::move(_swapchainImageViews);
+    // presents of the old images may still wait on these
+    retired.renderSemaphores = std::move(_renderSemaphores);
+    retired.retireFrame = _frameNumber;
+    _swapchainImageViews.clear();
+    _renderSemaphores.clear();
+
+    initSwapchain();
+    // framebuffers and transient images follow the new extent
+    initRenderGraph();
+    _retiredSwapchains.push_back(std::move(retired));
+
+    _imagesInFlight.assign(_swapchainImages.size(), vk::Fence{});
+    _swapchainDirty = false;
+}
+
+void Renderer::destroyRetiredSwapchains(bool all){
+    auto it = _retiredSwapchains.begin();
+    while(it != _retiredSwapchains.end()){
+        // the fence wait at the start of this frame retired every frame
+        // up to _frameNumber - framesInFlight
+        if(!all && _frameNumber + 1 < it->retireFrame + _frames.size()){
+            ++it;
+            continue;
+        }
+        for(auto view : it->imageViews)
+            _device.destroyImageView(view);
+        for(auto semaphore : it->renderSemaphores)
+            _device.destroySemaphore(semaphore);
+        _device.destroySwapchainKHR(it->swapchain);
+        it = _retiredSwapchains.erase(it);
+    }
+}
+
+void Renderer::initOffscreenTargets(){
+    _swapchainFormat = vk::Format::eR8G8B8A8Unorm;
+    _swapchainExtent = _window_size;
+
+    vk::ImageCreateInfo imageInfo{};
+    imageInfo.imageType = vk::ImageType::e2D;
+    imageInfo.format = _swapchainFormat;
+    imageInfo.extent = vk::Extent3D{_swapchainExtent.width, _swapchainExtent.height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = vk::SampleCountFlagBits::e1;
+    imageInfo.tiling = vk::ImageTiling::eOptimal;
+    imageInfo.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc | _capture.requiredUsage() | _post.requiredUsage();
+    imageInfo.sharingMode = vk::SharingMode::eExclusive;
+    imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+    for(uint32_t i=0;i<config.headlessImageCount;++i){
+        AllocatedImage target = _allocator.createImage(MemoryClass::RenderTarget, imageInfo);
+        _swapchainImages.push_back(target.image);
+        _offscreenTargets.push_back(target);
+    }
+
+    initImageViews();
+}
+
+void Renderer::initFrameArenas(){
+    vk::PhysicalDeviceLimits limits = _physicalDevice.getProperties().limits;
+    vk::DeviceSize minAlignment = std::max(
+        limits.minUniformBufferOffsetAlignment, 
+        limits.minStorageBufferOffsetAlignment
+    );
+    for(auto& frame : _frames)
+        frame.arena.init(_allocator, config.frameArenaSize, minAlignment);
+}
+
+void Renderer::initImageViews(){
     _swapchainImageViews.reserve( _swapchainImages.size() );
     vk::ImageViewCreateInfo imageViewCreateInfo(
         {},
@@ -382,24 +1295,45 @@ void Renderer::initSwapchain(){
 }
 
 void Renderer::initCommands(){
+    _frames = std::vector<FrameData>(config.framesInFlight);
+
     vk::CommandPoolCreateInfo cPoolInfo{
         vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
         _queueIndices.graphicsFamily.value()
     };
-    _commandPool = _device.createCommandPool(cPoolInfo);
 
-    vk::CommandBufferAllocateInfo cBufAllInfo{
-        _commandPool,
-        vk::CommandBufferLevel::ePrimary,
-        1
-    };
-    _commandBuffer = _device.allocateCommandBuffers(cBufAllInfo)[0];
+    // one pool per frame so a slot can be recorded while the others are executing
+    for(auto& frame : _frames){
+        frame.commandPool = _device.createCommandPool(cPoolInfo);
+
+        vk::CommandBufferAllocateInfo cBufAllInfo{
+            frame.commandPool,
+            vk::CommandBufferLevel::ePrimary,
+            1
+        };
+        frame.commandBuffer = _device.allocateCommandBuffers(cBufAllInfo)[0];
+
+        // reset as a whole every frame, secondaries are allocated on demand
+        vk::CommandPoolCreateInfo workerPoolInfo{
+            vk::CommandPoolCreateFlagBits::eTransient,
+            _queueIndices.graphicsFamily.value()
+        };
+        frame.workerCommands.resize(_jobs.workerCount());
+        for(auto& worker : frame.workerCommands)
+            worker.commandPool = _device.createCommandPool(workerPoolInfo);
+    }
+}
 
+std::vector<const char*> Renderer::getDeviceExtensions(){
+    // nothing is presented in headless mode, so the swapchain is not needed
+    if(config.headless)
+        return {};
+    return deviceExtensions;
 }
 
 bool Renderer::checkDeviceExtensions(vk::PhysicalDevice ph){
     std::vector<vk::ExtensionProperties> exts = ph.enumerateDeviceExtensionProperties();
-    for(auto str : deviceExtensions){
+    for(auto str : getDeviceExtensions()){
         auto it = std::find_if(exts.begin(), exts.end(), [str](vk::ExtensionProperties e){return std::strcmp(str, e.extensionName)==0;});
         if(it==exts.end())
             return false;
@@ -407,31 +1341,79 @@ bool Renderer::checkDeviceExtensions(vk::PhysicalDevice ph){
     return true;
 }
 
+bool Renderer::checkDeviceFeatures(vk::PhysicalDevice ph){
+    auto chain = ph.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+    const auto& features = chain.get<vk::PhysicalDeviceFeatures2>().features;
+    const auto& features12 = chain.get<vk::PhysicalDeviceVulkan12Features>();
+    // culled draws are indirect, only needed with GPU culling
+    if(config.gpuCulling && !(features.multiDrawIndirect && features.drawIndirectFirstInstance && features12.drawIndirectCount))
+        return false;
+    // uploads are tracked with a timeline semaphore, resources are bound
+    // through update-after-bind descriptor arrays
+    return features12.timelineSemaphore &&
+        features12.descriptorIndexing &&
+        features12.runtimeDescriptorArray &&
+        features12.descriptorBindingPartiallyBound &&
+        features12.descriptorBindingUpdateUnusedWhilePending &&
+        features12.descriptorBindingSampledImageUpdateAfterBind &&
+        features12.descriptorBindingStorageBufferUpdateAfterBind &&
+        features12.shaderSampledImageArrayNonUniformIndexing &&
+        features12.shaderStorageBufferArrayNonUniformIndexing;
+}
+
 std::optional<vk::PhysicalDevice> Renderer::getSuitablePhysicalDevice(){
     // enumerate the physicalDevices
     auto physicalDevices = _instance.enumeratePhysicalDevices();
 
-    std::optional<vk::PhysicalDevice> descDev = std::nullopt, intDev = std::nullopt;
+    // Every device is queried on its own worker, drivers answer the property,
+    // feature and extension queries of different devices in parallel.
+    // Unsuitable devices are left without a type
+    std::vector<std::optional<vk::PhysicalDeviceType>> suitableTypes(physicalDevices.size());
+    _jobs.parallelFor(uint32_t(physicalDevices.size()), 1, [&](uint32_t begin, uint32_t end, uint32_t){
+        for(uint32_t i=begin;i<end;++i){
+            // jobs must not throw, a device failing a query is skipped
+            try{
+                if(!checkDeviceExtensions(physicalDevices[i]))
+                    continue;
+                vk::PhysicalDeviceProperties pr = physicalDevices[i].getProperties();
+                if(pr.apiVersion < ApiVersion || !checkDeviceFeatures(physicalDevices[i]))
+                    continue;
+                suitableTypes[i] = pr.deviceType;
+            }
+            catch(const std::exception&){
+            }
+        }
+    });
 
-    for(vk::PhysicalDevice phDev : physicalDevices){
-        if(!checkDeviceExtensions(phDev))
-            continue;
+    std::optional<vk::PhysicalDevice> descDev = std::nullopt, intDev = std::nullopt, otherDev = std::nullopt;
 
-        vk::PhysicalDeviceProperties pr = phDev.getProperties();
-        vk::PhysicalDeviceFeatures ft = phDev.getFeatures();
-        if(pr.deviceType == vk::PhysicalDeviceType::eDiscreteGpu){
-            descDev = phDev;
-            break;
+    // in enumeration order, the first device of the preferred type wins
+    for(size_t i=0;i<physicalDevices.size();++i){
+        if(!suitableTypes[i])
+            continue;
+        vk::PhysicalDevice phDev = physicalDevices[i];
+        vk::PhysicalDeviceType type = suitableTypes[i].value();
+        if(type == vk::PhysicalDeviceType::eCpu && config.headless && config.preferCpuDevice)
+            return phDev;
+        if(type == vk::PhysicalDeviceType::eDiscreteGpu){
+            if(!descDev.has_value())
+                descDev = phDev;
         }
-        else if(pr.deviceType == vk::PhysicalDeviceType::eIntegratedGpu){
-            intDev = phDev;
-            break;
+        else if(type == vk::PhysicalDeviceType::eIntegratedGpu){
+            if(!intDev.has_value())
+                intDev = phDev;
+        }
+        // software implementations such as lavapipe, only used headless
+        else if(config.headless && !otherDev.has_value()){
+            otherDev = phDev;
         }
     }
     if(descDev.has_value())
         return descDev;
     else if(intDev.has_value())
         return intDev;
+    else if(otherDev.has_value())
+        return otherDev;
 
     return std::nullopt;
 } 
@@ -443,24 +1425,45 @@ QueueFamilyIndices Renderer::findQueueFamilies(vk::PhysicalDevice device) {
     std::vector<vk::QueueFamilyProperties> qfps = device.getQueueFamilyProperties();
     int i = 0;
 
+    // how many of graphics/compute a family supports besides what we look for,
+    // the dedicated families run asynchronously to the graphics queue
+    auto sharedFlags = [](vk::QueueFlags flags){
+        return int(bool(flags & vk::QueueFlagBits::eGraphics)) + int(bool(flags & vk::QueueFlagBits::eCompute));
+    };
+
     for(const auto& queueFamily : qfps){
-        if(indices.computeFamily && indices.graphicsFamily && indices.presentFamily && indices.transferFamily)
-            break;
-        if(!indices.isGraphicsAndPresentEqual() && queueFamily.queueFlags & vk::QueueFlagBits::eGraphics){
+        if(config.headless){
+            if(!indices.graphicsFamily && queueFamily.queueFlags & vk::QueueFlagBits::eGraphics)
+                indices.graphicsFamily = std::optional(i);
+        }
+        else if(!indices.isGraphicsAndPresentEqual() && queueFamily.queueFlags & vk::QueueFlagBits::eGraphics){
             indices.graphicsFamily = std::optional(i);
             if(device.getSurfaceSupportKHR(i, _surface))
                 indices.presentFamily = i;
         }
-        if(queueFamily.queueFlags & vk::QueueFlagBits::eCompute)
-            indices.computeFamily = std::optional(i);
+        if(queueFamily.queueFlags & vk::QueueFlagBits::eCompute){
+            if(!indices.computeFamily || 
+                (!(queueFamily.queueFlags & vk::QueueFlagBits::eGraphics) && 
+                 qfps[indices.computeFamily.value()].queueFlags & vk::QueueFlagBits::eGraphics))
+                indices.computeFamily = std::optional(i);
+        }
 
-        if(queueFamily.queueFlags & vk::QueueFlagBits::eTransfer)
-            indices.transferFamily = std::optional(i);
+        if(queueFamily.queueFlags & vk::QueueFlagBits::eTransfer){
+            if(!indices.transferFamily || 
+                sharedFlags(queueFamily.queueFlags) < sharedFlags(qfps[indices.transferFamily.value()].queueFlags))
+                indices.transferFamily = std::optional(i);
+        }
         
-        if(!indices.presentFamily)
+        if(!config.headless && !indices.presentFamily)
             if(device.getSurfaceSupportKHR(i, _surface))
                 indices.presentFamily = i;
 
+        ++i;
     }
+    // graphics queues can always do transfers even when they don't advertise it
+    if(!indices.transferFamily)
+        indices.transferFamily = indices.graphicsFamily;
+    if(!indices.computeFamily)
+        indices.computeFamily = indices.graphicsFamily;
     return indices;
 }
\ No newline at end of file
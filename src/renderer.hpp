@@ -17,10 +17,31 @@
 #include <array>
 #include <cstring>
 #include <stdexcept>
+#include <string>
 #include <type_traits>
 #include <vector>
 #include <optional>
 #include <glm/common.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+
+#include "allocator.hpp"
+#include "bindless.hpp"
+#include "draw_queue.hpp"
+#include "frame_capture.hpp"
+#include "gpu_culling.hpp"
+#include "init_graph.hpp"
+#include "jobs.hpp"
+#include "mesh.hpp"
+#include "pipelines.hpp"
+#include "post_process.hpp"
+#include "profiler.hpp"
+#include "render_graph.hpp"
+#include "resource_registry.hpp"
+#include "scene.hpp"
+#include "shader_program.hpp"
+#include "texture_streamer.hpp"
+#include "upload.hpp"
 
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
@@ -34,11 +55,136 @@ struct QueueFamilyIndices {
     }
 };
 
+// Present mode preference, falls back to the nearest supported mode.
+// FIFO is always available
+enum class PresentPolicy {
+    Fifo,           // vsync, no tearing
+    FifoRelaxed,    // vsync, tears when a frame is late
+    Mailbox,        // low latency without tearing, newest frame replaces the queued one
+    Immediate,      // lowest latency, tears
+};
+
+struct RendererConfig {
+    bool enableValidationLayers{true};
+    // Number of frames the CPU may record ahead of the GPU
+    uint32_t framesInFlight{2};
+    // Render into device owned images instead of a window swapchain.
+    // No SDL window, surface or present, CPU devices are accepted
+    bool headless{false};
+    // Number of offscreen color targets rotated through in headless mode
+    uint32_t headlessImageCount{3};
+    // Pick a CPU implementation such as lavapipe over any GPU, headless only.
+    // Gives comparable numbers across machines
+    bool preferCpuDevice{false};
+    PresentPolicy presentPolicy{PresentPolicy::Fifo};
+    // Requested swapchain image count, 0 picks the minimum for the present mode.
+    // Clamped to what the surface supports
+    uint32_t swapchainImageCount{0};
+    // Capacity of the per frame linear allocator for transient data
+    vk::DeviceSize frameArenaSize{4*1024*1024};
+    // Size of the staging ring used by the upload manager
+    vk::DeviceSize uploadStagingSize{32*1024*1024};
+    // CPU scope timers and GPU timestamp queries
+    bool profiling{true};
+    // Pipeline cache persisted between runs, empty keeps it in memory only
+    std::string pipelineCachePath{"pipeline_cache.bin"};
+    // Job system threads next to the render thread, used for per frame work
+    // such as draw list updates and command recording. ~0u uses one per spare
+    // hardware thread
+    uint32_t jobThreads{~0u};
+    // Number of test triangles drawn every frame, or test objects with gpuCulling
+    uint32_t testDrawCount{1};
+    // Materials the test triangles cycle through. Each one is its own batch,
+    // so this sets how many draws the main pass records
+    uint32_t testMaterialCount{1};
+    // Draw an animated 3D test scene through compute culling and indirect
+    // draws instead of the CPU built draw list. Only then does the device
+    // need multiDrawIndirect, drawIndirectFirstInstance and drawIndirectCount
+    bool gpuCulling{false};
+    // .mesh file whose sub-meshes the GPU culling scene instances, empty
+    // uses built-in cubes and pyramids. See tools/mesh_convert
+    std::string scenePath;
+    // Requested sizes of the bindless arrays, clamped to device limits
+    uint32_t bindlessImageCount{16384};
+    uint32_t bindlessBufferCount{16384};
+    uint32_t bindlessSamplerCount{256};
+    // Texel bytes streamed textures may keep resident, their smallest mips
+    // are loaded regardless
+    vk::DeviceSize textureBudget{256*1024*1024};
+    // Threads reading and decoding texture mips
+    uint32_t textureDecodeThreads{2};
+    // Readback buffers every frame's final image is captured into, 0 disables
+    // capture. See FrameCapture
+    uint32_t captureBuffers{0};
+    CaptureFormat captureFormat{CaptureFormat::Native};
+    // Render the main pass in HDR and tonemap it with bloom and auto exposure
+    // on the compute queue, presented one frame later. See PostProcess
+    bool postProcessing{false};
+    // Chrome trace JSON of the startup steps, written at the end of the
+    // constructor. Empty writes none
+    std::string startupTracePath;
+};
+
+// Swapchain replaced by a recreation, kept alive until the frames that used it retire
+struct RetiredSwapchain {
+    vk::SwapchainKHR swapchain;
+    std::vector<vk::ImageView> imageViews;
+    std::vector<vk::Semaphore> renderSemaphores;
+    // first frame recorded against the new swapchain
+    uint64_t retireFrame;
+};
+
+// Secondary command buffers of one recording worker for one frame slot.
+// Pools are externally synchronized, so every worker records from its own
+struct WorkerCommands {
+    vk::CommandPool commandPool;
+    std::vector<vk::CommandBuffer> secondaries;
+    // secondaries handed out since the pool was last reset
+    uint32_t used{0};
+};
+
+// matches the instance inputs of triangle.vert, tightly packed
+struct TriangleInstance {
+    glm::vec4 color;
+    float angle;
+};
+
+// matches the push block of scene.vert and scene.frag
+struct ScenePush {
+    glm::mat4 viewProj;
+    uint32_t instanceBuffer;
+    uint32_t textureTable;
+    uint32_t textureSampler;
+};
+
+struct FrameData {
+    vk::CommandPool commandPool;
+    vk::CommandBuffer commandBuffer;
+    // indexed by job system worker
+    std::vector<WorkerCommands> workerCommands;
+
+    vk::Fence renderFence;
+    vk::Semaphore presentSemaphore;
+
+    // transient uniform/vertex data, reset once this frame's fence has signaled
+    FrameArena arena;
+
+    // world transforms and bounds of the scene objects, rewritten by the CPU
+    // every frame and read by culling and drawing. gpuCulling only
+    AllocatedBuffer sceneInstances;
+    BindlessIndex sceneInstanceIndex{InvalidBindlessIndex};
+    // bindless image of every scene texture for this frame, indexed by the
+    // scene materials. gpuCulling only
+    AllocatedBuffer sceneTextureTable;
+    BindlessIndex sceneTextureTableIndex{InvalidBindlessIndex};
+};
+
 class Renderer{
 public:
 
     inline static const std::string AppName    = "01_InitInstance";
     inline static const std::string EngineName = "Vulkan.hpp";
+    inline static const uint32_t ApiVersion = VK_API_VERSION_1_2;
 
     inline static const std::vector<const char*> validationLayers = {
         "VK_LAYER_KHRONOS_validation"
@@ -48,42 +194,134 @@ public:
         VK_KHR_SWAPCHAIN_EXTENSION_NAME
     };
 
-    bool enableValidationLayers{true};
+    RendererConfig config;
+    // spans of the constructor's startup steps, timed from here
+    StartupTrace _startupTrace;
 
-    SDL_Window *_window;
+    SDL_Window *_window{nullptr};
     vk::Instance _instance;
     vk::PhysicalDevice _physicalDevice; 
     vk::Device _device;
     vk::SurfaceKHR _surface;
     vk::Queue _graphicsQueue;
+    // same queue as _graphicsQueue when there is no separate transfer family
+    vk::Queue _transferQueue;
+    // same queue as _graphicsQueue when there is no separate compute family
+    vk::Queue _computeQueue;
+
+    GpuAllocator _allocator;
+    // dynamic resources behind generational handles, destroyed as frames retire
+    ResourceRegistry _registry;
+    UploadManager _uploads;
+    Profiler _profiler;
+    PipelineManager _pipelines;
+    BindlessDescriptors _bindless;
+    TextureStreamer _textures;
+    FrameCapture _capture;
+    PostProcess _post;
+
+    ShaderProgram _triangleProgram;
+    vk::Pipeline _trianglePipeline;
+
+    JobSystem _jobs;
+    DrawQueue _drawQueue;
+
+    // GPU driven test scene, only with config.gpuCulling
+    GpuCulling _culling;
+    ShaderProgram _sceneProgram;
+    vk::Pipeline _scenePipeline;
+    GpuMesh _sceneMesh;
+    // the scene isn't drawn before its mesh upload is acquired
+    UploadTicket _sceneMeshTicket{0};
+    bool _sceneMeshReady{false};
+    Scene _scene;
+    glm::mat4 _sceneViewProj{1.0f};
+    // indexed by the scene materials, see setSceneTextures()
+    std::vector<TextureHandle> _sceneTextures;
+    vk::Sampler _sceneSampler;
+    BindlessIndex _sceneSamplerIndex{InvalidBindlessIndex};
 
     vk::SwapchainKHR _swapchain;
     vk::Format _swapchainFormat;
+    vk::ColorSpaceKHR _swapchainColorSpace;
+    vk::PresentModeKHR _presentMode;
     std::vector<vk::Image> _swapchainImages;
     std::vector<vk::ImageView> _swapchainImageViews;
+    // Signaled by the submit that renders into each swapchain image and waited
+    // on by its present. Indexed by image rather than frame slot: the present
+    // may still be waiting on it when the slot comes around again, the image
+    // can't be acquired before that wait is done
+    std::vector<vk::Semaphore> _renderSemaphores;
+    // Offscreen targets backing _swapchainImages, headless only
+    std::vector<AllocatedImage> _offscreenTargets;
+    std::vector<RetiredSwapchain> _retiredSwapchains;
+    // set on resize, out of date or suboptimal results and policy changes
+    bool _swapchainDirty{false};
+    bool _shutdown{false};
 
     vk::Extent2D _window_size{800,600}, _swapchainExtent;
-    
-    vk::CommandPool _commandPool;
-    vk::CommandBuffer _commandBuffer;
 
-    vk::RenderPass _renderPass;
-    std::vector<vk::Framebuffer> _frameBuffers;
-
-    vk::Fence _renderFence;
-    vk::Semaphore _presentSemaphore;
-    vk::Semaphore _renderSemaphore;
+    // rebuilt with the swapchain, imports the current swapchain image as backbuffer
+    RenderGraph _graph;
+    RenderGraphResource _backbuffer{InvalidRenderGraphResource};
+    // main pass target with post processing, one of PostProcess's HDR images
+    RenderGraphResource _hdr{InvalidRenderGraphResource};
+    uint32_t _mainPass{0};
+    vk::Format _depthFormat{vk::Format::eUndefined};
+
+    std::vector<FrameData> _frames;
+    // Fence of the frame that last rendered into each swapchain image
+    std::vector<vk::Fence> _imagesInFlight;
     
     QueueFamilyIndices _queueIndices;
 
     uint64_t _frameNumber{0};
 
-    Renderer(bool validationLayers=true);
+    Renderer(RendererConfig config = {});
 
+    // calls shutdown() unless that happened already
     ~Renderer();
 
     void draw();
 
+    // Call on the thread that draws from now on, when that is not the one
+    // that created the renderer
+    void bindRenderThread(){
+        _jobs.rebindMainThread();
+    }
+
+    // Waits until the device finished everything submitted, on the thread
+    // that draws. Nothing may be drawn afterwards
+    void shutdown();
+
+    // Recreates the swapchain before the next frame, call on window resize
+    // with the drawable size queried on the thread that owns the window
+    void requestSwapchainRecreate(vk::Extent2D drawableSize){
+        _window_size = drawableSize;
+        _swapchainDirty = true;
+    }
+
+    void setPresentPolicy(PresentPolicy policy);
+
+    static constexpr uint32_t MaxSceneTextures = 256;
+
+    // Textures of the gpuCulling scene, assigned to its objects in turn as
+    // their material. scene.frag samples them and the objects' on screen size
+    // drives their streaming. Before the first frame, at most MaxSceneTextures
+    void setSceneTextures(const std::vector<TextureHandle>& textures);
+
+    // code is SPIR-V, size in bytes. The caller owns the module and may
+    // destroy it once the pipelines using it have been created, if it passes
+    // contentHash(code, size) as their codeHash
+    vk::ShaderModule createShaderModule(const uint32_t* code, size_t size);
+
+    // builder targeting the main pass of the render graph, pass desc() to _pipelines
+    PipelineBuilder pipelineBuilder();
+
+    FrameData& getCurrentFrame(){
+        return _frames[_frameNumber % _frames.size()];
+    }
+
 private:
 
     bool checkValidationLayerSupport();
@@ -92,20 +330,74 @@ private:
 
     void initSDL();
 
+    // runs the startup steps through an InitGraph
     void initVulkan();
 
+    // instance, dispatcher and window surface
+    void initInstance();
+
+    // logical device and its queues on the chosen physical device
+    void initDevice();
+
     void initSyncStructures();
 
-    void initFrameBuffers();
+    // declares and compiles the frame's passes for the current swapchain
+    void initRenderGraph();
+
+    vk::Format chooseDepthFormat();
+
+    void initPipelines();
+
+    void buildDrawList();
+
+    // file is the mapped config.scenePath, empty without one
+    void initScene(const MeshFile& file);
+
+    // animates the scene objects and writes their instances for the frame
+    void updateScene(FrameData& frame);
+
+    // size feedback of _sceneTextures from the scene objects of the frame,
+    // each object reports the texture its material samples
+    void requestSceneTextures();
+
+    // vertical field of view of the scene camera, in degrees
+    static constexpr float SceneFovY = 60.0f;
 
-    void initDefaultRenderPass();
+    // orbiting camera over the test scene
+    glm::mat4 sceneViewProj();
+
+    void recordScene(vk::CommandBuffer cmd);
+
+    // records into the current frame's secondaries on the job workers,
+    // or inline into the primary when the draw list is too small to split
+    void recordMainPass(FrameData& frame, const RenderGraphContext& context);
+
+    void recordDraws(vk::CommandBuffer cmd, uint32_t firstBatch, uint32_t batchCount);
 
     void initSwapchain();
 
+    void recreateSwapchain();
+
+    void destroyRetiredSwapchains(bool all);
+
+    vk::PresentModeKHR choosePresentMode();
+
+    vk::SurfaceFormatKHR chooseSurfaceFormat();
+
+    void initOffscreenTargets();
+
+    void initImageViews();
+
+    void initFrameArenas();
+
+    std::vector<const char*> getDeviceExtensions();
+
     void initCommands();
 
     bool checkDeviceExtensions(vk::PhysicalDevice ph);
 
+    bool checkDeviceFeatures(vk::PhysicalDevice ph);
+
     std::optional<vk::PhysicalDevice> getSuitablePhysicalDevice();
 
 
@@ -0,0 +1,198 @@
+#include "resource_registry.hpp"
+
+void ResourceRegistry::init(vk::Device device, GpuAllocator& allocator, uint32_t framesInFlight){
+    _device = device;
+    _allocator = &allocator;
+    _framesInFlight = framesInFlight;
+}
+
+void ResourceRegistry::destroy(){
+    std::lock_guard<std::mutex> lock(_mutex);
+    for(auto& pending : _pending)
+        destroyObjects(pending);
+    _pending.clear();
+
+    for(auto& slot : _buffers.slots){
+        if(slot.live)
+            _allocator->destroyBuffer(slot.object);
+    }
+    for(auto& slot : _images.slots){
+        if(slot.live)
+            _allocator->destroyImage(slot.object);
+    }
+    for(auto& slot : _imageViews.slots){
+        if(slot.live)
+            _device.destroyImageView(slot.object);
+    }
+    for(auto& slot : _pipelines.slots){
+        if(slot.live)
+            _device.destroyPipeline(slot.object);
+    }
+    _buffers = {};
+    _images = {};
+    _imageViews = {};
+    _pipelines = {};
+}
+
+BufferHandle ResourceRegistry::createBuffer(MemoryClass memClass, vk::DeviceSize size, vk::BufferUsageFlags usage,
+    const std::vector<uint32_t>& concurrentFamilies){
+    AllocatedBuffer buffer = _allocator->createBuffer(memClass, size, usage, concurrentFamilies);
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _buffers.add<BufferTag>(buffer);
+}
+
+ImageHandle ResourceRegistry::createImage(MemoryClass memClass, const vk::ImageCreateInfo& imageInfo){
+    AllocatedImage image = _allocator->createImage(memClass, imageInfo);
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _images.add<ImageTag>(image);
+}
+
+ImageViewHandle ResourceRegistry::createImageView(const vk::ImageViewCreateInfo& viewInfo){
+    vk::ImageView view = _device.createImageView(viewInfo);
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _imageViews.add<ImageViewTag>(view);
+}
+
+PipelineHandle ResourceRegistry::adoptPipeline(vk::Pipeline pipeline){
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _pipelines.add<PipelineTag>(pipeline);
+}
+
+AllocatedBuffer ResourceRegistry::buffer(BufferHandle handle) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const AllocatedBuffer* buffer = _buffers.find(handle);
+    return buffer ? *buffer : AllocatedBuffer{};
+}
+
+vk::Image ResourceRegistry::image(ImageHandle handle) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const AllocatedImage* image = _images.find(handle);
+    return image ? image->image : vk::Image{};
+}
+
+vk::ImageView ResourceRegistry::imageView(ImageViewHandle handle) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const vk::ImageView* view = _imageViews.find(handle);
+    return view ? *view : vk::ImageView{};
+}
+
+vk::Pipeline ResourceRegistry::pipeline(PipelineHandle handle) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const vk::Pipeline* pipeline = _pipelines.find(handle);
+    return pipeline ? *pipeline : vk::Pipeline{};
+}
+
+void ResourceRegistry::release(BufferHandle handle, const RetirePoint& lastUse){
+    std::lock_guard<std::mutex> lock(_mutex);
+    PendingDestruction pending{};
+    pending.lastUse = lastUse;
+    if(_buffers.remove(handle, pending.buffer))
+        _pending.push_back(pending);
+}
+
+void ResourceRegistry::release(ImageHandle handle, const RetirePoint& lastUse){
+    std::lock_guard<std::mutex> lock(_mutex);
+    PendingDestruction pending{};
+    pending.lastUse = lastUse;
+    if(_images.remove(handle, pending.image))
+        _pending.push_back(pending);
+}
+
+void ResourceRegistry::release(ImageViewHandle handle, const RetirePoint& lastUse){
+    std::lock_guard<std::mutex> lock(_mutex);
+    PendingDestruction pending{};
+    pending.lastUse = lastUse;
+    if(_imageViews.remove(handle, pending.view))
+        _pending.push_back(pending);
+}
+
+void ResourceRegistry::release(PipelineHandle handle, const RetirePoint& lastUse){
+    std::lock_guard<std::mutex> lock(_mutex);
+    PendingDestruction pending{};
+    pending.lastUse = lastUse;
+    if(_pipelines.remove(handle, pending.pipeline))
+        _pending.push_back(pending);
+}
+
+void ResourceRegistry::defer(const AllocatedBuffer& buffer, const RetirePoint& lastUse){
+    std::lock_guard<std::mutex> lock(_mutex);
+    PendingDestruction pending{};
+    pending.buffer = buffer;
+    pending.lastUse = lastUse;
+    _pending.push_back(pending);
+}
+
+void ResourceRegistry::defer(const AllocatedImage& image, const RetirePoint& lastUse){
+    std::lock_guard<std::mutex> lock(_mutex);
+    PendingDestruction pending{};
+    pending.image = image;
+    pending.lastUse = lastUse;
+    _pending.push_back(pending);
+}
+
+void ResourceRegistry::defer(vk::ImageView view, const RetirePoint& lastUse){
+    std::lock_guard<std::mutex> lock(_mutex);
+    PendingDestruction pending{};
+    pending.view = view;
+    pending.lastUse = lastUse;
+    _pending.push_back(pending);
+}
+
+void ResourceRegistry::defer(vk::Pipeline pipeline, const RetirePoint& lastUse){
+    std::lock_guard<std::mutex> lock(_mutex);
+    PendingDestruction pending{};
+    pending.pipeline = pipeline;
+    pending.lastUse = lastUse;
+    _pending.push_back(pending);
+}
+
+void ResourceRegistry::retire(uint64_t frameNumber){
+    std::lock_guard<std::mutex> lock(_mutex);
+    // Not sorted, releases come from any thread and timelines advance on
+    // their own. Each timeline is queried once per call
+    std::vector<std::pair<VkSemaphore, uint64_t>> timelineValues;
+    auto reached = [&](const RetirePoint& point){
+        if(!point.timeline)
+            return true;
+        for(const auto& [timeline, value] : timelineValues){
+            if(timeline == VkSemaphore(point.timeline))
+                return value >= point.timelineValue;
+        }
+        uint64_t value = _device.getSemaphoreCounterValue(point.timeline);
+        timelineValues.emplace_back(point.timeline, value);
+        return value >= point.timelineValue;
+    };
+
+    size_t kept = 0;
+    for(size_t i=0;i<_pending.size();++i){
+        PendingDestruction& pending = _pending[i];
+        // the fence wait before this call retired every frame up to frameNumber - framesInFlight
+        if(pending.lastUse.frameNumber + _framesInFlight <= frameNumber && reached(pending.lastUse))
+            destroyObjects(pending);
+        else
+            _pending[kept++] = pending;
+    }
+    _pending.resize(kept);
+}
+
+ResourceRegistryStats ResourceRegistry::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    ResourceRegistryStats stats;
+    stats.buffers = _buffers.liveCount;
+    stats.images = _images.liveCount;
+    stats.imageViews = _imageViews.liveCount;
+    stats.pipelines = _pipelines.liveCount;
+    stats.pending = uint32_t(_pending.size());
+    return stats;
+}
+
+void ResourceRegistry::destroyObjects(PendingDestruction& pending){
+    if(pending.buffer.buffer)
+        _allocator->destroyBuffer(pending.buffer);
+    if(pending.image.image)
+        _allocator->destroyImage(pending.image);
+    if(pending.view)
+        _device.destroyImageView(pending.view);
+    if(pending.pipeline)
+        _device.destroyPipeline(pending.pipeline);
+}
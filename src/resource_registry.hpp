@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.hpp"
+
+// Slot index plus the generation of the resource that occupied it. Slots are
+// recycled, generations are not, so a handle kept past the destruction of its
+// resource resolves to nothing instead of to whatever reused the slot
+template<typename Tag>
+struct ResourceHandle {
+    uint32_t index{~0u};
+    uint32_t generation{0};
+
+    // false for default constructed handles only, destroyed ones stay valid
+    // and fail the lookup
+    bool valid() const {
+        return generation != 0;
+    }
+
+    bool operator==(const ResourceHandle& other) const {
+        return index == other.index && generation == other.generation;
+    }
+
+    bool operator!=(const ResourceHandle& other) const {
+        return !(*this == other);
+    }
+};
+
+using BufferHandle = ResourceHandle<struct BufferTag>;
+using ImageHandle = ResourceHandle<struct ImageTag>;
+using ImageViewHandle = ResourceHandle<struct ImageViewTag>;
+using PipelineHandle = ResourceHandle<struct PipelineTag>;
+
+// Slots of one kind of resource, the generation of a slot is bumped when its
+// object is removed
+template<typename T>
+struct ResourcePool {
+    struct Slot {
+        T object{};
+        uint32_t generation{1};
+        bool live{false};
+    };
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free;
+    uint32_t liveCount{0};
+
+    template<typename Tag>
+    ResourceHandle<Tag> add(const T& object){
+        uint32_t index;
+        if(!free.empty()){
+            index = free.back();
+            free.pop_back();
+        }
+        else{
+            index = uint32_t(slots.size());
+            slots.emplace_back();
+        }
+        slots[index].object = object;
+        slots[index].live = true;
+        ++liveCount;
+        return {index, slots[index].generation};
+    }
+
+    template<typename Tag>
+    const T* find(ResourceHandle<Tag> handle) const {
+        if(handle.index >= slots.size())
+            return nullptr;
+        const Slot& slot = slots[handle.index];
+        return slot.live && slot.generation == handle.generation ? &slot.object : nullptr;
+    }
+
+    // false for stale handles
+    template<typename Tag>
+    bool remove(ResourceHandle<Tag> handle, T& object){
+        if(!find(handle))
+            return false;
+        Slot& slot = slots[handle.index];
+        object = slot.object;
+        slot.object = T{};
+        slot.live = false;
+        // 0 marks default constructed handles
+        if(++slot.generation == 0)
+            slot.generation = 1;
+        free.push_back(handle.index);
+        --liveCount;
+        return true;
+    }
+};
+
+// Last use of a resource that is about to be destroyed. It is freed once
+// frameNumber retired and, with a timeline, once the timeline reached
+// timelineValue, e.g. for resources the upload queue still reads
+struct RetirePoint {
+    uint64_t frameNumber{0};
+    vk::Semaphore timeline;
+    uint64_t timelineValue{0};
+};
+
+struct ResourceRegistryStats {
+    uint32_t buffers{0};
+    uint32_t images{0};
+    uint32_t imageViews{0};
+    uint32_t pipelines{0};
+    // destroyed, waiting for their last use to retire
+    uint32_t pending{0};
+};
+
+// Owns dynamically created buffers, images, views and pipelines behind
+// generational handles, and destroys them deferred: release() invalidates the
+// handle right away, the Vulkan object goes to a deletion queue and is freed
+// by retire() once the frames, and timeline work, that may still use it have
+// finished. Creating and dropping resources while frames are in flight thus
+// needs neither a device wait nor care about use after free.
+//
+// Objects created elsewhere can be handed to the deletion queue with defer().
+// All methods are thread safe
+class ResourceRegistry {
+public:
+    void init(vk::Device device, GpuAllocator& allocator, uint32_t framesInFlight);
+
+    // after the device went idle, frees live and pending resources alike
+    void destroy();
+
+    BufferHandle createBuffer(MemoryClass memClass, vk::DeviceSize size, vk::BufferUsageFlags usage,
+        const std::vector<uint32_t>& concurrentFamilies = {});
+
+    ImageHandle createImage(MemoryClass memClass, const vk::ImageCreateInfo& imageInfo);
+
+    ImageViewHandle createImageView(const vk::ImageViewCreateInfo& viewInfo);
+
+    // Takes ownership of a pipeline created outside of the PipelineManager,
+    // whose cached pipelines live until it is destroyed
+    PipelineHandle adoptPipeline(vk::Pipeline pipeline);
+
+    // empty buffer or null handles once released
+    AllocatedBuffer buffer(BufferHandle handle) const;
+
+    vk::Image image(ImageHandle handle) const;
+
+    vk::ImageView imageView(ImageViewHandle handle) const;
+
+    vk::Pipeline pipeline(PipelineHandle handle) const;
+
+    // The handle stops resolving now, the object is destroyed once lastUse
+    // retired. Releasing a stale handle does nothing
+    void release(BufferHandle handle, const RetirePoint& lastUse);
+
+    void release(ImageHandle handle, const RetirePoint& lastUse);
+
+    void release(ImageViewHandle handle, const RetirePoint& lastUse);
+
+    void release(PipelineHandle handle, const RetirePoint& lastUse);
+
+    // objects not created through the registry
+    void defer(const AllocatedBuffer& buffer, const RetirePoint& lastUse);
+
+    void defer(const AllocatedImage& image, const RetirePoint& lastUse);
+
+    void defer(vk::ImageView view, const RetirePoint& lastUse);
+
+    void defer(vk::Pipeline pipeline, const RetirePoint& lastUse);
+
+    // Call after the fence wait of frameNumber, destroys what is no longer used
+    void retire(uint64_t frameNumber);
+
+    ResourceRegistryStats stats() const;
+
+private:
+    // one object, the others are null
+    struct PendingDestruction {
+        AllocatedBuffer buffer;
+        AllocatedImage image;
+        vk::ImageView view;
+        vk::Pipeline pipeline;
+        RetirePoint lastUse;
+    };
+
+    void destroyObjects(PendingDestruction& pending);
+
+    vk::Device _device;
+    GpuAllocator* _allocator{nullptr};
+    uint32_t _framesInFlight{1};
+
+    mutable std::mutex _mutex;
+    ResourcePool<AllocatedBuffer> _buffers;
+    ResourcePool<AllocatedImage> _images;
+    ResourcePool<vk::ImageView> _imageViews;
+    ResourcePool<vk::Pipeline> _pipelines;
+    std::vector<PendingDestruction> _pending;
+};
@@ -0,0 +1,346 @@
+#include "scene.hpp"
+
+#include <stdexcept>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SCENE_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCENE_SIMD_SSE
+#endif
+
+namespace {
+
+constexpr uint32_t InvalidWorldSlot = ~0u;
+
+// floats between the same field of two consecutive instances
+constexpr uint32_t InstanceStride = sizeof(SceneInstance) / sizeof(float);
+
+// Local transform streams read by the batch kernel
+struct LocalStreams {
+    const float* positionX;
+    const float* positionY;
+    const float* positionZ;
+    const float* rotationX;
+    const float* rotationY;
+    const float* rotationZ;
+    const float* rotationW;
+    const float* scale;
+    const float* boundsX;
+    const float* boundsY;
+    const float* boundsZ;
+    const float* boundsRadius;
+    const float* colorR;
+    const float* colorG;
+    const float* colorB;
+    const float* colorA;
+    const uint32_t* material;
+};
+
+// one vec4 field of an instance, bypassing the cache where the target can
+inline void streamVec4(float* dst, float x, float y, float z, float w){
+#if defined(SCENE_SIMD_SSE) || defined(SCENE_SIMD_AVX)
+    _mm_stream_ps(dst, _mm_setr_ps(x, y, z, w));
+#else
+    dst[0] = x;
+    dst[1] = y;
+    dst[2] = z;
+    dst[3] = w;
+#endif
+}
+
+inline void streamUvec4(uint32_t* dst, uint32_t x, uint32_t y, uint32_t z, uint32_t w){
+#if defined(SCENE_SIMD_SSE) || defined(SCENE_SIMD_AVX)
+    _mm_stream_si128(reinterpret_cast<__m128i*>(dst), _mm_setr_epi32(int(x), int(y), int(z), int(w)));
+#else
+    dst[0] = x;
+    dst[1] = y;
+    dst[2] = z;
+    dst[3] = w;
+#endif
+}
+
+// streaming stores are weakly ordered
+inline void streamFence(){
+#if defined(SCENE_SIMD_SSE) || defined(SCENE_SIMD_AVX)
+    _mm_sfence();
+#endif
+}
+
+// One node per pack, for the tail of a batch and targets without SIMD
+struct ScalarPack {
+    static constexpr uint32_t Width = 1;
+
+    float v;
+
+    static ScalarPack load(const float* p){
+        return {*p};
+    }
+
+    static ScalarPack set(float f){
+        return {f};
+    }
+
+    // x, y, z, w of the nodes into one vec4 field of their instances
+    static void stream(float* dst, ScalarPack x, ScalarPack y, ScalarPack z, ScalarPack w){
+        streamVec4(dst, x.v, y.v, z.v, w.v);
+    }
+
+    static void fence(){
+        streamFence();
+    }
+
+    friend ScalarPack operator+(ScalarPack a, ScalarPack b){ return {a.v + b.v}; }
+    friend ScalarPack operator-(ScalarPack a, ScalarPack b){ return {a.v - b.v}; }
+    friend ScalarPack operator*(ScalarPack a, ScalarPack b){ return {a.v * b.v}; }
+};
+
+#if defined(SCENE_SIMD_SSE) || defined(SCENE_SIMD_AVX)
+// transposes four lanes of x, y, z, w into four vec4 fields, bypassing the cache
+inline void streamTransposed(float* dst, __m128 x, __m128 y, __m128 z, __m128 w){
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_stream_ps(dst, x);
+    _mm_stream_ps(dst + InstanceStride, y);
+    _mm_stream_ps(dst + 2*InstanceStride, z);
+    _mm_stream_ps(dst + 3*InstanceStride, w);
+}
+#endif
+
+#if defined(SCENE_SIMD_AVX)
+struct SimdPack {
+    static constexpr uint32_t Width = 8;
+
+    __m256 v;
+
+    static SimdPack load(const float* p){
+        return {_mm256_loadu_ps(p)};
+    }
+
+    static SimdPack set(float f){
+        return {_mm256_set1_ps(f)};
+    }
+
+    static void stream(float* dst, SimdPack x, SimdPack y, SimdPack z, SimdPack w){
+        streamTransposed(dst,
+            _mm256_castps256_ps128(x.v), _mm256_castps256_ps128(y.v),
+            _mm256_castps256_ps128(z.v), _mm256_castps256_ps128(w.v));
+        streamTransposed(dst + 4*InstanceStride,
+            _mm256_extractf128_ps(x.v, 1), _mm256_extractf128_ps(y.v, 1),
+            _mm256_extractf128_ps(z.v, 1), _mm256_extractf128_ps(w.v, 1));
+    }
+
+    static void fence(){
+        streamFence();
+    }
+
+    friend SimdPack operator+(SimdPack a, SimdPack b){ return {_mm256_add_ps(a.v, b.v)}; }
+    friend SimdPack operator-(SimdPack a, SimdPack b){ return {_mm256_sub_ps(a.v, b.v)}; }
+    friend SimdPack operator*(SimdPack a, SimdPack b){ return {_mm256_mul_ps(a.v, b.v)}; }
+};
+#elif defined(SCENE_SIMD_SSE)
+struct SimdPack {
+    static constexpr uint32_t Width = 4;
+
+    __m128 v;
+
+    static SimdPack load(const float* p){
+        return {_mm_loadu_ps(p)};
+    }
+
+    static SimdPack set(float f){
+        return {_mm_set1_ps(f)};
+    }
+
+    static void stream(float* dst, SimdPack x, SimdPack y, SimdPack z, SimdPack w){
+        streamTransposed(dst, x.v, y.v, z.v, w.v);
+    }
+
+    static void fence(){
+        streamFence();
+    }
+
+    friend SimdPack operator+(SimdPack a, SimdPack b){ return {_mm_add_ps(a.v, b.v)}; }
+    friend SimdPack operator-(SimdPack a, SimdPack b){ return {_mm_sub_ps(a.v, b.v)}; }
+    friend SimdPack operator*(SimdPack a, SimdPack b){ return {_mm_mul_ps(a.v, b.v)}; }
+};
+#else
+using SimdPack = ScalarPack;
+#endif
+
+// Writes the instances of Pack::Width nodes starting at i, taking their local
+// transform as world transform
+template<typename Pack>
+inline void transformBatch(const LocalStreams& s, uint32_t i, SceneInstance* out){
+    Pack x = Pack::load(s.rotationX + i);
+    Pack y = Pack::load(s.rotationY + i);
+    Pack z = Pack::load(s.rotationZ + i);
+    Pack w = Pack::load(s.rotationW + i);
+    Pack scale = Pack::load(s.scale + i);
+
+    // rotation matrix rows as in glm::mat3_cast, times the scale
+    Pack xx = x*x, yy = y*y, zz = z*z;
+    Pack xy = x*y, xz = x*z, yz = y*z;
+    Pack wx = w*x, wy = w*y, wz = w*z;
+    Pack scale2 = scale + scale;
+    Pack m00 = scale - scale2*(yy + zz), m01 = scale2*(xy - wz), m02 = scale2*(xz + wy);
+    Pack m10 = scale2*(xy + wz), m11 = scale - scale2*(xx + zz), m12 = scale2*(yz - wx);
+    Pack m20 = scale2*(xz - wy), m21 = scale2*(yz + wx), m22 = scale - scale2*(xx + yy);
+    Pack tx = Pack::load(s.positionX + i);
+    Pack ty = Pack::load(s.positionY + i);
+    Pack tz = Pack::load(s.positionZ + i);
+
+    Pack cx = Pack::load(s.boundsX + i);
+    Pack cy = Pack::load(s.boundsY + i);
+    Pack cz = Pack::load(s.boundsZ + i);
+    Pack radius = Pack::load(s.boundsRadius + i) * scale;
+
+    float* dst = &out[i].transform[0].x;
+    Pack::stream(dst, m00, m01, m02, tx);
+    Pack::stream(dst + 4, m10, m11, m12, ty);
+    Pack::stream(dst + 8, m20, m21, m22, tz);
+    Pack::stream(dst + 12,
+        m00*cx + m01*cy + m02*cz + tx,
+        m10*cx + m11*cy + m12*cz + ty,
+        m20*cx + m21*cy + m22*cz + tz,
+        radius);
+    Pack::stream(dst + 16,
+        Pack::load(s.colorR + i), Pack::load(s.colorG + i),
+        Pack::load(s.colorB + i), Pack::load(s.colorA + i));
+    // one whole field per instance, there is nothing to compute
+    for(uint32_t lane=0;lane<Pack::Width;++lane)
+        streamUvec4(&out[i + lane].material.x, s.material[i + lane], 0, 0, 0);
+}
+
+}
+
+void Scene::reserve(uint32_t count){
+    for(auto* array : {
+        &_positionX, &_positionY, &_positionZ,
+        &_rotationX, &_rotationY, &_rotationZ, &_rotationW, &_scale,
+        &_boundsX, &_boundsY, &_boundsZ, &_boundsRadius,
+        &_colorR, &_colorG, &_colorB, &_colorA})
+        array->reserve(count);
+    _material.reserve(count);
+    _parents.reserve(count);
+    _worldSlots.reserve(count);
+    _depths.reserve(count);
+}
+
+void Scene::clear(){
+    for(auto* array : {
+        &_positionX, &_positionY, &_positionZ,
+        &_rotationX, &_rotationY, &_rotationZ, &_rotationW, &_scale,
+        &_boundsX, &_boundsY, &_boundsZ, &_boundsRadius,
+        &_colorR, &_colorG, &_colorB, &_colorA})
+        array->clear();
+    _material.clear();
+    _parents.clear();
+    _worldSlots.clear();
+    _worlds.clear();
+    _levels.clear();
+    _depths.clear();
+}
+
+SceneNode Scene::create(SceneNode parent){
+    if(parent != InvalidSceneNode && parent >= size())
+        throw std::runtime_error("scene node parent doesn't exist");
+    SceneNode node = size();
+    _parents.push_back(parent);
+    _positionX.push_back(0.0f);
+    _positionY.push_back(0.0f);
+    _positionZ.push_back(0.0f);
+    _rotationX.push_back(0.0f);
+    _rotationY.push_back(0.0f);
+    _rotationZ.push_back(0.0f);
+    _rotationW.push_back(1.0f);
+    _scale.push_back(1.0f);
+    _boundsX.push_back(0.0f);
+    _boundsY.push_back(0.0f);
+    _boundsZ.push_back(0.0f);
+    _boundsRadius.push_back(0.0f);
+    _colorR.push_back(1.0f);
+    _colorG.push_back(1.0f);
+    _colorB.push_back(1.0f);
+    _colorA.push_back(1.0f);
+    _material.push_back(NoSceneMaterial);
+    _worldSlots.push_back(InvalidWorldSlot);
+
+    uint32_t depth = 0;
+    if(parent != InvalidSceneNode){
+        depth = _depths[parent] + 1;
+        if(_levels.size() <= depth)
+            _levels.resize(depth + 1);
+        // the parent's world transform is kept from now on
+        if(_worldSlots[parent] == InvalidWorldSlot){
+            _worldSlots[parent] = uint32_t(_worlds.size());
+            _worlds.emplace_back();
+            if(_depths[parent] == 0)
+                _levels[0].push_back(parent);
+        }
+        _levels[depth].push_back(node);
+    }
+    _depths.push_back(depth);
+    return node;
+}
+
+Scene::WorldTransform Scene::localTransform(SceneNode node) const {
+    glm::quat rotation(_rotationW[node], _rotationX[node], _rotationY[node], _rotationZ[node]);
+    WorldTransform local;
+    local.basis = glm::mat3_cast(rotation) * _scale[node];
+    local.translation = glm::vec3(_positionX[node], _positionY[node], _positionZ[node]);
+    local.scale = _scale[node];
+    return local;
+}
+
+void Scene::update(JobSystem& jobs, SceneInstance* out){
+    if(reinterpret_cast<uintptr_t>(out) % 16 != 0)
+        throw std::runtime_error("scene instances must be 16 byte aligned");
+
+    LocalStreams streams{
+        _positionX.data(), _positionY.data(), _positionZ.data(),
+        _rotationX.data(), _rotationY.data(), _rotationZ.data(), _rotationW.data(),
+        _scale.data(),
+        _boundsX.data(), _boundsY.data(), _boundsZ.data(), _boundsRadius.data(),
+        _colorR.data(), _colorG.data(), _colorB.data(), _colorA.data(),
+        _material.data(),
+    };
+    jobs.parallelFor(size(), 4096, [&](uint32_t begin, uint32_t end, uint32_t){
+        uint32_t i = begin;
+        for(;i + SimdPack::Width <= end;i+=SimdPack::Width)
+            transformBatch<SimdPack>(streams, i, out);
+        for(;i<end;++i)
+            transformBatch<ScalarPack>(streams, i, out);
+        SimdPack::fence();
+    });
+
+    for(uint32_t depth=0;depth<_levels.size();++depth)
+        updateLevel(jobs, _levels[depth], depth == 0, out);
+}
+
+void Scene::updateLevel(JobSystem& jobs, const std::vector<SceneNode>& nodes, bool roots, SceneInstance* out){
+    jobs.parallelFor(uint32_t(nodes.size()), 1024, [&](uint32_t begin, uint32_t end, uint32_t){
+        for(uint32_t i=begin;i<end;++i){
+            SceneNode node = nodes[i];
+            WorldTransform world = localTransform(node);
+            // roots are already written, they only keep their transform for the children
+            if(!roots){
+                const WorldTransform& parent = _worlds[_worldSlots[_parents[node]]];
+                world.basis = parent.basis * world.basis;
+                world.translation = parent.basis * world.translation + parent.translation;
+                world.scale *= parent.scale;
+
+                SceneInstance& instance = out[node];
+                for(int row=0;row<3;++row)
+                    streamVec4(&instance.transform[row].x, world.basis[0][row], world.basis[1][row], world.basis[2][row], world.translation[row]);
+                glm::vec3 center = world.basis * glm::vec3(_boundsX[node], _boundsY[node], _boundsZ[node]) + world.translation;
+                streamVec4(&instance.sphere.x, center.x, center.y, center.z, _boundsRadius[node] * world.scale);
+                streamVec4(&instance.color.x, _colorR[node], _colorG[node], _colorB[node], _colorA[node]);
+                streamUvec4(&instance.material.x, _material[node], 0, 0, 0);
+            }
+            if(_worldSlots[node] != InvalidWorldSlot)
+                _worlds[_worldSlots[node]] = world;
+        }
+        streamFence();
+    });
+}
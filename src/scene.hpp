@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "jobs.hpp"
+
+using SceneNode = uint32_t;
+
+inline constexpr SceneNode InvalidSceneNode = ~0u;
+
+// material of nodes drawn without one
+inline constexpr uint32_t NoSceneMaterial = ~0u;
+
+// matches SceneInstance in scene.vert and cull.comp
+struct SceneInstance {
+    // rows of the affine world matrix
+    glm::vec4 transform[3];
+    // world space bounding sphere, xyz center and w radius
+    glm::vec4 sphere;
+    glm::vec4 color;
+    // x the node's material, yzw unused
+    glm::uvec4 material;
+};
+
+// Transforms, parents and bounds of every node in structure of arrays form,
+// so the per frame update streams through a few flat arrays and runs several
+// nodes per SIMD instruction. Local transforms are translation, rotation and
+// a positive uniform scale, bounds are a sphere in the node's local space.
+//
+// Parents are created before their children and never change, which keeps
+// the nodes of every hierarchy level in a flat list. Nodes can't be removed
+class Scene {
+public:
+    void reserve(uint32_t count);
+
+    void clear();
+
+    SceneNode create(SceneNode parent = InvalidSceneNode);
+
+    uint32_t size() const {
+        return uint32_t(_parents.size());
+    }
+
+    SceneNode parent(SceneNode node) const {
+        return _parents[node];
+    }
+
+    // local, the same as world for nodes without a parent
+    glm::vec3 position(SceneNode node) const {
+        return glm::vec3(_positionX[node], _positionY[node], _positionZ[node]);
+    }
+
+    // local bounding radius times the node's own scale
+    float scaledRadius(SceneNode node) const {
+        return _boundsRadius[node] * _scale[node];
+    }
+
+    void setPosition(SceneNode node, const glm::vec3& position){
+        _positionX[node] = position.x;
+        _positionY[node] = position.y;
+        _positionZ[node] = position.z;
+    }
+
+    // normalized
+    void setRotation(SceneNode node, const glm::quat& rotation){
+        _rotationX[node] = rotation.x;
+        _rotationY[node] = rotation.y;
+        _rotationZ[node] = rotation.z;
+        _rotationW[node] = rotation.w;
+    }
+
+    void setScale(SceneNode node, float scale){
+        _scale[node] = scale;
+    }
+
+    // xyz center and w radius in local space
+    void setBounds(SceneNode node, const glm::vec4& sphere){
+        _boundsX[node] = sphere.x;
+        _boundsY[node] = sphere.y;
+        _boundsZ[node] = sphere.z;
+        _boundsRadius[node] = sphere.w;
+    }
+
+    // Opaque to the scene, the renderer resolves it, e.g. to a texture.
+    // NoSceneMaterial by default
+    uint32_t material(SceneNode node) const {
+        return _material[node];
+    }
+
+    void setMaterial(SceneNode node, uint32_t material){
+        _material[node] = material;
+    }
+
+    void setColor(SceneNode node, const glm::vec4& color){
+        _colorR[node] = color.r;
+        _colorG[node] = color.g;
+        _colorB[node] = color.b;
+        _colorA[node] = color.a;
+    }
+
+    // Computes the world transform and bounds of every node and writes one
+    // instance per node to out, which must be 16 byte aligned and may be
+    // write combined memory, it is only written, with streaming stores on
+    // SSE targets and whole vec4 fields in order otherwise.
+    //
+    // All nodes first take their local transform as world transform in
+    // parallel SIMD batches, then the hierarchy levels fix up the children
+    // one level after the other
+    void update(JobSystem& jobs, SceneInstance* out);
+
+private:
+    // world transform of a node with children, rotation and scale in one matrix
+    struct WorldTransform {
+        glm::mat3 basis;
+        glm::vec3 translation;
+        float scale;
+    };
+
+    WorldTransform localTransform(SceneNode node) const;
+
+    void updateLevel(JobSystem& jobs, const std::vector<SceneNode>& nodes, bool roots, SceneInstance* out);
+
+    std::vector<SceneNode> _parents;
+    std::vector<float> _positionX, _positionY, _positionZ;
+    std::vector<float> _rotationX, _rotationY, _rotationZ, _rotationW;
+    std::vector<float> _scale;
+    std::vector<float> _boundsX, _boundsY, _boundsZ, _boundsRadius;
+    std::vector<float> _colorR, _colorG, _colorB, _colorA;
+    std::vector<uint32_t> _material;
+
+    // slot of a node in _worlds, only nodes with children have one
+    std::vector<uint32_t> _worldSlots;
+    std::vector<WorldTransform> _worlds;
+    // _levels[0] holds the roots with children, _levels[d] every node at depth d
+    std::vector<std::vector<SceneNode>> _levels;
+    std::vector<uint32_t> _depths;
+};
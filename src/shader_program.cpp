@@ -0,0 +1,156 @@
+#include "shader_program.hpp"
+
+#include "bindless.hpp"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+void ShaderProgram::configure(PipelineBuilder& builder) const {
+    for(const auto& stage : stages)
+        builder.shader(stage.stage, stage.module, stage.entry.c_str(), stage.codeHash);
+    if(vertexStride > 0)
+        builder.vertexBinding(0, vertexStride);
+    if(instanceStride > 0)
+        builder.vertexBinding(InstanceBinding, instanceStride, vk::VertexInputRate::eInstance);
+    for(const auto& attribute : attributes)
+        builder.vertexAttribute(attribute.location, attribute.binding, attribute.format, attribute.offset);
+    builder.layout(layout, layoutKey);
+}
+
+vk::ShaderStageFlags ShaderProgram::stageFlags() const {
+    vk::ShaderStageFlags flags;
+    for(const auto& stage : stages)
+        flags |= stage.stage;
+    return flags;
+}
+
+// the pipeline key of a layout, equal for layouts with the same definition
+static uint64_t hashLayout(const std::vector<std::vector<vk::DescriptorSetLayoutBinding>>& sets, vk::PushConstantRange pushConstants){
+    uint64_t key = ContentHashSeed;
+    for(uint32_t set=0;set<sets.size();++set){
+        for(const auto& binding : sets[set]){
+            uint32_t words[5] = {set, binding.binding, uint32_t(binding.descriptorType), binding.descriptorCount,
+                uint32_t(VkShaderStageFlags(binding.stageFlags))};
+            key = contentHash(words, sizeof(words), key);
+        }
+    }
+    uint32_t push[3] = {uint32_t(VkShaderStageFlags(pushConstants.stageFlags)), pushConstants.offset, pushConstants.size};
+    return contentHash(push, sizeof(push), key);
+}
+
+// creates the module of one stage and takes the vertex input of the vertex stage
+static void addStage(vk::Device device, const ShaderBlob* blob, ShaderProgram& program){
+    vk::ShaderModuleCreateInfo moduleInfo{};
+    moduleInfo.codeSize = blob->codeSize;
+    moduleInfo.pCode = blob->code;
+    vk::ShaderStageFlagBits stage = vk::ShaderStageFlagBits(blob->stage);
+    program.stages.push_back({stage, device.createShaderModule(moduleInfo), blob->entry, contentHash(blob->code, blob->codeSize)});
+
+    if(blob->stage == VK_SHADER_STAGE_VERTEX_BIT){
+        for(uint32_t i=0;i<blob->vertexInputCount;++i){
+            const ReflectedVertexInput& input = blob->vertexInputs[i];
+            if(input.location < FirstInstanceLocation){
+                program.attributes.push_back({input.location, 0, vk::Format(input.format), program.vertexStride});
+                program.vertexStride += input.size;
+            }
+            else{
+                program.attributes.push_back({input.location, InstanceBinding, vk::Format(input.format), program.instanceStride});
+                program.instanceStride += input.size;
+            }
+        }
+    }
+}
+
+ShaderProgram createShaderProgram(vk::Device device, std::initializer_list<const ShaderBlob*> blobs){
+    ShaderProgram program;
+
+    // (set, binding) -> merged binding
+    std::map<std::pair<uint32_t, uint32_t>, vk::DescriptorSetLayoutBinding> bindings;
+    uint32_t pushBegin = ~0u, pushEnd = 0;
+    vk::ShaderStageFlags pushStages;
+
+    for(const ShaderBlob* blob : blobs){
+        addStage(device, blob, program);
+        vk::ShaderStageFlagBits stage = vk::ShaderStageFlagBits(blob->stage);
+
+        for(uint32_t i=0;i<blob->bindingCount;++i){
+            const ReflectedBinding& reflected = blob->bindings[i];
+            vk::DescriptorType type = vk::DescriptorType(reflected.type);
+            uint32_t count = std::max(reflected.count, 1u);
+            auto [it, inserted] = bindings.try_emplace(
+                std::make_pair(reflected.set, reflected.binding),
+                reflected.binding, type, count, stage, nullptr
+            );
+            if(!inserted){
+                if(it->second.descriptorType != type)
+                    throw std::runtime_error(std::string("descriptor type mismatch in ") + blob->name);
+                it->second.stageFlags |= stage;
+                it->second.descriptorCount = std::max(it->second.descriptorCount, count);
+            }
+        }
+
+        if(blob->pushConstants.size > 0){
+            pushBegin = std::min(pushBegin, blob->pushConstants.offset);
+            pushEnd = std::max(pushEnd, blob->pushConstants.offset + blob->pushConstants.size);
+            pushStages |= stage;
+        }
+    }
+
+    uint32_t setCount = bindings.empty() ? 0 : bindings.rbegin()->first.first + 1;
+    std::vector<std::vector<vk::DescriptorSetLayoutBinding>> setBindings(setCount);
+    for(const auto& [key, binding] : bindings)
+        setBindings[key.first].push_back(binding);
+    for(const auto& set : setBindings){
+        vk::DescriptorSetLayoutCreateInfo setInfo{};
+        setInfo.setBindings(set);
+        program.setLayouts.push_back(device.createDescriptorSetLayout(setInfo));
+    }
+
+    // One range shared by every stage that declares push constants
+    vk::PipelineLayoutCreateInfo layoutInfo{};
+    layoutInfo.setSetLayouts(program.setLayouts);
+    if(pushEnd > 0){
+        program.pushConstants = vk::PushConstantRange{pushStages, pushBegin, pushEnd - pushBegin};
+        layoutInfo.setPushConstantRanges(program.pushConstants);
+    }
+    program.layout = device.createPipelineLayout(layoutInfo);
+    program.layoutKey = hashLayout(setBindings, program.pushConstants);
+    return program;
+}
+
+ShaderProgram createShaderProgram(vk::Device device, std::initializer_list<const ShaderBlob*> blobs, const BindlessDescriptors& bindless){
+    static constexpr vk::DescriptorType bindlessTypes[BindlessDescriptors::BindingCount] = {
+        vk::DescriptorType::eSampledImage,
+        vk::DescriptorType::eStorageBuffer,
+        vk::DescriptorType::eSampler,
+    };
+    ShaderProgram program;
+    for(const ShaderBlob* blob : blobs){
+        for(uint32_t i=0;i<blob->bindingCount;++i){
+            const ReflectedBinding& reflected = blob->bindings[i];
+            if(reflected.set != 0 || reflected.binding >= BindlessDescriptors::BindingCount ||
+                vk::DescriptorType(reflected.type) != bindlessTypes[reflected.binding])
+                throw std::runtime_error(std::string("binding outside the bindless set in ") + blob->name);
+        }
+        if(blob->pushConstants.offset + blob->pushConstants.size > BindlessDescriptors::PushConstantSize)
+            throw std::runtime_error(std::string("push constants too large for the bindless layout in ") + blob->name);
+        addStage(device, blob, program);
+    }
+    program.pushConstants = vk::PushConstantRange{vk::ShaderStageFlagBits::eAll, 0, BindlessDescriptors::PushConstantSize};
+    program.layout = bindless.pipelineLayout();
+    program.layoutKey = bindless.layoutKey();
+    program.ownsLayout = false;
+    return program;
+}
+
+void destroyShaderProgram(vk::Device device, ShaderProgram& program){
+    if(program.ownsLayout)
+        device.destroyPipelineLayout(program.layout);
+    for(auto setLayout : program.setLayouts)
+        device.destroyDescriptorSetLayout(setLayout);
+    for(auto& stage : program.stages)
+        device.destroyShaderModule(stage.module);
+    program = {};
+}
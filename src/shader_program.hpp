@@ -0,0 +1,50 @@
+#pragma once
+
+#include <initializer_list>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "pipelines.hpp"
+#include "shader_reflection.hpp"
+
+class BindlessDescriptors;
+
+// Vertex inputs from this location on are per instance and read from binding
+// InstanceBinding, the ones below are per vertex and read from binding 0
+inline constexpr uint32_t FirstInstanceLocation = 8;
+inline constexpr uint32_t InstanceBinding = 1;
+
+// Shader modules of one pipeline plus the descriptor set layouts, pipeline
+// layout and vertex input built from their merged reflection data
+struct ShaderProgram {
+    std::vector<ShaderStageDesc> stages;
+    // indexed by set number, sets without bindings get an empty layout
+    std::vector<vk::DescriptorSetLayout> setLayouts;
+    vk::PushConstantRange pushConstants;
+    vk::PipelineLayout layout;
+    // content key of the layout for the pipeline manager
+    uint64_t layoutKey{0};
+    // false when the layout is shared, e.g. the bindless one
+    bool ownsLayout{true};
+    // vertex inputs interleaved in location order, per vertex ones in
+    // binding 0 and per instance ones in InstanceBinding
+    std::vector<vk::VertexInputAttributeDescription> attributes;
+    uint32_t vertexStride{0};
+    uint32_t instanceStride{0};
+
+    // adds the stages, layout and vertex input to a pipeline description
+    void configure(PipelineBuilder& builder) const;
+
+    // vk stage flags of every stage in the program
+    vk::ShaderStageFlags stageFlags() const;
+};
+
+// Throws when two stages disagree on the type of a binding.
+// Runtime sized arrays get a single descriptor
+ShaderProgram createShaderProgram(vk::Device device, std::initializer_list<const ShaderBlob*> blobs);
+
+// Program indexing the bindless set, uses its shared pipeline layout. Throws
+// when a stage declares bindings outside of it or too many push constants
+ShaderProgram createShaderProgram(vk::Device device, std::initializer_list<const ShaderBlob*> blobs, const BindlessDescriptors& bindless);
+
+void destroyShaderProgram(vk::Device device, ShaderProgram& program);
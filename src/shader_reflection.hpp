@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vulkan/vulkan_core.h>
+
+// Plain data emitted by tools/spirv_embed for every shader in shaders/,
+// the generated headers define one constexpr ShaderBlob per shader
+
+struct ReflectedBinding {
+    uint32_t set;
+    uint32_t binding;
+    VkDescriptorType type;
+    // 0 for runtime sized arrays
+    uint32_t count;
+};
+
+struct ReflectedPushConstants {
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct ReflectedVertexInput {
+    uint32_t location;
+    VkFormat format;
+    uint32_t size;
+};
+
+struct ShaderBlob {
+    const char* name;
+    const uint32_t* code;
+    // in bytes
+    size_t codeSize;
+    VkShaderStageFlagBits stage;
+    const char* entry;
+
+    const ReflectedBinding* bindings;
+    uint32_t bindingCount;
+    // size 0 when the shader has no push constant block
+    ReflectedPushConstants pushConstants;
+    // vertex shaders only, sorted by location
+    const ReflectedVertexInput* vertexInputs;
+    uint32_t vertexInputCount;
+};
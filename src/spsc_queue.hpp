@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free queue between exactly one producer and one consumer
+// thread. Capacity must be a power of two. Indices only grow, each side
+// caches the other's index so a push or pop touches the shared cache line
+// only when the cached value says the queue looks full or empty
+template<typename T, uint32_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // producer, false when full
+    bool push(const T& value){
+        uint64_t head = _head.load(std::memory_order_relaxed);
+        if(head - _cachedTail >= Capacity){
+            _cachedTail = _tail.load(std::memory_order_acquire);
+            if(head - _cachedTail >= Capacity)
+                return false;
+        }
+        _items[head & (Capacity - 1)] = value;
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer, false when empty
+    bool pop(T& value){
+        uint64_t tail = _tail.load(std::memory_order_relaxed);
+        if(tail == _cachedHead){
+            _cachedHead = _head.load(std::memory_order_acquire);
+            if(tail == _cachedHead)
+                return false;
+        }
+        value = _items[tail & (Capacity - 1)];
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static constexpr size_t CacheLine = 64;
+
+    // written by the producer
+    alignas(CacheLine) std::atomic<uint64_t> _head{0};
+    uint64_t _cachedTail{0};
+    // written by the consumer
+    alignas(CacheLine) std::atomic<uint64_t> _tail{0};
+    uint64_t _cachedHead{0};
+    alignas(CacheLine) std::array<T, Capacity> _items{};
+};
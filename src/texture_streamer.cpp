@@ -0,0 +1,367 @@
+#include "texture_streamer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <exception>
+
+void TextureStreamer::init(
+    vk::Device device,
+    GpuAllocator& allocator,
+    UploadManager& uploads,
+    BindlessDescriptors& bindless,
+    uint32_t framesInFlight,
+    vk::DeviceSize budget,
+    uint32_t decodeThreads
+){
+    _device = device;
+    _allocator = &allocator;
+    _uploads = &uploads;
+    _bindless = &bindless;
+    _framesInFlight = framesInFlight;
+    _budget = budget;
+    _quit = false;
+    for(uint32_t i=0;i<std::max(decodeThreads, 1u);++i)
+        _threads.emplace_back([this]{ decodeLoop(); });
+}
+
+void TextureStreamer::destroy(){
+    stopThreads();
+
+    // levels of unfinished changes may still be copied into their images
+    _uploads->flush();
+    {
+        std::lock_guard<std::mutex> queueLock(_uploads->queueMutex());
+        _device.waitIdle();
+    }
+
+    for(auto& texture : _textures){
+        if(texture->transitioning)
+            retire(texture->pending, 0);
+        retire(texture->resident, 0);
+    }
+    for(auto& retired : _retired){
+        _device.destroyImageView(retired.view);
+        _allocator->destroyImage(retired.image);
+    }
+    _retired.clear();
+    _textures.clear();
+    _allocatedBytes = 0;
+    _transitions = 0;
+}
+
+void TextureStreamer::stopThreads(){
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _quit = true;
+        _tasks.clear();
+    }
+    _wake.notify_all();
+    for(auto& thread : _threads)
+        thread.join();
+    _threads.clear();
+}
+
+TextureHandle TextureStreamer::load(const std::string& path){
+    auto texture = std::make_unique<Texture>();
+    texture->path = path;
+    TextureHandle handle = TextureHandle(_textures.size());
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tasks.push_back({texture.get(), ~0u});
+    }
+    _textures.push_back(std::move(texture));
+    _wake.notify_one();
+    return handle;
+}
+
+void TextureStreamer::requestSize(TextureHandle texture, float pixels){
+    uint32_t size = uint32_t(std::ceil(std::max(pixels, 1.0f)));
+    std::atomic<uint32_t>& requested = _textures[texture]->requestedPixels;
+    uint32_t current = requested.load(std::memory_order_relaxed);
+    while(current < size && !requested.compare_exchange_weak(current, size, std::memory_order_relaxed)){}
+}
+
+BindlessIndex TextureStreamer::bindlessIndex(TextureHandle texture) const {
+    return _textures[texture]->resident.index;
+}
+
+uint32_t TextureStreamer::residentMip(TextureHandle texture) const {
+    const Texture& t = *_textures[texture];
+    return t.resident.image.image ? t.resident.firstMip : ~0u;
+}
+
+TextureStreamerStats TextureStreamer::stats() const {
+    TextureStreamerStats stats;
+    stats.textures = uint32_t(_textures.size());
+    std::lock_guard<std::mutex> lock(_mutex);
+    for(auto& texture : _textures){
+        if(texture->state == State::Failed)
+            ++stats.failed;
+        stats.committedBytes += committedSize(*texture);
+    }
+    stats.allocatedBytes = _allocatedBytes;
+    stats.budget = _budget;
+    stats.transitions = _transitions;
+    stats.evictions = _evictions;
+    return stats;
+}
+
+void TextureStreamer::decodeLoop(){
+    // reused between levels, decoded levels go straight into the staging ring
+    std::vector<uint8_t> data;
+    for(;;){
+        DecodeTask task;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this]{ return _quit || !_tasks.empty(); });
+            if(_quit)
+                return;
+            task = _tasks.front();
+            _tasks.pop_front();
+        }
+        Texture& texture = *task.texture;
+
+        if(task.level == ~0u){
+            try{
+                Ktx2File file(texture.path);
+                std::lock_guard<std::mutex> lock(_mutex);
+                texture.file = std::move(file);
+                texture.state = State::Ready;
+            }
+            catch(const std::exception& e){
+                fprintf(stderr, "texture streaming: %s\n", e.what());
+                std::lock_guard<std::mutex> lock(_mutex);
+                texture.state = State::Failed;
+            }
+            continue;
+        }
+
+        UploadTicket ticket = 0;
+        bool failed = false;
+        try{
+            texture.file.readLevel(task.level, data);
+            ticket = _uploads->uploadImage(
+                texture.pending.image,
+                {vk::ImageAspectFlagBits::eColor, task.level - texture.pending.firstMip, 0, 1},
+                texture.file.levelExtent(task.level),
+                data.data(),
+                data.size()
+            );
+        }
+        catch(const std::exception& e){
+            fprintf(stderr, "texture streaming: %s\n", e.what());
+            failed = true;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        texture.pendingTicket = std::max(texture.pendingTicket, ticket);
+        texture.pendingFailed = texture.pendingFailed || failed;
+        --texture.pendingLevels;
+    }
+}
+
+void TextureStreamer::initTexture(Texture& texture){
+    const Ktx2File& file = texture.file;
+    uint32_t levelCount = file.levelCount();
+    // levels are uploaded whole, larger ones than the staging ring can't be
+    while(texture.minMip < levelCount && file.levelSize(texture.minMip) > _uploads->stagingSize())
+        ++texture.minMip;
+    texture.tailMip = 0;
+    while(texture.tailMip + 1 < levelCount){
+        vk::Extent3D extent = file.levelExtent(texture.tailMip);
+        if(std::max(extent.width, extent.height) <= TailSize)
+            break;
+        ++texture.tailMip;
+    }
+    if(texture.minMip > texture.tailMip){
+        fprintf(stderr, "texture streaming: mips of %s don't fit the staging ring\n", texture.path.c_str());
+        texture.state = State::Failed;
+    }
+    texture.resident.firstMip = levelCount;
+    texture.wantedMip = texture.tailMip;
+    texture.initialized = true;
+}
+
+vk::DeviceSize TextureStreamer::residencySize(const Texture& texture, uint32_t firstMip) const {
+    vk::DeviceSize size = 0;
+    for(uint32_t level=firstMip;level<texture.file.levelCount();++level)
+        size += texture.file.levelSize(level);
+    return size;
+}
+
+void TextureStreamer::startTransition(Texture& texture, uint32_t firstMip){
+    const Ktx2File& file = texture.file;
+    uint32_t mipLevels = file.levelCount() - firstMip;
+
+    vk::ImageCreateInfo imageInfo{};
+    imageInfo.imageType = vk::ImageType::e2D;
+    imageInfo.format = file.format();
+    imageInfo.extent = file.levelExtent(firstMip);
+    imageInfo.mipLevels = mipLevels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = vk::SampleCountFlagBits::e1;
+    imageInfo.tiling = vk::ImageTiling::eOptimal;
+    imageInfo.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    imageInfo.sharingMode = vk::SharingMode::eExclusive;
+    imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+    Residency pending;
+    pending.image = _allocator->createImage(MemoryClass::Texture, imageInfo);
+    vk::ImageViewCreateInfo viewInfo{};
+    viewInfo.image = pending.image.image;
+    viewInfo.viewType = vk::ImageViewType::e2D;
+    viewInfo.format = imageInfo.format;
+    viewInfo.subresourceRange = {vk::ImageAspectFlagBits::eColor, 0, mipLevels, 0, 1};
+    pending.view = _device.createImageView(viewInfo);
+    pending.firstMip = firstMip;
+    pending.size = residencySize(texture, firstMip);
+    _allocatedBytes += pending.size;
+    if(firstMip > texture.resident.firstMip)
+        ++_evictions;
+    ++_transitions;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        texture.pending = pending;
+        texture.transitioning = true;
+        texture.pendingLevels = mipLevels;
+        texture.pendingTicket = 0;
+        texture.pendingFailed = false;
+        // smallest first, so a stalled stream still leaves the low mips usable
+        for(uint32_t level=file.levelCount();level-->firstMip;)
+            _tasks.push_back({&texture, level});
+    }
+    _wake.notify_all();
+}
+
+void TextureStreamer::finishTransition(Texture& texture, uint64_t frameNumber){
+    texture.transitioning = false;
+    --_transitions;
+    if(texture.pendingFailed){
+        // keep what is resident, the file is broken
+        texture.state = State::Failed;
+        retire(texture.pending, frameNumber);
+        return;
+    }
+    retire(texture.resident, frameNumber);
+    texture.resident = texture.pending;
+    texture.resident.index = _bindless->registerImage(texture.resident.view);
+    texture.pending = {};
+}
+
+void TextureStreamer::retire(Residency& residency, uint64_t frameNumber){
+    if(residency.index != InvalidBindlessIndex)
+        _bindless->releaseImage(residency.index, frameNumber);
+    if(residency.image.image)
+        _retired.push_back({residency.image, residency.view, residency.size, frameNumber});
+    residency.image = {};
+    residency.view = nullptr;
+    residency.index = InvalidBindlessIndex;
+    residency.size = 0;
+}
+
+void TextureStreamer::update(uint64_t frameNumber){
+    // same retirement as the bindless indices the images were registered at
+    while(!_retired.empty() && _retired.front().frameNumber + _framesInFlight <= frameNumber){
+        RetiredImage& retired = _retired.front();
+        _device.destroyImageView(retired.view);
+        _allocator->destroyImage(retired.image);
+        _allocatedBytes -= retired.size;
+        _retired.pop_front();
+    }
+
+    std::vector<Texture*> ready;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for(auto& texture : _textures){
+            if(texture->state == State::Ready && !texture->initialized)
+                initTexture(*texture);
+            if(texture->transitioning && texture->pendingLevels == 0 &&
+                (texture->pendingTicket == 0 || _uploads->isReady(texture->pendingTicket)))
+                finishTransition(*texture, frameNumber);
+            if(texture->state == State::Ready)
+                ready.push_back(texture.get());
+        }
+    }
+
+    // the mip whose size matches the largest request of the frame
+    for(Texture* texture : ready){
+        uint32_t pixels = texture->requestedPixels.exchange(0, std::memory_order_relaxed);
+        if(pixels > 0){
+            vk::Extent3D extent = texture->file.levelExtent(0);
+            uint32_t size = std::max(extent.width, extent.height);
+            uint32_t mip = 0;
+            while(mip < texture->tailMip && (size >> (mip + 1)) >= pixels)
+                ++mip;
+            texture->wantedMip = std::max(mip, texture->minMip);
+            texture->lastRequestFrame = frameNumber;
+        }
+        else if(frameNumber - texture->lastRequestFrame > UnusedFrames)
+            texture->wantedMip = texture->tailMip;
+    }
+
+    vk::DeviceSize committed = 0;
+    for(Texture* texture : ready)
+        committed += committedSize(*texture);
+
+    // Upgrades, textures without anything resident first, then the most
+    // recently requested. Nothing resident loads just the tail
+    std::vector<Texture*> upgrades;
+    for(Texture* texture : ready){
+        uint32_t target = texture->resident.image.image ? texture->wantedMip : texture->tailMip;
+        if(!texture->transitioning && target < texture->resident.firstMip)
+            upgrades.push_back(texture);
+    }
+    std::sort(upgrades.begin(), upgrades.end(), [](const Texture* a, const Texture* b){
+        bool aEmpty = !a->resident.image.image;
+        bool bEmpty = !b->resident.image.image;
+        if(aEmpty != bEmpty)
+            return aEmpty;
+        if(a->lastRequestFrame != b->lastRequestFrame)
+            return a->lastRequestFrame > b->lastRequestFrame;
+        return a->resident.firstMip - a->wantedMip > b->resident.firstMip - b->wantedMip;
+    });
+
+    // eviction candidates hold more than they were last asked for, least
+    // recently requested at the back
+    std::vector<Texture*> evictions;
+    for(Texture* texture : ready){
+        if(!texture->transitioning && texture->resident.image.image && texture->resident.firstMip < texture->wantedMip)
+            evictions.push_back(texture);
+    }
+    std::sort(evictions.begin(), evictions.end(), [](const Texture* a, const Texture* b){
+        return a->lastRequestFrame > b->lastRequestFrame;
+    });
+    auto evict = [&](){
+        Texture* texture = evictions.back();
+        evictions.pop_back();
+        committed -= texture->resident.size;
+        startTransition(*texture, texture->wantedMip);
+        committed += texture->pending.size;
+    };
+
+    // over budget without any upgrade, e.g. after a burst of requests
+    while(committed > _budget && !evictions.empty() && _transitions < MaxTransitions)
+        evict();
+
+    for(Texture* texture : upgrades){
+        if(_transitions >= MaxTransitions)
+            break;
+        bool empty = !texture->resident.image.image;
+        uint32_t target = empty ? texture->tailMip : texture->wantedMip;
+        // the tails are small and always loaded, larger mips have to fit
+        while(!empty){
+            vk::DeviceSize growth = residencySize(*texture, target) - texture->resident.size;
+            while(committed + growth > _budget && !evictions.empty() && _transitions + 1 < MaxTransitions)
+                evict();
+            if(committed + growth <= _budget || target + 1 >= texture->resident.firstMip)
+                break;
+            ++target;
+        }
+        vk::DeviceSize growth = residencySize(*texture, target) - texture->resident.size;
+        if(!empty && committed + growth > _budget)
+            continue;
+        committed += growth;
+        startTransition(*texture, target);
+    }
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.hpp"
+#include "bindless.hpp"
+#include "ktx2.hpp"
+#include "upload.hpp"
+
+using TextureHandle = uint32_t;
+inline constexpr TextureHandle InvalidTextureHandle = ~0u;
+
+struct TextureStreamerStats {
+    uint32_t textures{0};
+    uint32_t failed{0};
+    // texel bytes the resident mips will take once the changes in flight landed
+    vk::DeviceSize committedBytes{0};
+    // texel bytes of every live image, including replaced ones waiting for
+    // their frames to retire
+    vk::DeviceSize allocatedBytes{0};
+    vk::DeviceSize budget{0};
+    uint32_t transitions{0};
+    // residency changes that dropped mips, since init()
+    uint64_t evictions{0};
+};
+
+// Streams the mips of KTX2 textures in and out of a texture memory budget.
+//
+// Each texture has one image holding its resident mips [residentMip, levelCount).
+// A texture starts with the mips up to TailSize texels resident, callers then
+// report how large it is on screen with requestSize() and update() picks the
+// mip that matches. Changing residency creates a new image for the new range,
+// decode threads read, decompress and upload its levels smallest first, and
+// the new image replaces the old one once the upload finished, so the
+// bindless index of a texture changes with its residency. The smaller mips
+// that were already resident are uploaded again, at most a third of the
+// texels of the new top mip, in exchange for no GPU side copies.
+//
+// When an upgrade doesn't fit the budget, textures holding more mips than they
+// were last asked for are shrunk first, least recently requested first. Mips
+// are kept as a cache otherwise.
+//
+// Decode threads are plain threads, not job workers, since they block on
+// file reads and the staging ring. Everything except requestSize() is called
+// from the render thread
+class TextureStreamer {
+public:
+    // mips up to this size are loaded first and never evicted
+    static constexpr uint32_t TailSize = 64;
+    // textures not requested for this many frames only want their tail
+    static constexpr uint64_t UnusedFrames = 120;
+    static constexpr uint32_t MaxTransitions = 8;
+
+    void init(
+        vk::Device device,
+        GpuAllocator& allocator,
+        UploadManager& uploads,
+        BindlessDescriptors& bindless,
+        uint32_t framesInFlight,
+        vk::DeviceSize budget,
+        uint32_t decodeThreads
+    );
+
+    // decode threads still running stop here, e.g. when startup threw
+    // before destroy(). GPU resources are left to destroy()
+    ~TextureStreamer(){
+        stopThreads();
+    }
+
+    // the frames that sampled the textures must have retired
+    void destroy();
+
+    // Queues the file, its header is parsed on a decode thread. Files that
+    // can't be streamed are reported there and never become resident
+    TextureHandle load(const std::string& path);
+
+    // Screen space size feedback, the texture was drawn this frame covering
+    // about pixels along its larger axis. The largest request of a frame
+    // counts. Thread safe, except against load()
+    void requestSize(TextureHandle texture, float pixels);
+
+    // Once per frame after the fence wait of frameNumber. Swaps in finished
+    // residency changes, frees images of retired frames and starts new changes
+    void update(uint64_t frameNumber);
+
+    // The image of the resident mips, changes with the residency so look it
+    // up every frame. InvalidBindlessIndex while nothing is resident
+    BindlessIndex bindlessIndex(TextureHandle texture) const;
+
+    // largest resident mip, ~0u while nothing is resident
+    uint32_t residentMip(TextureHandle texture) const;
+
+    TextureStreamerStats stats() const;
+
+private:
+    enum class State {
+        Loading,
+        Ready,
+        Failed,
+    };
+
+    // one image holding the mips [firstMip, levelCount)
+    struct Residency {
+        AllocatedImage image;
+        vk::ImageView view;
+        BindlessIndex index{InvalidBindlessIndex};
+        uint32_t firstMip{0};
+        vk::DeviceSize size{0};
+    };
+
+    struct Texture {
+        std::string path;
+        State state{State::Loading};
+        // set by the decode thread that parsed the header
+        Ktx2File file;
+        bool initialized{false};
+        // smallest first mip worth loading, larger levels don't fit the staging ring
+        uint32_t minMip{0};
+        uint32_t tailMip{0};
+
+        Residency resident;
+        // written by decode threads under the streamer mutex
+        bool transitioning{false};
+        Residency pending;
+        uint32_t pendingLevels{0};
+        UploadTicket pendingTicket{0};
+        bool pendingFailed{false};
+
+        std::atomic<uint32_t> requestedPixels{0};
+        uint32_t wantedMip{0};
+        uint64_t lastRequestFrame{0};
+    };
+
+    // level ~0u parses the header
+    struct DecodeTask {
+        Texture* texture;
+        uint32_t level;
+    };
+
+    struct RetiredImage {
+        AllocatedImage image;
+        vk::ImageView view;
+        vk::DeviceSize size;
+        uint64_t frameNumber;
+    };
+
+    void decodeLoop();
+
+    void initTexture(Texture& texture);
+
+    vk::DeviceSize residencySize(const Texture& texture, uint32_t firstMip) const;
+
+    // texel bytes the texture will hold once its change in flight landed
+    vk::DeviceSize committedSize(const Texture& texture) const {
+        return texture.transitioning ? texture.pending.size : texture.resident.size;
+    }
+
+    void startTransition(Texture& texture, uint32_t firstMip);
+
+    void finishTransition(Texture& texture, uint64_t frameNumber);
+
+    void retire(Residency& residency, uint64_t frameNumber);
+
+    void stopThreads();
+
+    vk::Device _device;
+    GpuAllocator* _allocator{nullptr};
+    UploadManager* _uploads{nullptr};
+    BindlessDescriptors* _bindless{nullptr};
+    uint32_t _framesInFlight{1};
+    vk::DeviceSize _budget{0};
+
+    // guards the decode queue and the texture fields decode threads write
+    mutable std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _quit{false};
+    std::deque<DecodeTask> _tasks;
+    std::vector<std::thread> _threads;
+
+    std::vector<std::unique_ptr<Texture>> _textures;
+    std::deque<RetiredImage> _retired;
+    vk::DeviceSize _allocatedBytes{0};
+    uint32_t _transitions{0};
+    uint64_t _evictions{0};
+};
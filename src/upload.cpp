@@ -0,0 +1,349 @@
+#include "upload.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+void UploadManager::init(
+    vk::Device device,
+    GpuAllocator& allocator,
+    vk::Queue transferQueue,
+    uint32_t transferFamily,
+    uint32_t graphicsFamily,
+    vk::DeviceSize stagingSize,
+    vk::DeviceSize copyOffsetAlignment
+){
+    _device = device;
+    _allocator = &allocator;
+    _transferQueue = transferQueue;
+    _transferFamily = transferFamily;
+    _graphicsFamily = graphicsFamily;
+    // buffer to image copies need offsets aligned to the texel block size and to 4
+    _copyAlignment = std::max<vk::DeviceSize>(copyOffsetAlignment, 16);
+
+    vk::CommandPoolCreateInfo poolInfo{
+        vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+        _transferFamily
+    };
+    _commandPool = _device.createCommandPool(poolInfo);
+
+    vk::SemaphoreTypeCreateInfo typeInfo{vk::SemaphoreType::eTimeline, 0};
+    vk::SemaphoreCreateInfo semInfo{};
+    semInfo.pNext = &typeInfo;
+    _timeline = _device.createSemaphore(semInfo);
+
+    _staging = _allocator->createBuffer(MemoryClass::Staging, stagingSize, vk::BufferUsageFlagBits::eTransferSrc);
+}
+
+void UploadManager::destroy(){
+    std::unique_lock<std::mutex> lock(_mutex);
+    if(_recordingHasData)
+        submitLocked();
+    if(_nextValue>1){
+        vk::SemaphoreWaitInfo waitInfo{};
+        waitInfo.setSemaphores(_timeline);
+        UploadTicket last = _nextValue-1;
+        waitInfo.setValues(last);
+        vk::resultCheck(_device.waitSemaphores(waitInfo, UINT64_MAX), "wait for uploads");
+    }
+    _inFlight.clear();
+    _readyAcquires.clear();
+    _freeCommandBuffers.clear();
+    _allocator->destroyBuffer(_staging);
+    _device.destroySemaphore(_timeline);
+    _device.destroyCommandPool(_commandPool);
+}
+
+vk::DeviceSize UploadManager::allocateStaging(vk::DeviceSize size, vk::DeviceSize alignment, std::unique_lock<std::mutex>& lock){
+    if(size > _staging.size)
+        throw std::runtime_error("upload larger than the staging ring");
+
+    for(;;){
+        if(_inFlight.empty() && !_recordingHasData){
+            _head = 0;
+            _tail = 0;
+        }
+        bool empty = _inFlight.empty() && !_recordingHasData;
+        vk::DeviceSize offset = (_head + alignment - 1) & ~(alignment - 1);
+        if(empty || _head > _tail){
+            // free space is [_head, end) and then [0, _tail)
+            if(offset + size <= _staging.size){
+                _head = offset + size;
+                return offset;
+            }
+            // wrap, keeping head and tail apart so a full ring is not mistaken for an empty one
+            if(size < _tail){
+                _head = size;
+                return 0;
+            }
+        }
+        else if(offset + size < _tail){
+            // free space is [_head, _tail)
+            _head = offset + size;
+            return offset;
+        }
+
+        // Ring full, push out what is recorded and wait for the oldest batch.
+        // Only happens when more than the ring size is uploaded in one go
+        if(_recordingHasData)
+            submitLocked();
+        UploadTicket oldest = _inFlight.front().value;
+        vk::SemaphoreWaitInfo waitInfo{};
+        waitInfo.setSemaphores(_timeline);
+        waitInfo.setValues(oldest);
+        lock.unlock();
+        vk::resultCheck(_device.waitSemaphores(waitInfo, UINT64_MAX), "wait for staging space");
+        lock.lock();
+        collectLocked();
+    }
+}
+
+vk::CommandBuffer UploadManager::getRecordingCommandBuffer(){
+    if(!_recording.cmd){
+        if(_freeCommandBuffers.empty()){
+            vk::CommandBufferAllocateInfo allocInfo{
+                _commandPool,
+                vk::CommandBufferLevel::ePrimary,
+                1
+            };
+            _recording.cmd = _device.allocateCommandBuffers(allocInfo)[0];
+        }
+        else{
+            _recording.cmd = _freeCommandBuffers.back();
+            _freeCommandBuffers.pop_back();
+        }
+        _recording.cmd.begin(vk::CommandBufferBeginInfo{vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    }
+    _recordingHasData = true;
+    return _recording.cmd;
+}
+
+UploadTicket UploadManager::uploadBuffer(
+    const AllocatedBuffer& dst,
+    vk::DeviceSize dstOffset,
+    const void* data,
+    vk::DeviceSize size,
+    vk::PipelineStageFlags dstStage,
+    vk::AccessFlags dstAccess,
+    uint32_t dstFamily
+){
+    dstFamily = resolveFamily(dstFamily);
+    std::unique_lock<std::mutex> lock(_mutex);
+    vk::DeviceSize srcOffset = allocateStaging(size, 4, lock);
+    std::memcpy(static_cast<char*>(_staging.mapped) + srcOffset, data, size);
+    _allocator->flush(_staging, srcOffset, size);
+
+    vk::CommandBuffer cmd = getRecordingCommandBuffer();
+    vk::BufferCopy region{srcOffset, dstOffset, size};
+    cmd.copyBuffer(_staging.buffer, dst.buffer, region);
+
+    vk::BufferMemoryBarrier barrier{};
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.buffer = dst.buffer;
+    barrier.offset = dstOffset;
+    barrier.size = size;
+    if(_transferFamily != dstFamily){
+        // release, the matching acquire is recorded on the using queue
+        barrier.srcQueueFamilyIndex = _transferFamily;
+        barrier.dstQueueFamilyIndex = dstFamily;
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+            {}, {}, barrier, {}
+        );
+        barrier.srcAccessMask = {};
+        barrier.dstAccessMask = dstAccess;
+        PendingAcquire& acquire = pendingAcquire(dstFamily);
+        acquire.buffers.push_back(barrier);
+        acquire.stages |= dstStage;
+    }
+    else{
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstAccessMask = dstAccess;
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer, dstStage,
+            {}, {}, barrier, {}
+        );
+    }
+    return _nextValue;
+}
+
+UploadTicket UploadManager::uploadImage(
+    const AllocatedImage& dst,
+    vk::ImageSubresourceLayers subresource,
+    vk::Extent3D extent,
+    const void* data,
+    vk::DeviceSize size,
+    vk::ImageLayout finalLayout,
+    vk::PipelineStageFlags dstStage,
+    vk::AccessFlags dstAccess,
+    uint32_t dstFamily
+){
+    dstFamily = resolveFamily(dstFamily);
+    std::unique_lock<std::mutex> lock(_mutex);
+    vk::DeviceSize srcOffset = allocateStaging(size, _copyAlignment, lock);
+    std::memcpy(static_cast<char*>(_staging.mapped) + srcOffset, data, size);
+    _allocator->flush(_staging, srcOffset, size);
+
+    vk::ImageSubresourceRange range{
+        subresource.aspectMask,
+        subresource.mipLevel,
+        1,
+        subresource.baseArrayLayer,
+        subresource.layerCount
+    };
+
+    vk::CommandBuffer cmd = getRecordingCommandBuffer();
+
+    vk::ImageMemoryBarrier toTransfer{};
+    toTransfer.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toTransfer.oldLayout = vk::ImageLayout::eUndefined;
+    toTransfer.newLayout = vk::ImageLayout::eTransferDstOptimal;
+    toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.image = dst.image;
+    toTransfer.subresourceRange = range;
+    cmd.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+        {}, {}, {}, toTransfer
+    );
+
+    vk::BufferImageCopy region{};
+    region.bufferOffset = srcOffset;
+    region.imageSubresource = subresource;
+    region.imageExtent = extent;
+    cmd.copyBufferToImage(_staging.buffer, dst.image, vk::ImageLayout::eTransferDstOptimal, region);
+
+    vk::ImageMemoryBarrier barrier{};
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.newLayout = finalLayout;
+    barrier.image = dst.image;
+    barrier.subresourceRange = range;
+    if(_transferFamily != dstFamily){
+        // release with the layout change, the acquire repeats the same transition
+        barrier.srcQueueFamilyIndex = _transferFamily;
+        barrier.dstQueueFamilyIndex = dstFamily;
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+            {}, {}, {}, barrier
+        );
+        barrier.srcAccessMask = {};
+        barrier.dstAccessMask = dstAccess;
+        PendingAcquire& acquire = pendingAcquire(dstFamily);
+        acquire.images.push_back(barrier);
+        acquire.stages |= dstStage;
+    }
+    else{
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstAccessMask = dstAccess;
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer, dstStage,
+            {}, {}, {}, barrier
+        );
+    }
+    return _nextValue;
+}
+
+UploadManager::PendingAcquire& UploadManager::pendingAcquire(uint32_t family){
+    for(PendingAcquire& acquire : _recording.acquires){
+        if(acquire.family == family)
+            return acquire;
+    }
+    _recording.acquires.push_back({family});
+    return _recording.acquires.back();
+}
+
+void UploadManager::flush(){
+    std::unique_lock<std::mutex> lock(_mutex);
+    collectLocked();
+    if(_recordingHasData)
+        submitLocked();
+}
+
+void UploadManager::submitLocked(){
+    _recording.cmd.end();
+    _recording.value = _nextValue++;
+    _recording.ringEnd = _head;
+
+    vk::TimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.setSignalSemaphoreValues(_recording.value);
+
+    vk::SubmitInfo submit{};
+    submit.pNext = &timelineInfo;
+    submit.setCommandBuffers(_recording.cmd);
+    submit.setSignalSemaphores(_timeline);
+    {
+        std::lock_guard<std::mutex> queueLock(_queueMutex);
+        _transferQueue.submit(submit, nullptr);
+    }
+
+    _inFlight.push_back(std::move(_recording));
+    _recording = Batch{};
+    _recordingHasData = false;
+}
+
+void UploadManager::collectLocked(){
+    _completedValue = _device.getSemaphoreCounterValue(_timeline);
+    while(!_inFlight.empty() && _inFlight.front().value <= _completedValue){
+        Batch& batch = _inFlight.front();
+        _tail = batch.ringEnd;
+        batch.cmd.reset();
+        _freeCommandBuffers.push_back(batch.cmd);
+        batch.cmd = nullptr;
+        // without ownership transfers the barrier recorded with the copy is enough
+        if(!batch.acquires.empty())
+            _readyAcquires.push_back(std::move(batch));
+        _inFlight.pop_front();
+    }
+}
+
+uint64_t UploadManager::recordAcquires(vk::CommandBuffer cmd, uint32_t family){
+    family = resolveFamily(family);
+    std::unique_lock<std::mutex> lock(_mutex);
+    collectLocked();
+
+    std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+    std::vector<vk::ImageMemoryBarrier> imageBarriers;
+    vk::PipelineStageFlags dstStages;
+    uint64_t waitValue = 0;
+    for(Batch& batch : _readyAcquires){
+        auto it = std::find_if(batch.acquires.begin(), batch.acquires.end(), [family](const PendingAcquire& acquire){
+            return acquire.family == family;
+        });
+        if(it == batch.acquires.end())
+            continue;
+        dstStages |= it->stages;
+        bufferBarriers.insert(bufferBarriers.end(), it->buffers.begin(), it->buffers.end());
+        imageBarriers.insert(imageBarriers.end(), it->images.begin(), it->images.end());
+        waitValue = batch.value;
+        batch.acquires.erase(it);
+    }
+    // batches stay until every family they were released to acquired them
+    _readyAcquires.erase(
+        std::remove_if(_readyAcquires.begin(), _readyAcquires.end(), [](const Batch& batch){
+            return batch.acquires.empty();
+        }),
+        _readyAcquires.end()
+    );
+
+    if(waitValue != 0){
+        // the submit waits on the timeline at AllCommands, so nothing precedes the acquire
+        cmd.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTopOfPipe, dstStages,
+            {}, {}, bufferBarriers, imageBarriers
+        );
+    }
+    return waitValue;
+}
+
+bool UploadManager::isReady(UploadTicket ticket){
+    std::unique_lock<std::mutex> lock(_mutex);
+    collectLocked();
+    if(ticket > _completedValue)
+        return false;
+    return std::none_of(_readyAcquires.begin(), _readyAcquires.end(), [ticket](const Batch& batch){
+        return batch.value == ticket;
+    });
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "allocator.hpp"
+
+// Timeline value signaled by the transfer batch that carries an upload
+using UploadTicket = uint64_t;
+
+// Streams data to device local resources through a ring staging buffer on the
+// transfer queue. Copies are batched into one submit per flush(), completion is
+// tracked with a timeline semaphore and, when the transfer family differs from
+// the family that first uses the data, ownership of the destination is released
+// by the transfer queue and acquired by the using queue in recordAcquires()
+class UploadManager {
+public:
+    void init(
+        vk::Device device,
+        GpuAllocator& allocator,
+        vk::Queue transferQueue,
+        uint32_t transferFamily,
+        uint32_t graphicsFamily,
+        vk::DeviceSize stagingSize,
+        vk::DeviceSize copyOffsetAlignment
+    );
+
+    void destroy();
+
+    // dstStage/dstAccess describe the first use of the data on the queue of
+    // dstFamily, VK_QUEUE_FAMILY_IGNORED stands for the graphics family
+    UploadTicket uploadBuffer(
+        const AllocatedBuffer& dst,
+        vk::DeviceSize dstOffset,
+        const void* data,
+        vk::DeviceSize size,
+        vk::PipelineStageFlags dstStage = vk::PipelineStageFlagBits::eVertexInput,
+        vk::AccessFlags dstAccess = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead,
+        uint32_t dstFamily = VK_QUEUE_FAMILY_IGNORED
+    );
+
+    // copies tightly packed texels into one mip level/layer range of dst
+    UploadTicket uploadImage(
+        const AllocatedImage& dst,
+        vk::ImageSubresourceLayers subresource,
+        vk::Extent3D extent,
+        const void* data,
+        vk::DeviceSize size,
+        vk::ImageLayout finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
+        vk::PipelineStageFlags dstStage = vk::PipelineStageFlagBits::eFragmentShader,
+        vk::AccessFlags dstAccess = vk::AccessFlagBits::eShaderRead,
+        uint32_t dstFamily = VK_QUEUE_FAMILY_IGNORED
+    );
+
+    // submits the copies recorded since the last flush, never blocks
+    void flush();
+
+    // Records the acquire half of the ownership transfers to family of every
+    // finished batch into a command buffer of that family. Returns the timeline
+    // value the submit must wait on, 0 when there is nothing to wait for.
+    // Only batches the GPU already finished are acquired so the wait never stalls
+    uint64_t recordAcquires(vk::CommandBuffer cmd, uint32_t family = VK_QUEUE_FAMILY_IGNORED);
+
+    // true once the upload finished and every queue using it recorded its acquire
+    bool isReady(UploadTicket ticket);
+
+    vk::Semaphore timeline() const {
+        return _timeline;
+    }
+
+    // Held by every submit, present and wait idle on any queue. Uploads are
+    // submitted from decode threads too and the transfer queue may be the
+    // graphics or compute queue, which Vulkan requires to be used by one
+    // thread at a time
+    std::mutex& queueMutex(){
+        return _queueMutex;
+    }
+
+    // largest single upload
+    vk::DeviceSize stagingSize() const {
+        return _staging.size;
+    }
+
+private:
+    // acquire barriers of one batch for one destination family
+    struct PendingAcquire {
+        uint32_t family{0};
+        std::vector<vk::BufferMemoryBarrier> buffers;
+        std::vector<vk::ImageMemoryBarrier> images;
+        vk::PipelineStageFlags stages;
+    };
+
+    struct Batch {
+        UploadTicket value{0};
+        vk::CommandBuffer cmd;
+        // end of this batch's data in the staging ring
+        vk::DeviceSize ringEnd{0};
+        std::vector<PendingAcquire> acquires;
+    };
+
+    vk::DeviceSize allocateStaging(vk::DeviceSize size, vk::DeviceSize alignment, std::unique_lock<std::mutex>& lock);
+
+    vk::CommandBuffer getRecordingCommandBuffer();
+
+    void submitLocked();
+
+    void collectLocked();
+
+    uint32_t resolveFamily(uint32_t family) const {
+        return family == VK_QUEUE_FAMILY_IGNORED ? _graphicsFamily : family;
+    }
+
+    PendingAcquire& pendingAcquire(uint32_t family);
+
+    std::mutex _mutex;
+    // taken after _mutex, never the other way around
+    std::mutex _queueMutex;
+
+    vk::Device _device;
+    GpuAllocator* _allocator{nullptr};
+    vk::Queue _transferQueue;
+    uint32_t _transferFamily{0};
+    uint32_t _graphicsFamily{0};
+
+    vk::CommandPool _commandPool;
+    std::vector<vk::CommandBuffer> _freeCommandBuffers;
+
+    vk::Semaphore _timeline;
+    // value the batch being recorded will signal
+    UploadTicket _nextValue{1};
+    UploadTicket _completedValue{0};
+
+    AllocatedBuffer _staging;
+    vk::DeviceSize _copyAlignment{16};
+    // live staging data is [_tail, _head), wrapping around the end of the ring
+    vk::DeviceSize _head{0};
+    vk::DeviceSize _tail{0};
+
+    Batch _recording;
+    bool _recordingHasData{false};
+    std::deque<Batch> _inFlight;
+    // finished batches with acquires not yet recorded by some family
+    std::deque<Batch> _readyAcquires;
+};
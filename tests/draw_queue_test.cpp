@@ -0,0 +1,179 @@
+// Sort order and batching of DrawQueue, recorded into the null device's
+// command log
+
+#include "draw_queue.hpp"
+#include "null_device.hpp"
+#include "test.hpp"
+
+#include <cstring>
+
+namespace {
+    NullDevice device;
+    GpuAllocator allocator;
+    FrameArena arena;
+
+    // a packet with vertex buffer, set and material, the instance data is
+    // the submission index
+    DrawPacket basePacket(uint64_t key){
+        DrawPacket packet;
+        packet.key = key;
+        packet.pipeline = nullHandle<vk::Pipeline>(1);
+        packet.layout = nullHandle<vk::PipelineLayout>(1);
+        packet.descriptorSet = nullHandle<vk::DescriptorSet>(1);
+        packet.vertexBuffer = nullHandle<vk::Buffer>(1);
+        packet.count = 36;
+        packet.material = 7;
+        packet.materialStages = vk::ShaderStageFlagBits::eFragment;
+        return packet;
+    }
+
+    // builds and records the whole queue into a fresh log
+    void buildAndRecord(DrawQueue& queue){
+        arena.reset();
+        queue.build(arena);
+        nullCommandLog() = {};
+        queue.record(nullCommandBuffer(), 0, queue.batchCount());
+    }
+
+    // instance data of the recorded queue, in sorted order
+    uint32_t sortedInstance(uint32_t i){
+        const NullCommandLog& log = nullCommandLog();
+        const uint8_t* data = static_cast<const uint8_t*>(nullBufferData(log.instanceBuffer, log.instanceOffset));
+        CHECK(data);
+        uint32_t value;
+        std::memcpy(&value, data + size_t(i) * sizeof(value), sizeof(value));
+        return value;
+    }
+}
+
+// equal keys keep their submission order, here within one batch
+static void stableSort(){
+    DrawQueue queue;
+    queue.init(sizeof(uint32_t));
+    const uint64_t keys[] = {3, 1, 3, 2, 1, 3};
+    for(uint32_t i=0;i<6;++i)
+        queue.push(basePacket(keys[i]), &i);
+    buildAndRecord(queue);
+
+    CHECK_EQ(queue.batchCount(), 1u);
+    CHECK_EQ(nullCommandLog().draws.size(), 1u);
+    CHECK_EQ(nullCommandLog().draws[0].instanceCount, 6u);
+    const uint32_t expected[] = {1, 4, 3, 0, 2, 5};
+    for(uint32_t i=0;i<6;++i)
+        CHECK_EQ(sortedInstance(i), expected[i]);
+}
+
+// every key field, with many ties, against the submission order
+static void randomKeys(){
+    constexpr uint32_t Count = 20000;
+    DrawQueue queue;
+    queue.init(sizeof(uint32_t));
+    std::vector<uint64_t> keys(Count);
+    uint32_t random = 0x6b43a9b5u;
+    for(uint32_t i=0;i<Count;++i){
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        keys[i] = makeDrawKey(random & 1, random >> 1 & 3, random >> 3 & 0xf, random >> 7 & 0xf);
+        uint32_t index = queue.append(1);
+        queue.packet(index) = basePacket(keys[i]);
+        std::memcpy(queue.instanceData(index), &i, sizeof(i));
+    }
+    buildAndRecord(queue);
+
+    CHECK_EQ(queue.batchCount(), 1u);
+    for(uint32_t i=1;i<Count;++i){
+        uint32_t a = sortedInstance(i - 1);
+        uint32_t b = sortedInstance(i);
+        CHECK(keys[a] < keys[b] || (keys[a] == keys[b] && a < b));
+    }
+}
+
+// Adjacent packets merge when their state and geometry are equal, the index
+// type only matters with an index buffer
+static void batching(){
+    DrawQueue queue;
+    queue.init(sizeof(uint32_t));
+    std::vector<DrawPacket> packets(9, basePacket(0));
+    packets[2].material = 8;
+    packets[3].material = 8;
+    packets[4].pipeline = nullHandle<vk::Pipeline>(2);
+    packets[5].count = 6;
+    packets[6].count = 6;
+    packets[6].indexType = vk::IndexType::eUint16;
+    packets[7].indexBuffer = nullHandle<vk::Buffer>(2);
+    packets[8].indexBuffer = nullHandle<vk::Buffer>(2);
+    packets[8].indexType = vk::IndexType::eUint16;
+    for(uint32_t i=0;i<packets.size();++i){
+        packets[i].key = i;
+        queue.push(packets[i], &i);
+    }
+    buildAndRecord(queue);
+
+    const uint32_t instanceCounts[] = {2, 2, 1, 2, 1, 1};
+    const uint32_t firstInstances[] = {0, 2, 4, 5, 7, 8};
+    const NullCommandLog& log = nullCommandLog();
+    CHECK_EQ(queue.batchCount(), 6u);
+    CHECK_EQ(log.draws.size(), 6u);
+    for(uint32_t i=0;i<6;++i){
+        CHECK_EQ(log.draws[i].instanceCount, instanceCounts[i]);
+        CHECK_EQ(log.draws[i].firstInstance, firstInstances[i]);
+        CHECK_EQ(log.draws[i].indexed, i >= 4);
+    }
+    CHECK_EQ(log.draws[3].count, 6u);
+}
+
+// build() counts what record() binds, across layout changes and packets
+// without a set or material
+static void statsMatchRecord(){
+    DrawQueue queue;
+    queue.init(sizeof(uint32_t));
+    std::vector<DrawPacket> packets(8, basePacket(0));
+    packets[1].material = 9;
+    // the new layout invalidates the set and the push
+    packets[2].layout = nullHandle<vk::PipelineLayout>(2);
+    packets[3].layout = nullHandle<vk::PipelineLayout>(2);
+    packets[3].descriptorSet = nullptr;
+    packets[3].count = 3;
+    packets[4].pipeline = nullHandle<vk::Pipeline>(2);
+    packets[4].materialStages = {};
+    packets[5].vertexBuffer = nullHandle<vk::Buffer>(3);
+    packets[5].indexBuffer = nullHandle<vk::Buffer>(4);
+    packets[6].vertexBuffer = nullHandle<vk::Buffer>(3);
+    packets[6].indexBuffer = nullHandle<vk::Buffer>(4);
+    packets[6].indexType = vk::IndexType::eUint16;
+    packets[7].descriptorSet = nullHandle<vk::DescriptorSet>(2);
+    for(uint32_t i=0;i<packets.size();++i){
+        packets[i].key = i;
+        queue.push(packets[i], &i);
+    }
+    buildAndRecord(queue);
+
+    const DrawQueueStats& stats = queue.stats();
+    const NullCommandLog& log = nullCommandLog();
+    CHECK_EQ(stats.packets, 8u);
+    CHECK_EQ(stats.batches, 8u);
+    CHECK_EQ(stats.batches, log.draws.size());
+    CHECK_EQ(stats.pipelineBinds, log.pipelineBinds);
+    CHECK_EQ(stats.descriptorBinds, log.descriptorBinds);
+    CHECK_EQ(stats.vertexBufferBinds, log.vertexBufferBinds);
+    CHECK_EQ(stats.indexBufferBinds, log.indexBufferBinds);
+    CHECK_EQ(stats.materialPushes, log.pushes.size());
+    // the layout change rebinds the set and pushes the unchanged material
+    CHECK_EQ(stats.descriptorBinds, 4u);
+    CHECK_EQ(stats.materialPushes, 4u);
+    CHECK_EQ(stats.indexBufferBinds, 2u);
+}
+
+int main(){
+    device = createNullDevice();
+    allocator.init(device.instance, device.physicalDevice, device.device, device.apiVersion);
+    arena.init(allocator, 1 << 20, 16);
+    RUN_TEST(stableSort);
+    RUN_TEST(randomKeys);
+    RUN_TEST(batching);
+    RUN_TEST(statsMatchRecord);
+    arena.destroy(allocator);
+    allocator.destroy();
+    return 0;
+}
@@ -0,0 +1,134 @@
+// Job deque races and worker wakeups under contention
+
+#include "jobs.hpp"
+#include "test.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+// The owner pushes bursts of jobs and pops part of them back while thieves
+// steal from the other end. Every job has to be taken exactly once, small
+// bursts make the owner and the thieves race for the last job
+static void dequeStealPopRace(){
+    constexpr uint32_t JobCount = 1 << 20;
+    constexpr uint32_t ThiefCount = 3;
+    auto deque = std::make_unique<JobDeque>();
+    auto jobs = std::make_unique<Job[]>(JobCount);
+    std::vector<std::atomic<uint32_t>> taken(JobCount);
+    std::atomic<bool> done{false};
+
+    auto take = [&](Job* job){
+        CHECK(job >= jobs.get() && job < jobs.get() + JobCount);
+        taken[job - jobs.get()].fetch_add(1, std::memory_order_relaxed);
+    };
+
+    std::vector<std::thread> thieves;
+    for(uint32_t t=0;t<ThiefCount;++t){
+        thieves.emplace_back([&]{
+            for(;;){
+                bool finished = done.load(std::memory_order_acquire);
+                if(Job* job = deque->steal())
+                    take(job);
+                // the owner drained the deque before setting done
+                else if(finished)
+                    return;
+            }
+        });
+    }
+
+    uint32_t next = 0;
+    uint32_t random = 0x9e3779b9u;
+    while(next < JobCount){
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        uint32_t burst = random % 64 + 1;
+        for(uint32_t i=0;i<burst && next<JobCount;++i){
+            Job* job = &jobs[next++];
+            // full, the owner runs it itself like JobSystem::run()
+            if(!deque->push(job))
+                take(job);
+        }
+        uint32_t pops = (random >> 8) % (burst + 1);
+        for(uint32_t i=0;i<pops;++i){
+            if(Job* job = deque->pop())
+                take(job);
+        }
+    }
+    while(Job* job = deque->pop())
+        take(job);
+    done.store(true, std::memory_order_release);
+    for(auto& thief : thieves)
+        thief.join();
+
+    CHECK(deque->pop() == nullptr);
+    CHECK(deque->steal() == nullptr);
+    for(uint32_t i=0;i<JobCount;++i)
+        CHECK_EQ(taken[i].load(), 1u);
+}
+
+// Worker 0 queues a job and only watches it, so another worker has to wake
+// up and steal it. A lost wakeup leaves the job in the deque until the
+// deadline. The pauses let the workers fall asleep, or be about to, when
+// the job is queued
+static void wakeupRace(){
+    constexpr uint32_t Rounds = 3000;
+    JobSystem jobs;
+    jobs.init(3);
+
+    uint32_t random = 0x2545f491u;
+    for(uint32_t round=0;round<Rounds;++round){
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        auto pause = std::chrono::microseconds(random % 300);
+        auto resume = Clock::now() + pause;
+        while(Clock::now() < resume)
+            std::this_thread::yield();
+
+        std::atomic<uint32_t> ranOn{~0u};
+        std::atomic<uint32_t>* result = &ranOn;
+        Job* job = jobs.create([result](uint32_t worker){
+            result->store(worker, std::memory_order_relaxed);
+        });
+        jobs.run(job);
+        auto deadline = Clock::now() + std::chrono::seconds(10);
+        while(!jobs.isFinished(job)){
+            CHECK(Clock::now() < deadline);
+            std::this_thread::yield();
+        }
+        CHECK(ranOn.load() != 0u);
+        CHECK(ranOn.load() < jobs.workerCount());
+    }
+    jobs.destroy();
+}
+
+// many small chunks over and over, every item exactly once
+static void parallelForContention(){
+    constexpr uint32_t Count = 100000;
+    JobSystem jobs;
+    jobs.init(std::max(3u, std::thread::hardware_concurrency()));
+    std::vector<std::atomic<uint32_t>> visits(Count);
+    for(uint32_t round=0;round<50;++round){
+        jobs.parallelFor(Count, 1 + round % 7, [&](uint32_t begin, uint32_t end, uint32_t worker){
+            CHECK(worker < jobs.workerCount());
+            for(uint32_t i=begin;i<end;++i)
+                visits[i].fetch_add(1, std::memory_order_relaxed);
+        });
+    }
+    for(uint32_t i=0;i<Count;++i)
+        CHECK_EQ(visits[i].load(), 50u);
+    jobs.destroy();
+}
+
+int main(){
+    RUN_TEST(dequeStealPopRace);
+    RUN_TEST(wakeupRace);
+    RUN_TEST(parallelForContention);
+    return 0;
+}
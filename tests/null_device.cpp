@@ -0,0 +1,348 @@
+#include "null_device.hpp"
+
+#include <cstring>
+#include <map>
+
+namespace {
+    constexpr VkDeviceSize HeapSize = 64ull << 20;
+    constexpr VkDeviceSize ImageAlignment = 256;
+
+    struct Memory {
+        VkDeviceSize size;
+        std::vector<uint8_t> data;
+    };
+
+    struct Binding {
+        uint64_t memory{0};
+        VkDeviceSize offset{0};
+    };
+
+    struct State {
+        uint64_t nextHandle{1};
+        std::map<uint64_t, Memory> memory;
+        std::map<uint64_t, VkDeviceSize> bufferSizes;
+        std::map<uint64_t, Binding> bufferBindings;
+        std::map<uint64_t, VkDeviceSize> imageSizes;
+        std::map<uint64_t, uint64_t> semaphoreValues;
+        NullDeviceObjects objects;
+        NullCommandLog log;
+    };
+
+    State& state(){
+        static State s;
+        return s;
+    }
+
+    // the dispatchable handles only need to be distinct and non null
+    int instanceObject;
+    int physicalDeviceObject;
+    int deviceObject;
+    int commandBufferObject;
+
+    // non dispatchable handles are pointers or 64 bit integers depending on the platform
+    template<typename T>
+    T newHandle(){
+        return (T)(uintptr_t)state().nextHandle++;
+    }
+
+    template<typename T>
+    uint64_t key(T handle){
+        return (uint64_t)(uintptr_t)handle;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL getPhysicalDeviceProperties(VkPhysicalDevice, VkPhysicalDeviceProperties* properties){
+        *properties = {};
+        properties->apiVersion = VK_API_VERSION_1_0;
+        properties->deviceType = VK_PHYSICAL_DEVICE_TYPE_CPU;
+        std::strcpy(properties->deviceName, "null device");
+        properties->limits.maxMemoryAllocationCount = 4096;
+        properties->limits.bufferImageGranularity = 1;
+        properties->limits.nonCoherentAtomSize = 1;
+        properties->limits.minUniformBufferOffsetAlignment = 16;
+        properties->limits.minStorageBufferOffsetAlignment = 16;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL getPhysicalDeviceMemoryProperties(VkPhysicalDevice, VkPhysicalDeviceMemoryProperties* properties){
+        *properties = {};
+        properties->memoryTypeCount = 1;
+        properties->memoryTypes[0].propertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        properties->memoryTypes[0].heapIndex = 0;
+        properties->memoryHeapCount = 1;
+        properties->memoryHeaps[0].size = HeapSize;
+        properties->memoryHeaps[0].flags = VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+    }
+
+    VKAPI_ATTR VkResult VKAPI_CALL allocateMemory(VkDevice, const VkMemoryAllocateInfo* info, const VkAllocationCallbacks*, VkDeviceMemory* memory){
+        *memory = newHandle<VkDeviceMemory>();
+        state().memory[key(*memory)] = Memory{info->allocationSize, {}};
+        ++state().objects.memory;
+        return VK_SUCCESS;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL freeMemory(VkDevice, VkDeviceMemory memory, const VkAllocationCallbacks*){
+        if(state().memory.erase(key(memory)))
+            --state().objects.memory;
+    }
+
+    VKAPI_ATTR VkResult VKAPI_CALL mapMemory(VkDevice, VkDeviceMemory memory, VkDeviceSize offset, VkDeviceSize, VkMemoryMapFlags, void** data){
+        Memory& m = state().memory.at(key(memory));
+        if(m.data.empty())
+            m.data.resize(m.size);
+        *data = m.data.data() + offset;
+        return VK_SUCCESS;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL unmapMemory(VkDevice, VkDeviceMemory){
+    }
+
+    VKAPI_ATTR VkResult VKAPI_CALL flushMemoryRanges(VkDevice, uint32_t, const VkMappedMemoryRange*){
+        return VK_SUCCESS;
+    }
+
+    VKAPI_ATTR VkResult VKAPI_CALL createBuffer(VkDevice, const VkBufferCreateInfo* info, const VkAllocationCallbacks*, VkBuffer* buffer){
+        *buffer = newHandle<VkBuffer>();
+        state().bufferSizes[key(*buffer)] = info->size;
+        ++state().objects.buffers;
+        return VK_SUCCESS;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL destroyBuffer(VkDevice, VkBuffer buffer, const VkAllocationCallbacks*){
+        state().bufferBindings.erase(key(buffer));
+        if(state().bufferSizes.erase(key(buffer)))
+            --state().objects.buffers;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL getBufferMemoryRequirements(VkDevice, VkBuffer buffer, VkMemoryRequirements* requirements){
+        requirements->size = state().bufferSizes.at(key(buffer));
+        requirements->alignment = 16;
+        requirements->memoryTypeBits = 1;
+    }
+
+    VKAPI_ATTR VkResult VKAPI_CALL bindBufferMemory(VkDevice, VkBuffer buffer, VkDeviceMemory memory, VkDeviceSize offset){
+        state().bufferBindings[key(buffer)] = Binding{key(memory), offset};
+        return VK_SUCCESS;
+    }
+
+    VKAPI_ATTR VkResult VKAPI_CALL createImage(VkDevice, const VkImageCreateInfo* info, const VkAllocationCallbacks*, VkImage* image){
+        *image = newHandle<VkImage>();
+        VkDeviceSize size = VkDeviceSize(info->extent.width) * info->extent.height * info->extent.depth * 4;
+        state().imageSizes[key(*image)] = (size + ImageAlignment - 1) / ImageAlignment * ImageAlignment;
+        ++state().objects.images;
+        return VK_SUCCESS;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL destroyImage(VkDevice, VkImage image, const VkAllocationCallbacks*){
+        if(state().imageSizes.erase(key(image)))
+            --state().objects.images;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL getImageMemoryRequirements(VkDevice, VkImage image, VkMemoryRequirements* requirements){
+        requirements->size = state().imageSizes.at(key(image));
+        requirements->alignment = ImageAlignment;
+        requirements->memoryTypeBits = 1;
+    }
+
+    VKAPI_ATTR VkResult VKAPI_CALL bindImageMemory(VkDevice, VkImage, VkDeviceMemory, VkDeviceSize){
+        return VK_SUCCESS;
+    }
+
+    VKAPI_ATTR VkResult VKAPI_CALL createImageView(VkDevice, const VkImageViewCreateInfo*, const VkAllocationCallbacks*, VkImageView* view){
+        *view = newHandle<VkImageView>();
+        ++state().objects.imageViews;
+        return VK_SUCCESS;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL destroyImageView(VkDevice, VkImageView view, const VkAllocationCallbacks*){
+        if(view != VK_NULL_HANDLE)
+            --state().objects.imageViews;
+    }
+
+    VKAPI_ATTR VkResult VKAPI_CALL createRenderPass(VkDevice, const VkRenderPassCreateInfo*, const VkAllocationCallbacks*, VkRenderPass* renderPass){
+        *renderPass = newHandle<VkRenderPass>();
+        ++state().objects.renderPasses;
+        return VK_SUCCESS;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL destroyRenderPass(VkDevice, VkRenderPass renderPass, const VkAllocationCallbacks*){
+        if(renderPass != VK_NULL_HANDLE)
+            --state().objects.renderPasses;
+    }
+
+    VKAPI_ATTR VkResult VKAPI_CALL createFramebuffer(VkDevice, const VkFramebufferCreateInfo*, const VkAllocationCallbacks*, VkFramebuffer* framebuffer){
+        *framebuffer = newHandle<VkFramebuffer>();
+        ++state().objects.framebuffers;
+        return VK_SUCCESS;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL destroyFramebuffer(VkDevice, VkFramebuffer framebuffer, const VkAllocationCallbacks*){
+        if(framebuffer != VK_NULL_HANDLE)
+            --state().objects.framebuffers;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL destroyPipeline(VkDevice, VkPipeline pipeline, const VkAllocationCallbacks*){
+        if(pipeline != VK_NULL_HANDLE)
+            ++state().objects.destroyedPipelines;
+    }
+
+    VKAPI_ATTR VkResult VKAPI_CALL createSemaphore(VkDevice, const VkSemaphoreCreateInfo*, const VkAllocationCallbacks*, VkSemaphore* semaphore){
+        *semaphore = newHandle<VkSemaphore>();
+        state().semaphoreValues[key(*semaphore)] = 0;
+        ++state().objects.semaphores;
+        return VK_SUCCESS;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL destroySemaphore(VkDevice, VkSemaphore semaphore, const VkAllocationCallbacks*){
+        if(state().semaphoreValues.erase(key(semaphore)))
+            --state().objects.semaphores;
+    }
+
+    VKAPI_ATTR VkResult VKAPI_CALL getSemaphoreCounterValue(VkDevice, VkSemaphore semaphore, uint64_t* value){
+        *value = state().semaphoreValues.at(key(semaphore));
+        return VK_SUCCESS;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL cmdCopyBuffer(VkCommandBuffer, VkBuffer, VkBuffer, uint32_t, const VkBufferCopy*){
+    }
+
+    VKAPI_ATTR void VKAPI_CALL cmdBindPipeline(VkCommandBuffer, VkPipelineBindPoint, VkPipeline){
+        ++state().log.pipelineBinds;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL cmdBindDescriptorSets(VkCommandBuffer, VkPipelineBindPoint, VkPipelineLayout, uint32_t,
+        uint32_t, const VkDescriptorSet*, uint32_t, const uint32_t*){
+        ++state().log.descriptorBinds;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL cmdBindVertexBuffers(VkCommandBuffer, uint32_t firstBinding, uint32_t, const VkBuffer* buffers,
+        const VkDeviceSize* offsets){
+        if(firstBinding == 0)
+            ++state().log.vertexBufferBinds;
+        else{
+            state().log.instanceBuffer = vk::Buffer(buffers[0]);
+            state().log.instanceOffset = offsets[0];
+        }
+    }
+
+    VKAPI_ATTR void VKAPI_CALL cmdBindIndexBuffer(VkCommandBuffer, VkBuffer, VkDeviceSize, VkIndexType){
+        ++state().log.indexBufferBinds;
+    }
+
+    VKAPI_ATTR void VKAPI_CALL cmdPushConstants(VkCommandBuffer, VkPipelineLayout, VkShaderStageFlags, uint32_t, uint32_t size,
+        const void* values){
+        uint32_t value = 0;
+        std::memcpy(&value, values, size < sizeof(value) ? size : sizeof(value));
+        state().log.pushes.push_back(value);
+    }
+
+    VKAPI_ATTR void VKAPI_CALL cmdDraw(VkCommandBuffer, uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex,
+        uint32_t firstInstance){
+        state().log.draws.push_back({false, vertexCount, instanceCount, firstVertex, 0, firstInstance});
+    }
+
+    VKAPI_ATTR void VKAPI_CALL cmdDrawIndexed(VkCommandBuffer, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex,
+        int32_t vertexOffset, uint32_t firstInstance){
+        state().log.draws.push_back({true, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance});
+    }
+
+    PFN_vkVoidFunction lookup(const char* name);
+
+    VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL getInstanceProcAddr(VkInstance, const char* name){
+        return lookup(name);
+    }
+
+    VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL getDeviceProcAddr(VkDevice, const char* name){
+        return lookup(name);
+    }
+
+    struct Entry {
+        const char* name;
+        PFN_vkVoidFunction function;
+    };
+
+    // everything else is null
+    const Entry Entries[] = {
+        {"vkGetInstanceProcAddr", PFN_vkVoidFunction(getInstanceProcAddr)},
+        {"vkGetDeviceProcAddr", PFN_vkVoidFunction(getDeviceProcAddr)},
+        {"vkGetPhysicalDeviceProperties", PFN_vkVoidFunction(getPhysicalDeviceProperties)},
+        {"vkGetPhysicalDeviceMemoryProperties", PFN_vkVoidFunction(getPhysicalDeviceMemoryProperties)},
+        {"vkAllocateMemory", PFN_vkVoidFunction(allocateMemory)},
+        {"vkFreeMemory", PFN_vkVoidFunction(freeMemory)},
+        {"vkMapMemory", PFN_vkVoidFunction(mapMemory)},
+        {"vkUnmapMemory", PFN_vkVoidFunction(unmapMemory)},
+        {"vkFlushMappedMemoryRanges", PFN_vkVoidFunction(flushMemoryRanges)},
+        {"vkInvalidateMappedMemoryRanges", PFN_vkVoidFunction(flushMemoryRanges)},
+        {"vkCreateBuffer", PFN_vkVoidFunction(createBuffer)},
+        {"vkDestroyBuffer", PFN_vkVoidFunction(destroyBuffer)},
+        {"vkGetBufferMemoryRequirements", PFN_vkVoidFunction(getBufferMemoryRequirements)},
+        {"vkBindBufferMemory", PFN_vkVoidFunction(bindBufferMemory)},
+        {"vkCreateImage", PFN_vkVoidFunction(createImage)},
+        {"vkDestroyImage", PFN_vkVoidFunction(destroyImage)},
+        {"vkGetImageMemoryRequirements", PFN_vkVoidFunction(getImageMemoryRequirements)},
+        {"vkBindImageMemory", PFN_vkVoidFunction(bindImageMemory)},
+        {"vkCreateImageView", PFN_vkVoidFunction(createImageView)},
+        {"vkDestroyImageView", PFN_vkVoidFunction(destroyImageView)},
+        {"vkCreateRenderPass", PFN_vkVoidFunction(createRenderPass)},
+        {"vkDestroyRenderPass", PFN_vkVoidFunction(destroyRenderPass)},
+        {"vkCreateFramebuffer", PFN_vkVoidFunction(createFramebuffer)},
+        {"vkDestroyFramebuffer", PFN_vkVoidFunction(destroyFramebuffer)},
+        {"vkDestroyPipeline", PFN_vkVoidFunction(destroyPipeline)},
+        {"vkCreateSemaphore", PFN_vkVoidFunction(createSemaphore)},
+        {"vkDestroySemaphore", PFN_vkVoidFunction(destroySemaphore)},
+        {"vkGetSemaphoreCounterValue", PFN_vkVoidFunction(getSemaphoreCounterValue)},
+        {"vkCmdCopyBuffer", PFN_vkVoidFunction(cmdCopyBuffer)},
+        {"vkCmdBindPipeline", PFN_vkVoidFunction(cmdBindPipeline)},
+        {"vkCmdBindDescriptorSets", PFN_vkVoidFunction(cmdBindDescriptorSets)},
+        {"vkCmdBindVertexBuffers", PFN_vkVoidFunction(cmdBindVertexBuffers)},
+        {"vkCmdBindIndexBuffer", PFN_vkVoidFunction(cmdBindIndexBuffer)},
+        {"vkCmdPushConstants", PFN_vkVoidFunction(cmdPushConstants)},
+        {"vkCmdDraw", PFN_vkVoidFunction(cmdDraw)},
+        {"vkCmdDrawIndexed", PFN_vkVoidFunction(cmdDrawIndexed)},
+    };
+
+    PFN_vkVoidFunction lookup(const char* name){
+        for(const Entry& entry : Entries){
+            if(std::strcmp(entry.name, name) == 0)
+                return entry.function;
+        }
+        return nullptr;
+    }
+}
+
+NullDevice createNullDevice(){
+    NullDevice device;
+    device.instance = vk::Instance(reinterpret_cast<VkInstance>(&instanceObject));
+    device.physicalDevice = vk::PhysicalDevice(reinterpret_cast<VkPhysicalDevice>(&physicalDeviceObject));
+    device.device = vk::Device(reinterpret_cast<VkDevice>(&deviceObject));
+    device.apiVersion = VK_API_VERSION_1_0;
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(getInstanceProcAddr);
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(device.instance);
+    VULKAN_HPP_DEFAULT_DISPATCHER.init(device.device);
+    return device;
+}
+
+NullDeviceObjects nullDeviceObjects(){
+    return state().objects;
+}
+
+void setNullSemaphoreValue(vk::Semaphore semaphore, uint64_t value){
+    state().semaphoreValues.at(key(VkSemaphore(semaphore))) = value;
+}
+
+const void* nullBufferData(vk::Buffer buffer, vk::DeviceSize offset){
+    auto binding = state().bufferBindings.find(key(VkBuffer(buffer)));
+    if(binding == state().bufferBindings.end())
+        return nullptr;
+    Memory& memory = state().memory.at(binding->second.memory);
+    if(memory.data.empty())
+        memory.data.resize(memory.size);
+    return memory.data.data() + binding->second.offset + offset;
+}
+
+NullCommandLog& nullCommandLog(){
+    return state().log;
+}
+
+vk::CommandBuffer nullCommandBuffer(){
+    return vk::CommandBuffer(reinterpret_cast<VkCommandBuffer>(&commandBufferObject));
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+// Vulkan driver stand-in for tests of code that needs a device but does no
+// actual GPU work, e.g. compiling a render graph or recording a draw queue.
+// createNullDevice() points the default dispatcher at it. Every call
+// succeeds, handles are counters and memory is host memory allocated when
+// mapped. Images need width * height * 4 bytes aligned to 256 and every
+// resource fits the one memory type, which is device local and host visible.
+//
+// Single threaded, only the functions the tested code calls are implemented
+struct NullDevice {
+    vk::Instance instance;
+    vk::PhysicalDevice physicalDevice;
+    vk::Device device;
+    // for GpuAllocator::init
+    uint32_t apiVersion;
+};
+
+NullDevice createNullDevice();
+
+// created and not yet destroyed
+struct NullDeviceObjects {
+    uint32_t images{0};
+    uint32_t imageViews{0};
+    uint32_t buffers{0};
+    uint32_t memory{0};
+    uint32_t renderPasses{0};
+    uint32_t framebuffers{0};
+    uint32_t semaphores{0};
+    // pipelines are only adopted by the tested code, never created
+    uint32_t destroyedPipelines{0};
+};
+
+NullDeviceObjects nullDeviceObjects();
+
+// what getSemaphoreCounterValue returns from now on, 0 until set
+void setNullSemaphoreValue(vk::Semaphore semaphore, uint64_t value);
+
+// host memory a buffer is bound to, null before binding
+const void* nullBufferData(vk::Buffer buffer, vk::DeviceSize offset);
+
+// Commands recorded into any command buffer since the last clear
+struct NullDraw {
+    bool indexed;
+    uint32_t count;
+    uint32_t instanceCount;
+    uint32_t first;
+    int32_t vertexOffset;
+    uint32_t firstInstance;
+};
+
+struct NullCommandLog {
+    uint32_t pipelineBinds{0};
+    uint32_t descriptorBinds{0};
+    uint32_t indexBufferBinds{0};
+    // vertex buffer binds at binding 0
+    uint32_t vertexBufferBinds{0};
+    // buffer and offset of the last bind at any other binding
+    vk::Buffer instanceBuffer;
+    vk::DeviceSize instanceOffset{0};
+    // the first 4 bytes of every push
+    std::vector<uint32_t> pushes;
+    std::vector<NullDraw> draws;
+};
+
+NullCommandLog& nullCommandLog();
+
+// a command buffer that records into nullCommandLog()
+vk::CommandBuffer nullCommandBuffer();
+
+// handle with the given value for objects the null driver never sees
+// created, e.g. pipelines and layouts only compared by the tested code
+template<typename T>
+T nullHandle(uint64_t value){
+    return T((typename T::CType)(uintptr_t)value);
+}
@@ -0,0 +1,184 @@
+// Pass culling, barrier derivation and transient aliasing of RenderGraph,
+// compiled against the null device
+
+#include "null_device.hpp"
+#include "render_graph.hpp"
+#include "test.hpp"
+
+namespace {
+    constexpr vk::Extent2D Extent{64, 64};
+    // what the null device asks for an RGBA8 image of Extent
+    constexpr vk::DeviceSize ImageSize = 64 * 64 * 4;
+
+    NullDevice device;
+    GpuAllocator allocator;
+
+    void nothing(RenderGraphContext&){}
+
+    RenderGraphResource importBackbuffer(RenderGraph& graph){
+        RenderGraphImportDesc desc{};
+        desc.format = vk::Format::eR8G8B8A8Unorm;
+        desc.extent = Extent;
+        desc.initialLayout = vk::ImageLayout::eUndefined;
+        desc.finalLayout = vk::ImageLayout::ePresentSrcKHR;
+        desc.waitStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+        return graph.importImage("backbuffer", desc);
+    }
+
+    RenderGraphResource createTarget(RenderGraph& graph, const char* name){
+        RenderGraphImageDesc desc{};
+        desc.format = vk::Format::eR8G8B8A8Unorm;
+        desc.extent = Extent;
+        return graph.createImage(name, desc);
+    }
+}
+
+// Passes that neither reach an imported image nor have side effects are
+// culled, along with the passes only they depend on
+static void culling(){
+    RenderGraph graph;
+    graph.init(device.device, allocator, 2);
+    RenderGraphResource backbuffer = importBackbuffer(graph);
+    RenderGraphResource hdr = createTarget(graph, "hdr");
+    RenderGraphResource scratch = createTarget(graph, "scratch");
+    RenderGraphResource debug = createTarget(graph, "debug");
+
+    uint32_t opaque = graph.addPass("opaque", nothing)
+        .colorAttachment(hdr, vk::ClearColorValue{})
+        .index();
+    uint32_t unused = graph.addPass("unused", nothing)
+        .colorAttachment(scratch, vk::ClearColorValue{})
+        .index();
+    // only read by a culled pass, culled as well
+    uint32_t debugSource = graph.addPass("debug source", nothing)
+        .colorAttachment(debug, vk::ClearColorValue{})
+        .index();
+    uint32_t debugView = graph.addPass("debug view", nothing)
+        .sampled(debug)
+        .colorAttachment(scratch)
+        .index();
+    uint32_t tonemap = graph.addPass("tonemap", nothing)
+        .sampled(hdr)
+        .colorAttachment(backbuffer, vk::ClearColorValue{})
+        .index();
+    // writes nothing, kept for its side effects
+    uint32_t capture = graph.addPass("capture", nothing)
+        .transferSrc(backbuffer)
+        .sideEffects()
+        .index();
+    graph.compile();
+
+    CHECK(!graph.isCulled(opaque));
+    CHECK(graph.isCulled(unused));
+    CHECK(graph.isCulled(debugSource));
+    CHECK(graph.isCulled(debugView));
+    CHECK(!graph.isCulled(tonemap));
+    CHECK(!graph.isCulled(capture));
+    CHECK(graph.renderPass(opaque));
+    CHECK(!graph.renderPass(unused));
+    CHECK(!graph.renderPass(capture));
+
+    RenderGraphStats stats = graph.stats();
+    CHECK_EQ(stats.passes, 6u);
+    CHECK_EQ(stats.culledPasses, 3u);
+    // images of culled passes are not created
+    CHECK_EQ(stats.transientImages, 1u);
+    // opaque: hdr to attachment, tonemap: hdr to sampled and backbuffer to
+    // attachment, capture: backbuffer to transfer source, final: to present
+    CHECK_EQ(stats.imageBarriers, 5u);
+    graph.destroy();
+}
+
+// A read after a read needs no barrier when the first barrier already made
+// the write visible to the reading stage, and one more when it didn't
+static void readAfterRead(){
+    for(bool otherStage : {false, true}){
+        RenderGraph graph;
+        graph.init(device.device, allocator, 2);
+        RenderGraphResource backbuffer = importBackbuffer(graph);
+        RenderGraphResource hdr = createTarget(graph, "hdr");
+        graph.addPass("main", nothing)
+            .colorAttachment(hdr, vk::ClearColorValue{});
+        graph.addPass("first read", nothing)
+            .sampled(hdr)
+            .colorAttachment(backbuffer, vk::ClearColorValue{});
+        graph.addPass("second read", nothing)
+            .sampled(hdr, otherStage ? vk::PipelineStageFlagBits::eVertexShader : vk::PipelineStageFlagBits::eFragmentShader)
+            .colorAttachment(backbuffer);
+        graph.compile();
+
+        // main: 1, first read: 2, second read: backbuffer write after
+        // write and hdr only for the other stage, final: 1
+        CHECK_EQ(graph.stats().imageBarriers, otherStage ? 6u : 5u);
+        graph.destroy();
+    }
+}
+
+// Transients whose lifetimes don't overlap share memory
+static void aliasing(){
+    RenderGraph graph;
+    graph.init(device.device, allocator, 2);
+    RenderGraphResource backbuffer = importBackbuffer(graph);
+    RenderGraphResource a = createTarget(graph, "a");
+    RenderGraphResource b = createTarget(graph, "b");
+    RenderGraphResource c = createTarget(graph, "c");
+    // lifetimes a [0, 1], b [1, 2], c [2, 3], a and c may alias
+    graph.addPass("write a", nothing)
+        .colorAttachment(a, vk::ClearColorValue{});
+    graph.addPass("a to b", nothing)
+        .sampled(a)
+        .colorAttachment(b, vk::ClearColorValue{});
+    graph.addPass("b to c", nothing)
+        .sampled(b)
+        .colorAttachment(c, vk::ClearColorValue{});
+    graph.addPass("c to backbuffer", nothing)
+        .sampled(c)
+        .colorAttachment(backbuffer, vk::ClearColorValue{});
+    graph.compile();
+
+    RenderGraphStats stats = graph.stats();
+    CHECK_EQ(stats.culledPasses, 0u);
+    CHECK_EQ(stats.transientImages, 3u);
+    CHECK_EQ(stats.unaliasedBytes, 3 * ImageSize);
+    CHECK_EQ(stats.transientBytes, 2 * ImageSize);
+    CHECK(graph.view(a) && graph.view(b) && graph.view(c));
+    graph.destroy();
+}
+
+// Compiled objects live until the frames that may use them retired. The
+// memory is not counted, VMA may keep an empty block
+static void retire(){
+    NullDeviceObjects before = nullDeviceObjects();
+    RenderGraph graph;
+    graph.init(device.device, allocator, 2);
+    RenderGraphResource backbuffer = importBackbuffer(graph);
+    RenderGraphResource hdr = createTarget(graph, "hdr");
+    graph.addPass("main", nothing)
+        .colorAttachment(hdr, vk::ClearColorValue{});
+    graph.addPass("tonemap", nothing)
+        .sampled(hdr)
+        .colorAttachment(backbuffer, vk::ClearColorValue{});
+    graph.compile();
+    CHECK_EQ(nullDeviceObjects().images, before.images + 1);
+    CHECK_EQ(nullDeviceObjects().renderPasses, before.renderPasses + 2);
+
+    graph.reset(10);
+    graph.retire(11);
+    CHECK_EQ(nullDeviceObjects().images, before.images + 1);
+    graph.retire(12);
+    CHECK_EQ(nullDeviceObjects().images, before.images);
+    CHECK_EQ(nullDeviceObjects().imageViews, before.imageViews);
+    CHECK_EQ(nullDeviceObjects().renderPasses, before.renderPasses);
+    graph.destroy();
+}
+
+int main(){
+    device = createNullDevice();
+    allocator.init(device.instance, device.physicalDevice, device.device, device.apiVersion);
+    RUN_TEST(culling);
+    RUN_TEST(readAfterRead);
+    RUN_TEST(aliasing);
+    RUN_TEST(retire);
+    allocator.destroy();
+    return 0;
+}
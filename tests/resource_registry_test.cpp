@@ -0,0 +1,120 @@
+// Handle validation and deferred destruction of ResourceRegistry
+
+#include "null_device.hpp"
+#include "resource_registry.hpp"
+#include "test.hpp"
+
+namespace {
+    NullDevice device;
+    GpuAllocator allocator;
+}
+
+// A slot whose generation wraps skips 0 and the handle from just before the
+// wrap stays stale
+static void generationWrap(){
+    ResourcePool<int> pool;
+    BufferHandle first = pool.add<BufferTag>(1);
+    CHECK_EQ(first.generation, 1u);
+    int object;
+    CHECK(pool.remove(first, object));
+    CHECK_EQ(object, 1);
+
+    pool.slots[first.index].generation = ~0u;
+    BufferHandle last = pool.add<BufferTag>(2);
+    CHECK_EQ(last.index, first.index);
+    CHECK_EQ(last.generation, ~0u);
+    CHECK(pool.remove(last, object));
+    CHECK(!pool.find(last));
+    CHECK(!pool.remove(last, object));
+
+    BufferHandle wrapped = pool.add<BufferTag>(3);
+    CHECK_EQ(wrapped.index, first.index);
+    CHECK_EQ(wrapped.generation, 1u);
+    CHECK(wrapped.valid());
+    CHECK(!pool.find(last));
+    CHECK(pool.find(wrapped) && *pool.find(wrapped) == 3);
+    // same index and generation, a handle from before the wrap resolves to
+    // the new object. 2^32 - 1 removals of one slot are not expected
+    CHECK(pool.find(first));
+    CHECK_EQ(pool.liveCount, 1u);
+
+    // out of range and default constructed
+    CHECK(!pool.find(BufferHandle{7, 1}));
+    CHECK(!pool.find(BufferHandle{}));
+}
+
+// released handles stop resolving at once, even when the slot is reused
+static void staleHandles(){
+    ResourceRegistry registry;
+    registry.init(device.device, allocator, 2);
+    BufferHandle buffer = registry.createBuffer(MemoryClass::StaticGeometry, 256, vk::BufferUsageFlagBits::eVertexBuffer);
+    CHECK(registry.buffer(buffer).buffer);
+    registry.release(buffer, RetirePoint{1});
+    CHECK(!registry.buffer(buffer).buffer);
+
+    BufferHandle reused = registry.createBuffer(MemoryClass::StaticGeometry, 256, vk::BufferUsageFlagBits::eVertexBuffer);
+    CHECK_EQ(reused.index, buffer.index);
+    CHECK(reused.generation != buffer.generation);
+    CHECK(registry.buffer(reused).buffer);
+    CHECK(!registry.buffer(buffer).buffer);
+    // releasing the stale handle leaves the new buffer alone
+    registry.release(buffer, RetirePoint{1});
+    CHECK(registry.buffer(reused).buffer);
+    CHECK_EQ(registry.stats().buffers, 1u);
+    CHECK_EQ(registry.stats().pending, 1u);
+    registry.destroy();
+    CHECK_EQ(nullDeviceObjects().buffers, 0u);
+}
+
+// objects are destroyed once their frame retired and their timeline value
+// was reached
+static void retire(){
+    NullDeviceObjects before = nullDeviceObjects();
+    ResourceRegistry registry;
+    registry.init(device.device, allocator, 2);
+    PipelineHandle pipeline = registry.adoptPipeline(nullHandle<vk::Pipeline>(1));
+    ImageViewHandle view = registry.createImageView(vk::ImageViewCreateInfo{});
+    CHECK_EQ(nullDeviceObjects().imageViews, before.imageViews + 1);
+
+    registry.release(pipeline, RetirePoint{5});
+    CHECK(!registry.pipeline(pipeline));
+    CHECK_EQ(registry.stats().pipelines, 0u);
+    CHECK_EQ(registry.stats().pending, 1u);
+    // frame 5 retired after the fence wait of frame 7
+    registry.retire(6);
+    CHECK_EQ(nullDeviceObjects().destroyedPipelines, before.destroyedPipelines);
+    registry.retire(7);
+    CHECK_EQ(nullDeviceObjects().destroyedPipelines, before.destroyedPipelines + 1);
+    CHECK_EQ(registry.stats().pending, 0u);
+
+    vk::Semaphore timeline = device.device.createSemaphore({});
+    registry.release(view, RetirePoint{7, timeline, 3});
+    registry.retire(20);
+    CHECK_EQ(nullDeviceObjects().imageViews, before.imageViews + 1);
+    setNullSemaphoreValue(timeline, 2);
+    registry.retire(21);
+    CHECK_EQ(registry.stats().pending, 1u);
+    setNullSemaphoreValue(timeline, 3);
+    // the frame still has to retire
+    registry.retire(8);
+    CHECK_EQ(registry.stats().pending, 1u);
+    registry.retire(22);
+    CHECK_EQ(nullDeviceObjects().imageViews, before.imageViews);
+    CHECK_EQ(registry.stats().pending, 0u);
+
+    // a second release of the same handle does nothing
+    registry.release(view, RetirePoint{0});
+    CHECK_EQ(registry.stats().pending, 0u);
+    device.device.destroySemaphore(timeline);
+    registry.destroy();
+}
+
+int main(){
+    device = createNullDevice();
+    allocator.init(device.instance, device.physicalDevice, device.device, device.apiVersion);
+    RUN_TEST(generationWrap);
+    RUN_TEST(staleHandles);
+    RUN_TEST(retire);
+    allocator.destroy();
+    return 0;
+}
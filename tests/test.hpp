@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// Checks for the test executables. A failed check reports and ends the
+// process with exit code 1 right away, also from other threads, which is
+// what ctest looks at
+#define CHECK(condition) \
+    do{ \
+        if(!(condition)){ \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::fflush(stderr); \
+            std::_Exit(1); \
+        } \
+    }while(0)
+
+#define CHECK_EQ(a, b) \
+    do{ \
+        auto checkA_ = (a); \
+        auto checkB_ = (b); \
+        if(!(checkA_ == checkB_)){ \
+            std::fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, \
+                (long long)checkA_, (long long)checkB_); \
+            std::fflush(stderr); \
+            std::_Exit(1); \
+        } \
+    }while(0)
+
+// runs one test function and names it in the output
+#define RUN_TEST(function) \
+    do{ \
+        std::fprintf(stderr, "%s\n", #function); \
+        function(); \
+    }while(0)
@@ -0,0 +1,309 @@
+// Offline converter from Wavefront OBJ to the .mesh container read by MeshFile.
+//
+// usage: mesh_convert <input.obj> <output.mesh>
+//
+// Every o, g or usemtl statement starts a sub-mesh. Vertices are deduplicated
+// per sub-mesh and written interleaved as position, normal, uv (locations 0,
+// 1 and 2), indices are 16 bit when every sub-mesh has at most 65536
+// vertices. Missing normals are replaced by area weighted face normals.
+
+#include "mesh_format.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct Vertex {
+    float position[3];
+    float normal[3];
+    float uv[2];
+};
+static_assert(sizeof(Vertex) == 32);
+
+// position, uv and normal OBJ indices of a face corner, ~0u when missing
+struct Corner {
+    uint32_t indices[3];
+
+    bool operator==(const Corner& other) const {
+        return std::memcmp(indices, other.indices, sizeof(indices)) == 0;
+    }
+};
+
+struct CornerHash {
+    size_t operator()(const Corner& c) const {
+        uint64_t h = c.indices[0];
+        h = h * 0x9e3779b97f4a7c15ull ^ c.indices[1];
+        h = h * 0x9e3779b97f4a7c15ull ^ c.indices[2];
+        return size_t(h ^ (h >> 29));
+    }
+};
+
+struct SubMesh {
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    // vertices that need a generated normal
+    std::vector<bool> missingNormal;
+    std::unordered_map<Corner, uint32_t, CornerHash> lookup;
+};
+
+struct Obj {
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> uvs;
+    std::vector<SubMesh> subMeshes;
+};
+
+// OBJ indices are 1 based, negative ones count back from the end
+bool resolveIndex(long index, size_t count, uint32_t& out){
+    if(index > 0 && size_t(index) <= count)
+        out = uint32_t(index - 1);
+    else if(index < 0 && size_t(-index) <= count)
+        out = uint32_t(count + index);
+    else
+        return false;
+    return true;
+}
+
+// "v", "v/t", "v//n" or "v/t/n"
+bool parseCorner(const char* token, const Obj& obj, Corner& corner){
+    uint32_t* indices = corner.indices;
+    indices[0] = indices[1] = indices[2] = ~0u;
+    char* end;
+    if(!resolveIndex(std::strtol(token, &end, 10), obj.positions.size() / 3, indices[0]))
+        return false;
+    if(*end != '/')
+        return true;
+    token = end + 1;
+    if(*token != '/'){
+        if(!resolveIndex(std::strtol(token, &end, 10), obj.uvs.size() / 2, indices[1]))
+            return false;
+        token = end;
+    }
+    if(*token != '/')
+        return true;
+    return resolveIndex(std::strtol(token + 1, &end, 10), obj.normals.size() / 3, indices[2]);
+}
+
+uint32_t addVertex(Obj& obj, SubMesh& sub, const Corner& corner){
+    auto [it, inserted] = sub.lookup.try_emplace(corner, uint32_t(sub.vertices.size()));
+    if(!inserted)
+        return it->second;
+    const uint32_t* indices = corner.indices;
+    Vertex v{};
+    std::memcpy(v.position, &obj.positions[indices[0] * 3], sizeof(v.position));
+    if(indices[1] != ~0u){
+        v.uv[0] = obj.uvs[indices[1] * 2];
+        // OBJ has v pointing up, Vulkan samples top down
+        v.uv[1] = 1.0f - obj.uvs[indices[1] * 2 + 1];
+    }
+    if(indices[2] != ~0u)
+        std::memcpy(v.normal, &obj.normals[indices[2] * 3], sizeof(v.normal));
+    sub.vertices.push_back(v);
+    sub.missingNormal.push_back(indices[2] == ~0u);
+    return it->second;
+}
+
+bool parseObj(const char* path, Obj& obj){
+    FILE* file = std::fopen(path, "rb");
+    if(!file)
+        return false;
+    obj.subMeshes.emplace_back();
+    char line[4096];
+    std::vector<uint32_t> polygon;
+    while(std::fgets(line, sizeof(line), file)){
+        char* p = line;
+        while(*p == ' ' || *p == '\t')
+            ++p;
+        if(p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')){
+            float x = 0, y = 0, z = 0;
+            std::sscanf(p + 2, "%f %f %f", &x, &y, &z);
+            obj.positions.insert(obj.positions.end(), {x, y, z});
+        }
+        else if(p[0] == 'v' && p[1] == 'n'){
+            float x = 0, y = 0, z = 0;
+            std::sscanf(p + 3, "%f %f %f", &x, &y, &z);
+            obj.normals.insert(obj.normals.end(), {x, y, z});
+        }
+        else if(p[0] == 'v' && p[1] == 't'){
+            float u = 0, v = 0;
+            std::sscanf(p + 3, "%f %f", &u, &v);
+            obj.uvs.insert(obj.uvs.end(), {u, v});
+        }
+        else if(p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')){
+            SubMesh& sub = obj.subMeshes.back();
+            polygon.clear();
+            for(char* token = std::strtok(p + 2, " \t\r\n"); token; token = std::strtok(nullptr, " \t\r\n")){
+                Corner corner;
+                if(!parseCorner(token, obj, corner)){
+                    std::fclose(file);
+                    return false;
+                }
+                polygon.push_back(addVertex(obj, sub, corner));
+            }
+            // fan triangulation, fine for the convex polygons exporters write
+            for(size_t i=2;i<polygon.size();++i)
+                sub.indices.insert(sub.indices.end(), {polygon[0], polygon[i-1], polygon[i]});
+        }
+        else if(std::strncmp(p, "o ", 2) == 0 || std::strncmp(p, "g ", 2) == 0 || std::strncmp(p, "usemtl ", 7) == 0){
+            if(!obj.subMeshes.back().indices.empty())
+                obj.subMeshes.emplace_back();
+        }
+    }
+    std::fclose(file);
+    obj.subMeshes.erase(
+        std::remove_if(obj.subMeshes.begin(), obj.subMeshes.end(), [](const SubMesh& sub){
+            return sub.indices.empty();
+        }),
+        obj.subMeshes.end()
+    );
+    return true;
+}
+
+void generateNormals(SubMesh& sub){
+    std::vector<float> accumulated(sub.vertices.size() * 3, 0.0f);
+    for(size_t i=0;i+2<sub.indices.size();i+=3){
+        const float* a = sub.vertices[sub.indices[i]].position;
+        const float* b = sub.vertices[sub.indices[i+1]].position;
+        const float* c = sub.vertices[sub.indices[i+2]].position;
+        float e0[3] = {b[0]-a[0], b[1]-a[1], b[2]-a[2]};
+        float e1[3] = {c[0]-a[0], c[1]-a[1], c[2]-a[2]};
+        // unnormalized, so larger faces weigh more
+        float n[3] = {e0[1]*e1[2] - e0[2]*e1[1], e0[2]*e1[0] - e0[0]*e1[2], e0[0]*e1[1] - e0[1]*e1[0]};
+        for(int k=0;k<3;++k)
+            for(int j=0;j<3;++j)
+                accumulated[sub.indices[i+k]*3 + j] += n[j];
+    }
+    for(size_t v=0;v<sub.vertices.size();++v){
+        if(!sub.missingNormal[v])
+            continue;
+        float* n = &accumulated[v*3];
+        float length = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+        for(int j=0;j<3;++j)
+            sub.vertices[v].normal[j] = length > 0.0f ? n[j] / length : 0.0f;
+    }
+}
+
+MeshFileBounds computeBounds(const std::vector<Vertex>& vertices){
+    MeshFileBounds bounds{{HUGE_VALF, HUGE_VALF, HUGE_VALF}, {-HUGE_VALF, -HUGE_VALF, -HUGE_VALF}};
+    for(const Vertex& v : vertices){
+        for(int j=0;j<3;++j){
+            bounds.min[j] = std::min(bounds.min[j], v.position[j]);
+            bounds.max[j] = std::max(bounds.max[j], v.position[j]);
+        }
+    }
+    return bounds;
+}
+
+bool writePadding(FILE* out, uint64_t& offset){
+    static const char zeros[MeshFileAlignment] = {};
+    uint64_t padding = (MeshFileAlignment - offset % MeshFileAlignment) % MeshFileAlignment;
+    offset += padding;
+    return std::fwrite(zeros, 1, padding, out) == padding;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]){
+    if(argc != 3){
+        std::fprintf(stderr, "usage: mesh_convert <input.obj> <output.mesh>\n");
+        return 1;
+    }
+    Obj obj;
+    if(!parseObj(argv[1], obj)){
+        std::fprintf(stderr, "mesh_convert: can't read %s\n", argv[1]);
+        return 1;
+    }
+
+    bool shortIndices = true;
+    for(SubMesh& sub : obj.subMeshes){
+        generateNormals(sub);
+        shortIndices = shortIndices && sub.vertices.size() <= 65536;
+    }
+    uint32_t indexSize = shortIndices ? 2 : 4;
+
+    MeshFileHeader header{};
+    header.magic = MeshFileMagic;
+    header.version = MeshFileVersion;
+    header.vertexStride = sizeof(Vertex);
+    header.attributeCount = 3;
+    header.attributes[0] = {0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, position)};
+    header.attributes[1] = {1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, normal)};
+    header.attributes[2] = {2, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, uv)};
+    header.indexType = shortIndices ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    header.subMeshCount = uint32_t(obj.subMeshes.size());
+    header.bounds = {{HUGE_VALF, HUGE_VALF, HUGE_VALF}, {-HUGE_VALF, -HUGE_VALF, -HUGE_VALF}};
+
+    std::vector<MeshFileSubMesh> table;
+    uint64_t vertexCount = 0, indexCount = 0;
+    for(const SubMesh& sub : obj.subMeshes){
+        MeshFileSubMesh entry{};
+        entry.firstIndex = uint32_t(indexCount);
+        entry.indexCount = uint32_t(sub.indices.size());
+        entry.vertexOffset = int32_t(vertexCount);
+        entry.vertexCount = uint32_t(sub.vertices.size());
+        entry.bounds = computeBounds(sub.vertices);
+        float radius = 0.0f;
+        for(int j=0;j<3;++j){
+            entry.sphereCenter[j] = (entry.bounds.min[j] + entry.bounds.max[j]) * 0.5f;
+            header.bounds.min[j] = std::min(header.bounds.min[j], entry.bounds.min[j]);
+            header.bounds.max[j] = std::max(header.bounds.max[j], entry.bounds.max[j]);
+        }
+        for(const Vertex& v : sub.vertices){
+            float dx = v.position[0] - entry.sphereCenter[0];
+            float dy = v.position[1] - entry.sphereCenter[1];
+            float dz = v.position[2] - entry.sphereCenter[2];
+            radius = std::max(radius, dx*dx + dy*dy + dz*dz);
+        }
+        entry.sphereRadius = std::sqrt(radius);
+        table.push_back(entry);
+        vertexCount += sub.vertices.size();
+        indexCount += sub.indices.size();
+    }
+    if(vertexCount > INT32_MAX || indexCount > UINT32_MAX){
+        std::fprintf(stderr, "mesh_convert: %s is too large\n", argv[1]);
+        return 1;
+    }
+
+    uint64_t offset = sizeof(MeshFileHeader) + table.size() * sizeof(MeshFileSubMesh);
+    header.vertexOffset = (offset + MeshFileAlignment - 1) / MeshFileAlignment * MeshFileAlignment;
+    header.vertexSize = vertexCount * sizeof(Vertex);
+    header.indexOffset = (header.vertexOffset + header.vertexSize + MeshFileAlignment - 1) / MeshFileAlignment * MeshFileAlignment;
+    header.indexSize = indexCount * indexSize;
+
+    FILE* out = std::fopen(argv[2], "wb");
+    if(!out){
+        std::fprintf(stderr, "mesh_convert: can't write %s\n", argv[2]);
+        return 1;
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && (table.empty() || std::fwrite(table.data(), sizeof(MeshFileSubMesh), table.size(), out) == table.size());
+    ok = ok && writePadding(out, offset);
+    for(const SubMesh& sub : obj.subMeshes)
+        ok = ok && std::fwrite(sub.vertices.data(), sizeof(Vertex), sub.vertices.size(), out) == sub.vertices.size();
+    offset += header.vertexSize;
+    ok = ok && writePadding(out, offset);
+    for(const SubMesh& sub : obj.subMeshes){
+        if(shortIndices){
+            std::vector<uint16_t> indices(sub.indices.begin(), sub.indices.end());
+            ok = ok && std::fwrite(indices.data(), 2, indices.size(), out) == indices.size();
+        }
+        else
+            ok = ok && std::fwrite(sub.indices.data(), 4, sub.indices.size(), out) == sub.indices.size();
+    }
+    if(std::fclose(out) != 0 || !ok){
+        std::fprintf(stderr, "mesh_convert: can't write %s\n", argv[2]);
+        return 1;
+    }
+    std::printf("%s: %zu sub-meshes, %llu vertices, %llu indices (%u bit)\n",
+        argv[2], table.size(), (unsigned long long)vertexCount, (unsigned long long)indexCount, indexSize * 8);
+    return 0;
+}
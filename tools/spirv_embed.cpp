@@ -0,0 +1,503 @@
+// Build time helper: embeds a SPIR-V module into a C++ header together with
+// the descriptor bindings, push constant range and vertex inputs it declares.
+//
+// usage: spirv_embed <input.spv> <symbol> <output.hpp>
+//
+// Only the subset of SPIR-V glslc emits for graphics and compute shaders is
+// understood, anything else is ignored rather than rejected.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+// opcodes
+constexpr uint32_t OpEntryPoint = 15;
+constexpr uint32_t OpTypeBool = 20;
+constexpr uint32_t OpTypeInt = 21;
+constexpr uint32_t OpTypeFloat = 22;
+constexpr uint32_t OpTypeVector = 23;
+constexpr uint32_t OpTypeMatrix = 24;
+constexpr uint32_t OpTypeImage = 25;
+constexpr uint32_t OpTypeSampler = 26;
+constexpr uint32_t OpTypeSampledImage = 27;
+constexpr uint32_t OpTypeArray = 28;
+constexpr uint32_t OpTypeRuntimeArray = 29;
+constexpr uint32_t OpTypeStruct = 30;
+constexpr uint32_t OpTypePointer = 32;
+constexpr uint32_t OpConstant = 43;
+constexpr uint32_t OpVariable = 59;
+constexpr uint32_t OpDecorate = 71;
+constexpr uint32_t OpMemberDecorate = 72;
+constexpr uint32_t OpTypeAccelerationStructureKHR = 5341;
+
+// decorations
+constexpr uint32_t DecorationBlock = 2;
+constexpr uint32_t DecorationBufferBlock = 3;
+constexpr uint32_t DecorationArrayStride = 6;
+constexpr uint32_t DecorationMatrixStride = 7;
+constexpr uint32_t DecorationBuiltIn = 11;
+constexpr uint32_t DecorationLocation = 30;
+constexpr uint32_t DecorationBinding = 33;
+constexpr uint32_t DecorationDescriptorSet = 34;
+constexpr uint32_t DecorationOffset = 35;
+
+// storage classes
+constexpr uint32_t StorageUniformConstant = 0;
+constexpr uint32_t StorageInput = 1;
+constexpr uint32_t StorageUniform = 2;
+constexpr uint32_t StoragePushConstant = 9;
+constexpr uint32_t StorageStorageBuffer = 12;
+
+constexpr uint32_t DimBuffer = 5;
+constexpr uint32_t DimSubpassData = 6;
+
+struct Type {
+    uint32_t op{0};
+    // component or element or pointee type
+    uint32_t elementType{0};
+    // vector/matrix component count, int/float width, pointer storage class
+    uint32_t count{0};
+    bool isSigned{false};
+    // OpTypeArray length constant id, OpTypeImage dim
+    uint32_t lengthId{0};
+    uint32_t imageDim{0};
+    uint32_t imageSampled{0};
+    std::vector<uint32_t> members;
+};
+
+Type makeType(uint32_t op){
+    Type t;
+    t.op = op;
+    return t;
+}
+
+struct Decorations {
+    bool block{false};
+    bool bufferBlock{false};
+    bool builtIn{false};
+    bool hasLocation{false};
+    uint32_t location{0};
+    bool hasBinding{false};
+    uint32_t binding{0};
+    uint32_t set{0};
+    uint32_t arrayStride{0};
+    // by member index
+    std::map<uint32_t, uint32_t> memberOffsets;
+    std::map<uint32_t, uint32_t> memberMatrixStrides;
+    bool memberBuiltIn{false};
+};
+
+struct Variable {
+    uint32_t id;
+    uint32_t type;
+    uint32_t storage;
+};
+
+struct Module {
+    std::map<uint32_t, Type> types;
+    std::map<uint32_t, uint32_t> constants;
+    std::map<uint32_t, Decorations> decorations;
+    std::vector<Variable> variables;
+    uint32_t executionModel{~0u};
+    std::string entry{"main"};
+};
+
+bool parse(const std::vector<uint32_t>& words, Module& module){
+    if(words.size() < 5 || words[0] != 0x07230203)
+        return false;
+    size_t i = 5;
+    while(i < words.size()){
+        uint32_t wordCount = words[i] >> 16;
+        uint32_t op = words[i] & 0xffff;
+        if(wordCount == 0 || i + wordCount > words.size())
+            return false;
+        const uint32_t* in = &words[i];
+        switch(op){
+            case OpEntryPoint:
+                // the first entry point wins, glslc emits one per module
+                if(module.executionModel == ~0u){
+                    module.executionModel = in[1];
+                    module.entry = reinterpret_cast<const char*>(&in[3]);
+                }
+                break;
+            case OpTypeBool:
+                module.types[in[1]] = makeType(op);
+                break;
+            case OpTypeInt:{
+                Type t = makeType(op);
+                t.count = in[2];
+                t.isSigned = in[3] != 0;
+                module.types[in[1]] = t;
+                break;
+            }
+            case OpTypeFloat:{
+                Type t = makeType(op);
+                t.count = in[2];
+                module.types[in[1]] = t;
+                break;
+            }
+            case OpTypeVector:
+            case OpTypeMatrix:{
+                Type t = makeType(op);
+                t.elementType = in[2];
+                t.count = in[3];
+                module.types[in[1]] = t;
+                break;
+            }
+            case OpTypeImage:{
+                Type t = makeType(op);
+                t.imageDim = in[3];
+                t.imageSampled = in[7];
+                module.types[in[1]] = t;
+                break;
+            }
+            case OpTypeSampler:
+            case OpTypeAccelerationStructureKHR:
+                module.types[in[1]] = makeType(op);
+                break;
+            case OpTypeSampledImage:
+            case OpTypeRuntimeArray:{
+                Type t = makeType(op);
+                t.elementType = in[2];
+                module.types[in[1]] = t;
+                break;
+            }
+            case OpTypeArray:{
+                Type t = makeType(op);
+                t.elementType = in[2];
+                t.lengthId = in[3];
+                module.types[in[1]] = t;
+                break;
+            }
+            case OpTypeStruct:{
+                Type t = makeType(op);
+                t.members.assign(in + 2, in + wordCount);
+                module.types[in[1]] = t;
+                break;
+            }
+            case OpTypePointer:{
+                Type t = makeType(op);
+                t.count = in[2];
+                t.elementType = in[3];
+                module.types[in[1]] = t;
+                break;
+            }
+            case OpConstant:
+                // 32 bit constants are enough for array lengths
+                module.constants[in[2]] = in[3];
+                break;
+            case OpVariable:
+                module.variables.push_back({in[2], in[1], in[3]});
+                break;
+            case OpDecorate:{
+                Decorations& d = module.decorations[in[1]];
+                switch(in[2]){
+                    case DecorationBlock: d.block = true; break;
+                    case DecorationBufferBlock: d.bufferBlock = true; break;
+                    case DecorationBuiltIn: d.builtIn = true; break;
+                    case DecorationArrayStride: d.arrayStride = in[3]; break;
+                    case DecorationLocation: d.hasLocation = true; d.location = in[3]; break;
+                    case DecorationBinding: d.hasBinding = true; d.binding = in[3]; break;
+                    case DecorationDescriptorSet: d.set = in[3]; break;
+                }
+                break;
+            }
+            case OpMemberDecorate:{
+                Decorations& d = module.decorations[in[1]];
+                if(in[3] == DecorationOffset)
+                    d.memberOffsets[in[2]] = in[4];
+                else if(in[3] == DecorationMatrixStride)
+                    d.memberMatrixStrides[in[2]] = in[4];
+                else if(in[3] == DecorationBuiltIn)
+                    d.memberBuiltIn = true;
+                break;
+            }
+        }
+        i += wordCount;
+    }
+    return module.executionModel != ~0u;
+}
+
+const Type* findType(const Module& module, uint32_t id){
+    auto it = module.types.find(id);
+    return it == module.types.end() ? nullptr : &it->second;
+}
+
+template<typename T>
+T decoration(const Module& module, uint32_t id, T Decorations::*field){
+    auto it = module.decorations.find(id);
+    return it == module.decorations.end() ? T{} : it->second.*field;
+}
+
+uint32_t memberDecoration(const std::map<uint32_t, uint32_t>& members, uint32_t member){
+    auto it = members.find(member);
+    return it == members.end() ? 0 : it->second;
+}
+
+// size in bytes of a type inside an explicitly laid out block
+uint32_t typeSize(const Module& module, uint32_t id, uint32_t matrixStride = 0){
+    const Type* t = findType(module, id);
+    if(!t)
+        return 0;
+    switch(t->op){
+        case OpTypeBool:
+            return 4;
+        case OpTypeInt:
+        case OpTypeFloat:
+            return t->count / 8;
+        case OpTypeVector:
+            return t->count * typeSize(module, t->elementType);
+        case OpTypeMatrix:
+            return t->count * (matrixStride ? matrixStride : typeSize(module, t->elementType));
+        case OpTypeArray:{
+            uint32_t stride = decoration(module, id, &Decorations::arrayStride);
+            if(stride == 0)
+                stride = typeSize(module, t->elementType, matrixStride);
+            auto length = module.constants.find(t->lengthId);
+            return length == module.constants.end() ? 0 : stride * length->second;
+        }
+        case OpTypeStruct:{
+            auto it = module.decorations.find(id);
+            uint32_t size = 0;
+            for(uint32_t m=0;m<t->members.size();++m){
+                uint32_t offset = 0;
+                uint32_t memberMatrixStride = 0;
+                if(it != module.decorations.end()){
+                    offset = memberDecoration(it->second.memberOffsets, m);
+                    memberMatrixStride = memberDecoration(it->second.memberMatrixStrides, m);
+                }
+                size = std::max(size, offset + typeSize(module, t->members[m], memberMatrixStride));
+            }
+            return size;
+        }
+    }
+    return 0;
+}
+
+const char* descriptorType(const Module& module, uint32_t typeId, uint32_t storage){
+    const Type* t = findType(module, typeId);
+    if(!t)
+        return nullptr;
+    if(storage == StorageStorageBuffer)
+        return "VK_DESCRIPTOR_TYPE_STORAGE_BUFFER";
+    if(storage == StorageUniform){
+        // pre 1.3 SPIR-V marks storage buffers as Uniform + BufferBlock
+        if(decoration(module, typeId, &Decorations::bufferBlock))
+            return "VK_DESCRIPTOR_TYPE_STORAGE_BUFFER";
+        return "VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER";
+    }
+    switch(t->op){
+        case OpTypeSampler:
+            return "VK_DESCRIPTOR_TYPE_SAMPLER";
+        case OpTypeSampledImage:
+            return "VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER";
+        case OpTypeAccelerationStructureKHR:
+            return "VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR";
+        case OpTypeImage:
+            if(t->imageDim == DimSubpassData)
+                return "VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT";
+            if(t->imageDim == DimBuffer)
+                return t->imageSampled == 2 ? "VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER" : "VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER";
+            return t->imageSampled == 2 ? "VK_DESCRIPTOR_TYPE_STORAGE_IMAGE" : "VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE";
+    }
+    return nullptr;
+}
+
+const char* vertexFormat(const Module& module, uint32_t typeId, uint32_t& size){
+    const Type* t = findType(module, typeId);
+    if(!t)
+        return nullptr;
+    uint32_t components = 1;
+    const Type* scalar = t;
+    if(t->op == OpTypeVector){
+        components = t->count;
+        scalar = findType(module, t->elementType);
+    }
+    if(!scalar || scalar->count != 32)
+        return nullptr;
+    size = components * 4;
+    static const char* floats[] = {"VK_FORMAT_R32_SFLOAT", "VK_FORMAT_R32G32_SFLOAT", "VK_FORMAT_R32G32B32_SFLOAT", "VK_FORMAT_R32G32B32A32_SFLOAT"};
+    static const char* sints[] = {"VK_FORMAT_R32_SINT", "VK_FORMAT_R32G32_SINT", "VK_FORMAT_R32G32B32_SINT", "VK_FORMAT_R32G32B32A32_SINT"};
+    static const char* uints[] = {"VK_FORMAT_R32_UINT", "VK_FORMAT_R32G32_UINT", "VK_FORMAT_R32G32B32_UINT", "VK_FORMAT_R32G32B32A32_UINT"};
+    if(components < 1 || components > 4)
+        return nullptr;
+    if(scalar->op == OpTypeFloat)
+        return floats[components - 1];
+    if(scalar->op == OpTypeInt)
+        return scalar->isSigned ? sints[components - 1] : uints[components - 1];
+    return nullptr;
+}
+
+const char* stageName(uint32_t executionModel){
+    switch(executionModel){
+        case 0: return "VK_SHADER_STAGE_VERTEX_BIT";
+        case 1: return "VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT";
+        case 2: return "VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT";
+        case 3: return "VK_SHADER_STAGE_GEOMETRY_BIT";
+        case 4: return "VK_SHADER_STAGE_FRAGMENT_BIT";
+        case 5: return "VK_SHADER_STAGE_COMPUTE_BIT";
+    }
+    return nullptr;
+}
+
+struct Binding {
+    uint32_t set;
+    uint32_t binding;
+    const char* type;
+    uint32_t count;
+};
+
+struct VertexInput {
+    uint32_t location;
+    const char* format;
+    uint32_t size;
+};
+
+} // namespace
+
+int main(int argc, char* argv[]){
+    if(argc != 4){
+        std::fprintf(stderr, "usage: spirv_embed <input.spv> <symbol> <output.hpp>\n");
+        return 1;
+    }
+    const char* inputPath = argv[1];
+    std::string symbol = argv[2];
+    const char* outputPath = argv[3];
+
+    FILE* input = std::fopen(inputPath, "rb");
+    if(!input){
+        std::fprintf(stderr, "spirv_embed: can't open %s\n", inputPath);
+        return 1;
+    }
+    std::vector<uint32_t> words;
+    uint32_t word;
+    while(std::fread(&word, sizeof(word), 1, input) == 1)
+        words.push_back(word);
+    std::fclose(input);
+
+    Module module;
+    if(!parse(words, module)){
+        std::fprintf(stderr, "spirv_embed: %s is not a valid SPIR-V module\n", inputPath);
+        return 1;
+    }
+    const char* stage = stageName(module.executionModel);
+    if(!stage){
+        std::fprintf(stderr, "spirv_embed: %s has an unsupported execution model\n", inputPath);
+        return 1;
+    }
+
+    std::vector<Binding> bindings;
+    uint32_t pushOffset = ~0u, pushEnd = 0;
+    std::vector<VertexInput> vertexInputs;
+    for(const Variable& var : module.variables){
+        const Type* pointer = findType(module, var.type);
+        if(!pointer || pointer->op != OpTypePointer)
+            continue;
+        uint32_t pointee = pointer->elementType;
+        auto decorIt = module.decorations.find(var.id);
+        const Decorations* decor = decorIt == module.decorations.end() ? nullptr : &decorIt->second;
+
+        if(var.storage == StoragePushConstant){
+            const Type* block = findType(module, pointee);
+            auto blockDecor = module.decorations.find(pointee);
+            if(!block || blockDecor == module.decorations.end())
+                continue;
+            // the range covers only the members this stage declares
+            for(auto [member, offset] : blockDecor->second.memberOffsets){
+                pushOffset = std::min(pushOffset, offset);
+                uint32_t matrixStride = memberDecoration(blockDecor->second.memberMatrixStrides, member);
+                pushEnd = std::max(pushEnd, offset + typeSize(module, block->members[member], matrixStride));
+            }
+        }
+        else if(var.storage == StorageUniformConstant || var.storage == StorageUniform || var.storage == StorageStorageBuffer){
+            if(!decor || !decor->hasBinding)
+                continue;
+            uint32_t count = 1;
+            uint32_t resourceType = pointee;
+            const Type* t = findType(module, pointee);
+            if(t && t->op == OpTypeArray){
+                auto length = module.constants.find(t->lengthId);
+                count = length == module.constants.end() ? 1 : length->second;
+                resourceType = t->elementType;
+            }
+            else if(t && t->op == OpTypeRuntimeArray){
+                count = 0;
+                resourceType = t->elementType;
+            }
+            const char* type = descriptorType(module, resourceType, var.storage);
+            if(type)
+                bindings.push_back({decor->set, decor->binding, type, count});
+        }
+        else if(var.storage == StorageInput && module.executionModel == 0){
+            if(!decor || decor->builtIn || !decor->hasLocation || decoration(module, pointee, &Decorations::memberBuiltIn))
+                continue;
+            uint32_t size = 0;
+            const char* format = vertexFormat(module, pointee, size);
+            if(!format){
+                std::fprintf(stderr, "spirv_embed: %s location %u has an unsupported vertex format\n", inputPath, decor->location);
+                return 1;
+            }
+            vertexInputs.push_back({decor->location, format, size});
+        }
+    }
+    std::sort(bindings.begin(), bindings.end(), [](const Binding& a, const Binding& b){
+        return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+    });
+    std::sort(vertexInputs.begin(), vertexInputs.end(), [](const VertexInput& a, const VertexInput& b){
+        return a.location < b.location;
+    });
+    if(pushOffset == ~0u)
+        pushOffset = 0;
+
+    FILE* out = std::fopen(outputPath, "w");
+    if(!out){
+        std::fprintf(stderr, "spirv_embed: can't write %s\n", outputPath);
+        return 1;
+    }
+    std::fprintf(out, "// Generated by spirv_embed from %s, do not edit\n", inputPath);
+    std::fprintf(out, "#pragma once\n\n#include \"shader_reflection.hpp\"\n\nnamespace shaders {\n\n");
+
+    std::fprintf(out, "inline constexpr uint32_t %s_code[] = {", symbol.c_str());
+    for(size_t i=0;i<words.size();++i)
+        std::fprintf(out, "%s0x%08x,", i%8==0 ? "\n    " : " ", words[i]);
+    std::fprintf(out, "\n};\n\n");
+
+    if(!bindings.empty()){
+        std::fprintf(out, "inline constexpr ReflectedBinding %s_bindings[] = {\n", symbol.c_str());
+        for(const Binding& b : bindings)
+            std::fprintf(out, "    {%u, %u, %s, %u},\n", b.set, b.binding, b.type, b.count);
+        std::fprintf(out, "};\n\n");
+    }
+    if(!vertexInputs.empty()){
+        std::fprintf(out, "inline constexpr ReflectedVertexInput %s_vertex_inputs[] = {\n", symbol.c_str());
+        for(const VertexInput& v : vertexInputs)
+            std::fprintf(out, "    {%u, %s, %u},\n", v.location, v.format, v.size);
+        std::fprintf(out, "};\n\n");
+    }
+
+    std::fprintf(out, "inline constexpr ShaderBlob %s = {\n", symbol.c_str());
+    std::fprintf(out, "    \"%s\",\n", symbol.c_str());
+    std::fprintf(out, "    %s_code,\n    sizeof(%s_code),\n", symbol.c_str(), symbol.c_str());
+    std::fprintf(out, "    %s,\n    \"%s\",\n", stage, module.entry.c_str());
+    if(bindings.empty())
+        std::fprintf(out, "    nullptr,\n    0,\n");
+    else
+        std::fprintf(out, "    %s_bindings,\n    %zu,\n", symbol.c_str(), bindings.size());
+    std::fprintf(out, "    {%u, %u},\n", pushOffset, pushEnd > pushOffset ? pushEnd - pushOffset : 0);
+    if(vertexInputs.empty())
+        std::fprintf(out, "    nullptr,\n    0,\n");
+    else
+        std::fprintf(out, "    %s_vertex_inputs,\n    %zu,\n", symbol.c_str(), vertexInputs.size());
+    std::fprintf(out, "};\n\n} // namespace shaders\n");
+
+    if(std::fclose(out) != 0){
+        std::fprintf(stderr, "spirv_embed: can't write %s\n", outputPath);
+        return 1;
+    }
+    return 0;
+}